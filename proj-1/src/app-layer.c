@@ -1,5 +1,6 @@
 #include "app-layer.h"
 #include "ll-interface.h"
+#include "trace.h"
 #include "debug.h"
 
 #include <stdlib.h>
@@ -7,8 +8,12 @@
 #include <string.h>
 #include <stdio.h>
 
-static int out_packet_index = 0; // only supports one fd.
-static int in_packet_index = 0; // only supports one fd.
+// DATA packets are numbered per channel. Only supports one fd.
+static int out_packet_index[CHANNEL_MAX + 1];
+static int in_packet_index[CHANNEL_MAX + 1];
+static int out_channel = CHANNEL_NONE; // only supports one fd.
+static int in_channel = CHANNEL_NONE; // of the packet being parsed
+static bool out_offsets = false; // only supports one fd.
 
 void free_control_packet(control_packet packet) {
     for (size_t i = 0; i < packet.n; ++i) {
@@ -21,13 +26,26 @@ void free_data_packet(data_packet packet) {
     free(packet.data.s);
 }
 
-static bool isDATApacket(string packet_str, data_packet* outp) {
+static void put_u64le(char* buf, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        buf[i] = (char)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_u64le(const char* buf) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= (uint64_t)(unsigned char)buf[i] << (8 * i);
+    }
+    return value;
+}
+
+bool isDATApacket(string packet_str, data_packet* outp) {
     char c = packet_str.s[0];
+    size_t header = c == PCONTROL_DATA64 ? DATA64_HEADER_SIZE : DATA_HEADER_SIZE;
 
-    if (packet_str.len < 5 || packet_str.s == NULL || c != PCONTROL_DATA) {
-        if (TRACE_APP) {
-            printf("[APP] isDATApacket() ? 0\n");
-        }
+    if (packet_str.len < header + 1 || packet_str.s == NULL
+            || (c != PCONTROL_DATA && c != PCONTROL_DATA64)) {
         return false;
     }
 
@@ -36,27 +54,25 @@ static bool isDATApacket(string packet_str, data_packet* outp) {
     unsigned char l1 = packet_str.s[3];
     size_t len = (size_t)l1 + 256 * (size_t)l2;
 
-    bool b = len == (packet_str.len - 4);
+    bool b = len == (packet_str.len - header);
 
-    if (TRACE_APP) {
-        printf("[APP] isDATApacket() ? %d [index=%d len=%lu]\n",(int)b,
-            b ? index % 256 : 0, b ? len : 0);
-    }
+    uint64_t offset = DATA_OFFSET_NONE;
+    if (c == PCONTROL_DATA64) offset = get_u64le(packet_str.s + DATA_HEADER_SIZE);
 
     if (b) {
         string data;
 
         data.len = len;
         data.s = malloc((len + 1) * sizeof(char));
-        memcpy(data.s, packet_str.s + 4, len + 1);
+        memcpy(data.s, packet_str.s + header, len + 1);
 
-        data_packet out = {index, data};
+        data_packet out = {index, offset, data, in_channel};
 
         *outp = out;
 
-        if (index != in_packet_index % 256) {
+        if (index != in_packet_index[in_channel] % 256) {
             printf("[APP] Error: Expected DATA packet #%d, got #%d\n",
-                in_packet_index % 256, index);
+                in_packet_index[in_channel] % 256, index);
         }
     }
     return b;
@@ -71,6 +87,7 @@ static bool isCONTROLpacket(char c, string packet_str, control_packet* outp) {
     control_packet out;
     out.c = c;
     out.n = 0;
+    out.channel = in_channel;
     
     out.tlvs = malloc(2 * sizeof(tlv));
     size_t reserved = 2;
@@ -112,21 +129,11 @@ static bool isCONTROLpacket(char c, string packet_str, control_packet* outp) {
 }
 
 static bool isSTARTpacket(string packet_str, control_packet* outp) {
-    bool b = isCONTROLpacket(PCONTROL_START, packet_str, outp);
-
-    if (TRACE_APP) {
-        printf("[APP] isSTARTpacket() ? %d\n", (int)b);
-    }
-    return b;
+    return isCONTROLpacket(PCONTROL_START, packet_str, outp);
 }
 
 static bool isENDpacket(string packet_str, control_packet* outp) {
-    bool b = isCONTROLpacket(PCONTROL_END, packet_str, outp);
-
-    if (TRACE_APP) {
-        printf("[APP] isENDpacket() ? %d\n", (int)b);
-    }
-    return b;
+    return isCONTROLpacket(PCONTROL_END, packet_str, outp);
 }
 
 
@@ -135,7 +142,8 @@ bool get_tlv(control_packet control, char type, string* outp) {
         if (control.tlvs[i].type == type) {
             string value;
             value.len = control.tlvs[i].value.len;
-            value.s = strdup(control.tlvs[i].value.s);
+            value.s = malloc(value.len + 1);
+            memcpy(value.s, control.tlvs[i].value.s, value.len + 1);
             *outp = value;
             return true;
         }
@@ -146,72 +154,67 @@ bool get_tlv(control_packet control, char type, string* outp) {
 bool get_tlv_filename(control_packet control, char** outp) {
     string value;
     bool b = get_tlv(control, PCONTROL_TYPE_FILENAME, &value);
-    if (!b) {
-        if (TRACE_APP_INTERNALS) {
-            printf("[APPCORE] Get TLV filename: FAILED\n");
-        }
-        return false;
-    }
+    TRACE_EVENT(TRACE_CAT_APP, TEV_APP_TLV, PCONTROL_TYPE_FILENAME, b ? value.len : 0,
+        b ? 0 : 1);
+    if (!b) return false;
 
     *outp = value.s;
-    
-    if (TRACE_APP_INTERNALS) {
-        printf("[APPCORE] Get TLV filename: OK [filename=%s]\n", value.s);
-    }
     return true;
 }
 
-bool get_tlv_filesize(control_packet control, size_t* outp) {
+/**
+ * Get the filesize from the binary 64-bit TLV or, from older transmitters,
+ * the ASCII decimal one.
+ */
+bool get_tlv_filesize(control_packet control, uint64_t* outp) {
     string value;
-    bool b = get_tlv(control, PCONTROL_TYPE_FILESIZE, &value);
-    if (!b) {
-        if (TRACE_APP_INTERNALS) {
-            printf("[APPCORE] Get TLV filesize: FAILED\n");
-        }
-        return false;
-    }
+    uint64_t parse = 0;
 
-    long parse = strtol(value.s, NULL, 10);
-    free(value.s);
-    if (parse <= 0) {
-        if (TRACE_APP_INTERNALS) {
-            printf("[APPCORE] Get TLV filesize: BAD PARSE [long=%ld]\n", parse);
-        }
+    char type = PCONTROL_TYPE_FILESIZE64;
+
+    if (get_tlv(control, PCONTROL_TYPE_FILESIZE64, &value)) {
+        if (value.len == 8) parse = get_u64le(value.s);
+    } else if (get_tlv(control, PCONTROL_TYPE_FILESIZE, &value)) {
+        type = PCONTROL_TYPE_FILESIZE;
+        parse = strtoull(value.s, NULL, 10);
+    } else {
+        TRACE_EVENT(TRACE_CAT_APP, TEV_APP_TLV, PCONTROL_TYPE_FILESIZE, 0, 1);
         return false;
     }
 
-    *outp = (size_t)parse;
+    free(value.s);
+    TRACE_EVENT(TRACE_CAT_APP, TEV_APP_TLV, type, value.len, parse == 0 ? 1 : 0);
+    if (parse == 0) return false;
 
-    if (TRACE_APP_INTERNALS) {
-        printf("[APPCORE] Get TLV filesize: OK [filesize=%lu]\n", (size_t)parse);
-    }
+    *outp = parse;
     return true;
 }
 
-static int build_data_packet(string fragment, char index, string* outp) {
+/**
+ * Build a DATA64 packet, or a plain DATA packet if offset is
+ * DATA_OFFSET_NONE.
+ */
+int build_data_packet(string fragment, char index, uint64_t offset, string* outp) {
     static const size_t mod = 256;
     static const size_t max_len = 0x0ffff;
 
     if (fragment.len > max_len) return 1;
 
+    bool plain = offset == DATA_OFFSET_NONE;
+    size_t header = plain ? DATA_HEADER_SIZE : DATA64_HEADER_SIZE;
+
     string data_packet;
 
-    data_packet.len = fragment.len + 4;
+    data_packet.len = fragment.len + header;
     data_packet.s = malloc((data_packet.len + 1) * sizeof(char));
 
-    data_packet.s[0] = PCONTROL_DATA;
+    data_packet.s[0] = plain ? PCONTROL_DATA : PCONTROL_DATA64;
     data_packet.s[1] = index;
     data_packet.s[2] = fragment.len / mod;
     data_packet.s[3] = fragment.len % mod;
-    memcpy(data_packet.s + 4, fragment.s, fragment.len + 1);
-
-    if (TRACE_APP_INTERNALS) {
-        printf("[APPCORE] Built DP [c=0x%02x index=0x%02x l2=0x%02x l1=0x%02x flen=%lu]\n",
-            (unsigned char)data_packet.s[0], (unsigned char)data_packet.s[1],
-            (unsigned char)data_packet.s[2], (unsigned char)data_packet.s[3],
-            fragment.len);
-        if (TEXT_DEBUG) print_stringn(data_packet);
-    }
+    if (!plain) put_u64le(data_packet.s + DATA_HEADER_SIZE, offset);
+    memcpy(data_packet.s + header, fragment.s, fragment.len);
+    data_packet.s[data_packet.len] = '\0';
 
     *outp = data_packet;
     return 0;
@@ -231,17 +234,19 @@ static int build_tlv_str(char type, string value, string* outp) {
     tlv.s[1] = value.len;
     memcpy(tlv.s + 2, value.s, value.len + 1);
 
-    if (TRACE_APP_INTERNALS) {
-        printf("[APPCORE] Built TLV [t=0x%02x l=%lu]", type, value.len);
-        print_stringn(tlv);
-    }
-
     *outp = tlv;
     return 0;
 }
 
-static int build_tlv_uint(char type, long unsigned value, string* outp) {
-    char buf[10];
+static int build_tlv_u64(char type, uint64_t value, string* outp) {
+    char buf[9] = {0}; // build_tlv_str copies the terminator too
+    string tmp = {buf, 8};
+    put_u64le(buf, value);
+    return build_tlv_str(type, tmp, outp);
+}
+
+static int build_tlv_uint(char type, uint64_t value, string* outp) {
+    char buf[21]; // UINT64_MAX has 20 digits
     string tmp;
     tmp.s = buf;
     sprintf(tmp.s, "%lu", value);
@@ -249,6 +254,16 @@ static int build_tlv_uint(char type, long unsigned value, string* outp) {
     return build_tlv_str(type, tmp, outp);
 }
 
+/**
+ * The filesize TLV: binary to a receiver that takes DATA64 packets, and
+ * ASCII decimal, as before them, to any other.
+ */
+static int build_tlv_filesize(uint64_t filesize, string* outp) {
+    return out_offsets
+        ? build_tlv_u64(PCONTROL_TYPE_FILESIZE64, filesize, outp)
+        : build_tlv_uint(PCONTROL_TYPE_FILESIZE, filesize, outp);
+}
+
 static int build_control_packet(char control, string* tlvp, size_t n, string* outp) {
     string control_packet;
     control_packet.len = 1;
@@ -268,42 +283,78 @@ static int build_control_packet(char control, string* tlvp, size_t n, string* ou
         tmp += tlvp[i].len;
     }
 
-    if (TRACE_APP_INTERNALS) {
-        printf("[APPCORE] Built CP [c=0x%02x n=%lu tlen=%lu]\n",
-            control, n, control_packet.len);
-        if (TEXT_DEBUG) print_stringn(control_packet);
-    }
-
     *outp = control_packet;
     return 0;
 }
 
-int send_data_packet(int fd, string packet) {
+/**
+ * Packets sent from now on go on channel (CHANNEL_NONE: on none).
+ */
+void set_send_channel(int channel) {
+    out_channel = channel;
+}
+
+/**
+ * Whether DATA packets carry their offset from now on, as DATA64 packets.
+ * Receivers which predate them only take plain DATA packets, with the
+ * file's bytes in order, holes included.
+ */
+void set_send_offsets(bool offsets) {
+    out_offsets = offsets;
+}
+
+bool sends_offsets() {
+    return out_offsets;
+}
+
+/**
+ * llwrite packet, wrapped in a CHANNEL packet if a channel is set.
+ */
+static int write_packet(int fd, string packet) {
+    if (out_channel == CHANNEL_NONE) return llwrite(fd, packet);
+
+    string wrapped;
+    wrapped.len = packet.len + CHANNEL_HEADER_SIZE;
+    wrapped.s = malloc((wrapped.len + 1) * sizeof(char));
+
+    wrapped.s[0] = PCONTROL_CHANNEL;
+    wrapped.s[1] = (char)out_channel;
+    memcpy(wrapped.s + CHANNEL_HEADER_SIZE, packet.s, packet.len + 1);
+
+    int s = llwrite(fd, wrapped);
+    free(wrapped.s);
+    return s;
+}
+
+int send_data_packet(int fd, string packet, uint64_t offset) {
     int s;
+    int* index = &out_packet_index[out_channel];
 
     string data_packet;
-    s = build_data_packet(packet, out_packet_index % 256lu, &data_packet);
+    if (!out_offsets) offset = DATA_OFFSET_NONE;
+
+    s = build_data_packet(packet, *index % 256lu, offset, &data_packet);
     if (s != 0) return s;
 
-    if (TRACE_APP) {
-        printf("[APP] Sending DATA packet #%d [plen=%lu]\n",
-            out_packet_index % 256, packet.len);
+    TRACE_EVENT(TRACE_CAT_APP, TEV_APP_SEND, *index % 256,
+        data_packet.len, PCONTROL_DATA);
+    if (offset != DATA_OFFSET_NONE) {
+        TRACE_EVENT(TRACE_CAT_APP, TEV_APP_OFFSET, *index % 256, offset, PCONTROL_DATA);
     }
 
-    ++out_packet_index;
-    s = llwrite(fd, data_packet);
+    ++*index;
+    s = write_packet(fd, data_packet);
     free(data_packet.s);
     return s;
 }
 
-int send_start_packet(int fd, size_t filesize, char* filename) {
+int send_start_packet(int fd, uint64_t filesize, char* filename) {
     int s;
     string tlvs[2];
 
-    out_packet_index = 0;
+    out_packet_index[out_channel] = 0;
 
-    s = build_tlv_uint(PCONTROL_TYPE_FILESIZE,
-        filesize, tlvs + FILESIZE_TLV_N);
+    s = build_tlv_filesize(filesize, tlvs + FILESIZE_TLV_N);
     if (s != 0) return s;
 
     s = build_tlv_str(PCONTROL_TYPE_FILENAME,
@@ -317,22 +368,18 @@ int send_start_packet(int fd, size_t filesize, char* filename) {
     free(tlvs[0].s);
     free(tlvs[1].s);
 
-    if (TRACE_APP) {
-        printf("[APP] Sending START packet [filesize=%lu,filename=%s,plen=%lu]\n",
-            filesize, filename, start_packet.len);
-    }
+    TRACE_EVENT(TRACE_CAT_APP, TEV_APP_SEND, 0, start_packet.len, PCONTROL_START);
 
-    s = llwrite(fd, start_packet);
+    s = write_packet(fd, start_packet);
     free(start_packet.s);
     return s;
 }
 
-int send_end_packet(int fd, size_t filesize, char* filename) {
+int send_end_packet(int fd, uint64_t filesize, char* filename) {
     int s;
     string tlvs[2];
 
-    s = build_tlv_uint(PCONTROL_TYPE_FILESIZE,
-        filesize, tlvs + FILESIZE_TLV_N);
+    s = build_tlv_filesize(filesize, tlvs + FILESIZE_TLV_N);
     if (s != 0) return s;
 
     s = build_tlv_str(PCONTROL_TYPE_FILENAME,
@@ -346,12 +393,9 @@ int send_end_packet(int fd, size_t filesize, char* filename) {
     free(tlvs[0].s);
     free(tlvs[1].s);
 
-    if (TRACE_APP) {
-        printf("[APP] Sending END packet [filesize=%lu,filename=%s,plen=%lu]\n",
-            filesize, filename, end_packet.len);
-    }
+    TRACE_EVENT(TRACE_CAT_APP, TEV_APP_SEND, 0, end_packet.len, PCONTROL_END);
 
-    s = llwrite(fd, end_packet);
+    s = write_packet(fd, end_packet);
     free(end_packet.s);
     return s;
 }
@@ -364,11 +408,25 @@ int receive_packet(int fd, data_packet* datap,
     s = llread(fd, &packet);
     if (s != 0) return s;
 
+    // Unwrap, in place, a packet sent on a channel.
+    in_channel = CHANNEL_NONE;
+    if (packet.len > CHANNEL_HEADER_SIZE && packet.s[0] == PCONTROL_CHANNEL) {
+        in_channel = (unsigned char)packet.s[1];
+        packet.len -= CHANNEL_HEADER_SIZE;
+        memmove(packet.s, packet.s + CHANNEL_HEADER_SIZE, packet.len + 1);
+    }
+
     data_packet data;
     control_packet control;
 
     if (isDATApacket(packet, &data)) {
-        ++in_packet_index;
+        TRACE_EVENT(TRACE_CAT_APP, TEV_APP_RECV, data.index, packet.len,
+            PRECEIVE_DATA);
+        if (data.offset != DATA_OFFSET_NONE) {
+            TRACE_EVENT(TRACE_CAT_APP, TEV_APP_OFFSET, data.index, data.offset,
+                PRECEIVE_DATA);
+        }
+        ++in_packet_index[in_channel];
         *datap = data;
 
         free(packet.s);
@@ -376,7 +434,8 @@ int receive_packet(int fd, data_packet* datap,
     }
 
     if (isSTARTpacket(packet, &control)) {
-        in_packet_index = 0;
+        TRACE_EVENT(TRACE_CAT_APP, TEV_APP_RECV, 0, packet.len, PRECEIVE_START);
+        in_packet_index[in_channel] = 0;
         *controlp = control;
 
         free(packet.s);
@@ -384,7 +443,8 @@ int receive_packet(int fd, data_packet* datap,
     }
 
     if (isENDpacket(packet, &control)) {
-        in_packet_index = 0;
+        TRACE_EVENT(TRACE_CAT_APP, TEV_APP_RECV, 0, packet.len, PRECEIVE_END);
+        in_packet_index[in_channel] = 0;
         *controlp = control;
 
         free(packet.s);
@@ -392,6 +452,7 @@ int receive_packet(int fd, data_packet* datap,
     }
 
     printf("[APP] Error: Received BAD packet\n");
+    TRACE_EVENT(TRACE_CAT_APP, TEV_APP_RECV, 0, packet.len, PRECEIVE_BAD_PACKET);
     free(packet.s);
     return PRECEIVE_BAD_PACKET;
 }
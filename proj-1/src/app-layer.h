@@ -4,14 +4,33 @@
 #include "strings.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define PCONTROL_DATA          0x41
 #define PCONTROL_START         0x42
 #define PCONTROL_END           0x43
+#define PCONTROL_DATA64        0x44 // DATA packet carrying its file offset
+#define PCONTROL_CHANNEL       0x45 // Another packet, on a logical channel
 #define PCONTROL_BAD_PACKET    0x40
 
-#define PCONTROL_TYPE_FILESIZE 0x00
-#define PCONTROL_TYPE_FILENAME 0x01
+#define PCONTROL_TYPE_FILESIZE   0x00 // ASCII decimal, only parsed
+#define PCONTROL_TYPE_FILENAME   0x01
+#define PCONTROL_TYPE_FILESIZE64 0x02 // 8 bytes, little-endian
+
+// DATA: C N L2 L1 data...
+// DATA64: C N L2 L1 O0..O7 data..., with O the little-endian file offset
+#define DATA_HEADER_SIZE       4
+#define DATA64_HEADER_SIZE     12
+
+// Offset of a DATA packet, which is written after the previous one
+#define DATA_OFFSET_NONE       UINT64_MAX
+
+// CHANNEL: C CH packet..., with CH the channel of the file the packet
+// belongs to, so that several files can be in flight at once. Packets
+// outside of any channel are not wrapped.
+#define CHANNEL_HEADER_SIZE    2
+#define CHANNEL_NONE           0
+#define CHANNEL_MAX            255
 
 #define FILESIZE_TLV_N         0
 #define FILENAME_TLV_N         1
@@ -32,11 +51,14 @@ typedef struct {
     char c;
     tlv* tlvs;
     size_t n;
+    int channel;
 } control_packet;
 
 typedef struct {
     int index;
+    uint64_t offset; // DATA_OFFSET_NONE for plain DATA packets
     string data;
+    int channel;
 } data_packet;
 
 
@@ -49,14 +71,24 @@ bool get_tlv(control_packet controlp, char type, string* outp);
 
 bool get_tlv_filename(control_packet controlp, char** outp);
 
-bool get_tlv_filesize(control_packet controlp, size_t* outp);
+bool get_tlv_filesize(control_packet controlp, uint64_t* outp);
+
+
+int build_data_packet(string fragment, char index, uint64_t offset, string* outp);
+
+bool isDATApacket(string packet_str, data_packet* outp);
+
+void set_send_channel(int channel);
+
+void set_send_offsets(bool offsets);
 
+bool sends_offsets();
 
-int send_data_packet(int fd, string packet);
+int send_data_packet(int fd, string packet, uint64_t offset);
 
-int send_start_packet(int fd, size_t filesize, char* filename);
+int send_start_packet(int fd, uint64_t filesize, char* filename);
 
-int send_end_packet(int fd, size_t filesize, char* filename);
+int send_end_packet(int fd, uint64_t filesize, char* filename);
 
 int receive_packet(int fd, data_packet* datap, control_packet* controlp);
 
@@ -0,0 +1,459 @@
+#define _GNU_SOURCE // accept4
+
+#include "daemon.h"
+#include "fileio.h"
+#include "app-layer.h"
+#include "ll-interface.h"
+#include "options.h"
+#include "timing.h"
+#include "trace.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Clients connected to the daemon at once. Others wait in the backlog.
+#define DAEMON_MAX_CLIENTS     16
+#define DAEMON_BACKLOG         16
+
+// Job protocol, one line per file: the client writes the file's absolute
+// path, and the daemon writes back "OK path" or "FAIL path" once it is
+// sent. The client half-closes when it has no more files, and the daemon
+// closes once all its files are answered.
+#define DAEMON_REPLY_OK        "OK"
+#define DAEMON_REPLY_FAIL      "FAIL"
+
+typedef struct {
+    char* path;
+    int client; // Index in clients, or -1 for files given on the command line
+} job;
+
+typedef struct {
+    int fd; // -1 if free
+    char line[PATH_MAX + 1];
+    size_t len;
+    size_t pending; // Jobs queued and not yet answered
+    bool eof;
+} client;
+
+/**
+ * A file in flight on a channel.
+ */
+typedef struct {
+    bool busy;
+    job j;
+    file_sender fs;
+    long deficit; // Bytes it may still send in this round
+    uint64_t begin;
+} channel;
+
+// Only supports one daemon per process.
+static channel channels[CHANNELS_MAX];
+static int listenfd = -1;
+static client clients[DAEMON_MAX_CLIENTS];
+static job* queue = NULL;
+static size_t queue_head = 0, queue_tail = 0, queue_reserved = 0;
+static volatile sig_atomic_t stopping = 0;
+
+// SIGINT, SIGTERM
+static void sighandler_stop(int signum) {
+    stopping = 1;
+}
+
+/**
+ * Close the link instead of exiting on SIGINT and SIGTERM. Interrupted
+ * link-layer reads and writes restart; the wait for jobs does not.
+ */
+static void set_stop_handlers() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sighandler_stop;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
+
+static void push_job(char* path, int client) {
+    if (queue_tail == queue_reserved) {
+        // Reclaim the answered prefix before growing.
+        if (queue_head > 0) {
+            memmove(queue, queue + queue_head, (queue_tail - queue_head) * sizeof(job));
+            queue_tail -= queue_head;
+            queue_head = 0;
+        } else {
+            queue_reserved = queue_reserved ? 2 * queue_reserved : 16;
+            queue = realloc(queue, queue_reserved * sizeof(job));
+        }
+    }
+
+    job j = {path, client};
+    queue[queue_tail++] = j;
+    if (client >= 0) ++clients[client].pending;
+
+    TRACE_EVENT(TRACE_CAT_DAEMON, TEV_DAEMON_QUEUE, client, queue_tail - queue_head, 0);
+}
+
+static bool pop_job(job* jp) {
+    if (queue_head == queue_tail) return false;
+
+    *jp = queue[queue_head++];
+    if (queue_head == queue_tail) queue_head = queue_tail = 0;
+    return true;
+}
+
+static void close_client(int c) {
+    close(clients[c].fd);
+    clients[c].fd = -1;
+}
+
+static void answer_job(job j, int s) {
+    if (j.client >= 0) {
+        client* cl = &clients[j.client];
+        char reply[PATH_MAX + 16];
+        int len = snprintf(reply, sizeof(reply), "%s %s\n",
+            s == 0 ? DAEMON_REPLY_OK : DAEMON_REPLY_FAIL, j.path);
+
+        // A client that went away just misses its answer.
+        send(cl->fd, reply, len, MSG_NOSIGNAL);
+
+        if (--cl->pending == 0 && cl->eof) close_client(j.client);
+    }
+
+    free(j.path);
+}
+
+static int open_listener(const char* socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("[DAEMON] Error: Socket path too long %s\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenfd == -1) {
+        printf("[DAEMON] Error: socket failed [%s]\n", strerror(errno));
+        return 1;
+    }
+
+    // A socket left behind by a previous daemon.
+    unlink(socket_path);
+
+    if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(listenfd, DAEMON_BACKLOG) == -1) {
+        printf("[DAEMON] Error: Failed to listen on %s [%s]\n",
+            socket_path, strerror(errno));
+        close(listenfd);
+        return 1;
+    }
+
+    for (int c = 0; c < DAEMON_MAX_CLIENTS; ++c) clients[c].fd = -1;
+    return 0;
+}
+
+static void accept_clients() {
+    for (int c = 0; c < DAEMON_MAX_CLIENTS; ++c) {
+        if (clients[c].fd != -1) continue;
+
+        int fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) return;
+
+        client cl = {.fd = fd, .len = 0, .pending = 0, .eof = false};
+        clients[c] = cl;
+    }
+}
+
+/**
+ * Queue the complete lines a client has written so far.
+ */
+static void read_client(int c) {
+    client* cl = &clients[c];
+
+    while (true) {
+        char buf[512];
+        ssize_t r = read(cl->fd, buf, sizeof(buf));
+
+        if (r == -1 && errno == EINTR) continue;
+        if (r == -1) return; // EAGAIN: nothing more for now
+
+        if (r == 0) {
+            cl->eof = true;
+            if (cl->pending == 0) close_client(c);
+            return;
+        }
+
+        for (ssize_t i = 0; i < r; ++i) {
+            if (buf[i] != '\n') {
+                if (cl->len < PATH_MAX) cl->line[cl->len++] = buf[i];
+                continue;
+            }
+
+            cl->line[cl->len] = '\0';
+            if (cl->len > 0) push_job(strdup(cl->line), c);
+            cl->len = 0;
+        }
+    }
+}
+
+/**
+ * Accept clients and queue their jobs, waiting at most timeout_ms
+ * milliseconds (-1 waits until a job arrives or a signal stops the daemon).
+ */
+static void poll_jobs(int timeout_ms) {
+    struct pollfd pfds[DAEMON_MAX_CLIENTS + 1];
+    int index[DAEMON_MAX_CLIENTS + 1];
+    nfds_t n = 0;
+    bool full = true;
+
+    pfds[n].fd = listenfd;
+    pfds[n].events = POLLIN;
+    index[n++] = -1;
+
+    for (int c = 0; c < DAEMON_MAX_CLIENTS; ++c) {
+        if (clients[c].fd == -1) full = false;
+        if (clients[c].fd == -1 || clients[c].eof) continue;
+        pfds[n].fd = clients[c].fd;
+        pfds[n].events = POLLIN;
+        index[n++] = c;
+    }
+
+    // With no free slot, accept_clients leaves connections in the backlog,
+    // and the listener would stay readable: poll ignores it until one frees.
+    if (full) pfds[0].fd = -1;
+
+    if (poll(pfds, n, timeout_ms) <= 0) return;
+
+    for (nfds_t i = 1; i < n; ++i) {
+        if (pfds[i].revents) read_client(index[i]);
+    }
+
+    if (pfds[0].revents & POLLIN) accept_clients();
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/**
+ * Start queued jobs on the free channels.
+ *
+ * @return the number of channels started
+ */
+static int start_channels() {
+    int started = 0;
+
+    for (int c = 0; c < number_of_channels && queue_head != queue_tail; ++c) {
+        channel* ch = &channels[c];
+        if (ch->busy) continue;
+
+        job j;
+        pop_job(&j);
+
+        if (open_sender(&ch->fs, j.path, (char*)base_name(j.path)) != 0) {
+            answer_job(j, 1);
+            continue;
+        }
+
+        TRACE_EVENT(TRACE_CAT_DAEMON, TEV_DAEMON_START, c, ch->fs.number, 0);
+
+        ch->busy = true;
+        ch->j = j;
+        ch->deficit = 0;
+        ch->begin = monotonic_ns();
+        ++started;
+    }
+
+    return started;
+}
+
+static void finish_channel(int c, int s) {
+    channel* ch = &channels[c];
+
+    TRACE_EVENT(TRACE_CAT_DAEMON, TEV_DAEMON_DONE, c, monotonic_ns() - ch->begin, s);
+
+    // Timed from its START, while other channels may be sending too
+    if (s == 0) {
+        set_timing(1, (monotonic_ns() - ch->begin) / 1e6);
+        account_file(1, ch->fs.filesize);
+    }
+
+    close_sender(&ch->fs);
+    answer_job(ch->j, s);
+    ch->busy = false;
+    reset_counter();
+}
+
+/**
+ * Open a session with R, waiting for as long as it takes, unless stopping.
+ *
+ * @return LL_OK if the session is open
+ */
+static int open_session(int fd) {
+    int s = LL_NO_TIME_RETRIES;
+    while (!stopping && (s = llopen(fd)) != LL_OK) {
+        printf("[DAEMON] Waiting for R to open the session\n");
+    }
+    return s;
+}
+
+/**
+ * Transmitter daemon: open the link once, then send the files submitted
+ * on daemon_socket without closing the link in between. Files given on
+ * the command line are queued first.
+ *
+ * Up to number_of_channels files are in flight at once, each on its own
+ * channel, with their DATA packets interleaved by deficit round robin.
+ *
+ * Should the link fail, T and R no longer agree on what was received:
+ * every file in flight fails, and a new session is opened for the rest.
+ *
+ * @param  fd Link layer's file descriptor
+ * @return 0 if the link was closed cleanly, 1 otherwise
+ */
+int run_daemon(int fd) {
+    if (open_listener(daemon_socket) != 0) return 1;
+
+    set_stop_handlers();
+
+    for (size_t i = 0; i < number_of_files; ++i) {
+        push_job(strdup(files[i]), -1);
+    }
+
+    printf("[DAEMON] Listening on %s\n", daemon_socket);
+
+    int s = open_session(fd);
+
+    int active = 0, c = 0;
+
+    // Once stopping, the files in flight are finished, but no more start.
+    while (s == LL_OK && (!stopping || active > 0)) {
+        if (!stopping) {
+            // Pick up new jobs between packets, and wait for one when idle.
+            poll_jobs(active == 0 && queue_head == queue_tail ? -1 : 0);
+            active += start_channels();
+        }
+        if (active == 0) continue;
+
+        while (!channels[c].busy) c = (c + 1) % number_of_channels;
+        channel* ch = &channels[c];
+
+        // Deficit round robin: each visit grants a packet's worth of
+        // bytes, so channels share the link evenly whatever their file
+        // sizes, and a small file is not stuck behind a bulk one. With a
+        // single channel, packets are not wrapped at all.
+        set_send_channel(number_of_channels == 1 ? CHANNEL_NONE : c + 1);
+        ch->deficit += packetsize;
+
+        int r = LL_OK;
+        while (ch->deficit > 0 && ch->fs.stage != SENDER_DONE) {
+            size_t sent;
+            r = sender_step(fd, &ch->fs, &sent);
+            if (r != LL_OK) break;
+            ch->deficit -= sent;
+        }
+
+        if (r != LL_OK || ch->fs.stage == SENDER_DONE) {
+            finish_channel(c, r == LL_OK ? 0 : 1);
+            --active;
+        }
+
+        if (r == LL_NO_TIME_RETRIES || r == LL_NO_ANSWER_RETRIES) {
+            printf("[DAEMON] Link failed, opening a new session\n");
+            for (int k = 0; k < number_of_channels; ++k) {
+                if (channels[k].busy) finish_channel(k, 1);
+            }
+            active = 0;
+            s = open_session(fd);
+        }
+
+        c = (c + 1) % number_of_channels;
+    }
+
+    // Jobs still queued are answered, not sent.
+    job j;
+    while (pop_job(&j)) answer_job(j, 1);
+
+    printf("[DAEMON] Closing the session\n");
+    if (s == LL_OK) s = llclose(fd);
+
+    close(listenfd);
+    unlink(daemon_socket);
+    free(queue);
+    return s == LL_OK ? 0 : 1;
+}
+
+/**
+ * Submit files to the daemon listening on socket_path, and wait until it
+ * answers all of them.
+ *
+ * @return 0 if all files were sent, 1 otherwise
+ */
+int submit_files(const char* socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("[SUBMIT] Error: Socket path too long %s\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd == -1 || connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        printf("[SUBMIT] Error: Failed to connect to %s [%s]\n",
+            socket_path, strerror(errno));
+        if (sockfd != -1) close(sockfd);
+        return 1;
+    }
+
+    // The daemon has its own working directory.
+    size_t submitted = 0;
+    for (size_t i = 0; i < number_of_files; ++i) {
+        char path[PATH_MAX + 1];
+        if (realpath(files[i], path) == NULL) {
+            printf("[SUBMIT] Error: Bad file %s [%s]\n", files[i], strerror(errno));
+            continue;
+        }
+
+        size_t len = strlen(path);
+        path[len++] = '\n';
+        if (send(sockfd, path, len, MSG_NOSIGNAL) != (ssize_t)len) {
+            printf("[SUBMIT] Error: Failed to submit %s [%s]\n",
+                files[i], strerror(errno));
+            break;
+        }
+        ++submitted;
+    }
+
+    shutdown(sockfd, SHUT_WR);
+
+    // Answers are lines; echo them, and count the OK ones.
+    FILE* answers = fdopen(sockfd, "r");
+    char line[PATH_MAX + 16];
+    size_t ok = 0, answered = 0;
+
+    while (answered < submitted && fgets(line, sizeof(line), answers) != NULL) {
+        printf("[SUBMIT] %s", line);
+        if (strncmp(line, DAEMON_REPLY_OK " ", 3) == 0) ++ok;
+        ++answered;
+    }
+
+    fclose(answers);
+    return ok == number_of_files ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+#ifndef DAEMON_H___
+#define DAEMON_H___
+
+int run_daemon(int fd);
+
+int submit_files(const char* socket_path);
+
+#endif // DAEMON_H___
@@ -2,7 +2,26 @@
 
 communication_count_t counter;
 
+communication_count_t batch_counter;
+
+frame_metrics_t metrics;
+
+size_t io_syscalls = 0;
+
+/**
+ * Fold the current file's counters into the batch totals and clear them.
+ * communication_count_t holds only size_t counters, so it is summed as
+ * an array.
+ */
 void reset_counter() {
+    size_t* from = (size_t*)&counter;
+    size_t* to = (size_t*)&batch_counter;
+    size_t n = sizeof(communication_count_t) / sizeof(size_t);
+
+    for (size_t i = 0; i < n; ++i) {
+        to[i] += from[i];
+    }
+
     communication_count_t dummy = {0};
     counter = dummy;
 }
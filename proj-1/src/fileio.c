@@ -1,10 +1,16 @@
+#define _GNU_SOURCE // SEEK_DATA, SEEK_HOLE
+
 #include "fileio.h"
 #include "app-layer.h"
 #include "ll-interface.h"
+#include "ll-core.h"
 #include "options.h"
 #include "timing.h"
 #include "signals.h"
+#include "trace.h"
 #include "debug.h"
+#include "ll-transport.h"
+#include "ll-uring.h"
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,136 +20,353 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+
+// Wait between the attempts of an R daemon to open a session, doubled
+// after every one that fails, in ms.
+#define SESSION_BACKOFF_MIN    100
+#define SESSION_BACKOFF_MAX    5000
+
+static uint32_t file_number = 0; // For TEV_FILE_* trace records
+
+/**
+ * A file being received.
+ */
+typedef struct {
+    char* filename; // NULL if none
+    int filefd;
+    uint64_t filesize;
+    off_t position; // Where a DATA packet without offset goes
+    size_t packets;
+    uint32_t number;
+    uint64_t begin; // monotonic_ns() at its START, for the batch totals
+} file_sink;
+
+/**
+ * Find the first data extent at or after offset, so that holes of sparse
+ * files are skipped. Where SEEK_DATA is unsupported, the rest of the file
+ * is one extent.
+ */
+static void next_extent(int filefd, off_t offset, off_t filesize,
+        off_t* beginp, off_t* endp) {
+    io_syscalls += 2;
+    off_t begin = lseek(filefd, offset, SEEK_DATA);
+
+    if (begin == -1) {
+        // ENXIO: only a hole is left.
+        *beginp = errno == ENXIO ? filesize : offset;
+        *endp = filesize;
+        return;
+    }
 
-static void free_packets(string* packets, size_t number_packets) {
-    for (size_t i = 0; i < number_packets; ++i) {
-        free(packets[i].s);
+    off_t end = lseek(filefd, begin, SEEK_HOLE);
+    *beginp = begin;
+    *endp = end == -1 ? filesize : end;
+}
+
+/**
+ * pwrite all of buf at offset.
+ *
+ * @return 0 if successful, 1 otherwise
+ */
+static int write_at(int filefd, const char* buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ++io_syscalls;
+        ssize_t w = pwrite(filefd, buf, len, offset);
+        if (w <= 0) {
+            if (w == -1 && errno == EINTR) continue;
+            return 1;
+        }
+        buf += w;
+        len -= w;
+        offset += w;
     }
-    free(packets);
+    return 0;
 }
 
-int send_file(int fd, char* filename) {
-    int s = 0;
+/**
+ * pread a packet of a file, from its read ahead with the io_uring engine.
+ */
+static ssize_t read_at(int filefd, char* buf, size_t len, off_t offset) {
+    if (uring_active()) return uring_pread(filefd, buf, len, offset);
 
-    int filefd = open(filename, O_RDONLY);
+    ++io_syscalls;
+    return pread(filefd, buf, len, offset);
+}
+
+/**
+ * Open the file at path for sending, named name in its START and END
+ * packets. Nothing is sent yet.
+ *
+ * @return 0 if successful, 1 otherwise
+ */
+int open_sender(file_sender* fs, char* path, char* name) {
+    int filefd = open(path, O_RDONLY);
     if (filefd == -1) {
         printf("[FILE] Error: Failed to open file %s [%s]\n",
-            filename, strerror(errno));
+            path, strerror(errno));
         return 1;
     }
 
-    FILE* file = fdopen(filefd, "r");
-    if (file == NULL) {
-        printf("[FILE] Error: Failed to open file stream %s [%s]\n",
-            filename, strerror(errno));
+    struct stat st;
+    if (fstat(filefd, &st) == -1) {
+        printf("[FILE] Error: Failed to stat file %s [%s]\n",
+            path, strerror(errno));
         close(filefd);
         return 1;
     }
 
-    // Seek to the end of the file to extract its size.
-    s = fseek(file, 0, SEEK_END);
-    if (s != 0) {
-        printf("[FILE] Error: Failed to seek file %s [%s]\n",
-            filename, strerror(errno));
-        fclose(file);
+    if (st.st_size <= 0) {
+        printf("[FILE] Error: Invalid filesize %ld (probably 0) %s\n",
+            (long)st.st_size, path);
+        close(filefd);
         return 1;
     }
 
-    long lfs = ftell(file);
-    size_t filesize = lfs;
-    rewind(file);
+    fs->path = path;
+    fs->name = name;
+    fs->filefd = filefd;
+    fs->filesize = st.st_size;
+    fs->offset = fs->end = 0;
+    fs->stage = SENDER_START;
+    fs->number = file_number++;
 
-    if (lfs <= 0) {
-        printf("[FILE] Error: Invalid filesize %ld (probably 0) %s\n",
-            filesize, filename);
-        fclose(file);
-        return 1;
-    }
+    // The file is read one packet at a time, so memory use does not
+    // depend on the filesize.
+    fs->packet.s = malloc((packetsize + 1) * sizeof(char));
+    fs->packet.len = 0;
+
+    TRACE_EVENT(TRACE_CAT_FILE, TEV_FILE_BEGIN, fs->number, fs->filesize, 0);
+    return 0;
+}
 
-    // Read the entire file and close it.
-    char* buffer = malloc((filesize + 1) * sizeof(char));
-    fread(buffer, filesize, 1, file);
-    buffer[filesize] = '\0';
+/**
+ * Send the next packet of fs: START, then DATA packets, each with its
+ * offset, then END. Holes are not sent at all: the receiver leaves them
+ * unwritten and sizes the file at the END. To a receiver without DATA64
+ * packets, every byte is sent in order, holes too.
+ *
+ * @param sentp Where to store the number of file bytes sent
+ * @return LL_OK if successful, an LL_* error or 1 otherwise
+ */
+int sender_step(int fd, file_sender* fs, size_t* sentp) {
+    int s;
+    *sentp = 0;
+
+    switch (fs->stage) {
+    case SENDER_START:
+        s = send_start_packet(fd, fs->filesize, fs->name);
+        if (s == LL_OK) fs->stage = SENDER_DATA;
+        return s;
+    case SENDER_DATA:
+        if (fs->offset >= fs->end) {
+            if (sends_offsets()) {
+                next_extent(fs->filefd, fs->offset, fs->filesize, &fs->offset, &fs->end);
+            } else {
+                fs->end = fs->filesize;
+            }
+        }
 
-    fclose(file);
+        if (fs->offset >= (off_t)fs->filesize) {
+            fs->stage = SENDER_END;
+            return sender_step(fd, fs, sentp);
+        }
 
-    if (TRACE_FILE) {
-        printf("[FILE] File read and closed [filesize=%lu,filename=%s]\n",
-            filesize, filename);
-    }
+        size_t size = (size_t)(fs->end - fs->offset) < packetsize
+            ? (size_t)(fs->end - fs->offset) : packetsize;
+
+        ssize_t r = read_at(fs->filefd, fs->packet.s, size, fs->offset);
+        if (r <= 0) {
+            printf("[FILE] Error: Failed to read file %s at %ld [%s]\n",
+                fs->path, (long)fs->offset, r == 0 ? "EOF" : strerror(errno));
+            return 1;
+        }
 
-    // Split the buffer into various strings.
-    // The last one will have a smaller size.
-    size_t number_packets = number_of_packets(filesize);
-    string* packets = malloc(number_packets * sizeof(string));
+        fs->packet.len = r;
+        fs->packet.s[r] = '\0';
 
-    for (size_t i = 0; i < number_packets - 1; ++i) {
-        size_t offset = i * packetsize;
+        // Read the extent's next packet while this one is sent.
+        off_t next = fs->offset + r;
+        if (uring_active() && next < fs->end) {
+            size_t ahead = (size_t)(fs->end - next) < packetsize
+                ? (size_t)(fs->end - next) : packetsize;
+            uring_prefetch(fs->filefd, ahead, next);
+        }
 
-        packets[i].s = malloc((packetsize + 1) * sizeof(char));
-        packets[i].len = packetsize;
+        s = send_data_packet(fd, fs->packet, fs->offset);
+        if (s != LL_OK) return s;
 
-        memcpy(packets[i].s, buffer + offset, packetsize);
-        packets[i].s[packetsize] = '\0';
+        fs->offset += r;
+        *sentp = r;
+        return LL_OK;
+    case SENDER_END:
+        s = send_end_packet(fd, fs->filesize, fs->name);
+        if (s == LL_OK) fs->stage = SENDER_DONE;
+        return s;
     }
 
-    // Last packet
-    {
-        size_t offset = (number_packets - 1) * packetsize;
-        size_t size = filesize - offset;
+    return LL_OK;
+}
 
-        packets[number_packets - 1].s = malloc((size + 1) * sizeof(char));
-        packets[number_packets - 1].len = size;
+/**
+ * Release fs, which was sent if it reached SENDER_DONE.
+ */
+void close_sender(file_sender* fs) {
+    bool ok = fs->stage == SENDER_DONE;
 
-        memcpy(packets[number_packets - 1].s, buffer + offset, size);
-        packets[number_packets - 1].s[size] = '\0';
-    }
+    free(fs->packet.s);
+    uring_drain_file(fs->filefd);
+    close(fs->filefd);
+    TRACE_EVENT(TRACE_CAT_FILE, TEV_FILE_END, fs->number, fs->filesize, ok ? 0 : 1);
+}
+
+int send_file(int fd, char* filename) {
+    int s = 0;
 
-    free(buffer);
+    file_sender fs;
+    if (open_sender(&fs, filename, filename) != 0) return 1;
 
     // Start communications.
     begin_timing(0);
     s = llopen(fd);
     if (s != LL_OK) goto error;
 
-    if (TRACE_FILE) printf("[FILE] BEGIN Packets %s\n", filename);
-
     begin_timing(1);
-    s = send_start_packet(fd, filesize, filename);
-    if (s != LL_OK) goto error;
-
-    // Send data packets.
-    for (size_t i = 0; i < number_packets; ++i) {
-        s = send_data_packet(fd, packets[i]);
+    while (fs.stage != SENDER_DONE) {
+        size_t sent;
+        s = sender_step(fd, &fs, &sent);
         if (s != LL_OK) goto error;
     }
-
-    // End communications.
-    s = send_end_packet(fd, filesize, filename);
-    if (s != LL_OK) goto error;
     end_timing(1);
 
-    if (TRACE_FILE) printf("[FILE] END Packets %s\n", filename);
-
+    // End communications.
     s = llclose(fd);
     end_timing(0);
 
-    if (show_statistics) print_stats(1, filesize);
+    if (show_statistics) print_stats(1, fs.filesize);
+    account_file(1, fs.filesize);
 
-    free_packets(packets, number_packets);
+    close_sender(&fs);
     return s ? 1 : 0;
 
 error:
-    free_packets(packets, number_packets);
+    close_sender(&fs);
     return 1;
 }
 
+/**
+ * Start writing the file announced by a START packet.
+ *
+ * @return 0 if successful, 1 otherwise
+ */
+static int open_sink(file_sink* fk, control_packet cp) {
+    uint64_t filesize = 0;
+    char* filename = NULL;
+
+    get_tlv_filesize(cp, &filesize);
+    get_tlv_filename(cp, &filename);
+
+    if (filename == NULL) {
+        printf("[FILE] Error: START packet without filename\n");
+        return 1;
+    }
+
+    // Data is written as it arrives, at its offset, so memory use does
+    // not depend on the filesize.
+    int filefd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (filefd == -1) {
+        perror("[FILE] Failed to open output file");
+        free(filename);
+        return 1;
+    }
+
+    file_sink sink = {filename, filefd, filesize, 0, 0, file_number++, monotonic_ns()};
+    *fk = sink;
+
+    TRACE_EVENT(TRACE_CAT_FILE, TEV_FILE_BEGIN, fk->number, filesize, 0);
+    return 0;
+}
+
+/**
+ * Write a DATA packet's data, at its offset.
+ *
+ * @return 0 if successful, 1 otherwise
+ */
+static int sink_data(file_sink* fk, data_packet dp) {
+    off_t offset = dp.offset == DATA_OFFSET_NONE ? fk->position : (off_t)dp.offset;
+
+    int s = uring_active()
+        ? uring_pwrite(fk->filefd, dp.data.s, dp.data.len, offset)
+        : write_at(fk->filefd, dp.data.s, dp.data.len, offset);
+    if (s != 0) {
+        printf("[FILE] Error: Failed to write to file %s at %ld [%s]\n",
+            fk->filename, (long)offset, strerror(errno));
+        return 1;
+    }
+
+    fk->position = offset + dp.data.len;
+    ++fk->packets;
+    return 0;
+}
+
+/**
+ * Check an END packet against the START, and size the file, once the
+ * writes behind are done.
+ *
+ * @return 0 if all the file's data was written, 1 otherwise
+ */
+static int end_sink(file_sink* fk, control_packet cp) {
+    uint64_t end_filesize = 0;
+    char* end_filename = NULL;
+    get_tlv_filesize(cp, &end_filesize);
+    get_tlv_filename(cp, &end_filename);
+
+    int check = 0;
+    if (end_filesize != fk->filesize) check |= TEV_CHECK_FILESIZE;
+    if (end_filename == NULL || strcmp(fk->filename, end_filename) != 0) {
+        check |= TEV_CHECK_FILENAME;
+    }
+    if (check) {
+        TRACE_EVENT(TRACE_CAT_FILE, TEV_FILE_CHECK, fk->number, end_filesize, check);
+    }
+
+    free(end_filename);
+
+    if (uring_drain_file(fk->filefd) != 0) {
+        printf("[FILE] Error: Failed to write to file %s [%s]\n",
+            fk->filename, strerror(errno));
+        return 1;
+    }
+
+    // Holes at the end of a sparse file were never written. Without a
+    // size in START or END, the file ends at its last byte written.
+    if (fk->filesize == 0) fk->filesize = end_filesize;
+    if (fk->filesize != 0 && ftruncate(fk->filefd, fk->filesize) == -1) {
+        printf("[FILE] Error: Failed to size file %s to %lu [%s]\n",
+            fk->filename, fk->filesize, strerror(errno));
+    }
+    return 0;
+}
+
+/**
+ * Release fk. A file that was not received is removed: as before
+ * streaming, no output file is left by a failed transfer.
+ */
+static void close_sink(file_sink* fk, bool ok) {
+    uring_drain_file(fk->filefd);
+    close(fk->filefd);
+
+    if (!ok) unlink(fk->filename);
+
+    free(fk->filename);
+    fk->filename = NULL;
+    TRACE_EVENT(TRACE_CAT_FILE, TEV_FILE_END, fk->number, fk->filesize, ok ? 0 : 1);
+}
+
 int receive_file(int fd) {
     int s = 0;
 
-    // File variables.
-    size_t filesize = 0;
-    char* filename = NULL;
+    file_sink sink;
 
     // Packet variables.
     int type;
@@ -155,20 +378,15 @@ int receive_file(int fd) {
     s = llopen(fd);
     if (s != LL_OK) return 1;
 
-    if (TRACE_FILE) printf("[FILE] BEGIN Packets\n");
     begin_timing(1);
 
     type = receive_packet(fd, &dp, &cp);
 
     switch (type) {
     case PRECEIVE_START:
-        get_tlv_filesize(cp, &filesize);
-        get_tlv_filename(cp, &filename);
-        if (TRACE_FILE) {
-            printf("[FILE] Received START packet [filesize=%lu,filename=%s]\n",
-                filesize, filename);
-        }
+        s = open_sink(&sink, cp);
         free_control_packet(cp);
+        if (s != 0) return 1;
         break;
     case PRECEIVE_DATA:
         printf("[FILE] Error: Expected START packet, received DATA packet. Exiting\n");
@@ -183,55 +401,24 @@ int receive_file(int fd) {
         return 1;
     }
 
-    string* packets = malloc(10 * sizeof(string));
-    size_t reserved = 10, number_packets = 0;
     bool done = false, reached_end = false;
 
     while (!done) {
         type = receive_packet(fd, &dp, &cp);
 
-        if (number_packets == reserved) {
-            packets = realloc(packets, 2 * reserved * sizeof(string));
-            reserved *= 2;
-        }
-
         switch (type) {
         case PRECEIVE_START:
             printf("[FILE] Error: Expected DATA/END packet, received START packet. Continuing\n");
             free_control_packet(cp);
             break;
         case PRECEIVE_DATA:
-            packets[number_packets++] = dp.data;
+            s = sink_data(&sink, dp);
+            free_data_packet(dp);
+            if (s != 0) done = true;
             break;
         case PRECEIVE_END:
             done = true;
-            reached_end = true;
-
-            size_t end_filesize = 0;
-            char* end_filename = NULL;
-            get_tlv_filesize(cp, &end_filesize);
-            get_tlv_filename(cp, &end_filename);
-
-            if (TRACE_FILE) {
-                printf("[FILE] Received END packet [ndata=%lu,filesize=%lu,filename=%s]\n",
-                    number_packets, filesize, filename);
-
-                if (end_filesize == filesize) {
-                    printf("[FILE] END packet: filesize OK\n");
-                } else {
-                    printf("[FILE] END packet: filesize NOT OK [start=%lu]",
-                        filesize);
-                }
-                
-                if (strcmp(filename, end_filename) == 0) {
-                    printf("[FILE] END packet: filename OK\n");
-                } else {
-                    printf("[FILE] END packet: filename NOT OK [start=%s]",
-                        filename);
-                }
-            }
-            
-            free(end_filename);
+            reached_end = end_sink(&sink, cp) == 0;
             free_control_packet(cp);
             break;
         case PRECEIVE_BAD_PACKET:
@@ -244,43 +431,24 @@ int receive_file(int fd) {
         }
     }
 
-    if (!reached_end) goto error;
+    if (!reached_end) {
+        close_sink(&sink, false);
+        return 1;
+    }
 
     end_timing(1);
-    if (TRACE_FILE) printf("[FILE] END Packets %s\n", filename);
 
     s = llclose(fd);
     if (s != LL_OK) {
-        printf("[FILE] llclose failed. Writing to file %s anyway\n", filename);
+        printf("[FILE] llclose failed. Keeping file %s anyway\n", sink.filename);
     }
     end_timing(0);
 
-    if (show_statistics) print_stats(1, filesize);
-
-    FILE* file = fopen(filename, "w");
-    if (file == NULL) {
-        perror("[FILE] Failed to open output file");
-        goto error;
-    }
-
-    if (TRACE_FILE) printf("[FILE] Writing to file %s...\n", filename);
-
-    for (size_t i = 0; i < number_packets; ++i) {
-        fwrite(packets[i].s, packets[i].len, 1, file);
-    }
-
-    if (TRACE_FILE) printf("[FILE] Finished writing to file %s\n", filename);
+    if (show_statistics) print_stats(1, sink.filesize);
+    account_file(1, sink.filesize);
 
-    fclose(file);
-
-    free_packets(packets, number_packets);
-    free(filename);
+    close_sink(&sink, true);
     return s ? 1 : 0;
-
-error:
-    free_packets(packets, number_packets);
-    free(filename);
-    return 1;
 }
 
 int send_files(int fd) {
@@ -302,3 +470,100 @@ int receive_files(int fd) {
     }
     return 0;
 }
+
+/**
+ * Receive files over one session, until T closes it. Files sent on
+ * different channels are in flight at once, each with its own output
+ * file. The wait for packets is not bounded by the link's timeouts, as T
+ * may be idle for as long as it has no files to send.
+ *
+ * @return 0 if successful, 1 if the link failed
+ */
+int receive_session_files(int fd) {
+    static file_sink sinks[CHANNEL_MAX + 1]; // only supports one fd.
+
+    int s, type;
+    control_packet cp;
+    data_packet dp;
+
+    // An attempt fails at once on the frames of a session T still sends
+    // in, until T gives up on it: back off, rather than spin through them.
+    long backoff = SESSION_BACKOFF_MIN;
+    while ((s = llopen(fd)) != LL_OK) {
+        printf("[FILE] Waiting for T to open the session, again in %ld ms\n", backoff);
+        struct timespec t = {backoff / 1000, (backoff % 1000) * 1000000L};
+        nanosleep(&t, NULL);
+        backoff = backoff * 2 < SESSION_BACKOFF_MAX ? backoff * 2 : SESSION_BACKOFF_MAX;
+    }
+
+    while (true) {
+        if (!readPending() && transport_wait_readable(fd, -1) == -1) {
+            if (errno == EINTR) continue;
+            printf("[FILE] Error: wait for T failed [%s]\n", strerror(errno));
+            s = 1;
+            break;
+        }
+
+        type = receive_packet(fd, &dp, &cp);
+        if (type == LL_DISCONNECTED) break;
+
+        file_sink* fk;
+
+        switch (type) {
+        case PRECEIVE_START:
+            fk = &sinks[cp.channel];
+            if (fk->filename != NULL) {
+                printf("[FILE] Error: START on busy channel %d, dropping %s\n",
+                    cp.channel, fk->filename);
+                close_sink(fk, false);
+            }
+            open_sink(fk, cp);
+            free_control_packet(cp);
+            break;
+        case PRECEIVE_DATA:
+            fk = &sinks[dp.channel];
+            if (fk->filename == NULL) {
+                printf("[FILE] Error: DATA packet on idle channel %d\n", dp.channel);
+            } else if (sink_data(fk, dp) != 0) {
+                close_sink(fk, false);
+            }
+            free_data_packet(dp);
+            break;
+        case PRECEIVE_END:
+            fk = &sinks[cp.channel];
+            if (fk->filename == NULL) {
+                printf("[FILE] Error: END packet on idle channel %d\n", cp.channel);
+            } else {
+                bool ok = end_sink(fk, cp) == 0;
+                if (ok) {
+                    set_timing(1, (monotonic_ns() - fk->begin) / 1e6);
+                    account_file(1, fk->filesize);
+                }
+                close_sink(fk, ok);
+                reset_counter();
+            }
+            free_control_packet(cp);
+            break;
+        case PRECEIVE_BAD_PACKET:
+            break;
+        case LL_REOPENED:
+            // T's link failed: it fails the files in flight, and so do we.
+            printf("[FILE] T opened a new session, dropping its files in flight\n");
+            for (int c = 0; c <= CHANNEL_MAX; ++c) {
+                if (sinks[c].filename != NULL) close_sink(&sinks[c], false);
+            }
+            break;
+        default:
+            printf("[FILE] Error: Session read failed. Continuing\n");
+            break;
+        }
+    }
+
+    // Files T never finished.
+    for (int c = 0; c <= CHANNEL_MAX; ++c) {
+        if (sinks[c].filename != NULL) close_sink(&sinks[c], false);
+    }
+
+    if (s == 0) llclose(fd);
+    return s;
+}
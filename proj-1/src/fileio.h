@@ -3,8 +3,37 @@
 
 #include "app-layer.h"
 
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SENDER_START           0
+#define SENDER_DATA            1
+#define SENDER_END             2
+#define SENDER_DONE            3
+
+/**
+ * A file being sent, one packet at a time, so that the packets of several
+ * files can be interleaved over one link.
+ */
+typedef struct {
+    char* path;
+    char* name;
+    int filefd;
+    uint64_t filesize;
+    off_t offset, end; // Next DATA packet, and the end of its extent
+    string packet;
+    int stage; // SENDER_*
+    uint32_t number;
+} file_sender;
+
 size_t number_of_packets(size_t filesize);
 
+int open_sender(file_sender* fs, char* path, char* name);
+
+int sender_step(int fd, file_sender* fs, size_t* sentp);
+
+void close_sender(file_sender* fs);
+
 int send_file(int fd, char* filename);
 
 int receive_file(int fd);
@@ -13,4 +42,6 @@ int send_files(int fd);
 
 int receive_files(int fd);
 
+int receive_session_files(int fd);
+
 #endif // FILEIO_H___
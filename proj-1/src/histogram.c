@@ -0,0 +1,109 @@
+#include "histogram.h"
+
+#include <string.h>
+
+static size_t bucket_index(uint64_t value) {
+    if (value < (1 << HIST_SUB_BITS)) return (size_t)value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - (HIST_SUB_BITS - 1);
+
+    return (size_t)shift * HIST_SUB_HALF + (size_t)(value >> shift);
+}
+
+/**
+ * Highest value that falls into bucket i.
+ */
+static uint64_t bucket_upper(size_t i) {
+    if (i < (1 << HIST_SUB_BITS)) return (uint64_t)i;
+
+    size_t shift = i / HIST_SUB_HALF - 1;
+    uint64_t mantissa = i - shift * HIST_SUB_HALF;
+
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void hist_reset(histogram* h) {
+    memset(h, 0, sizeof(histogram));
+}
+
+void hist_record(histogram* h, uint64_t value) {
+    if (h->count == 0 || value < h->min) h->min = value;
+    if (h->count == 0 || value > h->max) h->max = value;
+
+    ++h->count;
+    h->sum += value;
+    ++h->buckets[bucket_index(value)];
+}
+
+double hist_mean(const histogram* h) {
+    return h->count ? (double)h->sum / h->count : 0.0;
+}
+
+/**
+ * Value at the given percentile (0-100), reported as the highest value
+ * equivalent to the bucket it falls in, clamped to the recorded maximum.
+ */
+uint64_t hist_percentile(const histogram* h, double percentile) {
+    if (h->count == 0) return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * h->count + 0.5);
+    if (rank == 0) rank = 1;
+    if (rank > h->count) rank = h->count;
+
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+static const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+static const char* percentile_names[] = {"p50", "p90", "p99", "p999"};
+static const size_t percentiles_length = sizeof(percentiles) / sizeof(double);
+
+/**
+ * Print the histogram as a JSON object: summary, percentiles and the
+ * non-empty buckets as [upper, count] pairs.
+ */
+void hist_print_json(FILE* out, const histogram* h) {
+    fprintf(out, "{\"count\": %lu, \"min\": %lu, \"max\": %lu, \"mean\": %.3f",
+        h->count, h->min, h->max, hist_mean(h));
+
+    for (size_t i = 0; i < percentiles_length; ++i) {
+        fprintf(out, ", \"%s\": %lu", percentile_names[i],
+            hist_percentile(h, percentiles[i]));
+    }
+
+    fprintf(out, ", \"buckets\": [");
+
+    const char* sep = "";
+    for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+        if (h->buckets[i] == 0) continue;
+        fprintf(out, "%s[%lu, %lu]", sep, bucket_upper(i), h->buckets[i]);
+        sep = ", ";
+    }
+
+    fprintf(out, "]}");
+}
+
+/**
+ * Print the histogram summary as name,field,value CSV rows.
+ */
+void hist_print_csv(FILE* out, const char* name, const histogram* h) {
+    fprintf(out, "%s,count,%lu\n", name, h->count);
+    fprintf(out, "%s,min,%lu\n", name, h->min);
+    fprintf(out, "%s,max,%lu\n", name, h->max);
+    fprintf(out, "%s,mean,%.3f\n", name, hist_mean(h));
+
+    for (size_t i = 0; i < percentiles_length; ++i) {
+        fprintf(out, "%s,%s,%lu\n", name, percentile_names[i],
+            hist_percentile(h, percentiles[i]));
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef HISTOGRAM_H___
+#define HISTOGRAM_H___
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// HDR-style log-linear histogram: exact below 32, then 16 linear
+// sub-buckets per power of two (~6% worst relative error).
+#define HIST_SUB_BITS          5
+#define HIST_SUB_HALF          (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS           ((64 - HIST_SUB_BITS + 1) * HIST_SUB_HALF + HIST_SUB_HALF)
+
+typedef struct {
+    uint64_t count, sum, min, max;
+    uint64_t buckets[HIST_BUCKETS];
+} histogram;
+
+void hist_reset(histogram* h);
+
+void hist_record(histogram* h, uint64_t value);
+
+double hist_mean(const histogram* h);
+
+uint64_t hist_percentile(const histogram* h, double percentile);
+
+void hist_print_json(FILE* out, const histogram* h);
+
+void hist_print_csv(FILE* out, const char* name, const histogram* h);
+
+#endif // HISTOGRAM_H___
@@ -0,0 +1,401 @@
+// Link captures: every byte read from and written to the link, timestamped,
+// and the replay transport, which reads one direction of a capture back
+// into readFrame and the ll-interface state machine, offline.
+#include "ll-capture.h"
+#include "ll-transport.h"
+#include "ll-core.h"
+#include "ll-errors.h"
+#include "options.h"
+#include "timing.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <errno.h>
+#include <time.h>
+
+#define CAPTURE_BUFFER_SIZE (64 * 1024)
+#define VARINT_MAX 10 // Bytes of a LEB128 uint64_t
+
+// The capture being written. Only supports one fd.
+static int capture_fd = -1;
+static char capture_buffer[CAPTURE_BUFFER_SIZE];
+static size_t capture_used = 0;
+static uint64_t capture_last_ns = 0;
+
+// The capture being replayed, whole. Only supports one fd.
+static char* replay_data = NULL;
+static size_t replay_size = 0;
+static size_t replay_next = 0;      // Next record not yet scanned
+static uint64_t replay_next_ns = 0; // Its time, once scanned
+static bool replay_scanned = false; // The replayed direction's next record
+static int replay_scanned_type = 0; // was found, and holds these bytes
+static const char* replay_scanned_bytes = NULL;
+static size_t replay_scanned_len = 0;
+static const char* replay_pending = NULL; // Bytes of the record being read
+static size_t replay_left = 0;
+static uint64_t replay_now = 0;     // Time of the last record taken
+static uint64_t replay_read_bytes = 0;
+static int replay_direction = CAPTURE_RX;
+static bool replay_realtime = false;
+
+static size_t put_varint(char* p, uint64_t value) {
+    size_t n = 0;
+    do {
+        unsigned char b = value & 0x7f;
+        value >>= 7;
+        p[n++] = b | (value != 0 ? 0x80 : 0);
+    } while (value != 0);
+    return n;
+}
+
+/**
+ * @return Bytes of the varint at p, or 0 if it runs past end
+ */
+static size_t get_varint(const char* p, const char* end, uint64_t* valuep) {
+    uint64_t value = 0;
+    for (size_t n = 0; n < VARINT_MAX && p + n < end; ++n) {
+        value |= (uint64_t)(p[n] & 0x7f) << (7 * n);
+        if ((p[n] & 0x80) == 0) {
+            *valuep = value;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes out the records buffered so far. Uses only write so that it may
+ * be called from a signal handler.
+ */
+void capture_flush() {
+    if (capture_fd == -1) return;
+
+    size_t done = 0;
+    while (done < capture_used) {
+        ssize_t s = write(capture_fd, capture_buffer + done, capture_used - done);
+        if (s == -1 && errno == EINTR) continue;
+        if (s <= 0) break;
+        done += s;
+    }
+    capture_used = 0;
+}
+
+static void capture_at_exit() {
+    capture_flush();
+    close(capture_fd);
+    capture_fd = -1;
+}
+
+/**
+ * Starts capturing the link into file, once it is open, and finishes the
+ * capture at exit. Does nothing if file is NULL.
+ *
+ * @param file   The capture's path
+ * @param linkfd The link's fd
+ */
+void capture_setup(const char* file, int linkfd) {
+    if (file == NULL) return;
+
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        printf("[SETUP] Failed to open capture %s [%s]\n", file, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+
+    capture_header header = {
+        .start_ns = (uint64_t)t.tv_sec * 1000000000lu + (uint64_t)t.tv_nsec,
+        .seed = get_error_seed(),
+        .h_error_prob = h_error_prob,
+        .f_error_prob = f_error_prob,
+        .fd = linkfd,
+        .baudrate = baudrate,
+        .packetsize = packetsize,
+        .role = my_role,
+        .codec = getFrameCodec(),
+        .frame_codec = frame_codec,
+        .flow_control = flow_control,
+        .daemon = daemon_socket != NULL,
+        .error_type = error_type
+    };
+
+    memcpy(capture_buffer, CAPTURE_MAGIC, 8);
+    memcpy(capture_buffer + 8, &header, sizeof(header));
+    capture_used = 8 + sizeof(header);
+
+    capture_fd = fd;
+    capture_last_ns = monotonic_ns();
+    atexit(capture_at_exit);
+
+    printf("[SETUP] Capturing the link into %s\n", file);
+}
+
+/**
+ * Appends a record to the capture, if one is being written.
+ *
+ * @param type CAPTURE_RX, CAPTURE_TX, CAPTURE_TICK or CAPTURE_CODEC
+ * @param buf  The bytes read or written, NULL otherwise
+ * @param len  Their length, the codec for CAPTURE_CODEC, or 0
+ */
+void capture_record(int type, const void* buf, size_t len) {
+    if (capture_fd == -1) return;
+
+    uint64_t now = monotonic_ns();
+
+    if (CAPTURE_BUFFER_SIZE - capture_used < 1 + 2 * VARINT_MAX) capture_flush();
+
+    char* p = capture_buffer + capture_used;
+    *p = type;
+    size_t n = 1;
+    n += put_varint(p + n, now - capture_last_ns);
+    n += put_varint(p + n, len);
+    capture_used += n;
+    capture_last_ns = now;
+
+    if (buf == NULL) return;
+
+    const char* bytes = buf;
+    while (len > 0) {
+        if (capture_used == CAPTURE_BUFFER_SIZE) capture_flush();
+
+        size_t chunk = CAPTURE_BUFFER_SIZE - capture_used;
+        if (chunk > len) chunk = len;
+        memcpy(capture_buffer + capture_used, bytes, chunk);
+        capture_used += chunk, bytes += chunk, len -= chunk;
+    }
+}
+
+/**
+ * Reads and checks the magic and header of the capture in file.
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int capture_read_header(const char* file, capture_header* headerp) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    char magic[8];
+    bool ok = read(fd, magic, 8) == 8 && memcmp(magic, CAPTURE_MAGIC, 8) == 0 &&
+        read(fd, headerp, sizeof(*headerp)) == sizeof(*headerp);
+
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Selects what the replay transport reads: the bytes of direction,
+ * CAPTURE_RX or CAPTURE_TX, as fast as possible, or at the pace they were
+ * captured if realtime. Set before open_transport.
+ */
+void replay_configure(int direction, bool realtime) {
+    replay_direction = direction;
+    replay_realtime = realtime;
+}
+
+/**
+ * @return The time the replay has reached, in ns since the capture began
+ */
+uint64_t replay_time_ns() {
+    return replay_now;
+}
+
+/**
+ * @return The bytes read from the replay so far
+ */
+uint64_t replay_bytes() {
+    return replay_read_bytes;
+}
+
+/**
+ * Parses the record at offset at of the replayed capture.
+ *
+ * @return Its size, or 0 if it is cut short
+ */
+static size_t parse_record(size_t at, int* typep, uint64_t* deltap, uint64_t* lenp) {
+    const char* p = replay_data + at;
+    const char* end = replay_data + replay_size;
+    size_t n = 1, m;
+
+    if (at >= replay_size) return 0;
+    if ((m = get_varint(p + n, end, deltap)) == 0) return 0;
+    n += m;
+    if ((m = get_varint(p + n, end, lenp)) == 0) return 0;
+    n += m;
+
+    *typep = p[0];
+    size_t bytes = *typep == CAPTURE_RX || *typep == CAPTURE_TX ? *lenp : 0;
+    if (bytes > (size_t)(end - p) - n) return 0;
+    return n + bytes;
+}
+
+/**
+ * @return true if a record is of the replayed direction: its bytes, and
+ *         for reads, the ticks that passed without any
+ */
+static bool replayed(int type) {
+    return type == replay_direction ||
+        (type == CAPTURE_TICK && replay_direction == CAPTURE_RX);
+}
+
+/**
+ * Finds the next record of the replayed direction, switching codecs as it
+ * passes codec records, as the link did when it was captured.
+ *
+ * @return true if there is one, false at the end of the capture
+ */
+static bool replay_scan() {
+    if (replay_scanned) return true;
+
+    int type;
+    uint64_t delta, len;
+    size_t size;
+
+    while ((size = parse_record(replay_next, &type, &delta, &len)) != 0) {
+        const char* p = replay_data + replay_next;
+        replay_next += size;
+        replay_next_ns += delta;
+
+        if (type == CAPTURE_CODEC) {
+            setFrameCodec(len);
+        } else if (replayed(type)) {
+            replay_scanned_type = type;
+            replay_scanned_bytes = p + size - (type == CAPTURE_TICK ? 0 : len);
+            replay_scanned_len = type == CAPTURE_TICK ? 0 : len;
+            replay_scanned = true;
+            return true;
+        }
+    }
+
+    replay_next = replay_size;
+    return false;
+}
+
+/**
+ * Takes the record replay_scan found, after its time passed in real time.
+ *
+ * @return false if it was a tick
+ */
+static bool replay_take() {
+    if (replay_realtime && replay_next_ns > replay_now) {
+        uint64_t ns = replay_next_ns - replay_now;
+        struct timespec t = {ns / 1000000000lu, ns % 1000000000lu};
+        while (nanosleep(&t, &t) == -1 && errno == EINTR) {}
+    }
+    if (replay_next_ns > replay_now) replay_now = replay_next_ns;
+
+    replay_scanned = false;
+    if (replay_scanned_type == CAPTURE_TICK) return false;
+
+    replay_pending = replay_scanned_bytes;
+    replay_left = replay_scanned_len;
+    return true;
+}
+
+/**
+ * @return true once every byte of the replayed direction was read, even if
+ *         the capture has ticks or other records left
+ */
+bool replay_at_end() {
+    if (replay_left > 0) return false;
+    if (replay_scanned && replay_scanned_type != CAPTURE_TICK) return false;
+
+    int type;
+    uint64_t delta, len;
+    size_t size;
+
+    for (size_t at = replay_next; (size = parse_record(at, &type, &delta, &len)) != 0; at += size) {
+        if (type == replay_direction) return false;
+    }
+    return true;
+}
+
+static int replay_open(const char* device) {
+    int fd = open(device, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        printf("[SETUP] Failed to open capture %s [%s]\n", device, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    replay_data = malloc(st.st_size);
+    replay_size = 0;
+    while (replay_size < (size_t)st.st_size) {
+        ssize_t s = read(fd, replay_data + replay_size, st.st_size - replay_size);
+        if (s <= 0) break;
+        replay_size += s;
+    }
+
+    size_t skip = 8 + sizeof(capture_header);
+    if (replay_size < skip || memcmp(replay_data, CAPTURE_MAGIC, 8) != 0) {
+        printf("[SETUP] %s is not a capture\n", device);
+        exit(EXIT_FAILURE);
+    }
+
+    replay_next = skip;
+    replay_next_ns = replay_now = replay_read_bytes = 0;
+    replay_scanned = false;
+    replay_pending = NULL, replay_left = 0;
+    return fd;
+}
+
+static ssize_t replay_read(int fd, void* buf, size_t len) {
+    if (replay_left == 0) {
+        if (!replay_scan() || !replay_take()) return 0;
+    }
+
+    size_t n = len < replay_left ? len : replay_left;
+    memcpy(buf, replay_pending, n);
+    replay_pending += n, replay_left -= n;
+    replay_read_bytes += n;
+    return n;
+}
+
+/**
+ * Waits as the capture did, rather than for timeout_ms: a tick recorded
+ * there times out here, however long it took, so that the state machine
+ * times out where it did on the link. Past the end of the capture, every
+ * wait times out at once.
+ */
+static int replay_wait_readable(int fd, int timeout_ms) {
+    if (replay_left > 0) return 1;
+    if (!replay_scan()) return 0;
+
+    if (replay_scanned_type == CAPTURE_TICK) return replay_take() ? 1 : 0;
+
+    // The bytes are taken by the read that follows, in time.
+    return 1;
+}
+
+// Replies are not replayed: the capture already holds what came of them.
+static ssize_t replay_write(int fd, const void* buf, size_t len) {
+    return len;
+}
+
+static int replay_flush(int fd, int queue) {
+    return 0;
+}
+
+static int replay_close(int fd) {
+    free(replay_data);
+    replay_data = NULL;
+    return close(fd);
+}
+
+const transport replay_transport = {
+    .name = "replay",
+    .open = replay_open,
+    .read = replay_read,
+    .write = replay_write,
+    .wait_readable = replay_wait_readable,
+    .flush = replay_flush,
+    .close = replay_close
+};
@@ -0,0 +1,59 @@
+#ifndef LL_CAPTURE_H___
+#define LL_CAPTURE_H___
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Link captures, recorded with --capture=S and replayed with ./llreplay.
+//
+// A capture is the magic, a capture_header, and then one record per read
+// or write on the link, and one per codec switch:
+//   u8 type, varint ns since the previous record, varint len, len bytes
+// where varints are LEB128. Only CAPTURE_RX and CAPTURE_TX records have
+// bytes: a CAPTURE_CODEC record's len is the codec itself, and a
+// CAPTURE_TICK's is 0. Ticks make replays time out exactly where the link
+// did, whatever time it took the original reads to. The bytes are the wire's, before any error was
+// injected in them; the header holds what the replay needs to inject the
+// same errors again.
+#define CAPTURE_MAGIC          "LLCAPT01"
+
+#define CAPTURE_RX             0x01 // Bytes read from the link
+#define CAPTURE_TX             0x02 // Bytes written to the link
+#define CAPTURE_CODEC          0x03 // setFrameCodec, as XID settles it
+#define CAPTURE_TICK           0x04 // A read tick passed without any bytes
+
+typedef struct {
+    uint64_t start_ns;      // CLOCK_REALTIME of the first record's time base
+    uint64_t seed;          // Error injection, which happens after capture,
+    double h_error_prob;    // on the link's fd, and is replayed as such
+    double f_error_prob;
+    int32_t fd;
+    uint32_t baudrate;
+    uint32_t packetsize;
+    uint8_t role;           // TRANSMITTER or RECEIVER
+    uint8_t codec;          // The link's codec when the capture began
+    uint8_t frame_codec;    // --codec
+    uint8_t flow_control;   // --flow
+    uint8_t daemon;         // The link carried a --daemon session
+    uint8_t error_type;
+    uint8_t reserved[6];
+} capture_header;
+
+void capture_setup(const char* file, int fd);
+
+void capture_record(int type, const void* buf, size_t len);
+
+void capture_flush();
+
+int capture_read_header(const char* file, capture_header* headerp);
+
+void replay_configure(int direction, bool realtime);
+
+uint64_t replay_time_ns();
+
+uint64_t replay_bytes();
+
+bool replay_at_end();
+
+#endif // LL_CAPTURE_H___
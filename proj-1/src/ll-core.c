@@ -2,7 +2,10 @@
 #include "ll-errors.h"
 #include "options.h"
 #include "signals.h"
+#include "trace.h"
 #include "debug.h"
+#include "ll-transport.h"
+#include "ll-capture.h"
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -16,6 +19,53 @@
 #include <errno.h>
 #include <assert.h>
 
+static int link_codec = CODEC_HDLC; // only supports one fd.
+static int fallback_codec = 0; // only supports one fd.
+
+// Bytes read from the device but not yet parsed. Only supports one fd.
+#define READ_BUFFER_SIZE 4096
+#define READ_TICK_MS 100 // As VTIME, where reads wait_readable first
+static char read_buffer[READ_BUFFER_SIZE];
+static size_t read_begin = 0, read_end = 0;
+
+/**
+ * Selects the codec for I frames' data, CODEC_HDLC or CODEC_COBS.
+ * Both ends must use the same one.
+ */
+void setFrameCodec(int codec) {
+    link_codec = codec;
+    capture_record(CAPTURE_CODEC, NULL, codec);
+}
+
+int getFrameCodec() {
+    return link_codec;
+}
+
+/**
+ * Until an I frame decodes with the codec selected, an I frame that does
+ * not is decoded with codec too, and selects it if it passes. R keeps the
+ * codec T falls back to this way, as T may never get its XID answer.
+ * A codec of 0 stops trying.
+ */
+void setFrameCodecFallback(int codec) {
+    fallback_codec = codec == link_codec ? 0 : codec;
+}
+
+// For each char, its stuffing if it must be escaped, or 0 otherwise.
+static char escapes[256] = {
+    [(unsigned char)FRAME_FLAG] = FRAME_FLAG_STUFFING,
+    [(unsigned char)FRAME_ESC] = FRAME_ESC_STUFFING
+}; // only supports one fd.
+
+/**
+ * Selects whether stuffData escapes XON and XOFF, for software flow
+ * control. destuffData accepts them escaped either way.
+ */
+void setFrameEscapeXonXoff(bool escape) {
+    escapes[FRAME_XON] = escape ? FRAME_XON_STUFFING : 0;
+    escapes[FRAME_XOFF] = escape ? FRAME_XOFF_STUFFING : 0;
+}
+
 /**
  * Performs stuffing on the string in, writing the result in the string out.
  * The bcc2 char is computed and appended to the out string, and also returned
@@ -28,16 +78,16 @@
  * @param  bcc2p [out] Computed bcc2
  * @return 0
  */
-static int stuffData(string in, string* outp, char* bcc2p) {
+int stuffData(string in, string* outp, char* bcc2p) {
     size_t stuff_count = 0;
     char parity = 0;
 
     for (size_t i = 0; i < in.len; ++i) {
-        if (FRAME_MUST_ESCAPE(in.s[i])) ++stuff_count;
+        if (escapes[(unsigned char)in.s[i]]) ++stuff_count;
         parity ^= in.s[i];
     }
 
-    bool stuff_bcc2 = FRAME_MUST_ESCAPE(parity);
+    char stuff_bcc2 = escapes[(unsigned char)parity];
     if (stuff_bcc2) ++stuff_count;
 
     string stuffed_data;
@@ -46,36 +96,29 @@ static int stuffData(string in, string* outp, char* bcc2p) {
 
     size_t j = 0;
     for (size_t i = 0; i < in.len; ++i) {
-        switch (in.s[i]) {
-        case FRAME_FLAG:
+        char stuffing = escapes[(unsigned char)in.s[i]];
+        if (stuffing) {
             stuffed_data.s[j++] = FRAME_ESC;
-            stuffed_data.s[j++] = FRAME_FLAG_STUFFING;
-            break;
-        case FRAME_ESC:
-            stuffed_data.s[j++] = FRAME_ESC;
-            stuffed_data.s[j++] = FRAME_ESC_STUFFING;
-            break;
-        default:
+            stuffed_data.s[j++] = stuffing;
+        } else {
             stuffed_data.s[j++] = in.s[i];
         }
     }
 
-    switch (parity) {
-    case FRAME_FLAG:
+    if (stuff_bcc2) {
         stuffed_data.s[j++] = FRAME_ESC;
-        stuffed_data.s[j++] = FRAME_FLAG_STUFFING;
-        break;
-    case FRAME_ESC:
-        stuffed_data.s[j++] = FRAME_ESC;
-        stuffed_data.s[j++] = FRAME_ESC_STUFFING;
-        break;
-    default:
+        stuffed_data.s[j++] = stuff_bcc2;
+    } else {
         stuffed_data.s[j++] = parity;
     }
 
     stuffed_data.s[stuffed_data.len] = '\0';
     assert(j == stuffed_data.len);
 
+    if (in.len > 0) {
+        hist_record(&metrics.stuffing, stuff_count * 1000 / in.len);
+    }
+
     *outp = stuffed_data;
     *bcc2p = parity;
     return 0;
@@ -94,7 +137,7 @@ static int stuffData(string in, string* outp, char* bcc2p) {
  *         FRAME_READ_BAD_ESCAPE if there is a badly escaped character
  *         FRAME_READ_BAD_BCC2 if bcc2 check does not pass
  */
-static int destuffData(string in, string* outp, char* bcc2p) {
+int destuffData(string in, string* outp, char* bcc2p) {
     size_t count = 0;
 
     for (size_t i = 0; i < in.len; ++i) {
@@ -117,11 +160,15 @@ static int destuffData(string in, string* outp, char* bcc2p) {
             case FRAME_ESC_STUFFING:
                 destuffed_data.s[j] = FRAME_ESC;
                 break;
+            case FRAME_XON_STUFFING:
+                destuffed_data.s[j] = FRAME_XON;
+                break;
+            case FRAME_XOFF_STUFFING:
+                destuffed_data.s[j] = FRAME_XOFF;
+                break;
             default:
-                if (TRACE_LL_ERRORS) {
-                    printf("[LLERR] Bad Escape [c=%c,0x%02x,i=%lu]\n",
-                        in.s[i], (unsigned char)in.s[i], i);
-                }
+                TRACE_EVENT(TRACE_CAT_FRAME, TEV_DECODE_ERROR, i, in.len,
+                    FRAME_READ_BAD_ESCAPE);
                 free(destuffed_data.s);
                 return FRAME_READ_BAD_ESCAPE;
             }
@@ -138,21 +185,176 @@ static int destuffData(string in, string* outp, char* bcc2p) {
     parity ^= bcc2;
 
     if (bcc2 != parity) {
-        if (TRACE_LL_ERRORS) {
-            printf("[LLERR] Bad BCC2 [calc=0x%02x,read=0x%02x] [len=%lu]\n",
-                (unsigned char)parity, (unsigned char)bcc2, destuffed_data.len);
-        }
+        TRACE_EVENT(TRACE_CAT_FRAME, TEV_DECODE_ERROR, destuffed_data.len, in.len,
+            FRAME_READ_BAD_BCC2);
         free(destuffed_data.s);
         return FRAME_READ_BAD_BCC2;
     }
 
     destuffed_data.s[destuffed_data.len] = '\0'; // clear bcc2
 
+    if (destuffed_data.len > 0) {
+        hist_record(&metrics.stuffing, count * 1000 / destuffed_data.len);
+    }
+
     *outp = destuffed_data;
     *bcc2p = parity;
     return 0;
 }
 
+static unsigned char crc8_table[256];
+static bool crc8_ready = false;
+
+/**
+ * CRC-8, polynomial x^8 + x^2 + x + 1, no reflection, initial value 0.
+ * Appending the CRC of some data to it makes the CRC of the whole 0.
+ */
+static void crc8_init() {
+    for (int i = 0; i < 256; ++i) {
+        unsigned char crc = i;
+        for (int k = 0; k < 8; ++k) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+        crc8_table[i] = crc;
+    }
+    crc8_ready = true;
+}
+
+/**
+ * Performs Consistent Overhead Byte Stuffing on the string in followed by
+ * its bcc2, in a single pass. The output is XORed with FRAME_FLAG so that,
+ * as COBS output has no zero bytes, it has no flags. FRAME_ESC is an
+ * ordinary byte. The overhead is 1 byte, plus 1 per 254 bytes at most.
+ *
+ * The bcc2 is a CRC-8 rather than a parity byte: a corrupted COBS code
+ * byte moves a zero to another position, which parity cannot detect.
+ *
+ * This function does not fail.
+ *
+ * @param  in    String to be encoded
+ * @param  outp  [out] Encoded string, including the computed bcc2
+ * @param  bcc2p [out] Computed bcc2
+ * @return 0
+ */
+int cobsEncode(string in, string* outp, char* bcc2p) {
+    size_t total = in.len + 1; // Data and bcc2
+    size_t reserved = total + total / 254 + 2;
+
+    string encoded;
+    encoded.s = malloc(reserved * sizeof(char));
+
+    if (!crc8_ready) crc8_init();
+
+    unsigned char crc = 0;
+    size_t code_i = 0, j = 1;
+    unsigned char code = 1;
+
+    for (size_t i = 0; i < total; ++i) {
+        char c;
+        if (i < in.len) {
+            c = in.s[i];
+            crc = crc8_table[crc ^ (unsigned char)c];
+        } else {
+            c = crc;
+        }
+
+        if (c == 0) {
+            encoded.s[code_i] = code ^ FRAME_FLAG;
+            code_i = j++;
+            code = 1;
+        } else {
+            encoded.s[j++] = c ^ FRAME_FLAG;
+            if (++code == 0xff) {
+                encoded.s[code_i] = code ^ FRAME_FLAG;
+                code_i = j++;
+                code = 1;
+            }
+        }
+    }
+
+    encoded.s[code_i] = code ^ FRAME_FLAG;
+    encoded.len = j;
+    encoded.s[j] = '\0';
+    assert(j < reserved);
+
+    if (in.len > 0) {
+        hist_record(&metrics.stuffing, (encoded.len - total) * 1000 / in.len);
+    }
+
+    *outp = encoded;
+    *bcc2p = crc;
+    return 0;
+}
+
+/**
+ * Decodes the string in, encoded by cobsEncode, in a single pass.
+ * The last decoded character is the bcc2 (CRC-8), which is checked and removed.
+ *
+ * @param  in    String to be decoded
+ * @param  outp  [out] Decoded string, without bcc2
+ * @param  bcc2p [out] Computed bcc2
+ * @return 0 if successful
+ *         FRAME_READ_BAD_ESCAPE if there is a bad code byte
+ *         FRAME_READ_BAD_BCC2 if bcc2 check does not pass
+ */
+int cobsDecode(string in, string* outp, char* bcc2p) {
+    if (!crc8_ready) crc8_init();
+
+    string decoded;
+    decoded.s = malloc((in.len + 1) * sizeof(char));
+
+    unsigned char crc = 0;
+    size_t i = 0, j = 0;
+
+    while (i < in.len) {
+        unsigned char code = in.s[i++] ^ FRAME_FLAG;
+
+        if (code == 0 || i + code - 1 > in.len) {
+            TRACE_EVENT(TRACE_CAT_FRAME, TEV_DECODE_ERROR, i - 1, in.len,
+                FRAME_READ_BAD_ESCAPE);
+            free(decoded.s);
+            return FRAME_READ_BAD_ESCAPE;
+        }
+
+        for (unsigned char k = 1; k < code; ++k) {
+            char c = in.s[i++] ^ FRAME_FLAG;
+            decoded.s[j++] = c;
+            crc = crc8_table[crc ^ (unsigned char)c];
+        }
+
+        if (code != 0xff && i < in.len) {
+            decoded.s[j++] = 0;
+            crc = crc8_table[crc];
+        }
+    }
+
+    if (j == 0) {
+        free(decoded.s);
+        return FRAME_READ_BAD_ESCAPE;
+    }
+
+    decoded.len = j - 1;
+    char bcc2 = decoded.s[decoded.len];
+
+    // The CRC runs over bcc2 too: it is 0 if the check passes.
+    if (crc != 0) {
+        TRACE_EVENT(TRACE_CAT_FRAME, TEV_DECODE_ERROR, decoded.len, in.len,
+            FRAME_READ_BAD_BCC2);
+        free(decoded.s);
+        return FRAME_READ_BAD_BCC2;
+    }
+
+    decoded.s[decoded.len] = '\0'; // clear bcc2
+
+    if (decoded.len > 0) {
+        hist_record(&metrics.stuffing, (in.len - decoded.len - 1) * 1000 / decoded.len);
+    }
+
+    *outp = decoded;
+    *bcc2p = bcc2;
+    return 0;
+}
+
 /**
  * A wrapper function for destuffData, which first extracts
  * the data fragment a string from the frame string text.
@@ -171,7 +373,23 @@ static int destuffText(string text, string* outp, char* bcc2) {
     memcpy(data.s, text.s + 4, data.len);
     data.s[data.len] = '\0';
 
-    int s = destuffData(data, outp, bcc2);
+    bool coded = text.s[2] != FRAME_C_XID;
+    int s = coded && link_codec == CODEC_COBS
+        ? cobsDecode(data, outp, bcc2)
+        : destuffData(data, outp, bcc2);
+
+    if (coded && fallback_codec != 0) {
+        if (s != 0) {
+            s = fallback_codec == CODEC_COBS
+                ? cobsDecode(data, outp, bcc2)
+                : destuffData(data, outp, bcc2);
+            if (s == 0) {
+                printf("[LL] I frame in the fallback codec: T kept its options\n");
+                setFrameCodec(fallback_codec);
+            }
+        }
+        if (s == 0) fallback_codec = 0;
+    }
 
     free(data.s);
     return s;
@@ -186,7 +404,7 @@ static int destuffText(string text, string* outp, char* bcc2) {
  * @param  textp [out] Stringified frame
  * @return 0
  */
-static int buildText(frame f, string* textp) {
+int buildText(frame f, string* textp) {
     if (f.data.s == NULL) {
         // S or U frame (control frame)
         string text;
@@ -207,7 +425,11 @@ static int buildText(frame f, string* textp) {
         // I frame (data frame)
         string stuffed_data;
         char bcc2;
-        stuffData(f.data, &stuffed_data, &bcc2);
+        if (link_codec == CODEC_COBS && f.c != FRAME_C_XID) {
+            cobsEncode(f.data, &stuffed_data, &bcc2);
+        } else {
+            stuffData(f.data, &stuffed_data, &bcc2);
+        }
 
         string text;
 
@@ -228,6 +450,50 @@ static int buildText(frame f, string* textp) {
     }
 }
 
+/**
+ * Reads the next byte from the device. The buffer is refilled with all the
+ * bytes available at once, rather than one read(2) per byte.
+ *
+ * In low-latency mode, VMIN and VTIME are 0 and poll waits for the bytes,
+ * so that read(2) returns them without any inter-byte timer. Transports
+ * other than serial have no VTIME, and always wait this way.
+ *
+ * @return 1 if a byte was read, 0 if a read tick (VTIME) passed with no
+ *         bytes, -1 on error, with errno set
+ */
+static ssize_t readByte(int fd, char* cp) {
+    if (read_begin == read_end) {
+        if (!transport_timed_reads()) {
+            int p = transport_wait_readable(fd, READ_TICK_MS);
+            if (p <= 0) return p;
+        }
+
+        ssize_t s = transport_read(fd, read_buffer, READ_BUFFER_SIZE);
+        if (s <= 0) return s;
+
+        read_begin = 0;
+        read_end = s;
+    }
+
+    *cp = read_buffer[read_begin++];
+    return 1;
+}
+
+/**
+ * @return true if bytes were read from the device but not yet parsed,
+ *         so that polling the device would miss them.
+ */
+bool readPending() {
+    return read_begin != read_end;
+}
+
+/**
+ * Discards the bytes read but not yet parsed, as tcflush does the kernel's.
+ */
+void flushReadBuffer() {
+    read_begin = read_end = 0;
+}
+
 /**
  * State machine for readText function
  */
@@ -244,7 +510,7 @@ typedef enum {
  * character must be a valid A character, as tested by FRAME_VALID_A,
  * otherwise it assumes it is reading noise.
  *
- * Enable DEEP_DEBUG in debug.h to echo characters read in the terminal.
+ * Trace category bytes records every character read.
  *
  * @param  fd    Communications file descriptor
  * @param  textp [out] Frame text read
@@ -264,21 +530,15 @@ static int readText(int fd, string* textp) {
     int timed = 0;
 
     while (state != READ_END_FLAG) {
-        char readbuf[2];
-        ssize_t s = read(fd, readbuf, 1);
-        char c = readbuf[0];
+        char c = 0;
+        ssize_t s = readByte(fd, &c);
 
         // Errors and text.s realloc
-        if (DEEP_DEBUG) {
-            printf("[LLREAD] s:%01d  c:%02x  state:%01d  |  %c\n",
-                (int)s, (unsigned char)c, state, c);
-        }
+        TRACE_EVENT(TRACE_CAT_BYTES, TEV_READ_BYTE, state, (unsigned char)c, s);
 
         if (s == 0) {
             if (++timed == timeout) {
-                if (TRACE_LLERR_READ) {
-                    printf("[LLREAD] Timeout [len=%lu]\n", text.len);
-                }
+                TRACE_EVENT(TRACE_CAT_FRAME, TEV_READ_ERROR, 0, text.len, 1);
                 free(text.s);
                 return FRAME_READ_TIMEOUT;
             } else {
@@ -287,28 +547,12 @@ static int readText(int fd, string* textp) {
         }
 
         if (s == -1) {
-            if (errno == EINTR) {
-                if (TRACE_LLERR_READ) {
-                    printf("[LLREAD] Error EINTR [len=%lu]\n", text.len);
-                }
-                continue;
-            } else if (errno == EIO) {
-                if (TRACE_LLERR_READ) {
-                    printf("[LLREAD] Error EIO [len=%lu]\n", text.len);
-                }
-                continue;
-            } else if (errno == EAGAIN) {
-                if (TRACE_LLERR_READ) {
-                    printf("[LLREAD] Error EAGAIN [len=%lu]\n", text.len);
-                }
-                continue;
-            } else {
-                if (TRACE_LLERR_READ) {
-                    printf("[LLREAD] Error %s [len=%lu]\n", strerror(errno), text.len);
-                }
-                free(text.s);
-                return FRAME_READ_INVALID;
-            }
+            bool retry = errno == EINTR || errno == EIO || errno == EAGAIN;
+            TRACE_EVENT(TRACE_CAT_FRAME, TEV_READ_ERROR, errno, text.len, retry ? 0 : 1);
+            if (retry) continue;
+
+            free(text.s);
+            return FRAME_READ_INVALID;
         }
 
         if (text.len + 1 == reserved) {
@@ -329,9 +573,6 @@ static int readText(int fd, string* textp) {
                     state = READ_WITHIN_FRAME;
                     text.s[text.len++] = c;
                 } else {
-                    if (TRACE_LLERR_READ) {
-                        printf("[LLREAD] Bad A 0x%02x, back to pre-frame\n", c);
-                    }
                     state = READ_PRE_FRAME;
                     text.len = 0;
                 }
@@ -352,7 +593,7 @@ static int readText(int fd, string* textp) {
 
     text.s[text.len] = '\0';
 
-    introduceErrors(text);
+    introduceErrors(fd, text);
 
     *textp = text;
     return 0;
@@ -370,50 +611,43 @@ int writeFrame(int fd, frame f) {
 
     set_alarm();
     errno = 0;
-    ssize_t s = write(fd, text.s, text.len);
+    transport_write(fd, text.s, text.len);
 
     int err = errno;
     bool b = was_alarmed();
     unset_alarm();
 
+    size_t len = text.len;
     free(text.s);
 
     if (b || err == EINTR) {
-        if (TRACE_LLERR_WRITE) {
-            printf("[LLWRITE] Timeout [alarm=%d s=%d errno=%d] [%s]\n",
-                (int)b, (int)s, err, strerror(err));
-        }
+        TRACE_EVENT(TRACE_CAT_FRAME, TEV_FRAME_WRITE, (unsigned char)f.c, len,
+            FRAME_WRITE_TIMEOUT);
         return FRAME_WRITE_TIMEOUT;
     } else {
+        TRACE_EVENT(TRACE_CAT_FRAME, TEV_FRAME_WRITE, (unsigned char)f.c, len,
+            FRAME_WRITE_OK);
         return FRAME_WRITE_OK;
     }
 }
 
 /**
- * Reads a frame from communication device.
+ * Parses and validates frame text read from the communication device:
+ * length, BCC1 and, for I frames, destuffing and BCC2. Does not take
+ * ownership of text.
  *
- * @param  fd Communications file descriptor
- * @param  fp [out] Frame read
+ * @param  text Full frame text, flags included
+ * @param  fp   [out] Frame parsed
  * @return FRAME_READ_OK if successful
- *         FRAME_READ_TIMEOUT if a timeout occurred while reading
- *         FRAME_READ_INVALID if the frame read is invalid
+ *         FRAME_READ_INVALID if the frame text is invalid
  */
-
-int readFrame(int fd, frame* fp) {
-    string text;
+int parseFrame(string text, frame* fp) {
     frame dummy = {0, 0, {NULL, 0}};
     *fp = dummy;
 
-    int s = readText(fd, &text);
-
-    if (s != 0) return s;
-
     if (text.len < 5 || text.len == 6) {
-        if (TRACE_LL_ERRORS) {
-            printf("[LLERR] Bad Length [len=%lu]\n",
-                text.len);
-        }
-        free(text.s);
+        TRACE_EVENT(TRACE_CAT_FRAME, TEV_FRAME_READ, 0, text.len,
+            FRAME_READ_BAD_LENGTH);
         ++counter.read.len;
         return FRAME_READ_INVALID;
     }
@@ -427,11 +661,8 @@ int readFrame(int fd, frame* fp) {
     char bcc1 = text.s[3];
 
     if (bcc1 != (f.a ^ f.c)) {
-        if (TRACE_LL_ERRORS) {
-            printf("[LLERR] Bad BCC1 [a=0x%02x,c=0x%02x,bcc1=0x%02x]\n",
-                f.a, f.c, bcc1);
-        }
-        free(text.s);
+        TRACE_EVENT(TRACE_CAT_FRAME, TEV_FRAME_READ, (unsigned char)f.c,
+            text.len, FRAME_READ_BAD_BCC1);
         ++counter.read.bcc1;
         return FRAME_READ_INVALID;
     }
@@ -442,7 +673,8 @@ int readFrame(int fd, frame* fp) {
         int s = destuffText(text, &data, &bcc2);
 
         if (s != 0) {
-            free(text.s);
+            TRACE_EVENT(TRACE_CAT_FRAME, TEV_FRAME_READ, (unsigned char)f.c,
+                text.len, s);
             ++counter.read.bcc2;
             return FRAME_READ_INVALID;
         }
@@ -452,6 +684,35 @@ int readFrame(int fd, frame* fp) {
 
     *fp = f;
 
-    free(text.s);
+    TRACE_EVENT(TRACE_CAT_FRAME, TEV_FRAME_READ, (unsigned char)f.c, text.len,
+        FRAME_READ_OK);
     return FRAME_READ_OK;
 }
+
+/**
+ * Reads a frame from communication device.
+ *
+ * @param  fd Communications file descriptor
+ * @param  fp [out] Frame read
+ * @return FRAME_READ_OK if successful
+ *         FRAME_READ_TIMEOUT if a timeout occurred while reading
+ *         FRAME_READ_INVALID if the frame read is invalid
+ */
+
+int readFrame(int fd, frame* fp) {
+    string text;
+    frame dummy = {0, 0, {NULL, 0}};
+    *fp = dummy;
+
+    int s = readText(fd, &text);
+
+    if (s != 0) {
+        TRACE_EVENT(TRACE_CAT_FRAME, TEV_FRAME_READ, 0, 0, s);
+        return s;
+    }
+
+    s = parseFrame(text, fp);
+
+    free(text.s);
+    return s;
+}
@@ -3,12 +3,21 @@
 
 #include "strings.h"
 
+#include <stdbool.h>
+
 #define FRAME_ESC              0x7d
 #define FRAME_FLAG_STUFFING    0x5e
 #define FRAME_ESC_STUFFING     0x5d
 #define FRAME_FLAG             0x7e
 #define FRAME_MUST_ESCAPE(c)   ((c == FRAME_ESC) || (c == FRAME_FLAG))
 
+// With software flow control, XON and XOFF are escaped too. A, C and
+// BCC1 are never either, whatever the frame.
+#define FRAME_XON              0x11
+#define FRAME_XOFF             0x13
+#define FRAME_XON_STUFFING     0x31
+#define FRAME_XOFF_STUFFING    0x33
+
 #define FRAME_READ_OK          0x00
 #define FRAME_READ_INVALID     0x10
 #define FRAME_READ_TIMEOUT     0x20
@@ -31,11 +40,15 @@
 #define FRAME_C_UA             (char)0x07
 #define FRAME_C_RR(n)          (char)((n % 2) ? 0x85 : 0x05)
 #define FRAME_C_REJ(n)         (char)((n % 2) ? 0x81 : 0x01)
+#define FRAME_C_XID            (char)0xaf
 
 /**
  * Frames I, SET, DISC: Command
  *
  * Frames UA, RR, REJ: Response
+ *
+ * Frame XID: Command from T after SET/UA, Response from R. Its data is
+ * always HDLC encoded, as the codec is what it negotiates.
  */
 
 typedef struct {
@@ -43,8 +56,32 @@ typedef struct {
     string data;
 } frame;
 
+void setFrameCodec(int codec);
+
+int getFrameCodec();
+
+void setFrameCodecFallback(int codec);
+
+void setFrameEscapeXonXoff(bool escape);
+
+int stuffData(string in, string* outp, char* bcc2p);
+
+int destuffData(string in, string* outp, char* bcc2p);
+
+int cobsEncode(string in, string* outp, char* bcc2p);
+
+int cobsDecode(string in, string* outp, char* bcc2p);
+
+int buildText(frame f, string* textp);
+
+int parseFrame(string text, frame* fp);
+
 int writeFrame(int fd, frame f);
 
 int readFrame(int fd, frame* fp);
 
+bool readPending();
+
+void flushReadBuffer();
+
 #endif // LL_CORE_H___
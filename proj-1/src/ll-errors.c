@@ -1,105 +1,129 @@
 #include "ll-errors.h"
+#include "prng.h"
+#include "trace.h"
 #include "debug.h"
 #include "options.h"
 
 #include <stdlib.h>
-#include <stdio.h>
-#include <time.h>
+#include <stdbool.h>
+
+/**
+ * Error injection PRNG state, one per link (fd). Each link's stream is
+ * derived from the --seed value and its fd, so concurrent links are
+ * independent of each other and every run with the same seed is identical.
+ */
+typedef struct {
+    int fd;
+    prng_t rng;
+} link_prng;
+
+static link_prng* links = NULL;
+static size_t number_of_links = 0, reserved_links = 0;
+
+static unsigned long long ll_error_seed = 0;
+
+/**
+ * Seed the error injection streams with seed, from the next injection on.
+ */
+void set_error_seed(unsigned long long seed) {
+    ll_error_seed = seed;
+    number_of_links = 0;
+}
 
-static bool srand_seeded = false;
+unsigned long long get_error_seed() {
+    return ll_error_seed;
+}
 
-static void seed_srand() {
-    struct timespec t;
-    clock_gettime(CLOCK_REALTIME, &t);
-    srand(t.tv_nsec);
-    srand_seeded = true;
+static prng_t* get_link_prng(int fd) {
+    for (size_t i = 0; i < number_of_links; ++i) {
+        if (links[i].fd == fd) return &links[i].rng;
+    }
+
+    // Every link keeps its own stream, however many there are.
+    if (number_of_links == reserved_links) {
+        reserved_links = reserved_links ? 2 * reserved_links : 16;
+        links = realloc(links, reserved_links * sizeof(link_prng));
+    }
+
+    size_t i = number_of_links++;
+
+    links[i].fd = fd;
+    prng_seed(&links[i].rng, ll_error_seed, (uint64_t)fd);
+    TRACE_EVENT(TRACE_CAT_CORR, TEV_PRNG_SEED, fd, ll_error_seed, 0);
+
+    return &links[i].rng;
 }
 
-static inline char corruptByte(char byte) {
-    return byte ^ (1 << (rand() % 8));
+static inline char corruptByte(prng_t* rng, char byte) {
+    return byte ^ (1 << (prng_next(rng) >> 61));
 }
 
-static int introduceErrorsByte(string text) {
-    int header_p = RAND_MAX * h_error_prob;
-    int frame_p = RAND_MAX * f_error_prob;
+/**
+ * Corrupt each byte in text.s[begin..end) independently with probability p.
+ * Instead of one draw per byte, jump straight to the next corrupted byte
+ * with a geometric skip, so the cost scales with the number of errors.
+ */
+static void corruptRange(prng_t* rng, string text, size_t begin, size_t end,
+        double p) {
+    size_t i = begin;
 
-    for (size_t i = 1; i < 4; ++i) {
-        int header_r = rand();
+    while (true) {
+        size_t skip = prng_geometric(rng, p);
+        if (skip >= end - i) break;
+        i += skip;
 
-        if (header_r < header_p) {
-            char c = corruptByte(text.s[i]);
+        char c = corruptByte(rng, text.s[i]);
 
-            if (TRACE_CORRUPTION) {
-                printf("[CORR] [header i=%lu] Corrupted 0x%02x to 0x%02x\n",
-                    i, (unsigned char)text.s[i], (unsigned char)c);
-            }
+        TRACE_EVENT(TRACE_CAT_CORR, TEV_CORRUPT, i, text.len,
+            (unsigned char)text.s[i] << 8 | (unsigned char)c);
 
-            text.s[i] = c;
-        }
+        text.s[i++] = c;
     }
+}
 
-    for (size_t i = 4; i < text.len - 1; ++i) {
-        int frame_r = rand();
-
-        if (frame_r < frame_p) {
-            char c = corruptByte(text.s[i]);
-
-            if (TRACE_CORRUPTION) {
-                printf("[CORR] [frame i=%lu] Corrupted 0x%02x to 0x%02x\n",
-                    i, (unsigned char)text.s[i], (unsigned char)c);
-            }
+static int introduceErrorsByte(prng_t* rng, string text) {
+    corruptRange(rng, text, 1, 4, h_error_prob);
 
-            text.s[i] = c;
-        }
+    if (text.len > 5) {
+        corruptRange(rng, text, 4, text.len - 1, f_error_prob);
     }
 
     return 0;
 }
 
-static int introduceErrorsFrame(string text) {
-    int header_p = RAND_MAX * h_error_prob;
-    int frame_p = RAND_MAX * f_error_prob;
-
-    int header_r = rand();
-    size_t header_b = 1 + (rand() % 3);
+static int introduceErrorsFrame(prng_t* rng, string text) {
+    if (prng_double(rng) < h_error_prob) {
+        size_t header_b = 1 + prng_below(rng, 3);
+        char c = corruptByte(rng, text.s[header_b]);
 
-    if (header_r < header_p) {
-        char c = corruptByte(text.s[header_b]);
-
-        if (TRACE_CORRUPTION) {
-            printf("[CORR] [frame i=%lu] Corrupted 0x%02x to 0x%02x\n",
-                header_b, (unsigned char)text.s[header_b], (unsigned char)c);
-        }
+        TRACE_EVENT(TRACE_CAT_CORR, TEV_CORRUPT, header_b, text.len,
+            (unsigned char)text.s[header_b] << 8 | (unsigned char)c);
 
         text.s[header_b] = c;
     }
 
-    if (text.len > 5) {
-        int frame_r = rand();
-        size_t frame_b = 4 + (rand() % (text.len - 5));
-
-        if (frame_r < frame_p) {
-            char c = corruptByte(text.s[frame_b]);
+    if (text.len > 5 && prng_double(rng) < f_error_prob) {
+        size_t frame_b = 4 + prng_below(rng, text.len - 5);
+        char c = corruptByte(rng, text.s[frame_b]);
 
-            if (TRACE_CORRUPTION) {
-                printf("[CORR] [frame i=%lu] Corrupted 0x%02x to 0x%02x\n",
-                    frame_b, (unsigned char)text.s[frame_b], (unsigned char)c);
-            }
+        TRACE_EVENT(TRACE_CAT_CORR, TEV_CORRUPT, frame_b, text.len,
+            (unsigned char)text.s[frame_b] << 8 | (unsigned char)c);
 
-            text.s[frame_b] = c;
-        }
+        text.s[frame_b] = c;
     }
 
     return 0;
 }
 
-int introduceErrors(string text) {
-    if (!srand_seeded) seed_srand();
+int introduceErrors(int fd, string text) {
+    if (h_error_prob == 0.0 && f_error_prob == 0.0) return 0;
+
+    prng_t* rng = get_link_prng(fd);
 
     if (error_type == ETYPE_BYTE) {
-        return introduceErrorsByte(text);
+        return introduceErrorsByte(rng, text);
     } else if (error_type == ETYPE_FRAME) {
-        return introduceErrorsFrame(text);
+        return introduceErrorsFrame(rng, text);
     }
 
     return 0;
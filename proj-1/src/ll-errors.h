@@ -5,6 +5,12 @@
 
 void reset_counter();
 
-int introduceErrors(string text);
+int introduceErrors(int fd, string text);
+
+// Seed for the error injection PRNG, set from --seed. Defaults to a
+// clock-derived seed, which is reported so that the run can be reproduced.
+void set_error_seed(unsigned long long seed);
+
+unsigned long long get_error_seed();
 
 #endif // LL_ERRORS_H___
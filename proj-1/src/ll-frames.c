@@ -3,7 +3,6 @@
 
 #include <stdlib.h>
 #include <unistd.h>
-#include <stdio.h>
 
 bool isIframe(frame f, int parity) {
     bool b = f.a == FRAME_A_COMMAND &&
@@ -11,8 +10,6 @@ bool isIframe(frame f, int parity) {
              f.data.s != NULL && f.data.len > 0;
 
     if (b) ++counter.in.I[parity % 2];
-
-    if (TRACE_LL_IS) printf("[LL] isIframe(%d) ? %d\n", parity % 2, (int)b);
     return b;
 }
 
@@ -22,8 +19,6 @@ bool isSETframe(frame f) {
              f.data.s == NULL;
 
     if (b) ++counter.in.SET;
-
-    if (TRACE_LL_IS) printf("[LL] isSETframe() ? %d\n", (int)b);
     return b;
 }
 
@@ -33,8 +28,6 @@ bool isDISCframe(frame f) {
              f.data.s == NULL;
 
     if (b) ++counter.in.DISC;
-
-    if (TRACE_LL_IS) printf("[LL] isDISCframe() ? %d\n", (int)b);
     return b;
 }
 
@@ -44,8 +37,6 @@ bool isUAframe(frame f) {
              f.data.s == NULL;
 
     if (b) ++counter.in.UA;
-
-    if (TRACE_LL_IS) printf("[LL] isUAframe() ? %d\n", (int)b);
     return b;
 }
 
@@ -55,8 +46,6 @@ bool isRRframe(frame f, int parity) {
              f.data.s == NULL;
 
     if (b) ++counter.in.RR[parity % 2];
-
-    if (TRACE_LL_IS) printf("[LL] isRRframe(%d) ? %d\n", parity % 2, (int)b);
     return b;
 }
 
@@ -66,11 +55,17 @@ bool isREJframe(frame f, int parity) {
              f.data.s == NULL;
 
     if (b) ++counter.in.REJ[parity % 2];
-
-    if (TRACE_LL_IS) printf("[LL] isREJframe(%d) ? %d\n", parity % 2, (int)b);
     return b;
 }
 
+bool isXIDframe(frame f, char a) {
+    bool b = f.a == a &&
+             f.c == FRAME_C_XID &&
+             f.data.s != NULL;
+
+    if (b) ++counter.in.XID;
+    return b;
+}
 
 
 int answerBADframe(int fd, frame f) {
@@ -103,10 +98,6 @@ int writeIframe(int fd, string message, int parity) {
 
     ++counter.out.I[parity % 2];
 
-    if (TRACE_LL_WRITE) {
-        printf("[LL] writeIframe(%d) [flen=%lu]\n", parity % 2, f.data.len);
-        if (TEXT_DEBUG) print_stringn(message);
-    }
     return writeFrame(fd, f);
 }
 
@@ -119,7 +110,6 @@ int writeSETframe(int fd) {
 
     ++counter.out.SET;
 
-    if (TRACE_LL_WRITE) printf("[LL] writeSETframe()\n");
     return writeFrame(fd, f);
 }
 
@@ -132,7 +122,6 @@ int writeDISCframe(int fd) {
 
     ++counter.out.DISC;
 
-    if (TRACE_LL_WRITE) printf("[LL] writeDISCframe()\n");
     return writeFrame(fd, f);
 }
 
@@ -145,7 +134,6 @@ int writeUAframe(int fd) {
 
     ++counter.out.UA;
 
-    if (TRACE_LL_WRITE) printf("[LL] writeUAframe()\n");
     return writeFrame(fd, f);
 }
 
@@ -158,7 +146,6 @@ int writeRRframe(int fd, int parity) {
 
     ++counter.out.RR[parity % 2];
 
-    if (TRACE_LL_WRITE) printf("[LL] writeRRframe(%d)\n", parity % 2);
     return writeFrame(fd, f);
 }
 
@@ -171,6 +158,17 @@ int writeREJframe(int fd, int parity) {
 
     ++counter.out.REJ[parity % 2];
 
-    if (TRACE_LL_WRITE) printf("[LL] writeREJframe(%d)\n", parity % 2);
+    return writeFrame(fd, f);
+}
+
+int writeXIDframe(int fd, char a, string info) {
+    frame f = {
+        .a = a,
+        .c = FRAME_C_XID,
+        .data = info
+    };
+
+    ++counter.out.XID;
+
     return writeFrame(fd, f);
 }
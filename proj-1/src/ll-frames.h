@@ -18,6 +18,8 @@ bool isRRframe(frame f, int parity);
 
 bool isREJframe(frame f, int parity);
 
+bool isXIDframe(frame f, char a);
+
 
 int answerBADframe(int fd, frame f);
 
@@ -34,4 +36,6 @@ int writeRRframe(int fd, int parity);
 
 int writeREJframe(int fd, int parity);
 
+int writeXIDframe(int fd, char a, string info);
+
 #endif // LL_FRAMES_H___
@@ -1,13 +1,105 @@
 #include "ll-interface.h"
 #include "ll-frames.h"
+#include "ll-xid.h"
 #include "options.h"
+#include "timing.h"
+#include "trace.h"
 #include "debug.h"
+#include "ll-transport.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <termios.h>
 #include <unistd.h>
 
+// Stop-and-wait sequence numbers of llwrite and llread. Every session
+// starts them over, so that T and R agree on them again after a failure.
+// Only supports one fd.
+static int write_index = 0;
+static int read_index = 0;
+
+static void trace_xid(const link_config* config, int status) {
+    if (config->offsets) status |= TEV_XID_OFFSETS;
+    TRACE_EVENT(TRACE_CAT_XID, TEV_XID, config->codec, config->packetsize, status);
+}
+
+/**
+ * Exchange XID frames with R, right after SET/UA, and switch both ends to
+ * the fastest configuration they support. A peer which never answers
+ * predates XID, so T keeps its own options, as that peer does.
+ *
+ * This runs on every llopen, as R may have restarted since the last one.
+ *
+ * @param fd Link layer's file descriptor
+ */
+static void llxid_transmitter(int fd) {
+    link_caps mine, peer;
+    link_config config;
+    string info;
+
+    xid_local_caps(&mine);
+    xid_build(&mine, &info);
+
+    for (int time_count = 0; time_count < time_retries; ++time_count) {
+        int s = writeXIDframe(fd, FRAME_A_COMMAND, info);
+        if (s != FRAME_WRITE_OK) continue;
+
+        frame f;
+        s = readFrame(fd, &f);
+        if (s == FRAME_READ_TIMEOUT) continue;
+
+        if (s == FRAME_READ_OK && isXIDframe(f, FRAME_A_RESPONSE)) {
+            s = xid_parse(f.data, &peer);
+            free(f.data.s);
+            if (s != 0) continue;
+
+            free(info.s);
+            xid_negotiate(&mine, &peer, &config);
+            xid_apply(&config);
+            trace_xid(&config, 0);
+            return;
+        }
+
+        if (s == FRAME_READ_OK) free(f.data.s);
+        ++counter.invalid;
+    }
+
+    free(info.s);
+    xid_fallback(&config);
+    xid_apply(&config);
+    trace_xid(&config, TEV_XID_NO_ANSWER);
+}
+
+/**
+ * Answer T's XID command with R's capabilities, and switch to the
+ * configuration T settles on with them. Should every answer be lost, T
+ * keeps its own options instead, so R also decodes I frames with T's own
+ * codec until one decodes with the one settled on.
+ *
+ * @param fd Link layer's file descriptor
+ * @param f  The XID command
+ */
+static void llxid_receiver(int fd, frame f) {
+    link_caps mine, peer;
+    link_config config;
+    string info;
+
+    // A malformed XID goes unanswered, and T falls back to its options.
+    int s = xid_parse(f.data, &peer);
+    free(f.data.s);
+    if (s != 0) return;
+
+    xid_local_caps(&mine);
+    xid_build(&mine, &info);
+    writeXIDframe(fd, FRAME_A_RESPONSE, info);
+    free(info.s);
+
+    xid_negotiate(&mine, &peer, &config);
+    xid_apply(&config);
+    trace_xid(&config, 0);
+    setFrameCodecFallback(xid_fallback_codec(&peer));
+}
+
 /**
  * llopen for T
  * 
@@ -19,7 +111,11 @@
 static int llopen_transmitter(int fd) {
     int time_count = 0, answer_count = 0;
 
-    tcflush(fd, TCIFLUSH);
+    write_index = 0;
+    xid_reset();
+
+    transport_flush(fd, TCIFLUSH);
+    flushReadBuffer();
 
     while (time_count < time_retries && answer_count < answer_retries) {
         int s = writeSETframe(fd);
@@ -34,17 +130,15 @@ static int llopen_transmitter(int fd) {
         switch (s) {
         case FRAME_READ_OK:
             if (isUAframe(f)) {
-                if (TRACE_LL || TRACE_FILE) {
-                    printf("[LL] llopen (T) OK\n");
-                }
+                llxid_transmitter(fd);
                 return LL_OK;
             }
             // FALLTHROUGH
         case FRAME_READ_INVALID:
-            if (TRACE_LL || TRACE_FILE) {
-                printf("[LL] llopen (T) ASSUME UA OK\n");
-            }
+            TRACE_EVENT(TRACE_CAT_LL, TEV_LL_ASSUME, (unsigned char)FRAME_C_UA, 0,
+                s == FRAME_READ_OK ? (unsigned char)f.c : 0);
             ++counter.invalid;
+            llxid_transmitter(fd);
             return LL_OK;
         case FRAME_READ_TIMEOUT:
             ++time_count, ++counter.timeout;
@@ -72,7 +166,10 @@ static int llopen_transmitter(int fd) {
 static int llopen_receiver(int fd) {
     int time_count = 0, answer_count = 0;
 
-    tcflush(fd, TCOFLUSH);
+    read_index = 0;
+    xid_reset();
+
+    transport_flush(fd, TCOFLUSH);
 
     while (time_count < time_retries && answer_count < answer_retries) {
         frame f;
@@ -82,9 +179,12 @@ static int llopen_receiver(int fd) {
         case FRAME_READ_OK:
             if (isSETframe(f)) {
                 writeUAframe(fd);
-                if (TRACE_LL || TRACE_FILE) {
-                    printf("[LL] llopen (R) OK\n");
-                }
+                return LL_OK;
+            } else if (isXIDframe(f, FRAME_A_COMMAND)) {
+                // Our UA was lost, and T assumed it.
+                llxid_receiver(fd, f);
+                TRACE_EVENT(TRACE_CAT_LL, TEV_LL_ASSUME, (unsigned char)FRAME_C_SET, 0,
+                    (unsigned char)FRAME_C_XID);
                 return LL_OK;
             }
             // FALLTHROUGH
@@ -131,9 +231,6 @@ static int llclose_transmitter(int fd) {
         case FRAME_READ_OK:
             if (isDISCframe(f)) {
                 writeUAframe(fd);
-                if (TRACE_LL || TRACE_FILE) {
-                    printf("[LL] llclose (T) OK\n");
-                }
                 return LL_OK;
             }
             // FALLTHROUGH
@@ -205,9 +302,7 @@ answer:
                 s = writeDISCframe(fd); // 3
                 if (s != FRAME_WRITE_OK) {
                     if (answered_disc) {
-                        if (TRACE_LL || TRACE_FILE) {
-                            printf("[LL] llclose (R) WRITE TIMEOUT ASSUME OK\n");
-                        }
+                        TRACE_EVENT(TRACE_CAT_LL, TEV_LL_ASSUME, (unsigned char)FRAME_C_UA, 0, 0);
                         return LL_OK;
                     } else {
                         ++time_count, ++counter.timeout;
@@ -222,9 +317,6 @@ answer:
                 switch (s) {
                 case FRAME_READ_OK: // 5.2
                     if (isUAframe(f)) {
-                        if (TRACE_LL || TRACE_FILE) {
-                            printf("[LL] llclose (R) OK\n");
-                        }
                         return LL_OK;
                     }
                     // FALLTHROUGH
@@ -234,9 +326,7 @@ answer:
                     goto answer;
                 case FRAME_READ_TIMEOUT:
                     if (answered_disc) {
-                        if (TRACE_LL || TRACE_FILE) {
-                            printf("[LL] llclose (R) READ TIMEOUT ASSUME OK\n");
-                        }
+                        TRACE_EVENT(TRACE_CAT_LL, TEV_LL_ASSUME, (unsigned char)FRAME_C_UA, 0, 0);
                         ++counter.timeout;
                         return LL_OK;
                     }
@@ -273,11 +363,16 @@ answer:
  *         LL_NO_ANSWER_RETRIES if answer errors maxed out.
  */
 int llopen(int fd) {
+    int s;
+
     if (my_role == TRANSMITTER) {
-        return llopen_transmitter(fd);
+        s = llopen_transmitter(fd);
     } else {
-        return llopen_receiver(fd);
+        s = llopen_receiver(fd);
     }
+
+    TRACE_EVENT(TRACE_CAT_LL, TEV_LLOPEN, 0, 0, s);
+    return s;
 }
 
 /**
@@ -288,34 +383,37 @@ int llopen(int fd) {
  *         LL_NO_ANSWER_RETRIES if answer errors maxed out.
  */
 int llwrite(int fd, string message) {
-    static int index = 0; // only supports one fd.
-
-    int time_count = 0, answer_count = 0;
+    int time_count = 0, answer_count = 0, writes = 0;
+    uint64_t begin = monotonic_ns();
 
     while (time_count < time_retries && answer_count < answer_retries) {
-        int s = writeIframe(fd, message, index);
+        int s = writeIframe(fd, message, write_index);
+        ++writes;
         if (s != FRAME_WRITE_OK) {
             ++time_count, ++counter.timeout;
             continue;
         }
 
+        uint64_t sent = monotonic_ns();
+
         frame f;
         s = readFrame(fd, &f);
 
+        if (s != FRAME_READ_TIMEOUT) {
+            hist_record(&metrics.rtt, monotonic_ns() - sent);
+        }
+
         switch (s) {
         case FRAME_READ_OK:
-            if (isRRframe(f, index + 1) || isREJframe(f, index + 1)) {
-                ++index;
-                if (TRACE_LL) {
-                    printf("[LL] llwrite OK [index=%d]\n", index);
-                }
+            if (isRRframe(f, write_index + 1) || isREJframe(f, write_index + 1)) {
+                ++write_index;
+                hist_record(&metrics.service, monotonic_ns() - begin);
+                hist_record(&metrics.retransmissions, writes - 1);
+                TRACE_EVENT(TRACE_CAT_LL, TEV_LLWRITE, write_index, message.len, LL_OK);
                 return LL_OK;
-            } else if (isRRframe(f, index) || isREJframe(f, index)) {
+            } else if (isRRframe(f, write_index) || isREJframe(f, write_index)) {
                 ++answer_count;
             } else {
-                if (TRACE_LL) {
-                    printf("[LL] llwrite: invalid response (not RR or REJ)\n");
-                }
                 ++answer_count, ++counter.invalid;
             }
             break;
@@ -330,9 +428,11 @@ int llwrite(int fd, string message) {
 
     if (time_count == time_retries) {
         printf("[LL] llwrite FAILED: %d time retries ran out\n", time_retries);
+        TRACE_EVENT(TRACE_CAT_LL, TEV_LLWRITE, write_index, message.len, LL_NO_TIME_RETRIES);
         return LL_NO_TIME_RETRIES;
     } else {
         printf("[LL] llwrite FAILED: %d answer retries ran out\n", answer_retries);
+        TRACE_EVENT(TRACE_CAT_LL, TEV_LLWRITE, write_index, message.len, LL_NO_ANSWER_RETRIES);
         return LL_NO_ANSWER_RETRIES;
     }
 }
@@ -345,8 +445,6 @@ int llwrite(int fd, string message) {
  *         LL_NO_ANSWER_RETRIES if answer errors maxed out.
  */
 int llread(int fd, string* messagep) {
-    static int index = 0; // only supports one fd.
-
     int time_count = 0, answer_count = 0;
 
     while (time_count < time_retries && answer_count < answer_retries) {
@@ -355,25 +453,35 @@ int llread(int fd, string* messagep) {
 
         switch (s) {
         case FRAME_READ_OK:
-            if (isIframe(f, index)) {
-                writeRRframe(fd, ++index);
+            if (isIframe(f, read_index)) {
+                writeRRframe(fd, ++read_index);
                 *messagep = f.data;
-                if (TRACE_LL) {
-                    printf("[LL] llread OK [index=%d]\n", index);
-                }
+                TRACE_EVENT(TRACE_CAT_LL, TEV_LLREAD, read_index, f.data.len, LL_OK);
                 return LL_OK;
-            } else if (isIframe(f, index + 1)) {
-                writeRRframe(fd, index);
+            } else if (isIframe(f, read_index + 1)) {
+                writeRRframe(fd, read_index);
                 ++answer_count;
-                if (TRACE_LL) {
-                    printf("[LL] llread: Expected frame %d, got frame %d\n",
-                        index % 2, (index + 1) % 2);
-                }
                 free(f.data.s);
+            } else if (isXIDframe(f, FRAME_A_COMMAND)) {
+                llxid_receiver(fd, f);
+            } else if (isSETframe(f)) {
+                // T opened a new session, after its link failed in this
+                // one. Its frames in flight are lost, and it negotiates
+                // from its own options again.
+                writeUAframe(fd);
+                read_index = 0;
+                xid_reset();
+                TRACE_EVENT(TRACE_CAT_LL, TEV_LLREAD, read_index, 0, LL_REOPENED);
+                return LL_REOPENED;
+            } else if (isDISCframe(f)) {
+                // T closes the session. R's llclose answers the DISC T
+                // sends again.
+                TRACE_EVENT(TRACE_CAT_LL, TEV_LLREAD, read_index, 0, LL_DISCONNECTED);
+                return LL_DISCONNECTED;
             }
             break;
         case FRAME_READ_INVALID:
-            writeREJframe(fd, index);
+            writeREJframe(fd, read_index);
             ++answer_count, ++counter.invalid;
             break;
         case FRAME_READ_TIMEOUT:
@@ -384,9 +492,11 @@ int llread(int fd, string* messagep) {
 
     if (time_count == time_retries) {
         printf("[LL] llwrite FAILED: %d time retries ran out\n", time_retries);
+        TRACE_EVENT(TRACE_CAT_LL, TEV_LLREAD, read_index, 0, LL_NO_TIME_RETRIES);
         return LL_NO_TIME_RETRIES;
     } else {
         printf("[LL] llwrite FAILED: %d answer retries ran out\n", answer_retries);
+        TRACE_EVENT(TRACE_CAT_LL, TEV_LLREAD, read_index, 0, LL_NO_ANSWER_RETRIES);
         return LL_NO_ANSWER_RETRIES;
     }
 }
@@ -398,9 +508,14 @@ int llread(int fd, string* messagep) {
  *         LL_NO_ANSWER_RETRIES if answer errors maxed out.
  */
 int llclose(int fd) {
+    int s;
+
     if (my_role == TRANSMITTER) {
-        return llclose_transmitter(fd);
+        s = llclose_transmitter(fd);
     } else {
-        return llclose_receiver(fd);
+        s = llclose_receiver(fd);
     }
+
+    TRACE_EVENT(TRACE_CAT_LL, TEV_LLCLOSE, 0, 0, s);
+    return s;
 }
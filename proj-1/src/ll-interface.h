@@ -6,6 +6,8 @@
 #define LL_OK                  0x00
 #define LL_NO_TIME_RETRIES     0x20
 #define LL_NO_ANSWER_RETRIES   0x21
+#define LL_DISCONNECTED        0x22 // llread got a DISC: T closed the session
+#define LL_REOPENED            0x23 // llread got a SET: T opened a new session
 
 int llopen(int fd);
 
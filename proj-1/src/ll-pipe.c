@@ -0,0 +1,148 @@
+// Pipe transport: a pair of FIFOs, or fds inherited from the parent, such
+// as a socketpair's or two pipes'.
+#include "ll-transport.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <signal.h>
+#include <errno.h>
+
+// The fd written to, when not the one read from. Only supports one fd.
+static int write_fd = -1;
+
+// The peer closed its end. Only supports one fd.
+static bool pipe_eof = false;
+
+/**
+ * Parses "R,W" or "N" into read and write fds.
+ *
+ * @return 0 if device holds fds, 1 otherwise
+ */
+static int parse_fds(const char* device, int* rfdp, int* wfdp) {
+    int rfd, wfd, n = 0;
+
+    if (sscanf(device, "%d,%d%n", &rfd, &wfd, &n) == 2 && device[n] == '\0') {
+        *rfdp = rfd, *wfdp = wfd;
+        return 0;
+    }
+    if (sscanf(device, "%d%n", &rfd, &n) == 1 && device[n] == '\0') {
+        *rfdp = *wfdp = rfd;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Opens FIFO path, creating it if it does not exist. FIFOs are opened
+ * O_RDWR so that neither end waits for the other to open.
+ */
+static int open_fifo(const char* path) {
+    if (mkfifo(path, 0600) == -1 && errno != EEXIST) {
+        printf("[SETUP] Failed to create FIFO %s [%s]\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        printf("[SETUP] Failed to open FIFO %s [%s]\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/**
+ * Opens the pipe transport on device: "R,W" or "N" for inherited fds, or
+ * a path S, for FIFOs S.tr (T to R) and S.rt (R to T).
+ */
+static int pipe_open(const char* device) {
+    int rfd, wfd;
+
+    // Writes to a closed pipe fail with EPIPE instead.
+    signal(SIGPIPE, SIG_IGN);
+
+    if (parse_fds(device, &rfd, &wfd) == 0) {
+        if (fcntl(rfd, F_GETFD) == -1 || fcntl(wfd, F_GETFD) == -1) {
+            printf("[SETUP] Pipe fds %s are not open\n", device);
+            exit(EXIT_FAILURE);
+        }
+        write_fd = wfd;
+        return rfd;
+    }
+
+    size_t len = strlen(device);
+    char tr[len + 4], rt[len + 4];
+    snprintf(tr, sizeof(tr), "%s.tr", device);
+    snprintf(rt, sizeof(rt), "%s.rt", device);
+
+    if (my_role == TRANSMITTER) {
+        write_fd = open_fifo(tr);
+        return open_fifo(rt);
+    } else {
+        write_fd = open_fifo(rt);
+        return open_fifo(tr);
+    }
+}
+
+static ssize_t pipe_read(int fd, void* buf, size_t len) {
+    ssize_t s = read(fd, buf, len);
+    if (s == 0) pipe_eof = true;
+    return s;
+}
+
+static ssize_t pipe_write(int fd, const void* buf, size_t len) {
+    return write(write_fd, buf, len);
+}
+
+static int pipe_wait_readable(int fd, int timeout_ms) {
+    if (!pipe_eof) return poll_readable(fd, timeout_ms);
+    return hung_up_wait(timeout_ms);
+}
+
+/**
+ * Discards the input already in the pipe. Output written cannot be taken
+ * back, so TCOFLUSH does nothing.
+ */
+static int pipe_flush(int fd, int queue) {
+    if (queue == TCOFLUSH || pipe_eof) return 0;
+
+    char buf[4096];
+    while (poll_readable(fd, 0) > 0) {
+        ssize_t s = read(fd, buf, sizeof(buf));
+        if (s <= 0) {
+            if (s == 0) pipe_eof = true;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int pipe_io_fds(int fd, int* rfdp, int* wfdp) {
+    *rfdp = fd;
+    *wfdp = write_fd;
+    return 0;
+}
+
+static int pipe_close(int fd) {
+    if (write_fd != fd) close(write_fd);
+    write_fd = -1;
+    return close(fd);
+}
+
+const transport pipe_transport = {
+    .name = "pipe",
+    .open = pipe_open,
+    .read = pipe_read,
+    .write = pipe_write,
+    .wait_readable = pipe_wait_readable,
+    .flush = pipe_flush,
+    .close = pipe_close,
+    .io_fds = pipe_io_fds
+};
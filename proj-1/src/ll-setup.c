@@ -1,4 +1,7 @@
 #include "ll-setup.h"
+#include "ll-core.h"
+#include "ll-termios2.h"
+#include "ll-transport.h"
 #include "options.h"
 #include "debug.h"
 
@@ -16,6 +19,13 @@
 
 static struct termios oldtios;
 
+// As read back from the driver, 0 if unknown. Only supports one fd.
+static int actual_baudrate = 0;
+
+// Overruns counted by the driver before setup, -1 if it does not count them.
+static int link_fd = -1; // only supports one fd.
+static long overruns_baseline = -1;
+
 static int baudrates_list[] = {50, 75, 110, 134, 150, 200, 300, 600, 1200,
     1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800,
     500000, 576000};
@@ -26,24 +36,46 @@ static int baudrates_macros[] = {B50, B75, B110, B134, B150, B200, B300, B600,
 
 static size_t baudrates_length = sizeof(baudrates_list) / sizeof(int);
 
+/**
+ * @return The Bxxx macro for baudrate, or -1 if it has none and must be
+ *         set with BOTHER
+ */
 static int select_baudrate() {
     for (size_t i = 0; i < baudrates_length; ++i) {
         if (baudrate == baudrates_list[i]) {
             return baudrates_macros[i];
         }
     }
-    printf("[SETUP] Bad select_baudrate\n");
-    exit(EXIT_FAILURE);
+    return -1;
 }
 
 bool is_valid_baudrate(int baudrate) {
-    for (size_t i = 0; i < baudrates_length; ++i) {
-        if (baudrate == baudrates_list[i]) return true;
-    }
+    // Others than baudrates_list are set with BOTHER, if the driver can.
+    if (baudrate > 0) return true;
+
     printf("[SETUP] Baudrate %d is invalid.\n", baudrate);
     return false;
 }
 
+/**
+ * @return The baudrate the link runs at: as read back from the driver if
+ *         it reports it, as requested otherwise.
+ */
+int link_baudrate() {
+    return actual_baudrate > 0 ? actual_baudrate : baudrate;
+}
+
+/**
+ * @return The received bytes the driver lost to overruns since setup, or -1
+ *         if it does not count them (ptys do not)
+ */
+long link_overruns() {
+    if (link_fd == -1 || overruns_baseline == -1) return -1;
+
+    long overruns = get_overruns(link_fd);
+    return overruns == -1 ? -1 : overruns - overruns_baseline;
+}
+
 /**
  * Opens the terminal with given file name, changes its configuration
  * according to the specs, and returns the file descriptor fd.
@@ -63,7 +95,7 @@ int setup_link_layer(const char* name) {
         exit(EXIT_FAILURE);
     }
 
-    if (TRACE_SETUP) printf("[SETUP] Opened device %s\n", name);
+    printf("[SETUP] Opened device %s\n", name);
 
     // Save current terminal settings in oldtios.
     if (tcgetattr(fd, &oldtios) == -1) {
@@ -82,6 +114,10 @@ int setup_link_layer(const char* name) {
     // ...
     newtio.c_iflag = IGNPAR;
 
+    // IXON   :- Stop output on XOFF, restart it on XON
+    // IXOFF  :- Send XOFF/XON as the input queue fills/drains
+    if (flow_control == FLOW_XONXOFF) newtio.c_iflag |= IXON | IXOFF;
+
     // c_oflag   Output delay...
     // ...
     newtio.c_oflag = 0;
@@ -92,7 +128,10 @@ int setup_link_layer(const char* name) {
     // CREAD  :- Enable receiver
     // CSTOPB :- Set two stop bits, rather than one
     // ...
-    newtio.c_cflag = baud | CS8 | CLOCAL | CREAD;
+    newtio.c_cflag = (baud == -1 ? B38400 : baud) | CS8 | CLOCAL | CREAD;
+
+    // CRTSCTS :- RTS/CTS hardware flow control
+    if (flow_control == FLOW_RTSCTS) newtio.c_cflag |= CRTSCTS;
 
     // c_lflag   Canonical or non canonical mode...
     // ICANON :- Enable canonical mode
@@ -106,10 +145,20 @@ int setup_link_layer(const char* name) {
     // ...
     newtio.c_cc[VTIME] = 1;
     newtio.c_cc[VMIN] = 0;
+    newtio.c_cc[VSTART] = FRAME_XON;
+    newtio.c_cc[VSTOP] = FRAME_XOFF;
 
     // VTIME e VMIN devem ser alterados de forma a proteger com um temporizador a
     // leitura do(s) proximo(s) caracter(es)
 
+    // In low-latency mode readText polls for bytes, and read(2) must then
+    // return them at once: a VMIN above a frame's length would hold its
+    // tail for VTIME, as stop & wait sends nothing after it.
+    if (low_latency) {
+        newtio.c_cc[VTIME] = 0;
+        newtio.c_cc[VMIN] = 0;
+    }
+
     tcflush(fd, TCIOFLUSH);
 
     //cfsetispeed(&newtio, B38400);
@@ -120,10 +169,58 @@ int setup_link_layer(const char* name) {
         exit(EXIT_FAILURE);
     }
 
-    if (TRACE_SETUP) printf("[SETUP] Setup link layer on %s\n", name);
+    if (baud == -1 && set_baudrate_other(fd, baudrate) == -1) {
+        printf("[SETUP] Failed to set baudrate %d (BOTHER) [%s]\n",
+            baudrate, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Not all devices are serial ports (ptys are not): carry on without.
+    if (low_latency && set_low_latency(fd) == -1) {
+        printf("[SETUP] No ASYNC_LOW_LATENCY on %s [%s]\n", name, strerror(errno));
+    }
+
+    actual_baudrate = get_baudrate_out(fd);
+    if (actual_baudrate > 0 && actual_baudrate != baudrate) {
+        printf("[SETUP] Baudrate %d requested, driver set %d\n",
+            baudrate, actual_baudrate);
+    }
+
+    link_fd = fd;
+    overruns_baseline = get_overruns(fd);
+
+    // Until the XID exchange in llopen settles on a codec, auto is hdlc.
+    setFrameCodec(frame_codec == CODEC_COBS ? CODEC_COBS : CODEC_HDLC);
+    setFrameEscapeXonXoff(flow_control == FLOW_XONXOFF);
+
+    printf("[SETUP] Setup link layer on %s [codec=%s,baudrate=%d%s%s]\n", name,
+        frame_codec == CODEC_COBS ? "cobs"
+            : frame_codec == CODEC_HDLC ? "hdlc" : "auto",
+        link_baudrate(), low_latency ? ",low-latency" : "",
+        flow_control == FLOW_XONXOFF ? ",xonxoff"
+            : flow_control == FLOW_RTSCTS ? ",rtscts" : "");
     return fd;
 }
 
+static ssize_t serial_read(int fd, void* buf, size_t len) {
+    return read(fd, buf, len);
+}
+
+static ssize_t serial_write(int fd, const void* buf, size_t len) {
+    return write(fd, buf, len);
+}
+
+const transport serial_transport = {
+    .name = "serial",
+    .open = setup_link_layer,
+    .read = serial_read,
+    .write = serial_write,
+    .wait_readable = poll_readable,
+    .flush = tcflush,
+    .close = reset_link_layer,
+    .io_fds = same_io_fds
+};
+
 /**
  * Resets the terminal's settings to the old ones.
  *
@@ -131,14 +228,14 @@ int setup_link_layer(const char* name) {
  * @return 0 if successful, 1 otherwise.
  */
 int reset_link_layer(int fd) {
+    link_fd = -1;
+
     if (tcsetattr(fd, TCSANOW, &oldtios) == -1) {
         perror("[RESET] Failed to set old terminal settings (tcsetattr)");
         close(fd);
         return 1;
     } else {
-        if (TRACE_SETUP) {
-            printf("[RESET] Reset device\n");
-        }
+        printf("[RESET] Reset device\n");
         close(fd);
         return 0;
     }
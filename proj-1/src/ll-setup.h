@@ -5,6 +5,10 @@
 
 bool is_valid_baudrate(int baudrate);
 
+int link_baudrate();
+
+long link_overruns();
+
 int setup_link_layer(const char* name);
 
 int reset_link_layer(int fd);
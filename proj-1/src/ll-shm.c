@@ -0,0 +1,215 @@
+// Shared memory transport: a POSIX shared memory object holding one
+// single-producer single-consumer ring per direction. Both ends block in
+// futexes on the ring's indices, so that the link runs at memory speed,
+// without any UART or socket in the way.
+#include "ll-transport.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <errno.h>
+#include <time.h>
+
+#define SHM_RING_SIZE (1 << 20) // Power of 2
+#define SHM_RING_MASK (SHM_RING_SIZE - 1)
+
+/**
+ * head and tail run free, and are masked to index data. The producer
+ * sleeps on tail while the ring is full, the consumer on head while it is
+ * empty; each flags that it sleeps, so the other only wakes it then.
+ */
+typedef struct {
+    _Atomic uint32_t head;
+    _Atomic uint32_t consumer_waiting;
+    char pad1[56];
+    _Atomic uint32_t tail;
+    _Atomic uint32_t producer_waiting;
+    char pad2[56];
+    char data[SHM_RING_SIZE];
+} shm_ring;
+
+typedef struct {
+    shm_ring ring[2]; // T to R, R to T
+} shm_link;
+
+static shm_link* link_map = NULL; // only supports one fd.
+static shm_ring* in_ring = NULL;
+static shm_ring* out_ring = NULL;
+static char* shm_name = NULL;
+
+static int futex_wait(_Atomic uint32_t* addr, uint32_t value, const struct timespec* t) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT, value, t, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Opens (or creates) the shared memory object name, and maps it. Whichever
+ * end comes first creates it zeroed; R unlinks it when it closes.
+ */
+static int shm_transport_open(const char* device) {
+    size_t len = strlen(device);
+    shm_name = malloc(len + 2);
+    snprintf(shm_name, len + 2, "%s%s", device[0] == '/' ? "" : "/", device);
+
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        printf("[SETUP] Failed to open shared memory %s [%s]\n", shm_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (ftruncate(fd, sizeof(shm_link)) == -1) {
+        printf("[SETUP] Failed to size shared memory %s [%s]\n", shm_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    link_map = mmap(NULL, sizeof(shm_link), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (link_map == MAP_FAILED) {
+        printf("[SETUP] Failed to map shared memory %s [%s]\n", shm_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    in_ring = &link_map->ring[my_role == TRANSMITTER ? 1 : 0];
+    out_ring = &link_map->ring[my_role == TRANSMITTER ? 0 : 1];
+    return fd;
+}
+
+static ssize_t shm_read(int fd, void* buf, size_t len) {
+    uint32_t head = atomic_load_explicit(&in_ring->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&in_ring->tail, memory_order_relaxed);
+
+    size_t n = head - tail;
+    if (n == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (n > len) n = len;
+
+    size_t at = tail & SHM_RING_MASK;
+    size_t first = n < SHM_RING_SIZE - at ? n : SHM_RING_SIZE - at;
+    memcpy(buf, in_ring->data + at, first);
+    memcpy((char*)buf + first, in_ring->data, n - first);
+
+    atomic_store_explicit(&in_ring->tail, tail + n, memory_order_seq_cst);
+    if (atomic_load(&in_ring->producer_waiting)) futex_wake(&in_ring->tail);
+    return n;
+}
+
+/**
+ * Writes all of buf, waiting for room while the ring is full.
+ *
+ * @return len, or what was written until a signal came (-1 if nothing,
+ *         with errno EINTR)
+ */
+static ssize_t shm_write(int fd, const void* buf, size_t len) {
+    size_t sent = 0;
+
+    while (sent < len) {
+        uint32_t head = atomic_load_explicit(&out_ring->head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&out_ring->tail, memory_order_acquire);
+
+        size_t room = SHM_RING_SIZE - (head - tail);
+        if (room == 0) {
+            atomic_store(&out_ring->producer_waiting, 1);
+            int s = 0;
+            if (atomic_load(&out_ring->tail) == tail) {
+                s = futex_wait(&out_ring->tail, tail, NULL);
+            }
+            atomic_store(&out_ring->producer_waiting, 0);
+
+            if (s == -1 && errno == EINTR) return sent > 0 ? (ssize_t)sent : -1;
+            continue;
+        }
+
+        size_t n = len - sent < room ? len - sent : room;
+        size_t at = head & SHM_RING_MASK;
+        size_t first = n < SHM_RING_SIZE - at ? n : SHM_RING_SIZE - at;
+        memcpy(out_ring->data + at, (const char*)buf + sent, first);
+        memcpy(out_ring->data, (const char*)buf + sent + first, n - first);
+
+        atomic_store_explicit(&out_ring->head, head + n, memory_order_seq_cst);
+        if (atomic_load(&out_ring->consumer_waiting)) futex_wake(&out_ring->head);
+        sent += n;
+    }
+    return sent;
+}
+
+static int shm_wait_readable(int fd, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        ++deadline.tv_sec, deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (true) {
+        uint32_t head = atomic_load(&in_ring->head);
+        if (head != atomic_load(&in_ring->tail)) return 1;
+
+        struct timespec left, *t = NULL;
+        if (timeout_ms >= 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = deadline.tv_sec - now.tv_sec;
+            left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (left.tv_nsec < 0) --left.tv_sec, left.tv_nsec += 1000000000L;
+            if (left.tv_sec < 0) return 0;
+            t = &left;
+        }
+
+        atomic_store(&in_ring->consumer_waiting, 1);
+        int s = 0;
+        if (atomic_load(&in_ring->head) == head) {
+            s = futex_wait(&in_ring->head, head, t);
+        }
+        atomic_store(&in_ring->consumer_waiting, 0);
+
+        if (s == -1 && errno == EINTR) return -1;
+    }
+}
+
+/**
+ * Discards the input in the ring. Output written cannot be taken back,
+ * as the consumer may be reading it, so TCOFLUSH does nothing.
+ */
+static int shm_flush(int fd, int queue) {
+    if (queue == TCOFLUSH) return 0;
+
+    atomic_store(&in_ring->tail, atomic_load(&in_ring->head));
+    if (atomic_load(&in_ring->producer_waiting)) futex_wake(&in_ring->tail);
+    return 0;
+}
+
+static int shm_close(int fd) {
+    munmap(link_map, sizeof(shm_link));
+    link_map = NULL, in_ring = out_ring = NULL;
+
+    if (my_role == RECEIVER) shm_unlink(shm_name);
+    free(shm_name);
+    shm_name = NULL;
+    return close(fd);
+}
+
+const transport shm_transport = {
+    .name = "shm",
+    .open = shm_transport_open,
+    .read = shm_read,
+    .write = shm_write,
+    .wait_readable = shm_wait_readable,
+    .flush = shm_flush,
+    .close = shm_close
+};
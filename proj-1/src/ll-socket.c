@@ -0,0 +1,238 @@
+#define _GNU_SOURCE // accept4
+
+// Socket transports: the link protocol tunneled over TCP or UDP. R is the
+// passive end, as it is over serial: it listens (or binds) on host:port,
+// and T connects (or sends) to it.
+#include "ll-transport.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <termios.h>
+#include <errno.h>
+#include <time.h>
+
+// Writes are cut in datagrams of at most this size, which fit a 1500-byte
+// MTU unfragmented. Reads (READ_BUFFER_SIZE) are larger, and never truncate.
+#define UDP_DATAGRAM_SIZE 1400
+
+#define CONNECT_TICK_MS 100
+
+// TCP: the peer closed the connection. Only supports one fd.
+static bool sock_eof = false;
+
+// UDP: R has learned T's address from its first datagram. Only supports one fd.
+static bool udp_connected = false;
+
+/**
+ * Splits "host:port" or "[v6host]:port" and resolves it.
+ *
+ * @return The addresses, for freeaddrinfo. Exits if it cannot resolve.
+ */
+static struct addrinfo* resolve(const char* device, int socktype, bool passive) {
+    char host[256];
+    const char* colon = strrchr(device, ':');
+    if (colon == NULL || colon - device >= (long)sizeof(host)) {
+        printf("[SETUP] Device %s is not host:port\n", device);
+        exit(EXIT_FAILURE);
+    }
+
+    const char* begin = device;
+    size_t len = colon - device;
+    if (len >= 2 && begin[0] == '[' && begin[len - 1] == ']') {
+        ++begin, len -= 2;
+    }
+    memcpy(host, begin, len);
+    host[len] = '\0';
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+    struct addrinfo* res;
+    int s = getaddrinfo(len > 0 ? host : NULL, colon + 1, &hints, &res);
+    if (s != 0) {
+        printf("[SETUP] Failed to resolve %s [%s]\n", device, gai_strerror(s));
+        exit(EXIT_FAILURE);
+    }
+    return res;
+}
+
+static int bound_socket(struct addrinfo* res) {
+    for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1) continue;
+
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) return fd;
+        close(fd);
+    }
+    return -1;
+}
+
+/**
+ * Connects to one of res, retrying for as long as T would retry a SET
+ * frame, so that T may be started before R listens.
+ */
+static int connected_socket(struct addrinfo* res) {
+    int ticks = timeout * time_retries * 100 / CONNECT_TICK_MS;
+
+    for (int i = 0; i <= ticks; ++i) {
+        for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+            int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd == -1) continue;
+
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) return fd;
+            close(fd);
+        }
+
+        struct timespec t = {0, CONNECT_TICK_MS * 1000000L};
+        nanosleep(&t, NULL);
+    }
+    return -1;
+}
+
+static int tcp_open(const char* device) {
+    struct addrinfo* res = resolve(device, SOCK_STREAM, my_role == RECEIVER);
+    int fd;
+
+    if (my_role == RECEIVER) {
+        int lfd = bound_socket(res);
+        if (lfd == -1 || listen(lfd, 1) == -1) {
+            printf("[SETUP] Failed to listen on %s [%s]\n", device, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        printf("[SETUP] Waiting for T on %s\n", device);
+
+        do {
+            fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        } while (fd == -1 && errno == EINTR);
+        close(lfd);
+    } else {
+        fd = connected_socket(res);
+    }
+    freeaddrinfo(res);
+
+    if (fd == -1) {
+        printf("[SETUP] Failed to connect on %s [%s]\n", device, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Frames are written whole: send each at once.
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static ssize_t tcp_read(int fd, void* buf, size_t len) {
+    ssize_t s = recv(fd, buf, len, 0);
+    if (s == 0) sock_eof = true;
+    return s;
+}
+
+static ssize_t tcp_write(int fd, const void* buf, size_t len) {
+    return send(fd, buf, len, MSG_NOSIGNAL);
+}
+
+static int tcp_wait_readable(int fd, int timeout_ms) {
+    if (!sock_eof) return poll_readable(fd, timeout_ms);
+    return hung_up_wait(timeout_ms);
+}
+
+/**
+ * Discards the input already received. Output sent cannot be taken back,
+ * so TCOFLUSH does nothing.
+ */
+static int sock_flush(int fd, int queue) {
+    if (queue == TCOFLUSH || sock_eof) return 0;
+
+    char buf[4096];
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+    return 0;
+}
+
+static int sock_close(int fd) {
+    return close(fd);
+}
+
+static int udp_open(const char* device) {
+    struct addrinfo* res = resolve(device, SOCK_DGRAM, my_role == RECEIVER);
+    int fd = my_role == RECEIVER ? bound_socket(res) : connected_socket(res);
+    freeaddrinfo(res);
+
+    if (fd == -1) {
+        printf("[SETUP] Failed to open UDP socket on %s [%s]\n", device, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    udp_connected = my_role == TRANSMITTER;
+    return fd;
+}
+
+/**
+ * Reads one datagram. R connects to the sender of the first, so that it
+ * answers T and ignores anyone else.
+ */
+static ssize_t udp_read(int fd, void* buf, size_t len) {
+    struct sockaddr_storage peer;
+    socklen_t peerlen = sizeof(peer);
+
+    ssize_t s = recvfrom(fd, buf, len, 0, (struct sockaddr*)&peer, &peerlen);
+
+    if (s > 0 && !udp_connected) {
+        if (connect(fd, (struct sockaddr*)&peer, peerlen) == 0) {
+            udp_connected = true;
+        }
+    }
+
+    // An ICMP port unreachable from a gone peer: silence, not an error.
+    if (s == -1 && errno == ECONNREFUSED) errno = EAGAIN;
+    return s;
+}
+
+static ssize_t udp_write(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    size_t sent = 0;
+
+    while (sent < len) {
+        size_t n = len - sent < UDP_DATAGRAM_SIZE ? len - sent : UDP_DATAGRAM_SIZE;
+        ssize_t s = send(fd, p + sent, n, MSG_NOSIGNAL);
+        if (s == -1) return sent > 0 ? (ssize_t)sent : -1;
+        sent += s;
+    }
+    return sent;
+}
+
+const transport tcp_transport = {
+    .name = "tcp",
+    .open = tcp_open,
+    .read = tcp_read,
+    .write = tcp_write,
+    .wait_readable = tcp_wait_readable,
+    .flush = sock_flush,
+    .close = sock_close,
+    .io_fds = same_io_fds
+};
+
+const transport udp_transport = {
+    .name = "udp",
+    .open = udp_open,
+    .read = udp_read,
+    .write = udp_write,
+    .wait_readable = poll_readable,
+    .flush = sock_flush,
+    .close = sock_close
+};
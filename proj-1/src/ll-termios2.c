@@ -0,0 +1,65 @@
+// Linux serial ioctls beyond termios(3). The kernel's termios2 cannot be
+// declared next to glibc's <termios.h>, so they live apart from ll-setup.
+#include "ll-termios2.h"
+
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+
+/**
+ * Set any baudrate, not just the Bxxx ones, with BOTHER. The driver may
+ * round it to the closest it can generate: see get_baudrate_out.
+ *
+ * @return 0 if successful, -1 otherwise, with errno set
+ */
+int set_baudrate_other(int fd, int rate) {
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) == -1) return -1;
+
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_ispeed = rate;
+    tio.c_ospeed = rate;
+
+    return ioctl(fd, TCSETS2, &tio);
+}
+
+/**
+ * @return The output baudrate the driver is set to, or -1 if unknown
+ */
+int get_baudrate_out(int fd) {
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) == -1) return -1;
+    return (int)tio.c_ospeed;
+}
+
+/**
+ * Have the driver push received bytes to the tty layer as they arrive,
+ * rather than in batches (ASYNC_LOW_LATENCY).
+ *
+ * @return 0 if successful, -1 otherwise, with errno set (ENOTTY and
+ *         EINVAL for devices other than serial ports)
+ */
+int set_low_latency(int fd) {
+    struct serial_struct serial;
+
+    if (ioctl(fd, TIOCGSERIAL, &serial) == -1) return -1;
+
+    serial.flags |= ASYNC_LOW_LATENCY;
+
+    return ioctl(fd, TIOCSSERIAL, &serial);
+}
+
+/**
+ * @return The driver's count of received bytes lost so far, overrun in the
+ *         UART's FIFO or in the tty's buffer (TIOCGICOUNT), or -1 if the
+ *         device does not keep it, with errno set
+ */
+long get_overruns(int fd) {
+    struct serial_icounter_struct icount;
+
+    if (ioctl(fd, TIOCGICOUNT, &icount) == -1) return -1;
+    return (long)icount.overrun + (long)icount.buf_overrun;
+}
@@ -0,0 +1,12 @@
+#ifndef LL_TERMIOS2_H___
+#define LL_TERMIOS2_H___
+
+int set_baudrate_other(int fd, int rate);
+
+int get_baudrate_out(int fd);
+
+int set_low_latency(int fd);
+
+long get_overruns(int fd);
+
+#endif // LL_TERMIOS2_H___
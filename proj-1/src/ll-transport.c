@@ -0,0 +1,163 @@
+#include "ll-transport.h"
+#include "ll-uring.h"
+#include "ll-capture.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <termios.h>
+
+static const transport* link_transport = &serial_transport; // only supports one fd.
+
+static const transport* select_transport() {
+    switch (transport_type) {
+    case TRANSPORT_PIPE: return &pipe_transport;
+    case TRANSPORT_TCP: return &tcp_transport;
+    case TRANSPORT_UDP: return &udp_transport;
+    case TRANSPORT_SHM: return &shm_transport;
+    case TRANSPORT_REPLAY: return &replay_transport;
+    default: return &serial_transport;
+    }
+}
+
+/**
+ * Starts the io_uring engine on the link, if it was selected and can run.
+ */
+static void setup_engine(int fd) {
+    int rfd, wfd;
+
+    if (io_engine != IO_ENGINE_URING) return;
+
+    if (link_transport->io_fds == NULL || link_transport->io_fds(fd, &rfd, &wfd) != 0) {
+        printf("[SETUP] No io_uring engine over the %s transport, using poll\n",
+            link_transport->name);
+    } else if (uring_setup(rfd, wfd) != 0) {
+        printf("[SETUP] No io_uring engine [%s], using poll\n", strerror(errno));
+    } else {
+        printf("[SETUP] Started io_uring engine\n");
+    }
+}
+
+/**
+ * Opens device with the transport selected by --transport. Exits if it
+ * cannot, as setup_link_layer always has.
+ *
+ * @return The link's fd
+ */
+int open_transport(const char* device) {
+    link_transport = select_transport();
+
+    int fd = link_transport->open(device);
+
+    if (link_transport != &serial_transport) {
+        printf("[SETUP] Opened %s transport on %s\n", link_transport->name, device);
+    }
+
+    setup_engine(fd);
+    return fd;
+}
+
+// Calls into shm are not system calls.
+static void count_syscall() {
+    if (link_transport != &shm_transport) ++io_syscalls;
+}
+
+ssize_t transport_read(int fd, void* buf, size_t len) {
+    ssize_t s;
+
+    if (uring_active()) {
+        s = uring_read(buf, len);
+    } else {
+        count_syscall();
+        s = link_transport->read(fd, buf, len);
+    }
+
+    if (s > 0) capture_record(CAPTURE_RX, buf, s);
+    if (s == 0) capture_record(CAPTURE_TICK, NULL, 0);
+    return s;
+}
+
+ssize_t transport_write(int fd, const void* buf, size_t len) {
+    ssize_t s;
+
+    if (uring_active()) {
+        s = uring_write(buf, len);
+    } else {
+        count_syscall();
+        s = link_transport->write(fd, buf, len);
+    }
+
+    if (s > 0) capture_record(CAPTURE_TX, buf, s);
+    return s;
+}
+
+int transport_wait_readable(int fd, int timeout_ms) {
+    int s;
+
+    if (uring_active()) {
+        s = uring_wait_readable(timeout_ms);
+    } else {
+        count_syscall();
+        s = link_transport->wait_readable(fd, timeout_ms);
+    }
+
+    if (s == 0) capture_record(CAPTURE_TICK, NULL, 0);
+    return s;
+}
+
+int transport_flush(int fd, int queue) {
+    if (uring_active() && queue != TCOFLUSH) uring_flush_input();
+
+    count_syscall();
+    return link_transport->flush(fd, queue);
+}
+
+/**
+ * @return true if reads themselves time out after one tick (VTIME), false
+ *         if they must be preceded by transport_wait_readable
+ */
+bool transport_timed_reads() {
+    return link_transport == &serial_transport && !low_latency && !uring_active();
+}
+
+int close_transport(int fd) {
+    uring_teardown();
+    return link_transport->close(fd);
+}
+
+/**
+ * io_fds for backends that read and write fd itself.
+ */
+int same_io_fds(int fd, int* rfdp, int* wfdp) {
+    *rfdp = *wfdp = fd;
+    return 0;
+}
+
+/**
+ * wait_readable for backends whose fd can be polled.
+ */
+int poll_readable(int fd, int timeout_ms) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    return poll(&pfd, 1, timeout_ms);
+}
+
+/**
+ * wait_readable for a peer that hung up: stay silent, as an unplugged
+ * line would, until timeout_ms passes or a signal comes.
+ */
+int hung_up_wait(int timeout_ms) {
+    if (timeout_ms < 0) {
+        pause();
+        errno = EINTR;
+        return -1;
+    }
+
+    struct timespec t = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    nanosleep(&t, NULL);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef LL_TRANSPORT_H___
+#define LL_TRANSPORT_H___
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * A byte stream the link protocol runs over. Each backend takes --device in
+ * its own format, and returns an int handle that the link layer passes
+ * back to it as fd.
+ *
+ * wait_readable returns 1 once bytes can be read, 0 if timeout_ms passed
+ * first (-1 waits forever), -1 on error with errno set. A peer that went
+ * away reads as a silent line: wait_readable times out.
+ *
+ * flush takes TCIFLUSH, TCOFLUSH or TCIOFLUSH and discards what it can.
+ *
+ * io_fds gives the fds that read and write are read(2) and write(2) on,
+ * for the io_uring engine to use directly.
+ */
+typedef struct {
+    const char* name;
+    int (*open)(const char* device);
+    ssize_t (*read)(int fd, void* buf, size_t len);
+    ssize_t (*write)(int fd, const void* buf, size_t len);
+    int (*wait_readable)(int fd, int timeout_ms);
+    int (*flush)(int fd, int queue);
+    int (*close)(int fd);
+    int (*io_fds)(int fd, int* rfdp, int* wfdp); // NULL if not plain fds
+} transport;
+
+extern const transport serial_transport; // ll-setup.c
+extern const transport pipe_transport; // ll-pipe.c
+extern const transport tcp_transport; // ll-socket.c
+extern const transport udp_transport; // ll-socket.c
+extern const transport shm_transport; // ll-shm.c
+extern const transport replay_transport; // ll-capture.c
+
+int open_transport(const char* device);
+
+ssize_t transport_read(int fd, void* buf, size_t len);
+
+ssize_t transport_write(int fd, const void* buf, size_t len);
+
+int transport_wait_readable(int fd, int timeout_ms);
+
+int transport_flush(int fd, int queue);
+
+bool transport_timed_reads();
+
+int close_transport(int fd);
+
+int poll_readable(int fd, int timeout_ms);
+
+int same_io_fds(int fd, int* rfdp, int* wfdp);
+
+int hung_up_wait(int timeout_ms);
+
+#endif // LL_TRANSPORT_H___
@@ -0,0 +1,643 @@
+#include "ll-uring.h"
+#include "ll-transport.h"
+#include "debug.h"
+
+#include <errno.h>
+
+#ifdef IO_URING
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <poll.h>
+#include <time.h>
+
+#define URING_ENTRIES          64
+#define URING_READ_SIZE        4096
+
+// user_data: kind << 32 | slot
+#define UD_LINK_POLL           1
+#define UD_LINK_READ           2
+#define UD_LINK_WRITE          3
+#define UD_FILE_READ           4
+#define UD_FILE_WRITE          5
+#define UD(kind, slot)         (((uint64_t)(kind) << 32) | (uint32_t)(slot))
+
+typedef struct {
+    int fd; // -1 if the engine is off
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* rings;
+    size_t rings_len, sqes_len;
+} uring;
+
+/**
+ * The next packet of a file being sent, read ahead.
+ */
+typedef struct {
+    int filefd; // -1 if free
+    off_t offset;
+    size_t len, cap;
+    char* buf;
+    ssize_t res;
+    bool inflight;
+} prefetch_slot;
+
+/**
+ * A packet of a file being received, written behind.
+ */
+typedef struct {
+    int filefd; // -1 if free
+    off_t offset;
+    size_t len, done, cap;
+    char* buf;
+} write_slot;
+
+static uring ring = {.fd = -1}; // only supports one fd.
+
+// The link: a poll linked to a read is armed on rfd, filling the landing
+// buffer, while the protocol consumes the ready one.
+static int link_rfd = -1, link_wfd = -1;
+static char read_bufs[2][URING_READ_SIZE];
+static int landing = 0;
+static size_t landed = 0; // Bytes in the landing buffer, read but not ready
+static size_t ready_begin = 0, ready_end = 0;
+static bool read_armed = false, link_eof = false;
+static int link_error = 0;
+
+static char* write_buf = NULL;
+static size_t write_len = 0, write_done = 0, write_cap = 0;
+static bool write_inflight = false;
+static int write_error = 0;
+
+static prefetch_slot prefetches[URING_PREFETCH_MAX];
+static write_slot writes[URING_WRITES_MAX];
+
+// First write error of each file with writes behind.
+static struct {
+    int filefd, err;
+} write_errors[URING_WRITES_MAX];
+
+static unsigned queued() {
+    return *ring.sq_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Submits the queued SQEs and, if min_complete is 1, waits for a completion
+ * until ts passes (NULL: forever).
+ *
+ * @return 0 if successful, -1 otherwise, with errno set (ETIME if ts passed)
+ */
+static int enter(unsigned min_complete, struct __kernel_timespec* ts) {
+    unsigned flags = 0;
+    struct io_uring_getevents_arg arg;
+    void* argp = NULL;
+    size_t argsz = 0;
+
+    if (min_complete > 0) flags |= IORING_ENTER_GETEVENTS;
+    if (min_complete > 0 && ts != NULL) {
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+
+    ++io_syscalls;
+    int s = syscall(__NR_io_uring_enter, ring.fd, queued(), min_complete,
+        flags, argp, argsz);
+    return s < 0 ? -1 : 0;
+}
+
+/**
+ * @return n zeroed SQEs, consecutive in the submission queue, which is
+ *         flushed first if it has no room for them
+ */
+static struct io_uring_sqe* get_sqes(unsigned n) {
+    if (queued() + n > ring.sq_entries) enter(0, NULL);
+
+    unsigned tail = *ring.sq_tail;
+    for (unsigned i = 0; i < n; ++i) {
+        unsigned index = (tail + i) & *ring.sq_mask;
+        ring.sq_array[index] = index;
+        memset(&ring.sqes[index], 0, sizeof(struct io_uring_sqe));
+    }
+    return &ring.sqes[tail & *ring.sq_mask];
+}
+
+static void push_sqes(unsigned n) {
+    __atomic_store_n(ring.sq_tail, *ring.sq_tail + n, __ATOMIC_RELEASE);
+}
+
+static struct io_uring_sqe* sqe_at(struct io_uring_sqe* first, unsigned i) {
+    unsigned index = (unsigned)(first - ring.sqes);
+    return &ring.sqes[(index + i) & *ring.sq_mask];
+}
+
+static void queue_rw(struct io_uring_sqe* sqe, int opcode, int fd, const void* buf,
+        size_t len, uint64_t offset, uint64_t user_data) {
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+}
+
+static void arm_read() {
+    struct io_uring_sqe* poll = get_sqes(2);
+    struct io_uring_sqe* read = sqe_at(poll, 1);
+
+    poll->opcode = IORING_OP_POLL_ADD;
+    poll->fd = link_rfd;
+    poll->poll32_events = POLLIN;
+    poll->flags = IOSQE_IO_LINK;
+    poll->user_data = UD(UD_LINK_POLL, 0);
+
+    queue_rw(read, IORING_OP_READ, link_rfd, read_bufs[landing], URING_READ_SIZE,
+        (uint64_t)-1, UD(UD_LINK_READ, 0));
+    push_sqes(2);
+    read_armed = true;
+}
+
+static void queue_link_write() {
+    struct io_uring_sqe* sqe = get_sqes(1);
+    queue_rw(sqe, IORING_OP_WRITE, link_wfd, write_buf + write_done,
+        write_len - write_done, (uint64_t)-1, UD(UD_LINK_WRITE, 0));
+    push_sqes(1);
+    write_inflight = true;
+}
+
+static void queue_file_write(int i) {
+    write_slot* w = &writes[i];
+    struct io_uring_sqe* sqe = get_sqes(1);
+    queue_rw(sqe, IORING_OP_WRITE, w->filefd, w->buf + w->done, w->len - w->done,
+        w->offset + w->done, UD(UD_FILE_WRITE, i));
+    push_sqes(1);
+}
+
+/**
+ * Makes the landed bytes ready once the ready ones are consumed, and arms
+ * the next read into the other buffer.
+ */
+static void promote() {
+    if (ready_begin < ready_end || landed == 0) return;
+
+    ready_begin = 0;
+    ready_end = landed;
+    landed = 0;
+    landing = 1 - landing;
+    arm_read();
+}
+
+static void record_write_error(int filefd, int err) {
+    for (int i = 0; i < URING_WRITES_MAX; ++i) {
+        if (write_errors[i].filefd == filefd) return;
+    }
+    for (int i = 0; i < URING_WRITES_MAX; ++i) {
+        if (write_errors[i].filefd == -1) {
+            write_errors[i].filefd = filefd;
+            write_errors[i].err = err;
+            return;
+        }
+    }
+}
+
+static void complete(uint64_t user_data, int res) {
+    int slot = (int)(uint32_t)user_data;
+
+    switch (user_data >> 32) {
+    case UD_LINK_POLL:
+        if (res < 0 && res != -ECANCELED && res != -EINTR) link_error = -res;
+        break;
+    case UD_LINK_READ:
+        read_armed = false;
+        if (res > 0) {
+            landed = res;
+            promote();
+        } else if (res == 0) {
+            link_eof = true;
+        } else if (link_error == 0 && (res == -EAGAIN || res == -EINTR
+                || res == -ECANCELED)) {
+            arm_read();
+        } else if (link_error == 0) {
+            link_error = -res;
+        }
+        break;
+    case UD_LINK_WRITE:
+        if (res > 0) write_done += res;
+        if ((res > 0 && write_done < write_len) || res == -EAGAIN || res == -EINTR) {
+            queue_link_write();
+            enter(0, NULL);
+        } else {
+            if (res < 0) write_error = -res;
+            write_inflight = false;
+        }
+        break;
+    case UD_FILE_READ:
+        prefetches[slot].res = res;
+        prefetches[slot].inflight = false;
+        break;
+    case UD_FILE_WRITE:
+        if (res > 0) writes[slot].done += res;
+        if ((res > 0 && writes[slot].done < writes[slot].len)
+                || res == -EAGAIN || res == -EINTR) {
+            queue_file_write(slot);
+        } else {
+            if (res <= 0) record_write_error(writes[slot].filefd, res == 0 ? ENOSPC : -res);
+            writes[slot].filefd = -1;
+        }
+        break;
+    }
+}
+
+static void reap() {
+    unsigned head = *ring.cq_head;
+
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+
+        __atomic_store_n(ring.cq_head, ++head, __ATOMIC_RELEASE);
+        complete(user_data, res);
+    }
+}
+
+/**
+ * Waits until *flag is cleared by a completion.
+ *
+ * @param  interruptible Return on signals, rather than wait on
+ * @return 0 if successful, -1 otherwise, with errno set
+ */
+static int wait_cleared(bool* flag, bool interruptible) {
+    while (true) {
+        reap();
+        if (!*flag) return 0;
+
+        if (enter(1, NULL) == -1 && errno != ETIME) {
+            if (errno == EINTR && !interruptible) continue;
+            return -1;
+        }
+    }
+}
+
+static bool writes_pending(int filefd) {
+    for (int i = 0; i < URING_WRITES_MAX; ++i) {
+        if (writes[i].filefd == filefd) return true;
+    }
+    return false;
+}
+
+/**
+ * Starts the engine on the link's fds.
+ *
+ * @return 0 if successful, -1 otherwise, with errno set
+ */
+int uring_setup(int rfd, int wfd) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (fd == -1) return -1;
+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring.rings_len = sq_len > cq_len ? sq_len : cq_len;
+    ring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring.rings = mmap(NULL, ring.rings_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring.rings == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    ring.sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        munmap(ring.rings, ring.rings_len);
+        close(fd);
+        return -1;
+    }
+
+    char* base = ring.rings;
+    ring.sq_head = (unsigned*)(base + p.sq_off.head);
+    ring.sq_tail = (unsigned*)(base + p.sq_off.tail);
+    ring.sq_mask = (unsigned*)(base + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned*)(base + p.sq_off.array);
+    ring.cq_head = (unsigned*)(base + p.cq_off.head);
+    ring.cq_tail = (unsigned*)(base + p.cq_off.tail);
+    ring.cq_mask = (unsigned*)(base + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(base + p.cq_off.cqes);
+    ring.sq_entries = p.sq_entries;
+    ring.fd = fd;
+
+    for (int i = 0; i < URING_PREFETCH_MAX; ++i) prefetches[i].filefd = -1;
+    for (int i = 0; i < URING_WRITES_MAX; ++i) writes[i].filefd = -1;
+    for (int i = 0; i < URING_WRITES_MAX; ++i) write_errors[i].filefd = -1;
+
+    link_rfd = rfd;
+    link_wfd = wfd;
+    arm_read();
+    enter(0, NULL);
+    return 0;
+}
+
+bool uring_active() {
+    return ring.fd != -1;
+}
+
+/**
+ * Waits for the last frame write, and stops the engine. Reads still armed
+ * are cancelled as the ring closes.
+ */
+void uring_teardown() {
+    if (!uring_active()) return;
+
+    wait_cleared(&write_inflight, true);
+
+    munmap(ring.sqes, ring.sqes_len);
+    munmap(ring.rings, ring.rings_len);
+    close(ring.fd);
+    ring.fd = -1;
+
+    for (int i = 0; i < URING_PREFETCH_MAX; ++i) free(prefetches[i].buf);
+    for (int i = 0; i < URING_WRITES_MAX; ++i) free(writes[i].buf);
+    free(write_buf);
+    write_buf = NULL;
+}
+
+/**
+ * Reads the bytes that are ready, without a system call.
+ *
+ * @return The bytes read, 0 if the peer hung up, -1 with errno EAGAIN if
+ *         none are ready
+ */
+ssize_t uring_read(void* buf, size_t len) {
+    reap();
+    promote();
+
+    if (ready_begin == ready_end) {
+        if (link_eof) return 0;
+        errno = link_error ? link_error : EAGAIN;
+        return -1;
+    }
+
+    size_t n = ready_end - ready_begin < len ? ready_end - ready_begin : len;
+    memcpy(buf, read_bufs[1 - landing] + ready_begin, n);
+    ready_begin += n;
+    return n;
+}
+
+/**
+ * Queues a frame write, once the last one is done. It is submitted by the
+ * wait for the answer that follows it, in the same system call.
+ *
+ * @return len if queued, -1 otherwise, with errno set (EINTR if a signal
+ *         came while the last write was not done, or the last write's error)
+ */
+ssize_t uring_write(const void* buf, size_t len) {
+    if (write_inflight && wait_cleared(&write_inflight, true) == -1) return -1;
+
+    if (write_error != 0) {
+        errno = write_error;
+        write_error = 0;
+        return -1;
+    }
+
+    if (len > write_cap) {
+        write_buf = realloc(write_buf, len);
+        write_cap = len;
+    }
+    memcpy(write_buf, buf, len);
+    write_len = len;
+    write_done = 0;
+
+    queue_link_write();
+    return len;
+}
+
+int uring_wait_readable(int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        ++deadline.tv_sec, deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (true) {
+        reap();
+        promote();
+
+        if (ready_begin < ready_end) return 1;
+        if (link_error != 0) {
+            errno = link_error;
+            return -1;
+        }
+        if (link_eof) return hung_up_wait(timeout_ms);
+        if (!read_armed && landed == 0) arm_read();
+
+        struct __kernel_timespec left, *ts = NULL;
+        if (timeout_ms >= 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = deadline.tv_sec - now.tv_sec;
+            left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (left.tv_nsec < 0) --left.tv_sec, left.tv_nsec += 1000000000L;
+            if (left.tv_sec < 0) return 0;
+            ts = &left;
+        }
+
+        if (enter(1, ts) == -1 && errno != ETIME) return -1;
+    }
+}
+
+/**
+ * Discards the bytes read but not yet consumed. The read still armed is
+ * kept: it may bring bytes sent before the flush, as a tty's queue may.
+ */
+void uring_flush_input() {
+    reap();
+    ready_begin = ready_end = 0;
+    landed = 0;
+    if (!read_armed && !link_eof) arm_read();
+}
+
+/**
+ * Reads a packet of a file, from its prefetch if it was read ahead, with
+ * pread(2) otherwise.
+ */
+ssize_t uring_pread(int filefd, void* buf, size_t len, off_t offset) {
+    for (int i = 0; i < URING_PREFETCH_MAX; ++i) {
+        prefetch_slot* p = &prefetches[i];
+        if (p->filefd != filefd) continue;
+
+        if (p->inflight) wait_cleared(&p->inflight, false);
+        if (p->offset == offset && p->len == len && p->res > 0) {
+            p->filefd = -1;
+            memcpy(buf, p->buf, p->res);
+            return p->res;
+        }
+        p->filefd = -1;
+        break;
+    }
+
+    ++io_syscalls;
+    return pread(filefd, buf, len, offset);
+}
+
+/**
+ * Queues the read of a file's next packet. It is submitted with the next
+ * frame write, and done while that frame is sent.
+ */
+void uring_prefetch(int filefd, size_t len, off_t offset) {
+    int slot = -1;
+    for (int i = 0; i < URING_PREFETCH_MAX && slot == -1; ++i) {
+        if (prefetches[i].filefd == filefd) slot = i;
+    }
+    for (int i = 0; i < URING_PREFETCH_MAX && slot == -1; ++i) {
+        if (prefetches[i].filefd == -1 && !prefetches[i].inflight) slot = i;
+    }
+    if (slot == -1) return;
+
+    prefetch_slot* p = &prefetches[slot];
+    if (p->inflight) wait_cleared(&p->inflight, false);
+
+    if (len > p->cap) {
+        p->buf = realloc(p->buf, len);
+        p->cap = len;
+    }
+    p->filefd = filefd;
+    p->offset = offset;
+    p->len = len;
+    p->res = 0;
+    p->inflight = true;
+
+    struct io_uring_sqe* sqe = get_sqes(1);
+    queue_rw(sqe, IORING_OP_READ, filefd, p->buf, len, offset, UD(UD_FILE_READ, slot));
+    push_sqes(1);
+}
+
+/**
+ * Queues a write of a copy of buf to a file, submitted with the next frame
+ * write or wait. Errors are reported by uring_drain_file.
+ *
+ * @return 0
+ */
+int uring_pwrite(int filefd, const void* buf, size_t len, off_t offset) {
+    int slot = -1;
+    while (slot == -1) {
+        for (int i = 0; i < URING_WRITES_MAX && slot == -1; ++i) {
+            if (writes[i].filefd == -1) slot = i;
+        }
+        if (slot == -1 && enter(1, NULL) == 0) reap();
+    }
+
+    write_slot* w = &writes[slot];
+    if (len > w->cap) {
+        w->buf = realloc(w->buf, len);
+        w->cap = len;
+    }
+    memcpy(w->buf, buf, len);
+    w->filefd = filefd;
+    w->offset = offset;
+    w->len = len;
+    w->done = 0;
+
+    queue_file_write(slot);
+    return 0;
+}
+
+/**
+ * Waits for a file's reads ahead and writes behind, before it is sized or
+ * closed.
+ *
+ * @return 0 if all its writes succeeded, 1 otherwise, with errno set
+ */
+int uring_drain_file(int filefd) {
+    for (int i = 0; i < URING_PREFETCH_MAX; ++i) {
+        prefetch_slot* p = &prefetches[i];
+        if (p->filefd != filefd) continue;
+        if (p->inflight) wait_cleared(&p->inflight, false);
+        p->filefd = -1;
+    }
+
+    while (writes_pending(filefd)) {
+        if (enter(1, NULL) == -1 && errno != EINTR && errno != ETIME) break;
+        reap();
+    }
+
+    for (int i = 0; i < URING_WRITES_MAX; ++i) {
+        if (write_errors[i].filefd == filefd) {
+            write_errors[i].filefd = -1;
+            errno = write_errors[i].err;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#else // !IO_URING
+
+int uring_setup(int rfd, int wfd) {
+    errno = ENOSYS;
+    return -1;
+}
+
+bool uring_active() {
+    return false;
+}
+
+void uring_teardown() {}
+
+ssize_t uring_read(void* buf, size_t len) {
+    errno = ENOSYS;
+    return -1;
+}
+
+ssize_t uring_write(const void* buf, size_t len) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_wait_readable(int timeout_ms) {
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring_flush_input() {}
+
+ssize_t uring_pread(int filefd, void* buf, size_t len, off_t offset) {
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring_prefetch(int filefd, size_t len, off_t offset) {}
+
+int uring_pwrite(int filefd, const void* buf, size_t len, off_t offset) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_drain_file(int filefd) {
+    return 0;
+}
+
+#endif // IO_URING
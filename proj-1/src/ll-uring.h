@@ -0,0 +1,43 @@
+#ifndef LL_URING_H___
+#define LL_URING_H___
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// The io_uring I/O engine, built with make IO_URING=1. One ring carries the
+// link's reads and writes and the files' reads and writes, all in flight at
+// once, and each io_uring_enter submits whatever was queued since the last:
+//   - A poll linked to a read is always armed on the link, so bytes land
+//     in a buffer while the protocol handles the previous ones.
+//   - Frame writes return once queued; the next one waits for the last.
+//   - The sender's next packet is read ahead while the current one is sent.
+//   - The receiver's packets are written behind, until the file is closed.
+// Without IO_URING, or if the kernel refuses the ring, uring_setup fails and
+// the link and files use poll and blocking reads and writes, as before.
+
+#define URING_PREFETCH_MAX     16 // Files read ahead at once
+#define URING_WRITES_MAX       32 // File writes in flight at once
+
+int uring_setup(int rfd, int wfd);
+
+bool uring_active();
+
+void uring_teardown();
+
+ssize_t uring_read(void* buf, size_t len);
+
+ssize_t uring_write(const void* buf, size_t len);
+
+int uring_wait_readable(int timeout_ms);
+
+void uring_flush_input();
+
+ssize_t uring_pread(int filefd, void* buf, size_t len, off_t offset);
+
+void uring_prefetch(int filefd, size_t len, off_t offset);
+
+int uring_pwrite(int filefd, const void* buf, size_t len, off_t offset);
+
+int uring_drain_file(int filefd);
+
+#endif // LL_URING_H___
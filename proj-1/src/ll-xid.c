@@ -0,0 +1,224 @@
+#include "ll-xid.h"
+#include "ll-core.h"
+#include "app-layer.h"
+#include "options.h"
+#include "ll-setup.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+static void put_le(char* buf, uint64_t value, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        buf[i] = (char)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const char* buf, size_t n) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < n; ++i) {
+        value |= (uint64_t)(unsigned char)buf[i] << (8 * i);
+    }
+    return value;
+}
+
+// This end's own options, as set up before any XID exchange changed them.
+// Only supports one fd.
+static size_t local_packetsize;
+static int local_timeout;
+static bool local_saved = false;
+
+static void save_local_options() {
+    if (local_saved) return;
+    local_packetsize = packetsize;
+    local_timeout = timeout;
+    local_saved = true;
+}
+
+/**
+ * Capabilities of this end, from its options. The transmitter offers the
+ * packet size it was given, the receiver the largest it can take.
+ */
+void xid_local_caps(link_caps* caps) {
+    save_local_options();
+
+    caps->max_packet = my_role == TRANSMITTER ? local_packetsize : MAXIMUM_PACKET_SIZE;
+    caps->window = 1;
+    caps->fcs = XID_FCS_PARITY | XID_FCS_CRC8;
+    caps->compression = 0;
+    caps->timeout = local_timeout;
+    caps->baudrate = link_baudrate();
+    caps->features = XID_FEATURE_OFFSETS;
+
+    switch (frame_codec) {
+    case CODEC_HDLC:
+        caps->codecs = XID_CODEC_HDLC;
+        break;
+    case CODEC_COBS:
+        caps->codecs = XID_CODEC_COBS;
+        break;
+    default:
+        caps->codecs = XID_CODEC_HDLC | XID_CODEC_COBS;
+        break;
+    }
+
+    // COBS would put XON and XOFF on the line.
+    if (flow_control == FLOW_XONXOFF) caps->codecs = XID_CODEC_HDLC;
+}
+
+/**
+ * Build the XID information field advertising caps.
+ *
+ * This function does not fail.
+ */
+void xid_build(const link_caps* caps, string* outp) {
+    static const struct {
+        char type;
+        size_t len;
+    } fields[] = {
+        {XID_MAX_PACKET, 4}, {XID_WINDOW, 1}, {XID_FCS, 1}, {XID_CODECS, 1},
+        {XID_COMPRESSION, 1}, {XID_TIMEOUT, 2}, {XID_BAUDRATE, 4},
+        {XID_FEATURES, 1}
+    };
+    static const size_t fields_length = sizeof(fields) / sizeof(fields[0]);
+
+    uint64_t values[] = {caps->max_packet, caps->window, caps->fcs, caps->codecs,
+        caps->compression, caps->timeout, caps->baudrate, caps->features};
+
+    string info;
+    info.s = malloc(64 * sizeof(char));
+    info.len = 0;
+
+    for (size_t i = 0; i < fields_length; ++i) {
+        info.s[info.len++] = fields[i].type;
+        info.s[info.len++] = (char)fields[i].len;
+        put_le(info.s + info.len, values[i], fields[i].len);
+        info.len += fields[i].len;
+    }
+
+    info.s[info.len] = '\0';
+    *outp = info;
+}
+
+/**
+ * Parse an XID information field. Parameters missing from it keep the
+ * values of an end that predates them.
+ *
+ * @return 0 if successful, 1 if the field is malformed
+ */
+int xid_parse(string info, link_caps* caps) {
+    link_caps parsed = {0, 1, XID_FCS_PARITY, XID_CODEC_HDLC, 0, 0, 0, 0};
+    size_t j = 0;
+
+    while (j + 2 <= info.len) {
+        char type = info.s[j++];
+        size_t l = (unsigned char)info.s[j++];
+
+        if (j + l > info.len || l > 8) return 1;
+
+        uint64_t value = get_le(info.s + j, l);
+        j += l;
+
+        switch (type) {
+        case XID_MAX_PACKET:  parsed.max_packet = value; break;
+        case XID_WINDOW:      parsed.window = value; break;
+        case XID_FCS:         parsed.fcs = value; break;
+        case XID_CODECS:      parsed.codecs = value; break;
+        case XID_COMPRESSION: parsed.compression = value; break;
+        case XID_TIMEOUT:     parsed.timeout = value; break;
+        case XID_BAUDRATE:    parsed.baudrate = value; break;
+        case XID_FEATURES:    parsed.features = value; break;
+        default:              break; // Unknown: skip
+        }
+    }
+
+    if (j != info.len) return 1;
+
+    *caps = parsed;
+    return 0;
+}
+
+/**
+ * Settle on the fastest configuration both ends support. Symmetric in
+ * mine and peer, so that both ends reach the same result on their own.
+ */
+void xid_negotiate(const link_caps* mine, const link_caps* peer, link_config* config) {
+    uint8_t codecs = mine->codecs & peer->codecs;
+    uint8_t fcs = mine->fcs & peer->fcs;
+
+    // COBS has bounded overhead, so it is never much slower than HDLC
+    // and up to twice as fast on data full of flags and escapes.
+    if ((codecs & XID_CODEC_COBS) && (fcs & XID_FCS_CRC8)) {
+        config->codec = CODEC_COBS;
+    } else if ((codecs & XID_CODEC_HDLC) && (fcs & XID_FCS_PARITY)) {
+        config->codec = CODEC_HDLC;
+    } else {
+        printf("[LL] XID: No common codec [mine=0x%02x,peer=0x%02x], using hdlc\n",
+            mine->codecs, peer->codecs);
+        config->codec = CODEC_HDLC;
+    }
+
+    size_t max = mine->max_packet;
+    if (peer->max_packet != 0 && peer->max_packet < max) max = peer->max_packet;
+    config->packetsize = max;
+
+    config->window = mine->window < peer->window ? mine->window : peer->window;
+    if (config->window < 1) config->window = 1;
+
+    config->timeout = mine->timeout > peer->timeout ? mine->timeout : peer->timeout;
+
+    config->offsets = (mine->features & peer->features & XID_FEATURE_OFFSETS) != 0;
+
+    if (peer->baudrate != 0 && peer->baudrate != mine->baudrate) {
+        printf("[LL] XID: Warning: baudrate mismatch [mine=%u,peer=%u]\n",
+            mine->baudrate, peer->baudrate);
+    }
+}
+
+/**
+ * Configuration for a peer that does not answer XID frames: this end's
+ * own options, as before negotiation existed.
+ */
+void xid_fallback(link_config* config) {
+    save_local_options();
+
+    config->packetsize = local_packetsize;
+    config->window = 1;
+    config->codec = frame_codec == CODEC_COBS ? CODEC_COBS : CODEC_HDLC;
+    config->timeout = local_timeout;
+    config->offsets = false; // Nor does it take DATA64 packets
+}
+
+/**
+ * Return this end to its own options, whatever an earlier session
+ * settled on, so that each session negotiates with the peer it meets:
+ * a restarted peer starts over from its own options too.
+ */
+void xid_reset() {
+    link_config config;
+    xid_fallback(&config);
+
+    setFrameCodec(config.codec);
+    setFrameCodecFallback(0);
+    packetsize = config.packetsize;
+    timeout = config.timeout;
+    set_send_offsets(config.offsets);
+}
+
+/**
+ * The codec of a peer with caps that falls back to its own options, as
+ * xid_fallback does there: COBS only if it offers nothing else.
+ */
+int xid_fallback_codec(const link_caps* caps) {
+    return caps->codecs == XID_CODEC_COBS ? CODEC_COBS : CODEC_HDLC;
+}
+
+/**
+ * Switch this end's link layer to config.
+ */
+void xid_apply(const link_config* config) {
+    setFrameCodec(config->codec);
+    packetsize = config->packetsize;
+    timeout = config->timeout;
+    set_send_offsets(config->offsets);
+}
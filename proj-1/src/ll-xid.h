@@ -0,0 +1,69 @@
+#ifndef LL_XID_H___
+#define LL_XID_H___
+
+#include "strings.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// XID information field: a list of T L V parameters, with little-endian
+// values. Unknown parameters are skipped, so newer versions may add more.
+#define XID_MAX_PACKET         0x01 // u32, largest packet accepted
+#define XID_WINDOW             0x02 // u8, frames in flight
+#define XID_FCS                0x03 // u8, mask of XID_FCS_*
+#define XID_CODECS             0x04 // u8, mask of XID_CODEC_*
+#define XID_COMPRESSION        0x05 // u8, mask of compression algorithms
+#define XID_TIMEOUT            0x06 // u16, in ds
+#define XID_BAUDRATE           0x07 // u32
+#define XID_FEATURES           0x08 // u8, mask of XID_FEATURE_*
+
+#define XID_FCS_PARITY         0x01 // XOR bcc2 (HDLC codec)
+#define XID_FCS_CRC8           0x02 // CRC-8 bcc2 (COBS codec)
+
+#define XID_CODEC_HDLC         0x01
+#define XID_CODEC_COBS         0x02
+
+#define XID_FEATURE_OFFSETS    0x01 // DATA64 packets, FILESIZE64 TLVs
+
+/**
+ * One end's capabilities, as advertised in its XID frame.
+ */
+typedef struct {
+    uint32_t max_packet;
+    uint8_t window;
+    uint8_t fcs;
+    uint8_t codecs;
+    uint8_t compression;
+    uint16_t timeout;
+    uint32_t baudrate;
+    uint8_t features;
+} link_caps;
+
+/**
+ * The configuration both ends settle on.
+ */
+typedef struct {
+    size_t packetsize;
+    int window;
+    int codec;
+    int timeout;
+    bool offsets; // Send DATA64 packets and FILESIZE64 TLVs
+} link_config;
+
+void xid_local_caps(link_caps* caps);
+
+void xid_build(const link_caps* caps, string* outp);
+
+int xid_parse(string info, link_caps* caps);
+
+void xid_negotiate(const link_caps* mine, const link_caps* peer, link_config* config);
+
+void xid_fallback(link_config* config);
+
+int xid_fallback_codec(const link_caps* caps);
+
+void xid_reset();
+
+void xid_apply(const link_config* config);
+
+#endif // LL_XID_H___
@@ -1,7 +1,11 @@
 #include "options.h"
 #include "signals.h"
 #include "fileio.h"
-#include "ll-setup.h"
+#include "daemon.h"
+#include "ll-transport.h"
+#include "timing.h"
+#include "trace.h"
+#include "ll-capture.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -20,18 +24,33 @@ int main(int argc, char** argv) {
     parse_args(argc, argv);
     adjust_args();
 
+    // Submitting files does not touch the link.
+    if (submit_socket != NULL) {
+        return submit_files(submit_socket) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    trace_setup(trace_file);
+
     set_signal_handlers();
     test_alarm();
     
-    int fd = setup_link_layer(device);
+    int fd = open_transport(device);
+    capture_setup(capture_file, fd);
 
-    if (my_role == TRANSMITTER) {
+    if (daemon_socket != NULL) {
+        if (my_role == TRANSMITTER) {
+            run_daemon(fd);
+        } else {
+            receive_session_files(fd);
+        }
+    } else if (my_role == TRANSMITTER) {
         send_files(fd);
     } else {
         receive_files(fd);
     }
 
+    export_stats();
+
     sleep(1);
-    reset_link_layer(fd);
+    close_transport(fd);
     return 0;
 }
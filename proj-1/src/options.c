@@ -1,5 +1,7 @@
 #include "options.h"
 #include "ll-setup.h"
+#include "ll-errors.h"
+#include "trace.h"
 #include "debug.h"
 
 #include <unistd.h>
@@ -11,6 +13,7 @@
 #include <locale.h>
 #include <wchar.h>
 #include <limits.h>
+#include <time.h>
 
 // <!--- OPTIONS
 static int show_help = false; // h, help
@@ -22,7 +25,11 @@ int time_retries = TIME_RETRIES_DEFAULT; // time-retries
 int answer_retries = ANSWER_RETRIES_DEFAULT; // answer-retries
 int timeout = TIMEOUT_DEFAULT; // timeout
 int baudrate = BAUDRATE_DEFAULT;
+int low_latency = LOW_LATENCY_DEFAULT; // low-latency
+int flow_control = FLOW_DEFAULT; // flow
 char* device = DEVICE_DEFAULT; // d, device
+int transport_type = TRANSPORT_DEFAULT; // transport
+int io_engine = IO_ENGINE_DEFAULT; // io-engine
 size_t packetsize = PACKETSIZE_DEFAULT; // p, packetsize
 int send_filesize = PACKET_FILESIZE_DEFAULT; // filesize, no-filesize
 int send_filename = PACKET_FILENAME_DEFAULT; // filename, no-filename
@@ -31,7 +38,16 @@ const char* role_string = NULL;
 double h_error_prob = H_ERROR_PROB_DEFAULT; // header-p
 double f_error_prob = F_ERROR_PROB_DEFAULT; // frame-p
 int error_type = ETYPE_DEFAULT; // error-byte, error-frame
+static int seed_given = false; // seed
+int frame_codec = CODEC_DEFAULT; // codec
 int show_statistics = STATS_DEFAULT;
+int stats_format = STATS_FORMAT_DEFAULT; // stats-format
+char* stats_file = NULL; // stats-file
+char* trace_file = TRACE_FILE_DEFAULT; // trace-file
+char* capture_file = NULL; // capture
+char* daemon_socket = NULL; // daemon
+int number_of_channels = CHANNELS_DEFAULT; // channels
+char* submit_socket = NULL; // submit
 
 // Positional
 char** files = NULL;
@@ -52,7 +68,11 @@ static const struct option long_options[] = {
     {TIMEOUT_LFLAG,           required_argument, NULL,              TIMEOUT_FLAG},
     {BAUDRATE_LFLAG,          required_argument, NULL,             BAUDRATE_FLAG},
     {DEVICE_LFLAG,            required_argument, NULL,               DEVICE_FLAG},
+    {TRANSPORT_LFLAG,         required_argument, NULL,            TRANSPORT_FLAG},
+    {IO_ENGINE_LFLAG,         required_argument, NULL,            IO_ENGINE_FLAG},
     {PACKETSIZE_LFLAG,        required_argument, NULL,           PACKETSIZE_FLAG},
+    {LOW_LATENCY_LFLAG,             no_argument, &low_latency,              true},
+    {FLOW_LFLAG,              required_argument, NULL,                 FLOW_FLAG},
     //{PACKET_FILESIZE_LFLAG,         no_argument, &send_filesize,            true},
     //{PACKET_NOFILESIZE_LFLAG,       no_argument, &send_filesize,           false},
     //{PACKET_FILENAME_LFLAG,         no_argument, &send_filename,            true},
@@ -61,11 +81,21 @@ static const struct option long_options[] = {
     {RECEIVER_LFLAG,                no_argument, NULL,             RECEIVER_FLAG},
     {HEADER_ERROR_P_LFLAG,    required_argument, NULL,       HEADER_ERROR_P_FLAG},
     {FRAME_ERROR_P_LFLAG,     required_argument, NULL,        FRAME_ERROR_P_FLAG},
+    {SEED_LFLAG,              required_argument, NULL,                 SEED_FLAG},
     {ETYPE_BYTE_LFLAG,              no_argument, &error_type,         ETYPE_BYTE},
     {ETYPE_FRAME_LFLAG,             no_argument, &error_type,        ETYPE_FRAME},
+    {CODEC_LFLAG,             required_argument, NULL,                CODEC_FLAG},
     {NOSTATS_LFLAG,                 no_argument, &show_statistics,    STATS_NONE},
     {STATS_LFLAG,                   no_argument, &show_statistics,    STATS_LONG},
     {COMPACT_LFLAG,                 no_argument, &show_statistics, STATS_COMPACT},
+    {STATS_FORMAT_LFLAG,      required_argument, NULL,         STATS_FORMAT_FLAG},
+    {STATS_FILE_LFLAG,        required_argument, NULL,           STATS_FILE_FLAG},
+    {TRACE_LFLAG,             required_argument, NULL,                TRACE_FLAG},
+    {TRACE_FILE_LFLAG,        required_argument, NULL,           TRACE_FILE_FLAG},
+    {CAPTURE_LFLAG,           required_argument, NULL,              CAPTURE_FLAG},
+    {DAEMON_LFLAG,            optional_argument, NULL,               DAEMON_FLAG},
+    {CHANNELS_LFLAG,          required_argument, NULL,             CHANNELS_FLAG},
+    {SUBMIT_LFLAG,            required_argument, NULL,               SUBMIT_FLAG},
     // end of options
     {0, 0, 0, 0}
     // format: {const char* lflag, int has_arg, int* flag, int val}
@@ -95,6 +125,10 @@ static const wchar_t* usage = L"usage:\n"
     "When RECEIVER:                                                       \n"
     "    ./ll -r [option...] number_of_files                              \n"
     "                                                                     \n"
+    "As a daemon, and to submit files to a transmitter daemon:            \n"
+    "    ./ll -t|-r --daemon[=S] [option...]                              \n"
+    "    ./ll --submit=S files...                                         \n"
+    "                                                                     \n"
     "Send one or more files through a device using a layered protocol.    \n"
     "                                                                     \n"
     "General:                                                             \n"
@@ -114,9 +148,31 @@ static const wchar_t* usage = L"usage:\n"
     "                                 [Default is 10]                     \n"
     "  -b, --baudrate=N             Set the connection's baudrate.        \n"
     "                               Should be equal for T and R.          \n"
+    "                               Rates other than the standard ones    \n"
+    "                               (up to 4000000 or more on USB-serial) \n"
+    "                               are set if the driver supports them.  \n"
     "                                 [Default is 115200]                 \n"
+    "      --low-latency            Have the serial driver and reads pass \n"
+    "                               on bytes as soon as they arrive.      \n"
+    "      --flow=F                 Flow control, none, rtscts or xonxoff.\n"
+    "                               With xonxoff, XON and XOFF bytes are  \n"
+    "                               escaped, and the codec is hdlc.       \n"
+    "                               Should be equal for T and R.          \n"
+    "                                 [Default is none]                   \n"
     "  -d, --device=S               Set the device.                       \n"
     "                                 [Default is /dev/ttyS0]             \n"
+    "      --transport=T            Run the link over serial, pipe, tcp,  \n"
+    "                               udp or shm. The device is then a tty, \n"
+    "                               a FIFO pair S.tr/S.rt or fds \"R,W\",   \n"
+    "                               host:port (R listens), or a shared    \n"
+    "                               memory name such as /ll.              \n"
+    "                                 [Default is serial]                 \n"
+    "      --io-engine=E            I/O engine, poll or uring. With uring,\n"
+    "                               link reads, frame writes, and file    \n"
+    "                               reads ahead and writes behind are all \n"
+    "                               in flight at once. Needs a build with \n"
+    "                               make IO_URING=1, and a link over fds. \n"
+    "                                 [Default is uring if built, or poll]\n"
     "  -s, --packetsize=N           Set the packets' size, in bytes.      \n"
     "                               * Relevant only for the Transmitter.  \n"
     "                                 [Default is 1024 bytes]             \n"
@@ -137,9 +193,50 @@ static const wchar_t* usage = L"usage:\n"
     "                               Introducing errors per-byte may cause \n"
     "                               corrupted messages to pass undetected,\n"
     "                               corrupting the output file(s).        \n"
+    "      --seed=N                 Seed for the error injection PRNG.    \n"
+    "                               Equal seeds reproduce equal errors.   \n"
+    "                                 [Default is taken from the clock]   \n"
+    "      --codec=C                Framing codec for I frames, auto,     \n"
+    "                               hdlc or cobs. COBS adds at most 1     \n"
+    "                               byte per 254, whatever the data.      \n"
+    "                               With auto, T and R agree on the best  \n"
+    "                               both support when the link opens.     \n"
+    "                               Peers without negotiation use hdlc.   \n"
+    "                                 [Default is auto]                   \n"
     "      --no-stats,                                                    \n"
     "      --compact,                                                     \n"
     "      --stats                  Show performance statistics.          \n"
+    "      --stats-format=F         Export the batch's counters and       \n"
+    "                               per-frame histograms after the last   \n"
+    "                               file, as text, json or csv.           \n"
+    "                                 [Default is text (no export)]       \n"
+    "      --stats-file=S           Write the export to file S.           \n"
+    "                                 [Default is stdout]                 \n"
+    "      --trace=C,...            Record binary traces for categories   \n"
+    "                               ll, frame, corr, app, file, xid,      \n"
+    "                               daemon, bytes (every byte read) or    \n"
+    "                               all (all but bytes).                  \n"
+    "                               Dumped at exit and on SIGUSR1,        \n"
+    "                               decoded with ./lltrace.               \n"
+    "                                 [Default is none]                   \n"
+    "      --trace-file=S           Set the trace dump file.              \n"
+    "                                 [Default is ll.trace]               \n"
+    "      --capture=S              Record the bytes read and written on  \n"
+    "                               the link, timestamped, into file S.   \n"
+    "                               Replayed offline with ./llreplay.     \n"
+    "      --daemon[=S]             Open the link once and keep it open.  \n"
+    "                               T sends the files submitted to the    \n"
+    "                               Unix-domain socket S as they come;    \n"
+    "                               R receives files until T closes.      \n"
+    "                               SIGINT or SIGTERM close the link.     \n"
+    "                                 [Default socket is ll.sock]         \n"
+    "      --channels=N             Files a T daemon sends at once, with  \n"
+    "                               their packets interleaved fairly, so  \n"
+    "                               small files are not stuck behind big  \n"
+    "                               ones. At most 16.                     \n"
+    "                                 [Default is 1]                      \n"
+    "      --submit=S               Queue files on the T daemon listening \n"
+    "                               on S, and wait until they are sent.   \n"
     "\n";
 
 /**
@@ -158,7 +255,11 @@ static void dump_options() {
         " answer_retries: %d       \n"
         " timeout: %d              \n"
         " baudrate: %d             \n"
+        " low_latency: %d          \n"
+        " flow_control: %s         \n"
         " device: %s               \n"
+        " transport_type: %d       \n"
+        " io_engine: %s            \n"
         " packetsize: %lu          \n"
         " my_role: %d (T=%d, R=%d) \n"
         " number_of_files: %d      \n"
@@ -166,12 +267,31 @@ static void dump_options() {
         " header-p: %lf            \n"
         " frame-p: %lf             \n"
         " show_statistics: %d      \n"
+        " seed: %llu               \n"
+        " frame_codec: %s          \n"
+        " stats_format: %d         \n"
+        " stats_file: %s           \n"
+        " trace_mask: 0x%02x        \n"
+        " trace_file: %s           \n"
+        " capture_file: %s         \n"
+        " daemon_socket: %s        \n"
+        " number_of_channels: %d   \n"
+        " submit_socket: %s        \n"
         "\n";
 
     printf(dump_string, show_help, show_usage, show_version, time_retries,
-        answer_retries, timeout, baudrate, device, packetsize, my_role,
+        answer_retries, timeout, baudrate, low_latency,
+        flow_control == FLOW_XONXOFF ? "xonxoff"
+            : flow_control == FLOW_RTSCTS ? "rtscts" : "none", device,
+        transport_type, io_engine == IO_ENGINE_URING ? "uring" : "poll", packetsize, my_role,
         TRANSMITTER, RECEIVER, number_of_files, files, h_error_prob,
-        f_error_prob, show_statistics);
+        f_error_prob, show_statistics, get_error_seed(),
+        frame_codec == CODEC_COBS ? "cobs"
+            : frame_codec == CODEC_HDLC ? "hdlc" : "auto", stats_format,
+        stats_file ? stats_file : "(stdout)", trace_mask, trace_file,
+        capture_file ? capture_file : "(none)",
+        daemon_socket ? daemon_socket : "(none)", number_of_channels,
+        submit_socket ? submit_socket : "(none)");
 
     if (files != NULL) {
         for (size_t i = 0; i < number_of_files; ++i) {
@@ -181,7 +301,7 @@ static void dump_options() {
 }
 
 static void exit_usage() {
-    if (DUMP_OPTIONS || dump) dump_options();
+    if (dump) dump_options();
 
     setlocale(LC_ALL, "");
     printf("%ls", usage);
@@ -189,7 +309,7 @@ static void exit_usage() {
 }
 
 static void exit_version() {
-    if (DUMP_OPTIONS || dump) dump_options();
+    if (dump) dump_options();
 
     setlocale(LC_ALL, "");
     printf("%ls", version);
@@ -197,7 +317,7 @@ static void exit_version() {
 }
 
 static void exit_nofiles() {
-    if (DUMP_OPTIONS || dump) dump_options();
+    if (dump) dump_options();
 
     setlocale(LC_ALL, "");
     printf("[ARGS] Error: Expected 1 or more positionals (filenames), but got none.\n");
@@ -206,7 +326,7 @@ static void exit_nofiles() {
 }
 
 static void exit_nonumber(int n) {
-    if (DUMP_OPTIONS || dump) dump_options();
+    if (dump) dump_options();
 
     setlocale(LC_ALL, "");
     printf("[ARGS] Error: Expected 1 positionals (number of files), but got %d.\n", n);
@@ -215,7 +335,7 @@ static void exit_nonumber(int n) {
 }
 
 static void exit_badpos(int n, const char* pos) {
-    if (DUMP_OPTIONS || dump) dump_options();
+    if (dump) dump_options();
 
     setlocale(LC_ALL, "");
     printf("[ARGS] Error: Bad positional #%d: %s.\n%ls", n, pos, usage);
@@ -223,7 +343,7 @@ static void exit_badpos(int n, const char* pos) {
 }
 
 static void exit_badarg(const char* option) {
-    if (DUMP_OPTIONS || dump) dump_options();
+    if (dump) dump_options();
 
     setlocale(LC_ALL, "");
     printf("[ARGS] Error: Bad argument for option %s.\n%ls", option, usage);
@@ -254,6 +374,19 @@ static int parse_double(const char* str, double* outp) {
     return 0;
 }
 
+static int parse_ullong(const char* str, unsigned long long* outp) {
+    char* endp;
+    errno = 0;
+    unsigned long long result = strtoull(str, &endp, 0);
+
+    if (endp == str || *endp != '\0' || errno == ERANGE) {
+        return 1;
+    }
+
+    *outp = result;
+    return 0;
+}
+
 static int parse_ulong(const char* str, size_t* outp) {
     char* endp;
     long result = strtol(str, &endp, 10);
@@ -276,6 +409,8 @@ void parse_args(int argc, char** argv) {
 
     atexit(clear_options);
 
+    unsigned long long seed;
+
     // Standard getopt_long Options Loop
     while (true) {
         int c, lindex = 0;
@@ -351,6 +486,96 @@ void parse_args(int argc, char** argv) {
                 exit_badarg(FRAME_ERROR_P_LFLAG);
             }
             break;
+        case SEED_FLAG:
+            if (parse_ullong(optarg, &seed) != 0) {
+                exit_badarg(SEED_LFLAG);
+            }
+            set_error_seed(seed);
+            seed_given = true;
+            break;
+        case TRANSPORT_FLAG:
+            if (strcmp(optarg, "serial") == 0) {
+                transport_type = TRANSPORT_SERIAL;
+            } else if (strcmp(optarg, "pipe") == 0) {
+                transport_type = TRANSPORT_PIPE;
+            } else if (strcmp(optarg, "tcp") == 0) {
+                transport_type = TRANSPORT_TCP;
+            } else if (strcmp(optarg, "udp") == 0) {
+                transport_type = TRANSPORT_UDP;
+            } else if (strcmp(optarg, "shm") == 0) {
+                transport_type = TRANSPORT_SHM;
+            } else {
+                exit_badarg(TRANSPORT_LFLAG);
+            }
+            break;
+        case IO_ENGINE_FLAG:
+            if (strcmp(optarg, "poll") == 0) {
+                io_engine = IO_ENGINE_POLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                io_engine = IO_ENGINE_URING;
+            } else {
+                exit_badarg(IO_ENGINE_LFLAG);
+            }
+            break;
+        case FLOW_FLAG:
+            if (strcmp(optarg, "none") == 0) {
+                flow_control = FLOW_NONE;
+            } else if (strcmp(optarg, "rtscts") == 0) {
+                flow_control = FLOW_RTSCTS;
+            } else if (strcmp(optarg, "xonxoff") == 0) {
+                flow_control = FLOW_XONXOFF;
+            } else {
+                exit_badarg(FLOW_LFLAG);
+            }
+            break;
+        case CODEC_FLAG:
+            if (strcmp(optarg, "auto") == 0) {
+                frame_codec = CODEC_AUTO;
+            } else if (strcmp(optarg, "hdlc") == 0) {
+                frame_codec = CODEC_HDLC;
+            } else if (strcmp(optarg, "cobs") == 0) {
+                frame_codec = CODEC_COBS;
+            } else {
+                exit_badarg(CODEC_LFLAG);
+            }
+            break;
+        case STATS_FORMAT_FLAG:
+            if (strcmp(optarg, "text") == 0) {
+                stats_format = STATS_FORMAT_TEXT;
+            } else if (strcmp(optarg, "json") == 0) {
+                stats_format = STATS_FORMAT_JSON;
+            } else if (strcmp(optarg, "csv") == 0) {
+                stats_format = STATS_FORMAT_CSV;
+            } else {
+                exit_badarg(STATS_FORMAT_LFLAG);
+            }
+            break;
+        case STATS_FILE_FLAG:
+            stats_file = optarg;
+            break;
+        case TRACE_FLAG:
+            if (trace_enable(optarg) != 0) {
+                exit_badarg(TRACE_LFLAG);
+            }
+            break;
+        case TRACE_FILE_FLAG:
+            trace_file = optarg;
+            break;
+        case CAPTURE_FLAG:
+            capture_file = optarg;
+            break;
+        case DAEMON_FLAG:
+            daemon_socket = optarg ? optarg : DAEMON_SOCKET_DEFAULT;
+            break;
+        case CHANNELS_FLAG:
+            if (parse_int(optarg, &number_of_channels) != 0
+              || number_of_channels < 1 || number_of_channels > CHANNELS_MAX) {
+                exit_badarg(CHANNELS_LFLAG);
+            }
+            break;
+        case SUBMIT_FLAG:
+            submit_socket = optarg;
+            break;
         case '?':
         default:
             // getopt_long already printed an error message.
@@ -366,11 +591,30 @@ void parse_args(int argc, char** argv) {
         exit_version();
     }
 
+    // COBS output holds any byte, XON and XOFF included.
+    if (flow_control == FLOW_XONXOFF && frame_codec == CODEC_COBS) {
+        exit_badarg(CODEC_LFLAG);
+    }
+
+    // Submitting takes files, as T does.
+    if (submit_socket != NULL) my_role = TRANSMITTER;
+
     role_string = my_role == TRANSMITTER ? "Transmitter" : "Receiver";
 
+    if (!seed_given) {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        set_error_seed((unsigned long long)t.tv_sec * 1000000000llu + t.tv_nsec);
+    }
+
+    printf("[SETUP] Error injection seed %llu\n", get_error_seed());
+
     // Positional arguments processing
     switch (my_role) {
     case TRANSMITTER:
+        // A daemon's files are submitted later.
+        if (optind == argc && daemon_socket != NULL) break;
+
         if (optind == argc) {
             exit_nofiles();
         }
@@ -384,6 +628,9 @@ void parse_args(int argc, char** argv) {
 
         break;
     case RECEIVER:
+        // A daemon receives until T closes the link.
+        if (optind == argc && daemon_socket != NULL) break;
+
         if (optind + 1 != argc) {
             exit_nonumber(argc - optind);
         }
@@ -395,6 +642,6 @@ void parse_args(int argc, char** argv) {
         break;
     }
 
-    if (DUMP_OPTIONS || dump) dump_options();
+    if (dump) dump_options();
     if (dump) exit(EXIT_SUCCESS);
 }
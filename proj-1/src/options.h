@@ -61,6 +61,37 @@ extern int timeout;
 #define DEVICE_DEFAULT "/dev/ttyS0"
 extern char* device;
 
+// Set the transport the link runs over, which gives the device's meaning:
+//   serial  A termios device path
+//   pipe    FIFOs S.tr and S.rt, or inherited fds "R,W" or "N" (socketpair)
+//   tcp     host:port, R listens and T connects
+//   udp     host:port, R binds and T sends to it
+//   shm     A POSIX shared memory name, holding one SPSC ring per direction
+#define TRANSPORT_FLAG 'E'
+#define TRANSPORT_LFLAG "transport"
+#define TRANSPORT_SERIAL 0
+#define TRANSPORT_PIPE 1
+#define TRANSPORT_TCP 2
+#define TRANSPORT_UDP 3
+#define TRANSPORT_SHM 4
+#define TRANSPORT_REPLAY 5 // A capture, read back by ./llreplay only
+#define TRANSPORT_DEFAULT TRANSPORT_SERIAL
+extern int transport_type;
+
+// I/O engine for the link and files: poll and blocking reads and writes,
+// or io_uring, if built with make IO_URING=1. uring falls back to poll where
+// the kernel or the transport does not support it.
+#define IO_ENGINE_FLAG 'F'
+#define IO_ENGINE_LFLAG "io-engine"
+#define IO_ENGINE_POLL 0
+#define IO_ENGINE_URING 1
+#ifdef IO_URING
+#define IO_ENGINE_DEFAULT IO_ENGINE_URING
+#else
+#define IO_ENGINE_DEFAULT IO_ENGINE_POLL
+#endif
+extern int io_engine;
+
 // Set packet size, in bytes
 #define PACKETSIZE_FLAG 's'
 #define PACKETSIZE_LFLAG "packetsize"
@@ -73,6 +104,23 @@ extern size_t packetsize;
 #define BAUDRATE_DEFAULT 115200
 extern int baudrate;
 
+// Low-latency serial: ASYNC_LOW_LATENCY on the driver, and reads that
+// return bytes as soon as they arrive.
+#define LOW_LATENCY_FLAG // none
+#define LOW_LATENCY_LFLAG "low-latency"
+#define LOW_LATENCY_DEFAULT false
+extern int low_latency;
+
+// Flow control: none, RTS/CTS hardware handshake, or XON/XOFF in-band,
+// for which the stuffing codec also escapes XON and XOFF bytes.
+#define FLOW_FLAG 'D'
+#define FLOW_LFLAG "flow"
+#define FLOW_NONE 0
+#define FLOW_RTSCTS 1
+#define FLOW_XONXOFF 2
+#define FLOW_DEFAULT FLOW_NONE
+extern int flow_control;
+
 // Send or do not send filesize in START packet
 #define PACKET_FILESIZE_FLAG // none
 #define PACKET_FILESIZE_LFLAG "filesize"
@@ -114,6 +162,21 @@ extern double f_error_prob;
 #define ETYPE_DEFAULT ETYPE_FRAME
 extern int error_type;
 
+// Seed for the error injection PRNG (ll-errors)
+#define SEED_FLAG '4'
+#define SEED_LFLAG "seed"
+
+// Framing codec for I frames' data: HDLC-style escaping, or Consistent
+// Overhead Byte Stuffing, whose overhead is at most 1 byte per 254.
+// With auto, the ends agree on one in llopen's XID exchange.
+#define CODEC_FLAG '9'
+#define CODEC_LFLAG "codec"
+#define CODEC_AUTO 0x80
+#define CODEC_HDLC 0x81
+#define CODEC_COBS 0x82
+#define CODEC_DEFAULT CODEC_AUTO
+extern int frame_codec;
+
 #define STATS_FLAG '3'
 #define NOSTATS_LFLAG "no-stats"
 #define STATS_LFLAG "stats"
@@ -123,6 +186,49 @@ extern int error_type;
 #define STATS_COMPACT 2
 #define STATS_DEFAULT STATS_NONE
 extern int show_statistics;
+
+// Machine-readable export of the batch's counters and histograms,
+// written once all files are transferred.
+#define STATS_FORMAT_FLAG '5'
+#define STATS_FORMAT_LFLAG "stats-format"
+#define STATS_FILE_FLAG '6'
+#define STATS_FILE_LFLAG "stats-file"
+#define STATS_FORMAT_TEXT 0
+#define STATS_FORMAT_JSON 1
+#define STATS_FORMAT_CSV 2
+#define STATS_FORMAT_DEFAULT STATS_FORMAT_TEXT
+extern int stats_format;
+extern char* stats_file;
+
+// Runtime tracing into in-memory binary rings, dumped at exit, on
+// SIGUSR1 and on fatal signals. Decode dumps with ./lltrace.
+#define TRACE_FLAG '7'
+#define TRACE_LFLAG "trace"
+#define TRACE_FILE_FLAG '8'
+#define TRACE_FILE_LFLAG "trace-file"
+extern char* trace_file;
+
+// Record every byte read from and written to the link, timestamped, into a
+// capture file, replayed offline with ./llreplay.
+#define CAPTURE_FLAG 'G'
+#define CAPTURE_LFLAG "capture"
+extern char* capture_file; // NULL if not capturing
+
+// Daemon mode: the link is opened once and kept open. T sends the files of
+// jobs submitted to a Unix-domain socket, back to back; R receives files
+// until T closes the link. Jobs are submitted with --submit.
+#define DAEMON_FLAG 'A'
+#define DAEMON_LFLAG "daemon"
+#define DAEMON_SOCKET_DEFAULT "ll.sock"
+#define CHANNELS_FLAG 'C'
+#define CHANNELS_LFLAG "channels"
+#define CHANNELS_DEFAULT 1
+#define CHANNELS_MAX 16
+#define SUBMIT_FLAG 'B'
+#define SUBMIT_LFLAG "submit"
+extern char* daemon_socket; // NULL if not a daemon
+extern int number_of_channels; // Files in flight at once, for T daemons
+extern char* submit_socket; // NULL if not submitting
 // ----> END OF OPTIONS
 
 // <!--- POSITIONAL
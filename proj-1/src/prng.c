@@ -0,0 +1,81 @@
+#include "prng.h"
+
+#include <math.h>
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15llu);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9llu;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebllu;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Seeds the generator from a 64-bit seed and a stream identifier,
+ * expanding both through splitmix64 as recommended by the xoshiro authors.
+ * Equal (seed, stream) pairs always produce the same sequence.
+ *
+ * @param rng    Generator to seed
+ * @param seed   User seed (e.g. from --seed)
+ * @param stream Stream identifier, distinct per link
+ */
+void prng_seed(prng_t* rng, uint64_t seed, uint64_t stream) {
+    uint64_t x = seed ^ splitmix64(&stream);
+
+    for (size_t i = 0; i < 4; ++i) {
+        rng->s[i] = splitmix64(&x);
+    }
+}
+
+/**
+ * xoshiro256** next output.
+ */
+uint64_t prng_next(prng_t* rng) {
+    uint64_t* s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+/**
+ * Uniform double in [0, 1), using the top 53 bits.
+ */
+double prng_double(prng_t* rng) {
+    return (prng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * Uniform integer in [0, n), without modulo bias on the low bits.
+ * n must be > 0.
+ */
+size_t prng_below(prng_t* rng, size_t n) {
+    return (size_t)(((unsigned __int128)prng_next(rng) * n) >> 64);
+}
+
+/**
+ * Number of failed Bernoulli(p) trials before the first success.
+ * Used to skip directly to the next corrupted byte instead of drawing
+ * one number per byte.
+ *
+ * @return SIZE_MAX if p <= 0 (never succeeds), 0 if p >= 1
+ */
+size_t prng_geometric(prng_t* rng, double p) {
+    if (p <= 0.0) return SIZE_MAX;
+    if (p >= 1.0) return 0;
+
+    double u = 1.0 - prng_double(rng); // (0, 1]
+    double g = floor(log(u) / log1p(-p));
+
+    return g >= (double)SIZE_MAX ? SIZE_MAX : (size_t)g;
+}
@@ -0,0 +1,25 @@
+#ifndef PRNG_H___
+#define PRNG_H___
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * xoshiro256** pseudo random number generator state.
+ * Each link owns one of these, so independent links never share a stream.
+ */
+typedef struct {
+    uint64_t s[4];
+} prng_t;
+
+void prng_seed(prng_t* rng, uint64_t seed, uint64_t stream);
+
+uint64_t prng_next(prng_t* rng);
+
+double prng_double(prng_t* rng);
+
+size_t prng_below(prng_t* rng, size_t n);
+
+size_t prng_geometric(prng_t* rng, double p);
+
+#endif // PRNG_H___
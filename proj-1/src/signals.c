@@ -1,5 +1,7 @@
 #include "signals.h"
 #include "options.h"
+#include "trace.h"
+#include "ll-capture.h"
 #include "debug.h"
 
 #include <unistd.h>
@@ -18,27 +20,36 @@
 static const char str_kill[]  = "[SIG] -- Terminating...\n";
 static const char str_abort[] = "[SIG] -- Aborting...\n";
 static const char str_alarm[] = "[SIG] -- Alarmed...\n";
+static const char str_dump[]  = "[SIG] -- Dumping trace...\n";
 
 static volatile sig_atomic_t alarmed = 0;
 
 // SIGHUP, SIGQUIT, SIGTERM, SIGINT
 static void sighandler_kill(int signum) {
-    if (TRACE_SIG) write(STDOUT_FILENO, str_kill, strlen(str_kill));
+    write(STDOUT_FILENO, str_kill, strlen(str_kill));
     exit(EXIT_FAILURE);
 }
 
 // SIGABRT
 static void sighandler_abort(int signum) {
-    if (TRACE_SIG) write(STDOUT_FILENO, str_abort, strlen(str_abort));
+    write(STDOUT_FILENO, str_abort, strlen(str_abort));
+    trace_dump(); // abort() skips atexit
+    capture_flush();
     abort();
 }
 
 // SIGALRM
 static void sighandler_alarm(int signum) {
-    if (TRACE_SIG) write(STDOUT_FILENO, str_alarm, strlen(str_alarm));
+    write(STDOUT_FILENO, str_alarm, strlen(str_alarm));
     alarmed = 1;
 }
 
+// SIGUSR1
+static void sighandler_dump(int signum) {
+    write(STDOUT_FILENO, str_dump, strlen(str_dump));
+    trace_dump();
+}
+
 /**
  * Set the process's signal handlers and overall dispositions
  */
@@ -101,7 +112,18 @@ int set_signal_handlers() {
         exit(EXIT_FAILURE);
     }
 
-    if (TRACE_SETUP) printf("[SIG] Set all signal handlers\n");
+    // Set trace dump handler
+    sigmask = current;
+    action.sa_handler = sighandler_dump;
+    action.sa_mask = sigmask;
+    action.sa_flags = SA_RESTART;
+    s = sigaction(SIGUSR1, &action, NULL);
+    if (s != 0) {
+        printf("[SIG] Error setting handler for SIGUSR1: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    printf("[SIG] Set all signal handlers\n");
     return 0;
 }
 
@@ -154,7 +176,7 @@ void test_alarm() {
     unset_alarm();
     errno = 0;
 
-    if (TRACE_SETUP) printf("[SETUP] Passed test_alarm()\n");
+    printf("[SETUP] Passed test_alarm()\n");
 }
 
 void await_timeout() {
@@ -1,17 +1,28 @@
 #include "timing.h"
+#include "app-layer.h"
 #include "ll-errors.h"
 #include "debug.h"
 #include "options.h"
+#include "ll-setup.h"
+#include "ll-uring.h"
+#include "trace.h"
 
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
 
 static struct timespec timestamp[3];
 static double times[3];
 
+// Batch totals, accumulated by account_file()
+static size_t batch_files = 0;
+static size_t batch_bytes = 0;
+static double batch_ms = 0.0;
+
 size_t number_of_packets(size_t filesize) {
     return (filesize + packetsize - 1) / packetsize;
 }
@@ -20,6 +31,21 @@ double average_packetsize(size_t filesize) {
     return (double)filesize / number_of_packets(filesize);
 }
 
+/**
+ * Formats the link's overruns count into buf, or n/a if it is not kept.
+ *
+ * @return buf
+ */
+static const char* overruns_string(char buf[static 24]) {
+    long overruns = link_overruns();
+    if (overruns >= 0) {
+        snprintf(buf, 24, "%ld", overruns);
+    } else {
+        snprintf(buf, 24, "n/a");
+    }
+    return buf;
+}
+
 static void print_stats_compact(size_t i, size_t filesize) {
     static const char* stats_string = "[STATS %s]\n"
         "==STATS==  %.5lf seconds                      \n"
@@ -96,8 +122,10 @@ static void print_stats_receiver(size_t i, size_t filesize) {
         "==STATS==    %6d Bad frame length                    \n"
         "==STATS==    %6d Bad BCC1                            \n"
         "==STATS==    %6d Bad BCC2                            \n"
+        "==STATS==    %6s Overruns (driver, since setup)      \n"
         "==STATS==\n";
 
+    char overruns[24];
     double ms = times[i];
     double s = ms / 1000.0;
     double h = h_error_prob, f = f_error_prob;
@@ -105,7 +133,7 @@ static void print_stats_receiver(size_t i, size_t filesize) {
     double ferI = h + f - (h * f);
     int numpackets = number_of_packets(filesize);
     int average = average_packetsize(filesize);
-    int frameIsize = 10 + average;
+    int frameIsize = 6 + DATA64_HEADER_SIZE + average;
 
     // Observed
     double obs_bits = 8.0 * filesize / s;
@@ -113,13 +141,13 @@ static void print_stats_receiver(size_t i, size_t filesize) {
     double obs_packs = obs_bytes / average_packetsize(filesize);
 
     // Maximum
-    double max_bits = baudrate;
-    double max_bytes = baudrate / 8.0;
+    double max_bits = link_baudrate();
+    double max_bytes = link_baudrate() / 8.0;
     double max_packs = max_bytes / average_packetsize(filesize);
 
     printf(stats_string,
         s, h, f, ferI,
-        baudrate,
+        link_baudrate(),
         average,
         frameIsize,
         numpackets,
@@ -136,7 +164,8 @@ static void print_stats_receiver(size_t i, size_t filesize) {
         counter.out.REJ[0], counter.out.REJ[1],
         counter.read.len,
         counter.read.bcc1,
-        counter.read.bcc2);
+        counter.read.bcc2,
+        overruns_string(overruns));
 }
 
 static void print_stats_transmitter(size_t i, size_t filesize) {
@@ -165,15 +194,17 @@ static void print_stats_transmitter(size_t i, size_t filesize) {
         "==STATS==    %6d Bad frame length                    \n"
         "==STATS==    %6d Bad BCC1                            \n"
         "==STATS==    %6d Bad BCC2                            \n"
+        "==STATS==    %6s Overruns (driver, since setup)      \n"
         "==STATS==\n";
 
+    char overruns[24];
     double ms = times[i];
     double s = ms / 1000.0;
     double h = h_error_prob;
 
     int numpackets = number_of_packets(filesize);
     int average = average_packetsize(filesize);
-    int frameIsize = 10 + average;
+    int frameIsize = 6 + DATA64_HEADER_SIZE + average;
 
     // Observed
     double obs_bits = 8.0 * filesize / s;
@@ -181,13 +212,13 @@ static void print_stats_transmitter(size_t i, size_t filesize) {
     double obs_packs = obs_bytes / average_packetsize(filesize);
 
     // Maximum
-    double max_bits = baudrate;
-    double max_bytes = baudrate / 8.0;
+    double max_bits = link_baudrate();
+    double max_bytes = link_baudrate() / 8.0;
     double max_packs = max_bytes / average_packetsize(filesize);
 
     printf(stats_string,
         s, h,
-        baudrate,
+        link_baudrate(),
         average,
         frameIsize,
         numpackets,
@@ -204,7 +235,8 @@ static void print_stats_transmitter(size_t i, size_t filesize) {
         counter.invalid,
         counter.read.len,
         counter.read.bcc1,
-        counter.read.bcc2);
+        counter.read.bcc2,
+        overruns_string(overruns));
 }
 
 void print_stats(size_t i, size_t filesize) {
@@ -219,10 +251,8 @@ void print_stats(size_t i, size_t filesize) {
     }
 }
 
-void begin_timing(size_t i) {    
-    if (TRACE_TIME) {
-        printf("[TIME] START Timing [%lu]\n", i);
-    }
+void begin_timing(size_t i) {
+    TRACE_EVENT(TRACE_CAT_FILE, TEV_TIMING, i, 0, 0);
 
     times[i] = 0.0;
     clock_gettime(CLOCK_MONOTONIC, &timestamp[i]);
@@ -232,17 +262,176 @@ void end_timing(size_t i) {
     struct timespec end;
     clock_gettime(CLOCK_MONOTONIC, &end);
 
-    if (TRACE_TIME) {
-        printf("[TIME] END timing [%lu]\n", i);
-    }
-
     double ts = (end.tv_sec - timestamp[i].tv_sec) * 1e3;
     double tns = (end.tv_nsec - timestamp[i].tv_nsec) / 1e6;
     
     times[i] = ts + tns;
     timestamp[i].tv_sec = 0; timestamp[i].tv_nsec = 0;
 
-    if (TRACE_TIME) {
-        printf("[STATS] Time [%lu] [ms=%.1lf]\n", i, times[i]);
+    TRACE_EVENT(TRACE_CAT_FILE, TEV_TIMING, i, (uint64_t)(times[i] * 1e6), 1);
+}
+
+/**
+ * Sets timing slot i to ms, for transfers timed by something else than the
+ * clock, such as the captures ./llreplay replays.
+ */
+void set_timing(size_t i, double ms) {
+    times[i] = ms;
+}
+
+uint64_t monotonic_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000lu + (uint64_t)t.tv_nsec;
+}
+
+/**
+ * Add a finished file, timed by timing slot i, to the batch totals.
+ */
+void account_file(size_t i, size_t filesize) {
+    ++batch_files;
+    batch_bytes += filesize;
+    batch_ms += times[i];
+}
+
+static void export_frame_count_json(FILE* out, const frame_count_t* fc) {
+    fprintf(out, "{\"I0\": %lu, \"I1\": %lu, \"RR0\": %lu, \"RR1\": %lu, "
+        "\"REJ0\": %lu, \"REJ1\": %lu, \"SET\": %lu, \"DISC\": %lu, \"UA\": %lu, "
+        "\"XID\": %lu}",
+        fc->I[0], fc->I[1], fc->RR[0], fc->RR[1], fc->REJ[0], fc->REJ[1],
+        fc->SET, fc->DISC, fc->UA, fc->XID);
+}
+
+static void export_frame_count_csv(FILE* out, const char* name, const frame_count_t* fc) {
+    fprintf(out, "%s,I0,%lu\n%s,I1,%lu\n", name, fc->I[0], name, fc->I[1]);
+    fprintf(out, "%s,RR0,%lu\n%s,RR1,%lu\n", name, fc->RR[0], name, fc->RR[1]);
+    fprintf(out, "%s,REJ0,%lu\n%s,REJ1,%lu\n", name, fc->REJ[0], name, fc->REJ[1]);
+    fprintf(out, "%s,SET,%lu\n%s,DISC,%lu\n%s,UA,%lu\n", name, fc->SET,
+        name, fc->DISC, name, fc->UA);
+    fprintf(out, "%s,XID,%lu\n", name, fc->XID);
+}
+
+/**
+ * @return The CPU time used so far, user and system, in ms
+ */
+static double cpu_ms() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+}
+
+static void export_stats_json(FILE* out, double s, double bits) {
+    const communication_count_t* c = &batch_counter;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"role\": \"%s\",\n", role_string);
+    fprintf(out, "  \"baudrate\": %d,\n", link_baudrate());
+    fprintf(out, "  \"packetsize\": %lu,\n", packetsize);
+    fprintf(out, "  \"timeout\": %d,\n", timeout);
+    fprintf(out, "  \"header_p\": %.6f,\n", h_error_prob);
+    fprintf(out, "  \"frame_p\": %.6f,\n", f_error_prob);
+    fprintf(out, "  \"seed\": %llu,\n", get_error_seed());
+    fprintf(out, "  \"files\": %lu,\n", batch_files);
+    fprintf(out, "  \"bytes\": %lu,\n", batch_bytes);
+    fprintf(out, "  \"seconds\": %.6f,\n", s);
+    fprintf(out, "  \"bits_per_second\": %.3f,\n", bits);
+    fprintf(out, "  \"efficiency\": %.6f,\n", bits / link_baudrate());
+    fprintf(out, "  \"io\": {\"engine\": \"%s\", \"syscalls\": %lu, \"cpu_ms\": %.3f, "
+        "\"cpu_ms_per_mb\": %.3f},\n", uring_active() ? "uring" : "poll",
+        io_syscalls, cpu_ms(), batch_bytes ? cpu_ms() * 1e6 / batch_bytes : 0.0);
+    fprintf(out, "  \"counters\": {\n");
+    fprintf(out, "    \"in\": ");
+    export_frame_count_json(out, &c->in);
+    fprintf(out, ",\n    \"out\": ");
+    export_frame_count_json(out, &c->out);
+    fprintf(out, ",\n    \"read\": {\"len\": %lu, \"bcc1\": %lu, \"bcc2\": %lu, ",
+        c->read.len, c->read.bcc1, c->read.bcc2);
+    long overruns = link_overruns();
+    if (overruns >= 0) {
+        fprintf(out, "\"overruns\": %ld},\n", overruns);
+    } else {
+        fprintf(out, "\"overruns\": null},\n");
+    }
+    fprintf(out, "    \"invalid\": %lu,\n", c->invalid);
+    fprintf(out, "    \"timeout\": %lu\n", c->timeout);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"histograms\": {\n");
+    fprintf(out, "    \"service_ns\": ");
+    hist_print_json(out, &metrics.service);
+    fprintf(out, ",\n    \"rtt_ns\": ");
+    hist_print_json(out, &metrics.rtt);
+    fprintf(out, ",\n    \"retransmissions\": ");
+    hist_print_json(out, &metrics.retransmissions);
+    fprintf(out, ",\n    \"stuffing_permille\": ");
+    hist_print_json(out, &metrics.stuffing);
+    fprintf(out, "\n  }\n}\n");
+}
+
+static void export_stats_csv(FILE* out, double s, double bits) {
+    const communication_count_t* c = &batch_counter;
+
+    fprintf(out, "metric,field,value\n");
+    fprintf(out, "link,role,%s\n", role_string);
+    fprintf(out, "link,baudrate,%d\n", link_baudrate());
+    fprintf(out, "link,packetsize,%lu\n", packetsize);
+    fprintf(out, "link,timeout,%d\n", timeout);
+    fprintf(out, "link,header_p,%.6f\n", h_error_prob);
+    fprintf(out, "link,frame_p,%.6f\n", f_error_prob);
+    fprintf(out, "link,seed,%llu\n", get_error_seed());
+    fprintf(out, "batch,files,%lu\n", batch_files);
+    fprintf(out, "batch,bytes,%lu\n", batch_bytes);
+    fprintf(out, "batch,seconds,%.6f\n", s);
+    fprintf(out, "batch,bits_per_second,%.3f\n", bits);
+    fprintf(out, "batch,efficiency,%.6f\n", bits / link_baudrate());
+    fprintf(out, "io,engine,%s\n", uring_active() ? "uring" : "poll");
+    fprintf(out, "io,syscalls,%lu\n", io_syscalls);
+    fprintf(out, "io,cpu_ms,%.3f\n", cpu_ms());
+    fprintf(out, "io,cpu_ms_per_mb,%.3f\n",
+        batch_bytes ? cpu_ms() * 1e6 / batch_bytes : 0.0);
+    export_frame_count_csv(out, "in", &c->in);
+    export_frame_count_csv(out, "out", &c->out);
+    fprintf(out, "read,len,%lu\nread,bcc1,%lu\nread,bcc2,%lu\n",
+        c->read.len, c->read.bcc1, c->read.bcc2);
+    long overruns = link_overruns();
+    if (overruns >= 0) fprintf(out, "read,overruns,%ld\n", overruns);
+    fprintf(out, "errors,invalid,%lu\nerrors,timeout,%lu\n", c->invalid, c->timeout);
+    hist_print_csv(out, "service_ns", &metrics.service);
+    hist_print_csv(out, "rtt_ns", &metrics.rtt);
+    hist_print_csv(out, "retransmissions", &metrics.retransmissions);
+    hist_print_csv(out, "stuffing_permille", &metrics.stuffing);
+}
+
+/**
+ * Export the batch totals, counters and per-frame histograms in the
+ * format selected by --stats-format, to --stats-file or stdout.
+ * Call after the last file of the batch (and its reset_counter()).
+ */
+void export_stats() {
+    if (stats_format == STATS_FORMAT_TEXT) return;
+
+    FILE* out = stdout;
+    if (stats_file != NULL) {
+        out = fopen(stats_file, "w");
+        if (out == NULL) {
+            printf("[STATS] Error: Failed to open stats file %s [%s]\n",
+                stats_file, strerror(errno));
+            return;
+        }
+    }
+
+    double s = batch_ms / 1000.0;
+    double bits = s > 0.0 ? 8.0 * batch_bytes / s : 0.0;
+
+    if (stats_format == STATS_FORMAT_JSON) {
+        export_stats_json(out, s, bits);
+    } else {
+        export_stats_csv(out, s, bits);
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    } else {
+        fflush(out);
     }
 }
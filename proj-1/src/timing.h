@@ -2,6 +2,7 @@
 #define TIMING_H___
 
 #include <stddef.h>
+#include <stdint.h>
 
 size_t number_of_packets(size_t filesize);
 
@@ -13,4 +14,12 @@ void begin_timing(size_t i);
 
 void end_timing(size_t i);
 
+void set_timing(size_t i, double ms);
+
+uint64_t monotonic_ns();
+
+void account_file(size_t i, size_t filesize);
+
+void export_stats();
+
 #endif // TIMING_H___
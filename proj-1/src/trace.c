@@ -0,0 +1,190 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+/**
+ * One ring per thread. Only the owning thread writes records and advances
+ * head, so recording needs no locks; rings are pushed onto a global
+ * lock-free list the first time their thread traces something.
+ */
+typedef struct trace_ring {
+    struct trace_ring* next;
+    uint32_t tid;
+    _Atomic uint64_t head; // Total records ever written
+    trace_record records[TRACE_RING_SIZE];
+} trace_ring;
+
+unsigned trace_mask = 0;
+
+static _Atomic(trace_ring*) rings = NULL;
+static _Atomic uint32_t next_tid = 1;
+static __thread trace_ring* my_ring = NULL;
+
+static char dump_path[256] = TRACE_FILE_DEFAULT;
+
+static const char* event_names[TEV_COUNT] = {
+    [TEV_NONE]         = "NONE",
+    [TEV_FRAME_WRITE]  = "FRAME_WRITE",
+    [TEV_FRAME_READ]   = "FRAME_READ",
+    [TEV_CORRUPT]      = "CORRUPT",
+    [TEV_LLOPEN]       = "LLOPEN",
+    [TEV_LLCLOSE]      = "LLCLOSE",
+    [TEV_LLWRITE]      = "LLWRITE",
+    [TEV_LLREAD]       = "LLREAD",
+    [TEV_APP_SEND]     = "APP_SEND",
+    [TEV_APP_RECV]     = "APP_RECV",
+    [TEV_FILE_BEGIN]   = "FILE_BEGIN",
+    [TEV_FILE_END]     = "FILE_END",
+    [TEV_FILE_CHECK]   = "FILE_CHECK",
+    [TEV_TIMING]       = "TIMING",
+    [TEV_APP_OFFSET]   = "APP_OFFSET",
+    [TEV_APP_TLV]      = "APP_TLV",
+    [TEV_LL_ASSUME]    = "LL_ASSUME",
+    [TEV_READ_ERROR]   = "READ_ERROR",
+    [TEV_READ_BYTE]    = "READ_BYTE",
+    [TEV_DECODE_ERROR] = "DECODE_ERROR",
+    [TEV_PRNG_SEED]    = "PRNG_SEED",
+    [TEV_XID]          = "XID",
+    [TEV_DAEMON_QUEUE] = "DAEMON_QUEUE",
+    [TEV_DAEMON_START] = "DAEMON_START",
+    [TEV_DAEMON_DONE]  = "DAEMON_DONE"
+};
+
+static const struct {
+    const char* name;
+    unsigned mask;
+} categories_list[] = {
+    {"ll",     TRACE_CAT_LL},
+    {"frame",  TRACE_CAT_FRAME},
+    {"corr",   TRACE_CAT_CORR},
+    {"app",    TRACE_CAT_APP},
+    {"file",   TRACE_CAT_FILE},
+    {"xid",    TRACE_CAT_XID},
+    {"daemon", TRACE_CAT_DAEMON},
+    {"bytes",  TRACE_CAT_BYTES},
+    {"all",    TRACE_CAT_ALL},
+    {"none",   0}
+};
+
+static const size_t categories_length = sizeof(categories_list)
+    / sizeof(categories_list[0]);
+
+const char* trace_event_name(unsigned event) {
+    return event < TEV_COUNT ? event_names[event] : "UNKNOWN";
+}
+
+/**
+ * Enable the comma separated list of categories, e.g. "ll,app,file".
+ *
+ * @return 0 if successful, 1 if some category is unknown
+ */
+int trace_enable(const char* categories) {
+    char* copy = strdup(categories);
+    char* saveptr = NULL;
+    int s = 0;
+
+    for (char* tok = strtok_r(copy, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr)) {
+        bool found = false;
+
+        for (size_t i = 0; i < categories_length; ++i) {
+            if (strcmp(tok, categories_list[i].name) == 0) {
+                trace_mask |= categories_list[i].mask;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found) s = 1;
+    }
+
+    free(copy);
+    return s;
+}
+
+static trace_ring* new_ring() {
+    trace_ring* ring = calloc(1, sizeof(trace_ring));
+    if (ring == NULL) return NULL;
+
+    ring->tid = atomic_fetch_add(&next_tid, 1);
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring));
+
+    return ring;
+}
+
+void trace_event(trace_event_id event, uint32_t seq, uint64_t len, uint16_t status) {
+    trace_ring* ring = my_ring;
+    if (ring == NULL) {
+        ring = my_ring = new_ring();
+        if (ring == NULL) return;
+    }
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    trace_record* r = &ring->records[head & (TRACE_RING_SIZE - 1)];
+
+    r->ns = (uint64_t)t.tv_sec * 1000000000lu + (uint64_t)t.tv_nsec;
+    r->event = event;
+    r->status = status;
+    r->seq = seq;
+    r->len = len;
+    r->tid = ring->tid;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void dump_at_exit() {
+    trace_dump();
+}
+
+/**
+ * Set the dump file and dump the rings at exit. Signal handlers that
+ * terminate the process go through exit(), so they dump too.
+ */
+void trace_setup(const char* dumpfile) {
+    if (trace_mask == 0) return;
+
+    if (dumpfile != NULL) {
+        strncpy(dump_path, dumpfile, sizeof(dump_path) - 1);
+    }
+
+    atexit(dump_at_exit);
+}
+
+/**
+ * Write every ring, oldest record first, to the dump file.
+ * Uses only open/write/close so that it may be called from a signal handler.
+ */
+void trace_dump() {
+    if (trace_mask == 0) return;
+
+    int fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return;
+
+    uint32_t header[2] = {sizeof(trace_record), TRACE_RING_SIZE};
+    write(fd, TRACE_DUMP_MAGIC, 8);
+    write(fd, header, sizeof(header));
+
+    for (trace_ring* ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t n = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+        uint64_t first = (head - n) & (TRACE_RING_SIZE - 1);
+
+        // The ring may wrap: write [first, end) and then [0, rest).
+        uint64_t chunk = TRACE_RING_SIZE - first < n ? TRACE_RING_SIZE - first : n;
+        write(fd, ring->records + first, chunk * sizeof(trace_record));
+        write(fd, ring->records, (n - chunk) * sizeof(trace_record));
+    }
+
+    close(fd);
+}
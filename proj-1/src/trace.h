@@ -0,0 +1,92 @@
+#ifndef TRACE_H___
+#define TRACE_H___
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Runtime trace categories, selected with --trace=ll,frame,app,...
+// Records are binary, kept in memory and only written out when dumped.
+#define TRACE_CAT_LL           0x01 // llopen, llwrite, llread, llclose
+#define TRACE_CAT_FRAME        0x02 // Frames written and read (ll-core)
+#define TRACE_CAT_CORR         0x04 // Injected corruption (ll-errors)
+#define TRACE_CAT_APP          0x08 // Packets sent and received (app-layer)
+#define TRACE_CAT_FILE         0x10 // File transfers (fileio, timing)
+#define TRACE_CAT_XID          0x20 // Link configuration settled (ll-interface)
+#define TRACE_CAT_DAEMON       0x40 // Job queue and channels (daemon)
+#define TRACE_CAT_BYTES        0x80 // Every byte read (ll-core)
+#define TRACE_CAT_ALL          0x7f // All but bytes, which would flood the rings
+
+// Records per thread ring, as a power of two. Older records are overwritten.
+#define TRACE_RING_BITS        16
+#define TRACE_RING_SIZE        (1u << TRACE_RING_BITS)
+
+#define TRACE_DUMP_MAGIC       "LLTRACE2"
+#define TRACE_FILE_DEFAULT     "ll.trace"
+
+typedef enum {
+    TEV_NONE = 0,
+    TEV_FRAME_WRITE,   // seq=C, len=frame text length, status=FRAME_WRITE_*
+    TEV_FRAME_READ,    // seq=C, len=frame text length, status=FRAME_READ_*
+    TEV_CORRUPT,       // seq=byte index, len=frame text length, status=old<<8|new
+    TEV_LLOPEN,        // status=LL_*
+    TEV_LLCLOSE,       // status=LL_*
+    TEV_LLWRITE,       // seq=frame index, len=message length, status=LL_*
+    TEV_LLREAD,        // seq=frame index, len=message length, status=LL_*
+    TEV_APP_SEND,      // seq=packet index, len=packet length, status=PCONTROL_*
+    TEV_APP_RECV,      // seq=packet index, len=packet length, status=PRECEIVE_*
+    TEV_FILE_BEGIN,    // seq=file number, len=filesize
+    TEV_FILE_END,      // seq=file number, len=filesize, status=0 if ok
+    TEV_FILE_CHECK,    // seq=file number, len=END's filesize, status=TEV_CHECK_*
+    TEV_TIMING,        // seq=timing slot, len=ns timed (0 at begin), status=1 at end
+    TEV_APP_OFFSET,    // seq=packet index, len=offset, status=PCONTROL_DATA|PRECEIVE_DATA
+    TEV_APP_TLV,       // seq=TLV type, len=value length, status=0 if parsed
+    TEV_LL_ASSUME,     // seq=C assumed read, status=C read instead, or 0
+    TEV_READ_ERROR,    // seq=errno (0: timeout), len=text read so far, status=1 if given up
+    TEV_READ_BYTE,     // seq=read state, len=byte, status=readByte's return
+    TEV_DECODE_ERROR,  // seq=byte index, len=data length, status=FRAME_READ_*
+    TEV_PRNG_SEED,     // seq=fd, len=seed
+    TEV_XID,           // seq=codec, len=packetsize, status=TEV_XID_*
+    TEV_DAEMON_QUEUE,  // seq=client (-1: command line), len=jobs queued
+    TEV_DAEMON_START,  // seq=channel, len=file number
+    TEV_DAEMON_DONE,   // seq=channel, len=ns since its start, status=0 if sent
+    TEV_COUNT
+} trace_event_id;
+
+// TEV_FILE_CHECK status: what END says differently from START
+#define TEV_CHECK_FILESIZE     0x01
+#define TEV_CHECK_FILENAME     0x02
+
+// TEV_XID status
+#define TEV_XID_OFFSETS        0x01 // DATA64 packets settled
+#define TEV_XID_NO_ANSWER      0x02 // T kept its own options
+
+/**
+ * Fixed-size binary trace record, written as-is to the dump file.
+ */
+typedef struct {
+    uint64_t ns;      // CLOCK_MONOTONIC timestamp
+    uint64_t len;     // 64 bits, for file sizes and offsets
+    uint32_t seq;
+    uint32_t tid;
+    uint16_t event;   // trace_event_id
+    uint16_t status;
+    uint32_t reserved;
+} trace_record;
+
+extern unsigned trace_mask;
+
+#define TRACE_EVENT(cat, event, seq, len, status) do { \
+        if (trace_mask & (cat)) trace_event(event, seq, len, status); \
+    } while (0)
+
+int trace_enable(const char* categories);
+
+void trace_setup(const char* dumpfile);
+
+void trace_event(trace_event_id event, uint32_t seq, uint64_t len, uint16_t status);
+
+void trace_dump();
+
+const char* trace_event_name(unsigned event);
+
+#endif // TRACE_H___
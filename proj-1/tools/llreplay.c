@@ -0,0 +1,320 @@
+#include "ll-capture.h"
+#include "ll-transport.h"
+#include "ll-core.h"
+#include "ll-errors.h"
+#include "ll-interface.h"
+#include "app-layer.h"
+#include "options.h"
+#include "timing.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * llreplay: replay a link capture written by ll --capture, offline.
+ *
+ * usage: ./llreplay [-r] [-q] [-c] capture
+ *
+ * Each direction of the capture is fed through readFrame, and the frames
+ * of both are printed in time order, with the parse throughput. Captures
+ * of R are then fed through the ll-interface state machine, as R's file
+ * transfers drove it, and its counters printed as by --stats. The errors
+ * R injected are injected again, with the same seed; the replies it writes
+ * are dropped, as the capture holds what came of the original ones.
+ *
+ *   -r  Replay at the pace of the capture, rather than as fast as possible
+ *   -q  Do not print the frames, only the totals
+ *   -c  Print the counters as by --compact
+ */
+
+typedef struct {
+    uint64_t ns;
+    int direction;
+    char a, c;
+    size_t len;
+    int status;
+} replay_frame;
+
+typedef struct {
+    size_t I, RR, REJ, SET, DISC, UA, XID, unknown, invalid;
+} frame_tally;
+
+static bool realtime = false;
+static bool quiet = false;
+
+static const char* direction_name(int direction) {
+    return direction == CAPTURE_RX ? "<-" : "->";
+}
+
+static const char* frame_read_status(int status) {
+    switch (status) {
+    case FRAME_READ_OK:         return "OK";
+    case FRAME_READ_INVALID:    return "INVALID";
+    case FRAME_READ_TIMEOUT:    return "TIMEOUT";
+    default:                    return "?";
+    }
+}
+
+static const char* codec_name(int codec) {
+    switch (codec) {
+    case CODEC_HDLC:            return "hdlc";
+    case CODEC_COBS:            return "cobs";
+    case CODEC_AUTO:            return "auto";
+    default:                    return "?";
+    }
+}
+
+/**
+ * Names a frame from its A and C, as ll-frames' is functions tell them
+ * apart, and tallies it.
+ */
+static const char* frame_name(const replay_frame* f, frame_tally* t) {
+    if (f->status != FRAME_READ_OK) {
+        ++t->invalid;
+        return "-";
+    }
+
+    if (f->a == FRAME_A_COMMAND) {
+        if (f->c == FRAME_C_I(0) && f->len > 0) return ++t->I, "I0";
+        if (f->c == FRAME_C_I(1) && f->len > 0) return ++t->I, "I1";
+        if (f->c == FRAME_C_SET) return ++t->SET, "SET";
+        if (f->c == FRAME_C_DISC) return ++t->DISC, "DISC";
+    } else {
+        if (f->c == FRAME_C_RR(0)) return ++t->RR, "RR0";
+        if (f->c == FRAME_C_RR(1)) return ++t->RR, "RR1";
+        if (f->c == FRAME_C_REJ(0)) return ++t->REJ, "REJ0";
+        if (f->c == FRAME_C_REJ(1)) return ++t->REJ, "REJ1";
+        if (f->c == FRAME_C_UA) return ++t->UA, "UA";
+    }
+    if (f->c == FRAME_C_XID) return ++t->XID, "XID";
+
+    ++t->unknown;
+    return "?";
+}
+
+/**
+ * Opens direction of the capture as the link, on the fd the link had, so
+ * that errors are injected as they were on it.
+ */
+static int open_replay(const char* path, const capture_header* header, int direction) {
+    replay_configure(direction, realtime);
+    int fd = open_transport(path);
+
+    if (fd != header->fd && dup2(fd, header->fd) != -1) {
+        close(fd);
+        fd = header->fd;
+    }
+
+    setFrameCodec(header->codec);
+    flushReadBuffer();
+    return fd;
+}
+
+/**
+ * Reads every frame of one direction of the capture.
+ *
+ * @param  framesp [in/out] Frames read, appended to
+ * @param  np      [in/out] Their number
+ * @return The wire bytes of the direction
+ */
+static uint64_t parse_direction(const char* path, const capture_header* header,
+        int direction, replay_frame** framesp, size_t* np, size_t* reservedp) {
+    int fd = open_replay(path, header, direction);
+
+    while (!replay_at_end() || readPending()) {
+        frame f;
+        int s = readFrame(fd, &f);
+        if (s == FRAME_READ_TIMEOUT) continue;
+
+        if (*np == *reservedp) {
+            *reservedp *= 2;
+            *framesp = realloc(*framesp, *reservedp * sizeof(replay_frame));
+        }
+
+        replay_frame r = {
+            .ns = replay_time_ns(),
+            .direction = direction,
+            .a = f.a,
+            .c = f.c,
+            .len = f.data.len,
+            .status = s
+        };
+        (*framesp)[(*np)++] = r;
+
+        if (s == FRAME_READ_OK) free(f.data.s);
+    }
+
+    uint64_t bytes = replay_bytes();
+    close_transport(fd);
+    return bytes;
+}
+
+/**
+ * Prints both directions' frames merged in time order, received first
+ * when simultaneous, and their totals.
+ */
+static void print_frames(replay_frame* frames, size_t rx, size_t n) {
+    frame_tally tally[2];
+    memset(tally, 0, sizeof(tally));
+
+    if (!quiet) printf("  time (ms)  dir  frame   data  status\n");
+
+    for (size_t i = 0, j = rx; i < rx || j < n;) {
+        replay_frame* f;
+        if (j == n || (i < rx && frames[i].ns <= frames[j].ns)) {
+            f = &frames[i++];
+        } else {
+            f = &frames[j++];
+        }
+
+        const char* name = frame_name(f, &tally[f->direction == CAPTURE_TX]);
+        if (!quiet) {
+            printf("%11.3f  %s   %-5s %6lu  %s\n", f->ns / 1e6,
+                direction_name(f->direction), name, f->len,
+                frame_read_status(f->status));
+        }
+    }
+
+    for (int d = 0; d < 2; ++d) {
+        frame_tally* t = &tally[d];
+        printf("[LLREPLAY] %s %lu I | %lu RR | %lu REJ | %lu SET | %lu DISC | "
+            "%lu UA | %lu XID | %lu unknown | %lu invalid\n",
+            direction_name(d == 0 ? CAPTURE_RX : CAPTURE_TX), t->I, t->RR,
+            t->REJ, t->SET, t->DISC, t->UA, t->XID, t->unknown, t->invalid);
+    }
+}
+
+/**
+ * Drives the receiver's state machine with the capture's received bytes,
+ * as receive_file and receive_session_files did, minus the files.
+ *
+ * @return The data bytes received
+ */
+static size_t replay_receiver(const char* path, const capture_header* header) {
+    int fd = open_replay(path, header, CAPTURE_RX);
+
+    size_t filesize = 0;
+    bool opened = false;
+
+    while (!replay_at_end() || readPending()) {
+        if (!opened) {
+            if (llopen(fd) != LL_OK) break;
+            opened = true;
+        }
+
+        data_packet dp;
+        control_packet cp;
+        int type = receive_packet(fd, &dp, &cp);
+
+        switch (type) {
+        case PRECEIVE_DATA:
+            filesize += dp.data.len;
+            free_data_packet(dp);
+            break;
+        case PRECEIVE_START:
+            free_control_packet(cp);
+            break;
+        case PRECEIVE_END:
+            free_control_packet(cp);
+            if (!header->daemon) {
+                llclose(fd);
+                opened = false;
+            }
+            break;
+        case LL_DISCONNECTED:
+            llclose(fd);
+            opened = false;
+            break;
+        case PRECEIVE_BAD_PACKET:
+            break;
+        default:
+            // llread gave up, and so did the file.
+            opened = header->daemon;
+            break;
+        }
+    }
+
+    close_transport(fd);
+    return filesize;
+}
+
+static void exit_usage(const char* argv0) {
+    printf("usage: %s [-r] [-q] [-c] capture\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    int c;
+    show_statistics = STATS_LONG;
+
+    while ((c = getopt(argc, argv, "rqc")) != -1) {
+        switch (c) {
+        case 'r': realtime = true; break;
+        case 'q': quiet = true; break;
+        case 'c': show_statistics = STATS_COMPACT; break;
+        default: exit_usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) exit_usage(argv[0]);
+
+    const char* path = argv[optind];
+    capture_header header;
+
+    if (capture_read_header(path, &header) != 0) {
+        printf("[LLREPLAY] Error: %s is not a capture of this version\n", path);
+        return EXIT_FAILURE;
+    }
+
+    // Configure the link as it was captured.
+    transport_type = TRANSPORT_REPLAY;
+    io_engine = IO_ENGINE_POLL;
+    my_role = header.role;
+    role_string = my_role == TRANSMITTER ? "Transmitter" : "Receiver";
+    baudrate = header.baudrate;
+    packetsize = header.packetsize;
+    frame_codec = header.frame_codec;
+    flow_control = header.flow_control;
+
+    printf("[LLREPLAY] Capture of %s%s [baudrate=%u,packetsize=%u,codec=%s,started=%lu]\n",
+        role_string, header.daemon ? " daemon" : "", header.baudrate,
+        header.packetsize, codec_name(header.frame_codec),
+        (unsigned long)(header.start_ns / 1000000000lu));
+
+    size_t reserved = 1024, n = 0;
+    replay_frame* frames = malloc(reserved * sizeof(replay_frame));
+
+    uint64_t begin = monotonic_ns();
+    uint64_t bytes = parse_direction(path, &header, CAPTURE_RX, &frames, &n, &reserved);
+    size_t rx = n;
+    uint64_t duration = replay_time_ns();
+    bytes += parse_direction(path, &header, CAPTURE_TX, &frames, &n, &reserved);
+    if (replay_time_ns() > duration) duration = replay_time_ns();
+    double parse_s = (monotonic_ns() - begin) / 1e9;
+
+    print_frames(frames, rx, n);
+    free(frames);
+
+    printf("[LLREPLAY] %lu frames, %lu bytes over %.3lf s, parsed in %.3lf s (%.2lf MB/s)\n",
+        n, (unsigned long)bytes, duration / 1e9, parse_s, bytes / parse_s / 1e6);
+
+    if (my_role != RECEIVER) {
+        printf("[LLREPLAY] No state machine replay: T's is driven by its files\n");
+        return EXIT_SUCCESS;
+    }
+
+    // The frames above are the wire's; R saw them with its errors injected.
+    h_error_prob = header.h_error_prob;
+    f_error_prob = header.f_error_prob;
+    error_type = header.error_type;
+    set_error_seed(header.seed);
+
+    memset(&counter, 0, sizeof(counter));
+    size_t filesize = replay_receiver(path, &header);
+
+    set_timing(0, replay_time_ns() / 1e6);
+    print_stats(0, filesize);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,660 @@
+#define _GNU_SOURCE
+
+#include "prng.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <termios.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/**
+ * llsweep: run ll over a grid of parameters and write the efficiency
+ * S of each point, with its 95% confidence interval and the theoretical
+ * stop & wait curve, as CSV.
+ *
+ * usage: ./llsweep [option...] file
+ *
+ *   -m MODE   pty, emulated or sim                         [Default is emulated]
+ *   -s LIST   Packet sizes, comma separated                [Default is 1024]
+ *   -b LIST   Baudrates                                    [Default is 38400]
+ *   -h LIST   Header error probabilities (receiver)        [Default is 0]
+ *   -f LIST   Frame error probabilities (receiver)         [Default is 0]
+ *   -T LIST   Timeouts, in ds                              [Default is 10]
+ *   -n N      Repetitions per point                        [Default is 5]
+ *   -P MS     One-way propagation delay (emulated, sim)    [Default is 0]
+ *   -B        Introduce errors per-byte (--error-byte)
+ *   -S N      Base seed; repetition r of a point uses N+r  [Default is 1]
+ *   -l PATH   ll binary                                    [Default is ./ll]
+ *   -k S      Kill a run after S seconds                   [Default is 300]
+ *   -o FILE   Write the CSV to FILE                        [Default is stdout]
+ *   -c        Fail runs whose received file differs from file
+ *   -v        Show the output of ll
+ *
+ * Modes:
+ *   pty       Two ll processes over a pair of PTYs, bridged byte for byte.
+ *             PTYs ignore the baudrate, so S may exceed 1.
+ *   emulated  As pty, but the bridge delivers each direction at the
+ *             baudrate (8 bits per byte, like ll's statistics) plus the
+ *             propagation delay.
+ *   sim       No processes: a Monte Carlo simulation of the stop & wait
+ *             protocol under the same error model. Header errors cost a
+ *             timeout, data errors a REJ round trip.
+ *
+ * The theoretical curve is the report's S = (1 - FER) / (1 + 2a), with
+ * FER = h + f - hf per frame (per-byte errors: over the frame's bytes)
+ * and a = Tprop / Tf.
+ */
+
+#define MAX_GRID 32
+#define CHANNEL_SIZE (1 << 16)
+
+typedef struct {
+    double values[MAX_GRID];
+    size_t length;
+} grid_axis;
+
+typedef enum {
+    MODE_PTY, MODE_EMULATED, MODE_SIM
+} sweep_mode;
+
+static const char* mode_names[] = {"pty", "emulated", "sim"};
+
+// Options
+static sweep_mode mode = MODE_EMULATED;
+static grid_axis sizes = {{1024}, 1};
+static grid_axis bauds = {{38400}, 1};
+static grid_axis header_ps = {{0.0}, 1};
+static grid_axis frame_ps = {{0.0}, 1};
+static grid_axis timeouts = {{10}, 1};
+static int repetitions = 5;
+static double propagation_ms = 0.0;
+static bool error_byte = false;
+static unsigned long long base_seed = 1;
+static const char* ll_path = "./ll";
+static int kill_after = 300;
+static bool compare = false;
+static bool verbose = false;
+
+static char* file_dir = NULL;
+static char* file_base = NULL;
+static size_t filesize = 0;
+
+/**
+ * One grid point, as passed to ll.
+ */
+typedef struct {
+    size_t packetsize;
+    int baudrate;
+    double h, f;
+    int timeout;
+} sweep_point;
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000lu + (uint64_t)t.tv_nsec;
+}
+
+// <!--- CHANNEL
+/**
+ * One direction of the bridge: bytes read from master `in` wait in the
+ * ring until their delivery time, then are written to master `out`.
+ */
+typedef struct {
+    int in, out;
+    unsigned char bytes[CHANNEL_SIZE];
+    uint64_t deliver[CHANNEL_SIZE];
+    size_t head, tail; // Read at head, written at tail
+    uint64_t busy_until;
+} channel;
+
+static channel channels[2];
+static uint64_t byte_ns = 0, propagation_ns = 0;
+
+static size_t channel_used(const channel* c) {
+    return c->tail - c->head;
+}
+
+static void channel_reset(channel* c, int in, int out) {
+    c->in = in;
+    c->out = out;
+    c->head = c->tail = 0;
+    c->busy_until = 0;
+}
+
+static void channel_read(channel* c) {
+    unsigned char buf[4096];
+    size_t room = CHANNEL_SIZE - channel_used(c);
+    if (room == 0) return;
+
+    ssize_t n = read(c->in, buf, room < sizeof(buf) ? room : sizeof(buf));
+    if (n <= 0) return;
+
+    uint64_t now = now_ns();
+
+    for (ssize_t i = 0; i < n; ++i) {
+        uint64_t depart = (c->busy_until > now ? c->busy_until : now) + byte_ns;
+        c->busy_until = depart;
+
+        size_t k = c->tail++ & (CHANNEL_SIZE - 1);
+        c->bytes[k] = buf[i];
+        c->deliver[k] = depart + propagation_ns;
+    }
+}
+
+static void channel_write(channel* c) {
+    unsigned char buf[4096];
+    uint64_t now = now_ns();
+    size_t n = 0;
+
+    while (n < sizeof(buf) && c->head + n != c->tail) {
+        size_t k = (c->head + n) & (CHANNEL_SIZE - 1);
+        if (c->deliver[k] > now) break;
+        buf[n++] = c->bytes[k];
+    }
+
+    if (n == 0) return;
+
+    ssize_t w = write(c->out, buf, n);
+    if (w > 0) c->head += w;
+}
+
+/**
+ * Milliseconds until the next byte of c is due, or -1 if it is empty.
+ */
+static int channel_wait_ms(const channel* c) {
+    if (c->head == c->tail) return -1;
+
+    uint64_t due = c->deliver[c->head & (CHANNEL_SIZE - 1)];
+    uint64_t now = now_ns();
+
+    return due <= now ? 0 : (int)((due - now + 999999) / 1000000);
+}
+
+/**
+ * Move bytes between the two masters for up to max_ms.
+ */
+static void bridge(int max_ms) {
+    struct pollfd fds[2];
+
+    for (int i = 0; i < 2; ++i) {
+        fds[i].fd = channels[i].in;
+        fds[i].events = channel_used(&channels[i]) < CHANNEL_SIZE ? POLLIN : 0;
+    }
+
+    int wait = max_ms;
+    for (int i = 0; i < 2; ++i) {
+        int w = channel_wait_ms(&channels[i]);
+        if (w >= 0 && w < wait) wait = w;
+    }
+
+    poll(fds, 2, wait);
+
+    for (int i = 0; i < 2; ++i) {
+        if (fds[i].revents & POLLIN) channel_read(&channels[i]);
+        channel_write(&channels[i]);
+    }
+}
+// ----> END OF CHANNEL
+
+// <!--- PTY
+static int masters[2] = {-1, -1};
+static int slaves[2] = {-1, -1};
+static char slave_names[2][64];
+
+/**
+ * Open two PTY pairs. The slaves stay open in this process so that the
+ * masters never hang up between runs, and are left raw so that ll
+ * restores a raw terminal when it exits.
+ */
+static void open_ptys() {
+    for (int i = 0; i < 2; ++i) {
+        masters[i] = posix_openpt(O_RDWR | O_NOCTTY);
+        if (masters[i] == -1 || grantpt(masters[i]) == -1
+                || unlockpt(masters[i]) == -1) {
+            perror("[SWEEP] Failed to open PTY");
+            exit(EXIT_FAILURE);
+        }
+
+        strncpy(slave_names[i], ptsname(masters[i]), sizeof(slave_names[i]) - 1);
+        fcntl(masters[i], F_SETFL, O_NONBLOCK);
+
+        slaves[i] = open(slave_names[i], O_RDWR | O_NOCTTY);
+        if (slaves[i] == -1) {
+            perror("[SWEEP] Failed to open PTY slave");
+            exit(EXIT_FAILURE);
+        }
+
+        struct termios tios;
+        tcgetattr(slaves[i], &tios);
+        cfmakeraw(&tios);
+        tcsetattr(slaves[i], TCSANOW, &tios);
+    }
+}
+
+static void drain_ptys() {
+    for (int i = 0; i < 2; ++i) {
+        tcflush(slaves[i], TCIOFLUSH);
+        tcflush(masters[i], TCIOFLUSH);
+    }
+}
+// ----> END OF PTY
+
+// <!--- RUN
+static pid_t spawn(char** argv, const char* dir) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    if (chdir(dir) == -1) _exit(127);
+
+    if (!verbose) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        close(masters[i]);
+        close(slaves[i]);
+    }
+
+    execv(argv[0], argv);
+    _exit(127);
+}
+
+/**
+ * Read batch,efficiency from a --stats-format=csv export.
+ */
+static int read_efficiency(const char* path, double* efficiency, double* seconds) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return 1;
+
+    char line[256];
+    int found = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "batch,efficiency,%lf", efficiency) == 1) ++found;
+        if (sscanf(line, "batch,seconds,%lf", seconds) == 1) ++found;
+    }
+
+    fclose(file);
+    return found == 2 ? 0 : 1;
+}
+
+/**
+ * Whether files a and b have the same bytes. Holes read as zeros, so
+ * this reads all of a sparse file, but only as fast as memory goes.
+ */
+static bool same_file(const char* a, const char* b) {
+    static char abuf[1 << 20], bbuf[1 << 20];
+
+    int afd = open(a, O_RDONLY);
+    int bfd = open(b, O_RDONLY);
+    bool same = afd != -1 && bfd != -1;
+
+    while (same) {
+        ssize_t an = read(afd, abuf, sizeof(abuf));
+        ssize_t bn = an <= 0 ? an : read(bfd, bbuf, an);
+
+        same = an >= 0 && an == bn && memcmp(abuf, bbuf, an) == 0;
+        if (an == 0) break;
+    }
+
+    // Equal up to the end of a: b must end there too.
+    if (same) same = read(bfd, bbuf, 1) == 0;
+
+    if (afd != -1) close(afd);
+    if (bfd != -1) close(bfd);
+    return same;
+}
+
+/**
+ * Transfer the file once through the bridge.
+ *
+ * @return 0 if both ends exited cleanly and the receiver exported its stats
+ */
+static int run_once(sweep_point p, unsigned long long seed, double* efficiency,
+        double* seconds) {
+    char dir[] = "/tmp/llsweep.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("[SWEEP] Failed to create run directory");
+        return 1;
+    }
+
+    char stats[64], baud[16], size[32], timeout[16], h[32], f[32], seedarg[32];
+    snprintf(stats, sizeof(stats), "--stats-file=%s/stats.csv", dir);
+    snprintf(baud, sizeof(baud), "%d", p.baudrate);
+    snprintf(size, sizeof(size), "%lu", p.packetsize);
+    snprintf(timeout, sizeof(timeout), "--timeout=%d", p.timeout);
+    snprintf(h, sizeof(h), "%.6f", p.h);
+    snprintf(f, sizeof(f), "%.6f", p.f);
+    snprintf(seedarg, sizeof(seedarg), "--seed=%llu", seed);
+
+    char* error = error_byte ? "--error-byte" : "--error-frame";
+
+    char* rx_argv[] = {(char*)ll_path, "-r", "-d", slave_names[1], "-b", baud,
+        timeout, "-h", h, "-f", f, error, seedarg, "--stats-format=csv", stats,
+        "1", NULL};
+    char* tx_argv[] = {(char*)ll_path, "-t", "-d", slave_names[0], "-b", baud,
+        "-s", size, timeout, file_base, NULL};
+
+    drain_ptys();
+    channel_reset(&channels[0], masters[0], masters[1]);
+    channel_reset(&channels[1], masters[1], masters[0]);
+
+    pid_t rx = spawn(rx_argv, dir);
+    for (int i = 0; i < 20; ++i) bridge(10);
+    pid_t tx = spawn(tx_argv, file_dir);
+
+    uint64_t deadline = now_ns() + (uint64_t)kill_after * 1000000000lu;
+    int rx_status = -1, tx_status = -1;
+
+    while (rx_status == -1 || tx_status == -1) {
+        bridge(10);
+
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            if (pid == rx) rx_status = status;
+            if (pid == tx) tx_status = status;
+        }
+
+        if (now_ns() > deadline) {
+            fprintf(stderr, "[SWEEP] Run exceeded %d seconds, killed\n", kill_after);
+            if (rx_status == -1) kill(rx, SIGKILL);
+            if (tx_status == -1) kill(tx, SIGKILL);
+            waitpid(rx, NULL, 0);
+            waitpid(tx, NULL, 0);
+            rx_status = tx_status = 1;
+        }
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s/stats.csv", dir);
+
+    char received[64 + 256], sent[PATH_MAX + 256];
+    snprintf(received, sizeof(received), "%s/%s", dir, file_base);
+    snprintf(sent, sizeof(sent), "%s/%s", file_dir, file_base);
+
+    int s = rx_status != 0 || tx_status != 0;
+
+    if (s) {
+        fprintf(stderr, "[SWEEP] ll failed [rx status=0x%x,tx status=0x%x]\n",
+            rx_status, tx_status);
+    } else if (read_efficiency(path, efficiency, seconds) != 0) {
+        fprintf(stderr, "[SWEEP] No stats exported by the receiver\n");
+        s = 1;
+    } else if (compare && !same_file(sent, received)) {
+        fprintf(stderr, "[SWEEP] Received file differs from %s\n", sent);
+        s = 1;
+    }
+
+    // Clean up the run directory: the stats and the received file.
+    unlink(received);
+    unlink(path);
+    rmdir(dir);
+
+    return s;
+}
+// ----> END OF RUN
+
+// <!--- MODEL
+static double frame_bytes(sweep_point p) {
+    size_t packets = (filesize + p.packetsize - 1) / p.packetsize;
+    double average = packets ? (double)filesize / packets : 0.0;
+    return average + 18.0; // Same I frame size as ll's statistics
+}
+
+static double frame_error_rate(sweep_point p, double* header, double* data) {
+    if (error_byte) {
+        *header = 1.0 - pow(1.0 - p.h, 3.0);
+        *data = 1.0 - pow(1.0 - p.f, frame_bytes(p) - 5.0);
+    } else {
+        *header = p.h;
+        *data = p.f;
+    }
+    return *header + *data - *header * *data;
+}
+
+/**
+ * The report's S = (1 - FER) / (1 + 2a).
+ */
+static double theoretical_efficiency(sweep_point p, double* fer, double* a) {
+    double header, data;
+    double tf = 8.0 * frame_bytes(p) / p.baudrate;
+
+    *fer = frame_error_rate(p, &header, &data);
+    *a = propagation_ms / 1000.0 / tf;
+
+    return (1.0 - *fer) / (1.0 + 2.0 * *a);
+}
+
+/**
+ * Simulate one transfer: every data packet, plus START and END, is sent
+ * until it gets through. A corrupted header makes the receiver ignore the
+ * frame and costs a timeout; corrupted data costs a REJ round trip.
+ */
+static int simulate_once(sweep_point p, unsigned long long seed,
+        double* efficiency, double* seconds) {
+    prng_t rng;
+    prng_seed(&rng, seed, 0);
+
+    double header, data;
+    frame_error_rate(p, &header, &data);
+
+    double tf = 8.0 * frame_bytes(p) / p.baudrate;
+    double ta = 8.0 * 5.0 / p.baudrate;
+    double round_trip = tf + ta + 2.0 * propagation_ms / 1000.0;
+    double tout = p.timeout / 10.0;
+
+    size_t packets = (filesize + p.packetsize - 1) / p.packetsize + 2;
+    double t = 0.0;
+
+    for (size_t i = 0; i < packets; ++i) {
+        while (true) {
+            if (prng_double(&rng) < header) {
+                t += tout;
+            } else if (prng_double(&rng) < data) {
+                t += round_trip;
+            } else {
+                t += round_trip;
+                break;
+            }
+        }
+    }
+
+    *seconds = t;
+    *efficiency = 8.0 * filesize / t / p.baudrate;
+    return 0;
+}
+// ----> END OF MODEL
+
+// <!--- STATISTICS
+// Two-sided 95% Student t quantiles, by degrees of freedom.
+static const double t95[] = {0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+    2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+    2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+    2.052, 2.048, 2.045, 2.042};
+
+static double t_quantile(size_t df) {
+    return df < sizeof(t95) / sizeof(double) ? t95[df] : 1.960;
+}
+// ----> END OF STATISTICS
+
+static int parse_axis(const char* arg, grid_axis* axis) {
+    char* copy = strdup(arg);
+    char* saveptr = NULL;
+    axis->length = 0;
+
+    for (char* tok = strtok_r(copy, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr)) {
+        char* end;
+        double value = strtod(tok, &end);
+
+        if (*end != '\0' || axis->length == MAX_GRID) {
+            free(copy);
+            return 1;
+        }
+
+        axis->values[axis->length++] = value;
+    }
+
+    free(copy);
+    return axis->length == 0;
+}
+
+static void exit_usage(const char* argv0) {
+    printf("usage: %s [-m pty|emulated|sim] [-s sizes] [-b bauds] [-h ps] [-f ps]\n"
+        "         [-T timeouts] [-n N] [-P ms] [-B] [-S seed] [-l ll] [-k s]\n"
+        "         [-o out.csv] [-c] [-v] file\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+static void parse_sweep_args(int argc, char** argv) {
+    const char* output = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:s:b:h:f:T:n:P:BS:l:k:o:cv")) != -1) {
+        int bad = 0;
+
+        switch (c) {
+        case 'm':
+            if (strcmp(optarg, "pty") == 0) mode = MODE_PTY;
+            else if (strcmp(optarg, "emulated") == 0) mode = MODE_EMULATED;
+            else if (strcmp(optarg, "sim") == 0) mode = MODE_SIM;
+            else bad = 1;
+            break;
+        case 's': bad = parse_axis(optarg, &sizes); break;
+        case 'b': bad = parse_axis(optarg, &bauds); break;
+        case 'h': bad = parse_axis(optarg, &header_ps); break;
+        case 'f': bad = parse_axis(optarg, &frame_ps); break;
+        case 'T': bad = parse_axis(optarg, &timeouts); break;
+        case 'n': repetitions = atoi(optarg); bad = repetitions < 1; break;
+        case 'P': propagation_ms = atof(optarg); break;
+        case 'B': error_byte = true; break;
+        case 'S': base_seed = strtoull(optarg, NULL, 10); break;
+        case 'l': ll_path = optarg; break;
+        case 'k': kill_after = atoi(optarg); break;
+        case 'o': output = optarg; break;
+        case 'c': compare = true; break;
+        case 'v': verbose = true; break;
+        default: bad = 1; break;
+        }
+
+        if (bad) exit_usage(argv[0]);
+    }
+
+    if (optind != argc - 1) exit_usage(argv[0]);
+
+    char* path = realpath(argv[optind], NULL);
+    struct stat st;
+
+    if (path == NULL || stat(path, &st) == -1) {
+        printf("[SWEEP] Error: Cannot open file %s [%s]\n", argv[optind],
+            strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    filesize = st.st_size;
+    file_dir = strdup(dirname(strdup(path)));
+    file_base = strdup(basename(path));
+
+    if (mode != MODE_SIM) {
+        char* ll = realpath(ll_path, NULL);
+        if (ll == NULL || access(ll, X_OK) == -1) {
+            printf("[SWEEP] Error: Cannot execute %s, build ll first\n", ll_path);
+            exit(EXIT_FAILURE);
+        }
+        ll_path = ll;
+    }
+
+    if (output != NULL && freopen(output, "w", stdout) == NULL) {
+        printf("[SWEEP] Error: Cannot open output %s [%s]\n", output, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char** argv) {
+    parse_sweep_args(argc, argv);
+
+    if (mode != MODE_SIM) {
+        signal(SIGPIPE, SIG_IGN);
+        open_ptys();
+    }
+
+    if (mode == MODE_EMULATED) {
+        propagation_ns = (uint64_t)(propagation_ms * 1e6);
+    }
+
+    size_t total = sizes.length * bauds.length * header_ps.length
+        * frame_ps.length * timeouts.length;
+    size_t point_number = 0;
+
+    printf("mode,packetsize,baudrate,header_p,frame_p,timeout,runs,ok,"
+        "seconds_mean,s_mean,s_sd,s_ci95_low,s_ci95_high,fer,a,s_theory\n");
+    fflush(stdout);
+
+    for (size_t si = 0; si < sizes.length; ++si)
+    for (size_t bi = 0; bi < bauds.length; ++bi)
+    for (size_t hi = 0; hi < header_ps.length; ++hi)
+    for (size_t fi = 0; fi < frame_ps.length; ++fi)
+    for (size_t ti = 0; ti < timeouts.length; ++ti) {
+        sweep_point p = {(size_t)sizes.values[si], (int)bauds.values[bi],
+            header_ps.values[hi], frame_ps.values[fi], (int)timeouts.values[ti]};
+
+        if (mode == MODE_EMULATED) byte_ns = 8000000000lu / p.baudrate;
+
+        ++point_number;
+        fprintf(stderr, "[SWEEP] Point %lu/%lu [s=%lu,b=%d,h=%g,f=%g,timeout=%d]\n",
+            point_number, total, p.packetsize, p.baudrate, p.h, p.f, p.timeout);
+
+        double sum = 0.0, sum2 = 0.0, seconds_sum = 0.0;
+        int ok = 0;
+
+        for (int r = 0; r < repetitions; ++r) {
+            double efficiency = 0.0, seconds = 0.0;
+            unsigned long long seed = base_seed + r;
+
+            int s = mode == MODE_SIM
+                ? simulate_once(p, seed, &efficiency, &seconds)
+                : run_once(p, seed, &efficiency, &seconds);
+
+            if (s != 0) {
+                fprintf(stderr, "[SWEEP] Run %d failed\n", r);
+                continue;
+            }
+
+            ++ok;
+            sum += efficiency;
+            sum2 += efficiency * efficiency;
+            seconds_sum += seconds;
+        }
+
+        double mean = ok ? sum / ok : 0.0;
+        double sd = ok > 1 ? sqrt(fmax(0.0, (sum2 - ok * mean * mean) / (ok - 1))) : 0.0;
+        double half = ok > 1 ? t_quantile(ok - 1) * sd / sqrt(ok) : 0.0;
+        double fer, a;
+        double theory = theoretical_efficiency(p, &fer, &a);
+
+        printf("%s,%lu,%d,%.6f,%.6f,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n",
+            mode_names[mode], p.packetsize, p.baudrate, p.h, p.f, p.timeout,
+            repetitions, ok, ok ? seconds_sum / ok : 0.0, mean, sd,
+            mean - half, mean + half, fer, a, theory);
+        fflush(stdout);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+#include "trace.h"
+#include "ll-core.h"
+#include "ll-interface.h"
+#include "app-layer.h"
+#include "options.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * lltrace: decode binary trace dumps written by ll --trace into text.
+ *
+ * usage: ./lltrace [ll.trace]
+ *
+ * Records of all threads are merged and printed in timestamp order,
+ * relative to the first record.
+ */
+
+static const char* frame_read_status(unsigned status) {
+    switch (status) {
+    case FRAME_READ_OK:         return "OK";
+    case FRAME_READ_INVALID:    return "INVALID";
+    case FRAME_READ_TIMEOUT:    return "TIMEOUT";
+    case FRAME_READ_BAD_LENGTH: return "BAD_LENGTH";
+    case FRAME_READ_BAD_BCC1:   return "BAD_BCC1";
+    case FRAME_READ_BAD_BCC2:   return "BAD_BCC2";
+    case FRAME_READ_BAD_ESCAPE: return "BAD_ESCAPE";
+    default:                    return "?";
+    }
+}
+
+static const char* frame_write_status(unsigned status) {
+    switch (status) {
+    case FRAME_WRITE_OK:        return "OK";
+    case FRAME_WRITE_TIMEOUT:   return "TIMEOUT";
+    default:                    return "?";
+    }
+}
+
+static const char* ll_status(unsigned status) {
+    switch (status) {
+    case LL_OK:                 return "OK";
+    case LL_NO_TIME_RETRIES:    return "NO_TIME_RETRIES";
+    case LL_NO_ANSWER_RETRIES:  return "NO_ANSWER_RETRIES";
+    case LL_DISCONNECTED:       return "DISCONNECTED";
+    case LL_REOPENED:           return "REOPENED";
+    default:                    return "?";
+    }
+}
+
+static const char* packet_type(unsigned status) {
+    switch (status) {
+    case PCONTROL_DATA:         return "DATA";
+    case PCONTROL_START:        return "START";
+    case PCONTROL_END:          return "END";
+    case PRECEIVE_DATA:         return "DATA";
+    case PRECEIVE_START:        return "START";
+    case PRECEIVE_END:          return "END";
+    case PRECEIVE_BAD_PACKET:   return "BAD";
+    default:                    return "?";
+    }
+}
+
+static int compare_records(const void* a, const void* b) {
+    const trace_record* ra = a;
+    const trace_record* rb = b;
+    if (ra->ns != rb->ns) return ra->ns < rb->ns ? -1 : 1;
+    return 0;
+}
+
+static void print_record(const trace_record* r, uint64_t t0) {
+    printf("%14.6f ms  [t%u]  %-12s", (r->ns - t0) / 1e6, r->tid,
+        trace_event_name(r->event));
+
+    switch (r->event) {
+    case TEV_FRAME_WRITE:
+        printf("c=0x%02x len=%lu %s\n", r->seq, r->len, frame_write_status(r->status));
+        break;
+    case TEV_FRAME_READ:
+        printf("c=0x%02x len=%lu %s\n", r->seq, r->len, frame_read_status(r->status));
+        break;
+    case TEV_CORRUPT:
+        printf("i=%u len=%lu 0x%02x -> 0x%02x\n", r->seq, r->len,
+            r->status >> 8, r->status & 0xff);
+        break;
+    case TEV_LLOPEN: case TEV_LLCLOSE:
+        printf("%s\n", ll_status(r->status));
+        break;
+    case TEV_LLWRITE: case TEV_LLREAD:
+        printf("index=%u len=%lu %s\n", r->seq, r->len, ll_status(r->status));
+        break;
+    case TEV_APP_SEND: case TEV_APP_RECV:
+        printf("%s #%u len=%lu\n", packet_type(r->status), r->seq, r->len);
+        break;
+    case TEV_FILE_BEGIN:
+        printf("file #%u filesize=%lu\n", r->seq, r->len);
+        break;
+    case TEV_FILE_END:
+        printf("file #%u filesize=%lu %s\n", r->seq, r->len,
+            r->status ? "FAILED" : "OK");
+        break;
+    case TEV_FILE_CHECK:
+        printf("file #%u END filesize=%lu%s%s\n", r->seq, r->len,
+            r->status & TEV_CHECK_FILESIZE ? " FILESIZE_DIFFERS" : "",
+            r->status & TEV_CHECK_FILENAME ? " FILENAME_DIFFERS" : "");
+        break;
+    case TEV_TIMING:
+        if (r->status) {
+            printf("slot=%u END ms=%.3f\n", r->seq, r->len / 1e6);
+        } else {
+            printf("slot=%u BEGIN\n", r->seq);
+        }
+        break;
+    case TEV_APP_OFFSET:
+        printf("%s #%u offset=%lu\n", packet_type(r->status), r->seq, r->len);
+        break;
+    case TEV_APP_TLV:
+        printf("type=%u len=%lu %s\n", r->seq, r->len, r->status ? "BAD" : "OK");
+        break;
+    case TEV_LL_ASSUME:
+        printf("c=0x%02x read=0x%02x\n", r->seq, r->status);
+        break;
+    case TEV_READ_ERROR:
+        printf("%s len=%lu%s\n", r->seq ? strerror(r->seq) : "timeout", r->len,
+            r->status ? " GIVEN UP" : "");
+        break;
+    case TEV_READ_BYTE:
+        printf("state=%u byte=0x%02lx -> %u\n", r->seq, r->len, r->status);
+        break;
+    case TEV_DECODE_ERROR:
+        printf("i=%u len=%lu %s\n", r->seq, r->len, frame_read_status(r->status));
+        break;
+    case TEV_PRNG_SEED:
+        printf("fd=%u seed=%lu\n", r->seq, r->len);
+        break;
+    case TEV_XID:
+        printf("codec=%s packetsize=%lu%s%s\n", r->seq == CODEC_COBS ? "cobs" : "hdlc", r->len,
+            r->status & TEV_XID_OFFSETS ? " offsets" : "",
+            r->status & TEV_XID_NO_ANSWER ? " NO_ANSWER" : "");
+        break;
+    case TEV_DAEMON_QUEUE:
+        printf("client=%d queued=%lu\n", (int)r->seq, r->len);
+        break;
+    case TEV_DAEMON_START:
+        printf("channel=%u file #%lu\n", r->seq, r->len);
+        break;
+    case TEV_DAEMON_DONE:
+        printf("channel=%u ms=%.3f %s\n", r->seq, r->len / 1e6,
+            r->status ? "FAILED" : "OK");
+        break;
+    default:
+        printf("seq=%u len=%lu status=0x%04x\n", r->seq, r->len, r->status);
+        break;
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : TRACE_FILE_DEFAULT;
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror("[LLTRACE] Failed to open trace dump");
+        return EXIT_FAILURE;
+    }
+
+    char magic[8];
+    uint32_t header[2];
+
+    if (fread(magic, 8, 1, file) != 1 || memcmp(magic, TRACE_DUMP_MAGIC, 8) != 0
+            || fread(header, sizeof(header), 1, file) != 1
+            || header[0] != sizeof(trace_record)) {
+        printf("[LLTRACE] Error: %s is not a trace dump of this version\n", path);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    size_t reserved = 1024, n = 0;
+    trace_record* records = malloc(reserved * sizeof(trace_record));
+
+    while (fread(records + n, sizeof(trace_record), 1, file) == 1) {
+        if (++n == reserved) {
+            records = realloc(records, 2 * reserved * sizeof(trace_record));
+            reserved *= 2;
+        }
+    }
+
+    fclose(file);
+
+    qsort(records, n, sizeof(trace_record), compare_records);
+
+    for (size_t i = 0; i < n; ++i) {
+        print_record(&records[i], records[0].ns);
+    }
+
+    printf("[LLTRACE] %lu records\n", n);
+
+    free(records);
+    return EXIT_SUCCESS;
+}
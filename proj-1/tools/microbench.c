@@ -0,0 +1,556 @@
+#include "ll-core.h"
+#include "ll-errors.h"
+#include "app-layer.h"
+#include "options.h"
+#include "prng.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * microbench: time the framing hot paths in isolation, then compare the
+ * goodput of the HDLC and COBS codecs on each kind of payload.
+ *
+ * usage: bin/microbench [-b baseline] [-w baseline] [-t threshold] [-m ms]
+ *
+ *   -b FILE  Compare ns/byte against FILE, exit 1 on regressions, or if
+ *            FILE is missing
+ *   -w FILE  Write this run's results to FILE as the new baseline
+ *   -t P     Regression threshold, as a fraction [Default is 0.10]
+ *   -m MS    Minimum measuring time per case, in ms [Default is 20]
+ *
+ * Load on the machine, and the layout of each process, move the cases by
+ * far more than the threshold on a busy machine. So the tolerance is the
+ * threshold plus the spread between the quartiles of all the cases'
+ * deltas, and a case above it is measured again, in CONFIRM_ROUNDS rounds
+ * after the others. It is a regression only if it stays above it in all.
+ *
+ * The cycles are read with rdtsc on x86. Elsewhere, cyc/byte shows the
+ * nanoseconds of CLOCK_MONOTONIC_RAW instead.
+ *
+ * Linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc so that
+ * allocations per call can be counted (see Makefile, microbench target).
+ */
+
+#define REPETITIONS 5
+#define CONFIRM_ROUNDS 3
+
+// <!--- ALLOCATION COUNTING
+static size_t allocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    ++allocations;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    ++allocations;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    ++allocations;
+    return __real_realloc(ptr, size);
+}
+// ----> END OF ALLOCATION COUNTING
+
+static const size_t sizes[] = {16, 64, 256, 1024, 4096, 16384, 65535};
+static const size_t sizes_length = sizeof(sizes) / sizeof(size_t);
+
+typedef enum {
+    DIST_RANDOM, DIST_WORST, DIST_ASCII, DIST_COUNT
+} distribution;
+
+static const char* dist_names[DIST_COUNT] = {"random", "worst", "ascii"};
+
+/**
+ * Inputs prepared for one (size, distribution) case.
+ */
+typedef struct {
+    string payload;  // Raw data
+    string stuffed;  // stuffData(payload), with bcc2
+    string encoded;  // cobsEncode(payload), with bcc2
+    string text;     // buildText of an I frame carrying payload
+    string packet;   // build_data_packet(payload)
+    string scratch;  // Copy of text, corrupted by introduceErrors
+} bench_input;
+
+typedef void (*bench_fn)(bench_input* in);
+
+static void bench_stuff(bench_input* in) {
+    string out;
+    char bcc2;
+    stuffData(in->payload, &out, &bcc2);
+    free(out.s);
+}
+
+static void bench_destuff(bench_input* in) {
+    string out;
+    char bcc2;
+    destuffData(in->stuffed, &out, &bcc2);
+    free(out.s);
+}
+
+static void bench_cobs_encode(bench_input* in) {
+    string out;
+    char bcc2;
+    cobsEncode(in->payload, &out, &bcc2);
+    free(out.s);
+}
+
+static void bench_cobs_decode(bench_input* in) {
+    string out;
+    char bcc2;
+    cobsDecode(in->encoded, &out, &bcc2);
+    free(out.s);
+}
+
+static void bench_build_text(bench_input* in) {
+    frame f = {FRAME_A_COMMAND, FRAME_C_I(0), in->payload};
+    string out;
+    buildText(f, &out);
+    free(out.s);
+}
+
+static void bench_parse_frame(bench_input* in) {
+    frame f;
+    parseFrame(in->text, &f);
+    free(f.data.s);
+}
+
+static void bench_build_packet(bench_input* in) {
+    string out;
+    build_data_packet(in->payload, 0, 0, &out);
+    free(out.s);
+}
+
+static void bench_is_data_packet(bench_input* in) {
+    data_packet out;
+    if (isDATApacket(in->packet, &out)) free_data_packet(out);
+}
+
+static void bench_errors(bench_input* in) {
+    introduceErrors(3, in->scratch);
+}
+
+static const struct {
+    const char* name;
+    bench_fn fn;
+    int error_type;
+} benches[] = {
+    {"stuffData",         bench_stuff,          0},
+    {"destuffData",       bench_destuff,        0},
+    {"cobsEncode",        bench_cobs_encode,    0},
+    {"cobsDecode",        bench_cobs_decode,    0},
+    {"buildText",         bench_build_text,     0},
+    {"parseFrame",        bench_parse_frame,    0},
+    {"build_data_packet", bench_build_packet,   0},
+    {"isDATApacket",      bench_is_data_packet, 0},
+    {"introduceErrors/B", bench_errors,         ETYPE_BYTE},
+    {"introduceErrors/F", bench_errors,         ETYPE_FRAME},
+};
+
+static const size_t benches_length = sizeof(benches) / sizeof(benches[0]);
+
+static string make_payload(size_t size, distribution dist, prng_t* rng) {
+    static const char ascii[] = "The quick brown fox jumps over the lazy dog. "
+        "Lorem ipsum dolor sit amet, consectetur adipiscing elit.\n";
+
+    string s;
+    s.len = size;
+    s.s = malloc(size + 1);
+
+    for (size_t i = 0; i < size; ++i) {
+        switch (dist) {
+        case DIST_RANDOM:
+            s.s[i] = (char)prng_next(rng);
+            break;
+        case DIST_WORST:
+            s.s[i] = (i % 2) ? FRAME_ESC : FRAME_FLAG;
+            break;
+        default:
+            s.s[i] = ascii[i % (sizeof(ascii) - 1)];
+            break;
+        }
+    }
+
+    s.s[size] = '\0';
+    return s;
+}
+
+static bench_input make_input(size_t size, distribution dist, prng_t* rng) {
+    bench_input in;
+    char bcc2;
+
+    in.payload = make_payload(size, dist, rng);
+    stuffData(in.payload, &in.stuffed, &bcc2);
+    cobsEncode(in.payload, &in.encoded, &bcc2);
+
+    frame f = {FRAME_A_COMMAND, FRAME_C_I(0), in.payload};
+    buildText(f, &in.text);
+    build_data_packet(in.payload, 0, 0, &in.packet);
+
+    in.scratch.len = in.text.len;
+    in.scratch.s = malloc(in.text.len + 1);
+    memcpy(in.scratch.s, in.text.s, in.text.len + 1);
+
+    return in;
+}
+
+static void free_input(bench_input in) {
+    free(in.payload.s);
+    free(in.stuffed.s);
+    free(in.encoded.s);
+    free(in.text.s);
+    free(in.packet.s);
+    free(in.scratch.s);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static unsigned long long read_cycles() {
+    return __rdtsc();
+}
+#else
+static unsigned long long read_cycles() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+#endif
+
+/**
+ * Thread CPU time, so that time spent descheduled is not measured.
+ */
+static double now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+typedef struct {
+    double ns_per_call, cycles_per_call, allocs_per_call;
+} bench_result;
+
+/**
+ * Run fn until at least min_ns have passed, REPETITIONS times, and keep
+ * the fastest repetition.
+ */
+static bench_result run_bench(bench_fn fn, bench_input* in, double min_ns) {
+    bench_result best = {0, 0, 0};
+
+    for (size_t i = 0; i < 100; ++i) fn(in); // warm up
+
+    for (int r = 0; r < REPETITIONS; ++r) {
+        size_t iterations = 0;
+        size_t allocs = allocations;
+        unsigned long long c0 = read_cycles();
+        double t0 = now_ns(), t1;
+
+        do {
+            for (size_t i = 0; i < 64; ++i) fn(in);
+            iterations += 64;
+            t1 = now_ns();
+        } while (t1 - t0 < min_ns);
+
+        unsigned long long c1 = read_cycles();
+
+        bench_result result = {
+            (t1 - t0) / iterations,
+            (double)(c1 - c0) / iterations,
+            (double)(allocations - allocs) / iterations
+        };
+
+        if (r == 0 || result.ns_per_call < best.ns_per_call) best = result;
+    }
+
+    return best;
+}
+
+// <!--- GOODPUT
+static void bench_hdlc_roundtrip(bench_input* in) {
+    bench_stuff(in);
+    bench_destuff(in);
+}
+
+static void bench_cobs_roundtrip(bench_input* in) {
+    bench_cobs_encode(in);
+    bench_cobs_decode(in);
+}
+
+/**
+ * For both codecs, print the I frame size on the wire, the share of the
+ * line left for payload, the goodput at the default baudrate, and the
+ * encode+decode throughput of the CPU.
+ */
+static void print_goodput(prng_t* rng, double min_ns) {
+    static const size_t goodput_sizes[] = {256, 1024, 65535};
+
+    printf("\n%-6s %6s %-7s %9s %9s %12s %10s\n", "codec", "size", "dist",
+        "wire", "line %", "goodput B/s", "codec MB/s");
+
+    for (int codec = 0; codec < 2; ++codec) {
+        for (size_t s = 0; s < sizeof(goodput_sizes) / sizeof(size_t); ++s) {
+            for (int d = 0; d < DIST_COUNT; ++d) {
+                size_t size = goodput_sizes[s];
+                bench_input in = make_input(size, d, rng);
+
+                // Flag, A, C, BCC1 and flag around the encoded data and bcc2
+                size_t wire = 5 + (codec ? in.encoded.len : in.stuffed.len);
+                double line = (double)size / wire;
+
+                bench_result r = run_bench(codec ? bench_cobs_roundtrip
+                    : bench_hdlc_roundtrip, &in, min_ns);
+
+                printf("%-6s %6lu %-7s %9lu %9.2f %12.1f %10.1f\n",
+                    codec ? "cobs" : "hdlc", size, dist_names[d], wire,
+                    100.0 * line, line * BAUDRATE_DEFAULT / 8.0,
+                    size / r.ns_per_call * 1e3);
+
+                free_input(in);
+            }
+        }
+    }
+}
+// ----> END OF GOODPUT
+
+// <!--- BASELINE
+typedef struct {
+    char name[32];
+    size_t size;
+    char dist[16];
+    double ns_per_byte;
+} baseline_entry;
+
+static baseline_entry* baseline = NULL;
+static size_t baseline_length = 0;
+
+static int load_baseline(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return 1;
+
+    size_t reserved = 64;
+    baseline = malloc(reserved * sizeof(baseline_entry));
+
+    baseline_entry e;
+    while (fscanf(file, "%31s %lu %15s %lf", e.name, &e.size, e.dist,
+            &e.ns_per_byte) == 4) {
+        if (baseline_length == reserved) {
+            baseline = realloc(baseline, 2 * reserved * sizeof(baseline_entry));
+            reserved *= 2;
+        }
+        baseline[baseline_length++] = e;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static const baseline_entry* find_baseline(const char* name, size_t size,
+        const char* dist) {
+    for (size_t i = 0; i < baseline_length; ++i) {
+        if (baseline[i].size == size && strcmp(baseline[i].name, name) == 0
+                && strcmp(baseline[i].dist, dist) == 0) {
+            return &baseline[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * A case compared against the baseline, and measured again while it is
+ * above the tolerance.
+ */
+typedef struct {
+    size_t b, s;
+    distribution d;
+    double ns_per_byte; // Fastest so far
+    const baseline_entry* e;
+} suspect;
+
+static double suspect_delta(const suspect* x) {
+    return (x->ns_per_byte - x->e->ns_per_byte) / x->e->ns_per_byte;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * The spread between the first and third quartiles of the deltas.
+ */
+static double delta_spread(const suspect* cases, size_t n) {
+    if (n < 4) return 0;
+
+    double* deltas = malloc(n * sizeof(double));
+    for (size_t i = 0; i < n; ++i) deltas[i] = suspect_delta(&cases[i]);
+    qsort(deltas, n, sizeof(double), compare_doubles);
+
+    double spread = deltas[3 * n / 4] - deltas[n / 4];
+    free(deltas);
+    return spread;
+}
+// ----> END OF BASELINE
+
+/**
+ * Measure bench b on a fresh input of size sizes[s] and distribution d.
+ */
+static bench_result measure(size_t b, size_t s, distribution d, prng_t* rng,
+        double min_ns) {
+    bench_input in = make_input(sizes[s], d, rng);
+
+    if (benches[b].error_type != 0) {
+        error_type = benches[b].error_type;
+        f_error_prob = error_type == ETYPE_BYTE ? 0.001 : 0.5;
+    }
+
+    bench_result r = run_bench(benches[b].fn, &in, min_ns);
+    free_input(in);
+    return r;
+}
+
+int main(int argc, char** argv) {
+    const char* baseline_path = NULL;
+    const char* write_path = NULL;
+    double threshold = 0.10;
+    double min_ms = 20.0;
+
+    int c;
+    while ((c = getopt(argc, argv, "b:w:t:m:")) != -1) {
+        switch (c) {
+        case 'b': baseline_path = optarg; break;
+        case 'w': write_path = optarg; break;
+        case 't': threshold = atof(optarg); break;
+        case 'm': min_ms = atof(optarg); break;
+        default:
+            printf("usage: %s [-b baseline] [-w baseline] [-t threshold] [-m ms]\n",
+                argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (baseline_path != NULL && load_baseline(baseline_path) != 0) {
+        printf("[BENCH] No baseline at %s, run make microbench-baseline first\n",
+            baseline_path);
+        return EXIT_FAILURE;
+    }
+
+    FILE* out = NULL;
+    if (write_path != NULL) {
+        out = fopen(write_path, "w");
+        if (out == NULL) {
+            perror("[BENCH] Failed to open baseline for writing");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Error injection: the byte mode rate gives a few errors per KiB,
+    // the frame mode always corrupts.
+    h_error_prob = 0.001;
+    set_error_seed(42);
+
+    prng_t rng;
+    prng_seed(&rng, 42, 0);
+
+    suspect* suspects = malloc(benches_length * sizes_length * DIST_COUNT
+        * sizeof(suspect));
+    size_t suspects_length = 0;
+
+    printf("%-18s %6s %-7s %11s %9s %9s %7s %9s\n", "bench", "size", "dist",
+        "ns/call", "ns/byte", "cyc/byte", "allocs", "vs base");
+
+    for (size_t b = 0; b < benches_length; ++b) {
+        for (size_t s = 0; s < sizes_length; ++s) {
+            for (distribution d = 0; d < DIST_COUNT; ++d) {
+                bench_result r = measure(b, s, d, &rng, min_ms * 1e6);
+                double ns_per_byte = r.ns_per_call / sizes[s];
+
+                printf("%-18s %6lu %-7s %11.1f %9.3f %9.3f %7.2f",
+                    benches[b].name, sizes[s], dist_names[d], r.ns_per_call,
+                    ns_per_byte, r.cycles_per_call / sizes[s], r.allocs_per_call);
+
+                const baseline_entry* e = baseline_path == NULL ? NULL
+                    : find_baseline(benches[b].name, sizes[s], dist_names[d]);
+
+                if (e != NULL) {
+                    suspect x = {b, s, d, ns_per_byte, e};
+                    suspects[suspects_length++] = x;
+                    printf(" %+8.1f%%", 100.0 * suspect_delta(&x));
+                }
+
+                printf("\n");
+
+                if (out != NULL) {
+                    fprintf(out, "%s %lu %s %.6f\n", benches[b].name, sizes[s],
+                        dist_names[d], ns_per_byte);
+                }
+            }
+        }
+    }
+
+    double tolerance = threshold + delta_spread(suspects, suspects_length);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < suspects_length; ++i) {
+        if (suspect_delta(&suspects[i]) > tolerance) suspects[kept++] = suspects[i];
+    }
+    suspects_length = kept;
+
+    if (baseline_path != NULL) {
+        printf("[BENCH] Tolerance %.0f%%: the threshold, plus %.0f%% between the "
+            "quartiles of the deltas\n", 100.0 * tolerance, 100.0 * (tolerance - threshold));
+    }
+
+    // Measure the suspects again, until they are gone, or have stayed
+    // above the tolerance in every round.
+    for (int round = 0; round < CONFIRM_ROUNDS && suspects_length > 0; ++round) {
+        printf("[BENCH] Measuring %lu cases above %.0f%% again, round %d of %d\n",
+            suspects_length, 100.0 * tolerance, round + 1, CONFIRM_ROUNDS);
+
+        kept = 0;
+        for (size_t i = 0; i < suspects_length; ++i) {
+            suspect x = suspects[i];
+            bench_result r = measure(x.b, x.s, x.d, &rng, min_ms * 1e6);
+            double ns_per_byte = r.ns_per_call / sizes[x.s];
+            if (ns_per_byte < x.ns_per_byte) x.ns_per_byte = ns_per_byte;
+
+            if (suspect_delta(&x) > tolerance) suspects[kept++] = x;
+        }
+        suspects_length = kept;
+    }
+
+    for (size_t i = 0; i < suspects_length; ++i) {
+        const suspect* x = &suspects[i];
+        printf("%-18s %6lu %-7s %9.3f ns/byte %+8.1f%% REGRESSION\n",
+            benches[x->b].name, sizes[x->s], dist_names[x->d], x->ns_per_byte,
+            100.0 * suspect_delta(x));
+    }
+
+    print_goodput(&rng, min_ms * 1e6);
+
+    if (out != NULL) {
+        fclose(out);
+        printf("[BENCH] Wrote baseline %s\n", write_path);
+    }
+
+    if (baseline_path != NULL) {
+        printf("[BENCH] %lu regressions above %.0f%% against %s\n", suspects_length,
+            100.0 * tolerance, baseline_path);
+    }
+
+    free(suspects);
+    free(baseline);
+    return suspects_length ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# restart-check: send two files from one T to two R processes in turn,
+# over UDP on localhost, the second R started once the first has exited.
+# Both ends run with --codec=auto, so T settles on cobs with the first R,
+# and must negotiate again with the second, which starts over from hdlc.
+#
+# usage: tools/restart-check.sh [ll]               [Default is ./ll]
+#
+# The port is RESTART_CHECK_PORT, or 47011.
+
+set -e
+
+LL=$(realpath "${1:-./ll}")
+PORT=${RESTART_CHECK_PORT:-47011}
+OPTS="--transport=udp -d 127.0.0.1:$PORT --codec=auto --no-stats"
+
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/restart-check.XXXXXX")
+T=
+trap '[ -n "$T" ] && kill $T 2>/dev/null; rm -rf "$DIR"' EXIT
+
+mkdir "$DIR/t" "$DIR/r"
+
+# Random data is full of flags and escapes, which the codecs encode apart.
+head -c 300000 /dev/urandom > "$DIR/t/first.bin"
+head -c 300000 /dev/urandom > "$DIR/t/second.bin"
+
+cd "$DIR/r"
+"$LL" -r $OPTS 1 > "$DIR/r1.log" 2>&1 &
+R=$!
+
+cd "$DIR/t"
+"$LL" -t $OPTS first.bin second.bin > "$DIR/t.log" 2>&1 &
+T=$!
+
+# T retries its SET for the second file until the second R is up.
+wait $R || true
+cd "$DIR/r"
+"$LL" -r $OPTS 1 > "$DIR/r2.log" 2>&1 || true
+wait $T || true
+T=
+
+for f in first.bin second.bin; do
+    if ! cmp -s "$DIR/t/$f" "$DIR/r/$f"; then
+        echo "[RESTART] FAILED: $f not received equal"
+        echo "--- T"; cat "$DIR/t.log"
+        echo "--- second R"; cat "$DIR/r2.log"
+        exit 1
+    fi
+done
+
+echo "[RESTART] OK: T negotiated again with a restarted R"
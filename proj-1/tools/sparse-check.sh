@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# sparse-check: send a 10 GiB sparse file over a local PTY pair, with
+# llsweep's pty mode, and check that it is received equal. The file has
+# data at 5e9, at 8.2e9 and in its last 4 bytes: only that data goes over
+# the link, and the receiver sizes the file past its trailing hole.
+#
+# usage: tools/sparse-check.sh [ll [llsweep]]     [Default is ./ll ./llsweep]
+#
+# Needs a filesystem with sparse files for its temporary directory.
+
+set -e
+
+LL=${1:-./ll}
+LLSWEEP=${2:-./llsweep}
+
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/sparse-check.XXXXXX")
+trap 'rm -rf "$DIR"' EXIT
+
+FILE=$DIR/sparse.img
+SIZE=10737418240
+
+truncate -s $SIZE "$FILE"
+head -c 1000000 /dev/urandom | dd of="$FILE" bs=1000000 seek=5000 conv=notrunc status=none
+head -c 1000000 /dev/urandom | dd of="$FILE" bs=1000000 seek=8200 conv=notrunc status=none
+printf 'tail' | dd of="$FILE" bs=1 seek=$((SIZE - 4)) conv=notrunc status=none
+
+"$LLSWEEP" -m pty -n 1 -s 16384 -k 600 -c -l "$LL" -o "$DIR/sweep.csv" "$FILE"
+
+# The CSV's ok column: runs that succeeded, and received the file equal
+OK=$(tail -n 1 "$DIR/sweep.csv" | cut -d, -f8)
+
+if [ "$OK" = "1" ]; then
+    echo "[SPARSE] OK: 10 GiB sparse file received equal"
+else
+    echo "[SPARSE] FAILED: sparse file not received, or not equal"
+    exit 1
+fi
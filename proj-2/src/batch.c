@@ -0,0 +1,291 @@
+#include "batch.h"
+#include "pipeline.h"
+#include "engine.h"
+#include "transfer.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+/**
+ * Batch download. The URLs are grouped by host and login, and each group's
+ * files are downloaded over one logged in control connection, with a PASV
+ * and a RETR each, in a child process.
+ *
+ * With --jobs, the files are downloaded by the event driven engine instead.
+ *
+ * The pipeline gives up on the first error, and so does a group's child.
+ * The files' state is shared with the parent, which marks the file the
+ * child was on as failed, and starts another child, over a new connection,
+ * from the next one.
+ *
+ * Each file is downloaded into its .part, and renamed once complete, so a
+ * failed download leaves what was there before. All the files go into the
+ * current directory, so two URLs with the same file name are refused.
+ */
+
+#define BATCH_PENDING 0
+#define BATCH_STARTED 1
+#define BATCH_DONE    2
+#define BATCH_FAILED  3
+
+typedef struct {
+    url_t url;
+    int group;
+} batch_file;
+
+typedef struct {
+    int status;
+    long long bytes;
+} batch_state;
+
+/**
+ * Shared with the groups' children
+ */
+static batch_state* state = NULL;
+
+/**
+ * Whether two URLs can share a control connection
+ */
+static bool same_login(const url_t* a, const url_t* b) {
+    return strcmp(a->hostname, b->hostname) == 0 && a->port == b->port &&
+        strcmp(a->username, b->username) == 0 && strcmp(a->password, b->password) == 0;
+}
+
+/**
+ * Read the URLs in path, or stdin if "-", one per line. Blank lines and
+ * lines starting with # are skipped, and so are invalid URLs.
+ *
+ * @return The number of files read into *filesp
+ */
+static int read_batch(const char* path, batch_file** filesp, int* invalidp) {
+    FILE* in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (in == NULL) libfail("Failed to open input file %s", path);
+
+    int n = 0, reserved = 64;
+    batch_file* files = malloc(reserved * sizeof(batch_file));
+
+    char* line = NULL;
+    size_t len = 0;
+
+    while (getline(&line, &len, in) != -1) {
+        char* start = line;
+        while (isspace(*start)) ++start;
+        char* end = start + strlen(start);
+        while (end > start && isspace(end[-1])) *--end = '\0';
+
+        if (*start == '\0' || *start == '#') continue;
+
+        if (n == reserved) {
+            reserved *= 2;
+            files = realloc(files, reserved * sizeof(batch_file));
+        }
+
+        if (ftp_parse_url(start, &files[n].url) != 0) {
+            printf(CYELLOW" Skipping invalid URL %s\n"CEND, start);
+            ++*invalidp;
+            continue;
+        }
+
+        // Both would be downloaded into the same file.
+        int same = 0;
+        while (same < n && strcmp(files[same].url.filename, files[n].url.filename) != 0) ++same;
+        if (same < n) {
+            printf(CYELLOW" Skipping %s, an earlier URL downloads into %s too\n"CEND,
+                start, files[n].url.filename);
+            ftp_free_url(&files[n].url);
+            ++*invalidp;
+            continue;
+        }
+
+        ++n;
+    }
+
+    free(line);
+    if (in != stdin) fclose(in);
+
+    *filesp = files;
+    return n;
+}
+
+/**
+ * Download files order[from..to), all of one group, over one control
+ * connection, in a child process, and exit.
+ */
+static void run_group(batch_file* files, int* order, int from, int to, int n) {
+    ftp_use_url(&files[order[from]].url);
+
+    // 2. Resolve hostname and open control socket
+    ftp_open_control_socket();
+
+    // 3. Login to the server (user + password), once for every file
+    ftp_login();
+    ftp_binary_mode();
+
+    for (int i = from; i < to; ++i) {
+        const url_t* url = &files[order[i]].url;
+        state[order[i]].status = BATCH_STARTED;
+
+        progress(CGREEN"Batch file %d of %d: ftp://%s/%s%s"CEND, order[i] + 1, n,
+            url->hostname, url->pathname, url->filename);
+
+        ftp_use_url(url);
+
+        char part[PATH_MAX];
+        snprintf(part, sizeof(part), "%s"PART_SUFFIX, url->filename);
+
+        // 4-6. PASV, RETR, and the data, into the file's .part
+        ftp_open_passive_socket();
+        send_retrieve();
+        download_file(part, 0, -1);
+
+        struct stat st;
+        state[order[i]].bytes = stat(part, &st) == 0 ? st.st_size : 0;
+        if (rename(part, url->filename) != 0) {
+            libfail("Failed to rename %s to %s", part, url->filename);
+        }
+        state[order[i]].status = BATCH_DONE;
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+static double elapsed(struct timespec* begin) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/**
+ * 1-7. Download every URL listed in path, grouped by host and login.
+ */
+int download_batch(const char* path) {
+    batch_file* files;
+    int failed = 0;
+    int n = read_batch(path, &files, &failed);
+
+    // Or all at once, on one thread
+    if (jobs > 1) {
+        const url_t** urls = malloc(n * sizeof(url_t*));
+        for (int i = 0; i < n; ++i) urls[i] = &files[i].url;
+
+        failed += engine_download(urls, n, NULL);
+
+        free(urls);
+        for (int i = 0; i < n; ++i) ftp_free_url(&files[i].url);
+        free(files);
+
+        if (failed > 0) fail("%d files failed", failed);
+        return 0;
+    }
+
+    // 1. Group the URLs, in the order their groups first appear
+    int groups = 0;
+    int* first = malloc(n * sizeof(int)); // Of each group, its first file
+
+    for (int i = 0; i < n; ++i) {
+        int g = 0;
+        while (g < groups && !same_login(&files[first[g]].url, &files[i].url)) ++g;
+        if (g == groups) first[groups++] = i;
+        files[i].group = g;
+    }
+
+    int* order = malloc(n * sizeof(int));
+    int* group_start = malloc((groups + 1) * sizeof(int));
+
+    for (int g = 0, k = 0; g < groups; ++g) {
+        group_start[g] = k;
+        for (int i = first[g]; i < n; ++i) {
+            if (files[i].group == g) order[k++] = i;
+        }
+    }
+    group_start[groups] = n;
+
+    progress("1. Batch of %d files from %d hosts and logins", n, groups);
+
+    state = mmap(NULL, (n + 1) * sizeof(batch_state), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED) libfail("Failed to map the batch's state");
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    int connections = 0;
+
+    for (int g = 0; g < groups; ++g) {
+        int from = group_start[g], to = group_start[g + 1];
+
+        while (from < to) {
+            // Children must not flush the parent's output again.
+            fflush(stdout);
+            ++connections;
+
+            pid_t child = fork();
+            if (child == -1) libfail("Failed to fork for the batch");
+            if (child == 0) run_group(files, order, from, to, n);
+
+            int status;
+            waitpid(child, &status, 0);
+
+            while (from < to && state[order[from]].status == BATCH_DONE) ++from;
+            if (from == to) break;
+
+            const url_t* url = &files[order[from]].url;
+
+            if (state[order[from]].status == BATCH_STARTED) {
+                // The child died on this file: skip it, and go on.
+                printf(CRED" Failed to download ftp://%s/%s%s\n"CEND,
+                    url->hostname, url->pathname, url->filename);
+
+                char part[PATH_MAX];
+                snprintf(part, sizeof(part), "%s"PART_SUFFIX, url->filename);
+                unlink(part);
+
+                state[order[from]].status = BATCH_FAILED;
+                ++failed;
+                ++from;
+            } else {
+                // It never got to a file: could not connect or log in.
+                printf(CRED" Failed to log in as %s on %s, skipping its %d files\n"CEND,
+                    url->username, url->hostname, to - from);
+                failed += to - from;
+                break;
+            }
+        }
+    }
+
+    double s = elapsed(&begin);
+
+    long long bytes = 0;
+    int done = 0;
+    for (int i = 0; i < n; ++i) {
+        if (state[i].status == BATCH_DONE) {
+            bytes += state[i].bytes;
+            ++done;
+        }
+    }
+
+    progress(CGREEN"Done."CEND" %d files, %lld bytes in %.3lf s over %d connections, "
+        "%.2lf ms per file", done, bytes, s, connections, done > 0 ? s * 1e3 / done : 0.0);
+
+    munmap(state, (n + 1) * sizeof(batch_state));
+    for (int i = 0; i < n; ++i) ftp_free_url(&files[i].url);
+    free(files);
+    free(first);
+    free(order);
+    free(group_start);
+
+    if (failed > 0) fail("%d files failed", failed);
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef BATCH_H___
+#define BATCH_H___
+
+int download_batch(const char* path);
+
+#endif // BATCH_H___
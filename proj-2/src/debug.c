@@ -22,7 +22,7 @@ void logftpcommand(const char* line) {
 
 void logftpreply(const char* line) {
 #if PRINT_FTP_REPLY
-    printf(CPURP"    [REPLY] %s"CEND, line);
+    printf(CPURP"    [REPLY] %s\n"CEND, line);
 #endif
 }
 
@@ -57,5 +57,5 @@ void unexpected(const char* format, ...) {
     vfprintf(stderr, format, arglist);
     va_end(arglist);
     printf("\n"CEND);
-    exit(EXIT_FAILURE);
+    exit(EXIT_UNEXPECTED);
 }
@@ -27,6 +27,13 @@
 
 #define PRINT_FTP_REPLY 1
 
+/**
+ * Exit status of unexpected(): the server refused something, and asking it
+ * again would not change its mind. fail() and libfail() exit with
+ * EXIT_FAILURE, which a resumable download retries.
+ */
+#define EXIT_UNEXPECTED 2
+
 /**
  * Logging functions
  */
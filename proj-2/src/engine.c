@@ -0,0 +1,858 @@
+#include "engine.h"
+#include "transfer.h"
+#include "resolve.h"
+#include "reply.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * Event driven download engine. Where the pipeline is one blocking
+ * transfer per process, kept in its file statics, the engine runs many at
+ * once on one thread: each is a state machine, with its own context, and
+ * is driven by epoll events on its control and passive sockets.
+ *
+ *   RESOLVE -> CONNECT -> GREET -> USER -> PASS -> TYPE -> PASV -> RETR
+ *           -> DATA -> (226 and end of data) -> PASV of its next file, or QUIT
+ *
+ * Hosts are looked up asynchronously, and their addresses raced while
+ * connecting, as resolve.c does. PASV is EPSV on IPv6. With --pipeline, the
+ * USER, PASS, TYPE I and PASV are sent at once on the 220, and their
+ * replies only move the state machine on.
+ *
+ * At most --jobs control connections are open at once, and at most
+ * --per-host to the same host. A connection done with its file goes on
+ * with the next one queued for the same host and login, if any, with just
+ * a PASV and a RETR.
+ *
+ * The passive sockets are read a --buffer at a time, into the one buffer,
+ * and written through the page cache: the engine neither splices nor
+ * preallocates, and --direct and --writeback are refused with it.
+ *
+ * A file is written into its .part, opened once the server accepted its
+ * RETR, and renamed to the file once the 226 came: a file the server
+ * refuses, or that fails half way, leaves the local one as it was.
+ */
+
+#define ENGINE_RESOLVE  0
+#define ENGINE_CONNECT  1
+#define ENGINE_GREET    2
+#define ENGINE_USER     3
+#define ENGINE_PASS     4
+#define ENGINE_TYPE     5
+#define ENGINE_PASV     6
+#define ENGINE_RETR     7
+#define ENGINE_DATA     8
+#define ENGINE_QUIT     9
+
+#define FILE_PENDING 0
+#define FILE_ACTIVE  1
+#define FILE_DONE    2
+#define FILE_FAILED  3
+
+typedef struct {
+    bool used;
+    int state;
+    int file;           // Its file, -1 if none
+    int host;
+
+    int lookup;         // Of its host's addresses
+    address_list addresses;
+    int next_address;   // The next one to try, while connecting
+    int attempts[RESOLVE_MAX_ADDRESSES]; // Sockets connecting to them
+    int nattempts;
+    long long next_attempt; // When to try the next address (ms)
+
+    int controlfd;      // -1 until connected
+    struct sockaddr_storage peer; // The address it is connected to
+    int passivefd;      // -1 if none
+    int outfd;          // -1 if none
+
+    reply_parser replies; // Of the control connection
+    bool no_password;   // USER was answered 230: the pipelined PASS's reply
+                        // is 202 or 503, and moot
+
+    bool data_done;     // The passive connection was closed by the server
+    bool replied;       // And the control connection said 226
+    long long bytes;
+    long long requested; // When its file was started on (ms)
+    long long first_byte; // And when its first byte came, -1 until then
+    time_t active;      // Last time the server was heard from
+} transfer;
+
+typedef struct {
+    const char* name;
+    int active;         // Its open control connections
+} host_state;
+
+/**
+ * The engine's state, for the run of engine_download
+ */
+static const url_t** urls = NULL;
+static int* file_state = NULL;
+static long long* file_bytes = NULL;
+static int files = 0;
+
+static host_state* hosts = NULL;
+static int* file_host = NULL;
+static int nhosts = 0;
+
+static transfer* transfers = NULL;
+static int slots = 0;
+static int active = 0;
+static int connections = 0;
+
+static long long first_byte_total = 0; // ms, of the files done
+static int epollfd = -1;
+static char* buffer = NULL;
+static size_t buffer_len = 0;
+
+/**
+ * epoll data of a transfer's socket: the socket, its slot, and whether it
+ * is the passive one. Events of sockets closed since are told apart by it.
+ */
+static uint64_t event_key(int fd, int slot, bool passive) {
+    return ((uint64_t)fd << 32) | ((uint64_t)slot << 1) | passive;
+}
+
+// epoll data of resolve.c's eventfd
+#define RESOLVE_KEY UINT64_MAX
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ll + ts.tv_nsec / 1000000;
+}
+
+static bool same_login(const url_t* a, const url_t* b) {
+    return strcmp(a->hostname, b->hostname) == 0 && a->port == b->port &&
+        strcmp(a->username, b->username) == 0 && strcmp(a->password, b->password) == 0;
+}
+
+static void close_fd(int* fdp) {
+    if (*fdp == -1) return;
+    close(*fdp);
+    *fdp = -1;
+}
+
+static void close_passive(transfer* t) {
+    close_fd(&t->passivefd); // Closing it takes it out of epoll
+    close_fd(&t->outfd);
+}
+
+/**
+ * The name of the file's .part, which it is downloaded into.
+ */
+static void part_name(const url_t* url, char* name, size_t len) {
+    snprintf(name, len, "%s"PART_SUFFIX, url->filename);
+}
+
+/**
+ * Close the transfer's connections and free its slot.
+ */
+static void release(transfer* t) {
+    close_passive(t);
+    close_fd(&t->controlfd);
+    for (int i = 0; i < t->nattempts; ++i) close(t->attempts[i]);
+    t->nattempts = 0;
+    --hosts[t->host].active;
+    --active;
+    t->used = false;
+}
+
+/**
+ * The transfer's file failed: report it, and let it go.
+ */
+static void fail_file(transfer* t, const char* why) {
+    if (t->file == -1) return;
+
+    const url_t* url = urls[t->file];
+    printf(CRED" [%ld] Failed ftp://%s/%s%s: %s\n"CEND, (long)(t - transfers),
+        url->hostname, url->pathname, url->filename, why);
+
+    if (t->outfd != -1) {
+        char part[PATH_MAX];
+        part_name(url, part, sizeof(part));
+        unlink(part);
+    }
+
+    file_state[t->file] = FILE_FAILED;
+    t->file = -1;
+    close_passive(t);
+}
+
+/**
+ * The transfer's control connection failed: its file with it.
+ */
+static void fail_transfer(transfer* t, const char* why) {
+    fail_file(t, why);
+    release(t);
+}
+
+static int send_command(transfer* t, const char* format, const char* arg) {
+    char command[1024];
+    int len = snprintf(command, sizeof(command), format, arg);
+    if (len < 0 || len >= (int)sizeof(command)) return 1;
+
+    ssize_t s = send(t->controlfd, command, len, MSG_NOSIGNAL);
+    return s == len ? 0 : 1; // A few bytes always fit in the socket
+}
+
+/**
+ * PASV, or EPSV for IPv6, which PASV does not speak.
+ */
+static void send_passive(transfer* t) {
+    t->state = ENGINE_PASV;
+    const char* command = t->peer.ss_family == AF_INET6 ? "EPSV\r\n" : "PASV\r\n";
+    if (send_command(t, command, NULL) != 0) fail_transfer(t, "Failed to send PASV");
+}
+
+/**
+ * USER, PASS, TYPE I and PASV, at once.
+ */
+static void send_login(transfer* t, const url_t* url) {
+    char commands[1024];
+    int len = snprintf(commands, sizeof(commands), "USER %s\r\nPASS %s\r\nTYPE I\r\n%s\r\n",
+        url->username, url->password, t->peer.ss_family == AF_INET6 ? "EPSV" : "PASV");
+
+    if (len < 0 || len >= (int)sizeof(commands) || send_command(t, "%s", commands) != 0) {
+        fail_transfer(t, "Failed to send pipelined login");
+    }
+}
+
+/**
+ * Take the next pending file for the transfer's host and login, with a
+ * PASV, or say goodbye if there is none.
+ */
+static void next_file(transfer* t, const url_t* login) {
+    t->file = -1;
+
+    for (int i = 0; i < files; ++i) {
+        if (file_state[i] == FILE_PENDING && same_login(urls[i], login)) {
+            t->file = i;
+            break;
+        }
+    }
+
+    if (t->file == -1) {
+        t->state = ENGINE_QUIT;
+        if (send_command(t, "QUIT\r\n", NULL) != 0) release(t);
+        return;
+    }
+
+    file_state[t->file] = FILE_ACTIVE;
+    t->requested = now_ms();
+    send_passive(t);
+}
+
+static void complete_file(transfer* t) {
+    const url_t* url = urls[t->file];
+
+    char part[PATH_MAX];
+    part_name(url, part, sizeof(part));
+
+    int s = close(t->outfd);
+    t->outfd = -1;
+    if (s != 0) {
+        unlink(part);
+        fail_file(t, "Failed to write to output file");
+        next_file(t, url);
+        return;
+    }
+    if (rename(part, url->filename) != 0) {
+        unlink(part);
+        fail_file(t, "Failed to rename output file");
+        next_file(t, url);
+        return;
+    }
+
+    close_passive(t);
+    file_state[t->file] = FILE_DONE;
+    file_bytes[t->file] = t->bytes;
+
+    long long ttfb = t->first_byte >= 0 ? t->first_byte - t->requested : 0;
+    first_byte_total += ttfb;
+
+    progress(" [%ld] Done ftp://%s/%s%s, %lld bytes, first after %lld ms", (long)(t - transfers),
+        url->hostname, url->pathname, url->filename, t->bytes, ttfb);
+
+    next_file(t, url);
+}
+
+/**
+ * The passive address in a 227 or a 229 reply.
+ *
+ * @return 0 on success, 1 if the reply is malformed
+ */
+static int passive_address(transfer* t, const char* code, const char* line,
+        struct sockaddr_storage* addrp) {
+    const char* p = strchr(line, '(');
+    if (p == NULL) return 1;
+
+    if (strcmp(code, "229") == 0) {
+        // 229 Entering Extended Passive Mode (|||port|), of the peer's address
+        int port;
+        if (p[1] == '\0' || p[2] != p[1] || p[3] != p[1] || sscanf(p + 4, "%d", &port) != 1) {
+            return 1;
+        }
+
+        *addrp = t->peer;
+        if (addrp->ss_family == AF_INET6) {
+            ((struct sockaddr_in6*)addrp)->sin6_port = htons(port);
+        } else {
+            ((struct sockaddr_in*)addrp)->sin_port = htons(port);
+        }
+        return 0;
+    }
+
+    // 227 Entering Passive Mode (IP3.IP2.IP1.IP0,Port1,Port0)
+    int ip3, ip2, ip1, ip0, port1, port0;
+    if (sscanf(p + 1, "%d, %d, %d, %d, %d, %d", &ip3, &ip2, &ip1, &ip0, &port1, &port0) != 6) {
+        return 1;
+    }
+
+    struct sockaddr_in* in_addr = (struct sockaddr_in*)addrp;
+    memset(addrp, 0, sizeof(*addrp));
+    in_addr->sin_family = AF_INET;
+    in_addr->sin_port = htons(port1 * 256 + port0);
+    in_addr->sin_addr.s_addr = htonl((ip3 << 24) | (ip2 << 16) | (ip1 << 8) | ip0);
+    return 0;
+}
+
+/**
+ * 4-5. Connect to the passive address in the 227 or 229 reply, and RETR the
+ * file. The passive socket is watched, and the file opened, only once the
+ * server accepts the RETR: what it sends before waits in the socket.
+ */
+static void open_passive(transfer* t, const char* code, const char* line) {
+    const url_t* url = urls[t->file];
+
+    struct sockaddr_storage addr;
+    if (passive_address(t, code, line, &addr) != 0) {
+        fail_transfer(t, "Unexpected Passive Mode response format");
+        return;
+    }
+
+    t->passivefd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (t->passivefd == -1) {
+        fail_transfer(t, "Failed to open passive socket");
+        return;
+    }
+
+    if (rcvbuf_size > 0) {
+        int size = rcvbuf_size * 1024;
+        setsockopt(t->passivefd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    socklen_t len = addr.ss_family == AF_INET6 ?
+        sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+    int s = connect(t->passivefd, (struct sockaddr*)&addr, len);
+    if (s != 0 && errno != EINPROGRESS) {
+        fail_transfer(t, "Failed to connect() passive socket");
+        return;
+    }
+
+    t->data_done = t->replied = false;
+    t->bytes = 0;
+    t->first_byte = -1;
+
+    char path[2048];
+    snprintf(path, sizeof(path), "%s%s", url->pathname, url->filename);
+
+    t->state = ENGINE_RETR;
+    if (send_command(t, "RETR %s\r\n", path) != 0) fail_transfer(t, "Failed to send RETR");
+}
+
+/**
+ * 5.1. The server accepted the RETR: open the file's .part, and read the
+ * passive socket into it.
+ */
+static void start_data(transfer* t) {
+    char part[PATH_MAX];
+    part_name(urls[t->file], part, sizeof(part));
+
+    t->outfd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (t->outfd == -1) {
+        fail_transfer(t, "Failed to open output file");
+        return;
+    }
+
+    // Errors of the connect in progress come as EPOLLERR
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = event_key(t->passivefd, t - transfers, true)};
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, t->passivefd, &ev);
+
+    t->state = ENGINE_DATA;
+}
+
+/**
+ * Advance the transfer's state machine on a complete reply.
+ */
+static void on_reply(transfer* t, const char* code, const char* line) {
+    const url_t* url = urls[t->file != -1 ? t->file : 0];
+
+    switch (t->state) {
+    case ENGINE_GREET:
+        // 220 === Service ready for new user
+        if (strcmp(code, "220") != 0) {
+            fail_transfer(t, "Expected reply 220");
+            return;
+        }
+        t->state = ENGINE_USER;
+        if (pipelined) {
+            send_login(t, url);
+        } else if (send_command(t, "USER %s\r\n", url->username) != 0) {
+            fail_transfer(t, "Failed to send USER");
+        }
+        break;
+    case ENGINE_USER:
+        // 331 === User name okay, send password
+        // 230 === Login successful, with no password needed
+        if (strcmp(code, "230") == 0 && pipelined) {
+            t->state = ENGINE_PASS;
+            t->no_password = true;
+            break;
+        }
+        if (strcmp(code, "230") == 0) {
+            t->state = ENGINE_TYPE;
+            if (send_command(t, "TYPE I\r\n", NULL) != 0) fail_transfer(t, "Failed to send TYPE");
+            break;
+        }
+        if (strcmp(code, "331") != 0) {
+            fail_transfer(t, "Expected reply 331");
+            return;
+        }
+        t->state = ENGINE_PASS;
+        if (pipelined) break;
+        if (send_command(t, "PASS %s\r\n", url->password) != 0) fail_transfer(t, "Failed to send PASS");
+        break;
+    case ENGINE_PASS:
+        // 230 === Login successful, proceed
+        if (strcmp(code, "230") != 0 && !t->no_password) {
+            fail_transfer(t, "Expected reply 230");
+            return;
+        }
+        t->state = ENGINE_TYPE;
+        if (pipelined) break;
+        if (send_command(t, "TYPE I\r\n", NULL) != 0) fail_transfer(t, "Failed to send TYPE");
+        break;
+    case ENGINE_TYPE:
+        // 200 === Command okay
+        if (strcmp(code, "200") != 0) {
+            fail_transfer(t, "Expected reply 200");
+            return;
+        }
+        if (pipelined) {
+            t->state = ENGINE_PASV;
+        } else {
+            send_passive(t);
+        }
+        break;
+    case ENGINE_PASV:
+        // 227 Entering Passive Mode (IP3.IP2.IP1.IP0,Port1,Port0)
+        // 229 Entering Extended Passive Mode (|||port|)
+        if (strcmp(code, "227") != 0 && strcmp(code, "229") != 0) {
+            fail_transfer(t, "Expected reply 227 or 229");
+            return;
+        }
+        open_passive(t, code, line);
+        break;
+    case ENGINE_RETR:
+        // 150 File status okay, opening data transfer now
+        // 550 and such === No such file: the connection goes on with the next
+        if (code[0] == '1') {
+            start_data(t);
+            break;
+        }
+        fail_file(t, line);
+        next_file(t, url);
+        break;
+    case ENGINE_DATA:
+        // 226 === Closing data connection, transfer complete
+        if (code[0] == '1') break;
+        if (strcmp(code, "226") != 0) {
+            fail_file(t, line);
+            next_file(t, url);
+            break;
+        }
+        t->replied = true;
+        if (t->data_done) complete_file(t);
+        break;
+    case ENGINE_QUIT:
+        release(t);
+        break;
+    }
+}
+
+/**
+ * Read what the control socket has, and act on every complete reply: the
+ * last line of it, that starts with the code and a space.
+ */
+static void on_control(transfer* t) {
+    size_t len;
+    char* space = reply_space(&t->replies, &len);
+
+    ssize_t r = recv(t->controlfd, space, len, 0);
+
+    if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (r <= 0) {
+        if (t->state == ENGINE_QUIT) {
+            release(t);
+        } else {
+            fail_transfer(t, "Control connection closed");
+        }
+        return;
+    }
+
+    reply_received(&t->replies, r);
+    t->active = time(NULL);
+
+    int slot = t - transfers;
+    ftp_reply reply;
+    int s;
+
+    while ((s = reply_next(&t->replies, &reply)) == REPLY_DONE) {
+        on_reply(t, reply.code, reply.line);
+
+        // The reply may have ended the transfer, or started another in it.
+        if (!transfers[slot].used || t->controlfd == -1) return;
+    }
+
+    if (s == REPLY_TOO_LONG) fail_transfer(t, "Reply line too long");
+}
+
+/**
+ * Copy what the passive socket has into the file.
+ */
+static void on_passive(transfer* t) {
+    ssize_t r;
+
+    while ((r = read(t->passivefd, buffer, buffer_len)) > 0) {
+        if (t->first_byte == -1) t->first_byte = now_ms();
+
+        for (ssize_t done = 0; done < r;) {
+            ssize_t w = write(t->outfd, buffer + done, r - done);
+            if (w <= 0) {
+                fail_transfer(t, "Failed to write to output file");
+                return;
+            }
+            done += w;
+        }
+        t->bytes += r;
+    }
+
+    if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        t->active = time(NULL);
+        return;
+    }
+    if (r == -1) {
+        fail_transfer(t, "Failed to read file on passive socket");
+        return;
+    }
+
+    // End of data: the file is complete once the server says so.
+    t->data_done = true;
+    close_fd(&t->passivefd);
+
+    if (t->replied) complete_file(t);
+}
+
+/**
+ * 2.2. Start connecting to the host's next address. Once all of them
+ * failed, so did the transfer.
+ */
+static void start_attempt(transfer* t) {
+    while (t->next_address < t->addresses.n) {
+        const struct addrinfo* ai = t->addresses.addresses[t->next_address++];
+
+        int fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd == -1) continue;
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0 && errno != EINPROGRESS) {
+            close(fd);
+            continue;
+        }
+
+        t->attempts[t->nattempts++] = fd;
+        t->next_attempt = now_ms() + CONNECT_ATTEMPT_DELAY_MS;
+
+        struct epoll_event ev = {.events = EPOLLOUT, .data.u64 = event_key(fd, t - transfers, false)};
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+        return;
+    }
+
+    if (t->nattempts == 0) fail_transfer(t, "Failed to connect() control socket");
+}
+
+/**
+ * 2.1. Go on connecting once the host's lookup is done.
+ */
+static void on_resolved(transfer* t) {
+    int s = resolve_poll(t->lookup, &t->addresses);
+    if (s == RESOLVE_PENDING) return;
+
+    if (s == RESOLVE_FAILED) {
+        fail_transfer(t, resolve_error(t->lookup));
+        return;
+    }
+
+    t->state = ENGINE_CONNECT;
+    t->next_address = 0;
+    start_attempt(t);
+}
+
+/**
+ * 2. Look the host of the file up, and connect to it once it is.
+ */
+static void start_transfer(int slot, int file) {
+    transfer* t = &transfers[slot];
+    const url_t* url = urls[file];
+
+    *t = (transfer){
+        .used = true,
+        .state = ENGINE_RESOLVE,
+        .file = file,
+        .host = file_host[file],
+        .controlfd = -1,
+        .passivefd = -1,
+        .outfd = -1,
+        .requested = now_ms(),
+        .active = time(NULL)
+    };
+
+    file_state[file] = FILE_ACTIVE;
+    ++hosts[t->host].active;
+    ++active;
+    ++connections;
+
+    t->lookup = resolve_start(url->hostname, url->port);
+    on_resolved(t);
+}
+
+/**
+ * 2.3. One of the control connection attempts is writable: it connected,
+ * and wins over the others, or failed.
+ */
+static void on_connect(transfer* t, int fd) {
+    int i = 0;
+    while (i < t->nattempts && t->attempts[i] != fd) ++i;
+    if (i == t->nattempts) return; // Closed since
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+    t->attempts[i] = t->attempts[--t->nattempts];
+
+    if (err != 0) {
+        close(fd);
+        if (t->nattempts > 0) return;
+
+        if (t->next_address < t->addresses.n) {
+            start_attempt(t);
+        } else {
+            fail_transfer(t, strerror(err));
+        }
+        return;
+    }
+
+    for (int k = 0; k < t->nattempts; ++k) close(t->attempts[k]);
+    t->nattempts = 0;
+
+    t->controlfd = fd;
+    len = sizeof(t->peer);
+    getpeername(fd, (struct sockaddr*)&t->peer, &len);
+
+    t->state = ENGINE_GREET;
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = event_key(fd, t - transfers, false)};
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/**
+ * Race the next address of the transfers whose attempts are slow.
+ *
+ * @return Milliseconds until the next attempt is due, at most 1000
+ */
+static int race(long long now) {
+    long long wait = 1000;
+
+    for (int i = 0; i < slots; ++i) {
+        transfer* t = &transfers[i];
+        if (!t->used || t->state != ENGINE_CONNECT || t->next_address >= t->addresses.n) continue;
+
+        if (now >= t->next_attempt) start_attempt(t);
+        if (t->used && t->next_address < t->addresses.n && t->next_attempt - now < wait) {
+            wait = t->next_attempt - now;
+        }
+    }
+
+    return wait < 0 ? 0 : wait;
+}
+
+/**
+ * Start pending files while there are free slots, and their hosts are
+ * under their limit.
+ */
+static void schedule() {
+    for (int i = 0; i < files && active < slots; ++i) {
+        if (file_state[i] != FILE_PENDING) continue;
+        if (hosts[file_host[i]].active >= per_host) continue;
+
+        int slot = 0;
+        while (transfers[slot].used) ++slot;
+        start_transfer(slot, i);
+    }
+}
+
+/**
+ * Give up on the transfers the server has not answered for too long.
+ */
+static void expire(time_t now) {
+    for (int i = 0; i < slots; ++i) {
+        transfer* t = &transfers[i];
+        if (t->used && now - t->active > ENGINE_TIMEOUT) fail_transfer(t, "Timed out");
+    }
+}
+
+static double elapsed(struct timespec* begin) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/**
+ * 2-7. Download the n files at once, --jobs at a time, at most --per-host
+ * from the same host.
+ *
+ * @return The number of files that failed, and whether each one was
+ *         downloaded in donep[i], unless donep is NULL
+ */
+int engine_download(const url_t** list, int n, bool* donep) {
+    urls = list;
+    files = n;
+    slots = jobs;
+
+    file_state = calloc(n, sizeof(int));
+    file_bytes = calloc(n, sizeof(long long));
+    file_host = malloc(n * sizeof(int));
+    hosts = malloc(n * sizeof(host_state));
+    transfers = calloc(slots, sizeof(transfer));
+
+    for (int i = 0; i < n; ++i) {
+        int h = 0;
+        while (h < nhosts && strcmp(hosts[h].name, urls[i]->hostname) != 0) ++h;
+        if (h == nhosts) hosts[nhosts++] = (host_state){urls[i]->hostname, 0};
+        file_host[i] = h;
+    }
+
+    buffer_len = (size_t)buffer_size * MIB;
+    buffer = malloc(buffer_len);
+
+    // Each transfer has up to three files open.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    epollfd = epoll_create1(0);
+    if (epollfd == -1) libfail("Failed to create epoll instance");
+
+    struct epoll_event wake = {.events = EPOLLIN, .data.u64 = RESOLVE_KEY};
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, resolve_eventfd(), &wake);
+
+    progress("2. Downloading %d files from %d hosts, %d at a time, %d per host",
+        n, nhosts, slots, per_host);
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    int peak = 0;
+    struct epoll_event events[64];
+
+    schedule();
+    int wait = race(now_ms());
+
+    while (active > 0) {
+        if (active > peak) peak = active;
+
+        int k = epoll_wait(epollfd, events, 64, wait);
+        if (k == -1 && errno != EINTR) libfail("Failed to wait for events");
+
+        for (int i = 0; i < k; ++i) {
+            if (events[i].data.u64 == RESOLVE_KEY) {
+                resolve_collect();
+                for (int j = 0; j < slots; ++j) {
+                    if (transfers[j].used && transfers[j].state == ENGINE_RESOLVE) {
+                        on_resolved(&transfers[j]);
+                    }
+                }
+                continue;
+            }
+
+            int fd = events[i].data.u64 >> 32;
+            transfer* t = &transfers[(events[i].data.u64 & 0xffffffff) >> 1];
+            bool passive = events[i].data.u64 & 1;
+
+            // The event may be of a socket a previous event closed.
+            if (!t->used) continue;
+
+            if (passive) {
+                if (fd == t->passivefd) on_passive(t);
+            } else if (t->state == ENGINE_CONNECT) {
+                on_connect(t, fd);
+            } else if (fd == t->controlfd) {
+                on_control(t);
+            }
+        }
+
+        expire(time(NULL));
+        schedule();
+        wait = race(now_ms());
+    }
+
+    double s = elapsed(&begin);
+
+    int done = 0, failed = 0;
+    long long bytes = 0;
+    for (int i = 0; i < n; ++i) {
+        if (donep != NULL) donep[i] = file_state[i] == FILE_DONE;
+
+        if (file_state[i] == FILE_DONE) {
+            ++done;
+            bytes += file_bytes[i];
+        } else {
+            ++failed;
+        }
+    }
+
+    progress(CGREEN"Done."CEND" %d files, %lld bytes in %.3lf s, %.2lf MB/s over %d connections, "
+        "%d at once at most", done, bytes, s, bytes / s / 1e6, connections, peak);
+    progress(" First byte after %.1lf ms on average (%s)", done > 0 ? (double)first_byte_total / done : 0.0,
+        pipelined ? "pipelined" : "one command at a time");
+
+    close(epollfd);
+    free(buffer);
+    free(transfers);
+    free(hosts);
+    free(file_host);
+    free(file_bytes);
+    free(file_state);
+
+    return failed;
+}
@@ -0,0 +1,11 @@
+#ifndef ENGINE_H___
+#define ENGINE_H___
+
+#include "pipeline.h"
+
+// Seconds a transfer may wait on the server before it is given up on
+#define ENGINE_TIMEOUT 30
+
+int engine_download(const url_t** urls, int n, bool* donep);
+
+#endif // ENGINE_H___
@@ -0,0 +1,245 @@
+#include "index.h"
+#include "options.h"
+#include "transfer.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+ * The mirror's index: an array of entries, loaded whole, looked up by path
+ * with a binary search, and written whole again into a new file renamed
+ * over the old one, so that a run cut short leaves the old index.
+ */
+
+// Bytes of a u64's LEB128 varint, at most
+#define VARINT_MAX 10
+
+static size_t put_varint(unsigned char* p, uint64_t value) {
+    size_t n = 0;
+    do {
+        unsigned char b = value & 0x7f;
+        value >>= 7;
+        p[n++] = b | (value != 0 ? 0x80 : 0);
+    } while (value != 0);
+    return n;
+}
+
+/**
+ * @return Bytes of the varint at p, or 0 if it runs past end
+ */
+static size_t get_varint(const unsigned char* p, const unsigned char* end, uint64_t* valuep) {
+    uint64_t value = 0;
+    for (size_t n = 0; n < VARINT_MAX && p + n < end; ++n) {
+        value |= (uint64_t)(p[n] & 0x7f) << (7 * n);
+        if ((p[n] & 0x80) == 0) {
+            *valuep = value;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static int by_path(const void* a, const void* b) {
+    return strcmp(((const index_entry*)a)->path, ((const index_entry*)b)->path);
+}
+
+static void sort_index(mirror_index* index) {
+    if (!index->sorted) qsort(index->entries, index->n, sizeof(index_entry), by_path);
+    index->sorted = true;
+}
+
+void index_add(mirror_index* index, const index_entry* entry) {
+    if (index->n == index->reserved) {
+        index->reserved = index->reserved == 0 ? 64 : index->reserved * 2;
+        index->entries = realloc(index->entries, index->reserved * sizeof(index_entry));
+    }
+
+    index->entries[index->n] = *entry;
+    index->entries[index->n++].path = strdup(entry->path);
+    index->sorted = false;
+}
+
+/**
+ * Read the index in file into *indexp, or an empty one if there is none.
+ *
+ * @return 0 on success, 1 if the file is not an index, or is cut short: the
+ *         entries read until then are kept
+ */
+int index_load(const char* file, mirror_index* indexp) {
+    *indexp = (mirror_index){.sorted = true};
+
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) libfail("Failed to stat index %s", file);
+
+    unsigned char* data = malloc(st.st_size + 1);
+    ssize_t len = read(fd, data, st.st_size);
+    close(fd);
+
+    const size_t magic = strlen(INDEX_MAGIC);
+    if (len != st.st_size || (size_t)len < magic || memcmp(data, INDEX_MAGIC, magic) != 0) {
+        free(data);
+        return 1;
+    }
+
+    const unsigned char* p = data + magic;
+    const unsigned char* end = data + len;
+
+    char* path = malloc(1);
+    size_t path_len = 0;
+    int s = 0;
+
+    while (p < end) {
+        uint64_t shared, suffix, size, stamp;
+        size_t n;
+
+        if ((n = get_varint(p, end, &shared)) == 0) { s = 1; break; }
+        p += n;
+        if ((n = get_varint(p, end, &suffix)) == 0) { s = 1; break; }
+        p += n;
+
+        if (shared > path_len || suffix > (uint64_t)(end - p)) { s = 1; break; }
+
+        path = realloc(path, shared + suffix + 1);
+        memcpy(path + shared, p, suffix);
+        path_len = shared + suffix;
+        path[path_len] = '\0';
+        p += suffix;
+
+        if ((n = get_varint(p, end, &size)) == 0) { s = 1; break; }
+        p += n;
+        if ((n = get_varint(p, end, &stamp)) == 0) { s = 1; break; }
+        p += n;
+        if (end - p < 8) { s = 1; break; }
+
+        uint64_t checksum = 0;
+        for (int i = 7; i >= 0; --i) checksum = (checksum << 8) | p[i];
+        p += 8;
+
+        index_entry entry = {
+            .path = path,
+            .size = (long long)size - 1,
+            .stamp = (long long)stamp - 1,
+            .checksum = checksum
+        };
+        index_add(indexp, &entry);
+    }
+
+    free(path);
+    free(data);
+
+    indexp->sorted = false;
+    sort_index(indexp);
+    return s;
+}
+
+/**
+ * Write the index, but its removed entries, into file.
+ *
+ * @return 0 on success
+ */
+int index_save(const char* file, mirror_index* index) {
+    sort_index(index);
+
+    char* tmp = malloc(strlen(file) + 5);
+    sprintf(tmp, "%s.new", file);
+
+    FILE* out = fopen(tmp, "w");
+    if (out == NULL) libfail("Failed to open index %s", tmp);
+
+    fwrite(INDEX_MAGIC, 1, strlen(INDEX_MAGIC), out);
+
+    const char* previous = "";
+    unsigned char record[4 * VARINT_MAX + 8];
+
+    for (int i = 0; i < index->n; ++i) {
+        const index_entry* entry = &index->entries[i];
+        if (entry->removed) continue;
+
+        size_t shared = 0;
+        while (previous[shared] != '\0' && previous[shared] == entry->path[shared]) ++shared;
+        size_t suffix = strlen(entry->path) - shared;
+
+        size_t n = put_varint(record, shared);
+        n += put_varint(record + n, suffix);
+        fwrite(record, 1, n, out);
+        fwrite(entry->path + shared, 1, suffix, out);
+
+        n = put_varint(record, entry->size + 1);
+        n += put_varint(record + n, entry->stamp + 1);
+        for (int k = 0; k < 8; ++k) record[n++] = entry->checksum >> (8 * k);
+        fwrite(record, 1, n, out);
+
+        previous = entry->path;
+    }
+
+    if (fclose(out) != 0) libfail("Failed to write index %s", tmp);
+    if (rename(tmp, file) != 0) libfail("Failed to replace index %s", file);
+
+    free(tmp);
+    return 0;
+}
+
+/**
+ * @return The entry of path, or NULL if there is none
+ */
+index_entry* index_find(mirror_index* index, const char* path) {
+    sort_index(index);
+
+    index_entry key = {.path = (char*)path};
+    index_entry* entry = bsearch(&key, index->entries, index->n, sizeof(index_entry), by_path);
+
+    return entry == NULL || entry->removed ? NULL : entry;
+}
+
+/**
+ * Leave the entry out of the index from now on. It stays in place until the
+ * index is freed, not to move the others.
+ */
+void index_remove(index_entry* entry) {
+    entry->removed = true;
+}
+
+void index_free(mirror_index* index) {
+    for (int i = 0; i < index->n; ++i) free(index->entries[i].path);
+    free(index->entries);
+    *index = (mirror_index){0};
+}
+
+/**
+ * FNV-1a, 64 bits, of the file's bytes: to tell whether it changed since it
+ * was downloaded, not to trust it against anyone.
+ *
+ * @return 0 on success, 1 if the file could not be read
+ */
+int file_checksum(const char* file, uint64_t* checksump) {
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) return 1;
+
+    size_t len = (size_t)buffer_size * MIB;
+    unsigned char* buffer = malloc(len);
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    ssize_t count;
+    while ((count = read(fd, buffer, len)) > 0) {
+        for (ssize_t i = 0; i < count; ++i) {
+            hash ^= buffer[i];
+            hash *= 0x100000001b3ull;
+        }
+    }
+
+    free(buffer);
+    close(fd);
+
+    if (count < 0) return 1;
+
+    *checksump = hash;
+    return 0;
+}
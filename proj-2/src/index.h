@@ -0,0 +1,50 @@
+#ifndef INDEX_H___
+#define INDEX_H___
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A mirror's index, of the files it downloaded: kept in its local root,
+// for the next run to download only what changed.
+//
+// The file is the magic, and then one record per file, sorted by path:
+//   varint shared, varint len, len bytes, varint size + 1, varint stamp + 1,
+//   u64 checksum
+// where varints are LEB128 and the u64 little endian. A path is stored as
+// the bytes it shares with the path before it, and the len bytes after
+// those, so that the files of a directory cost little more than their names.
+#define INDEX_MAGIC "FTPIDX01"
+#define INDEX_FILE  ".mirror-index"
+
+typedef struct {
+    char* path;         // Relative to the mirror's root
+    long long size;     // -1 if the listing did not tell
+    long long stamp;    // MLSD's modify, as MDTM's YYYYMMDDHHMMSS, or a
+                        // hash of LIST's date; -1 if the listing did not tell
+    uint64_t checksum;  // Of the local file, as downloaded
+    bool seen;          // Listed by this run, not stored
+    bool removed;       // Not to be stored
+} index_entry;
+
+typedef struct {
+    index_entry* entries;
+    int n;
+    int reserved;
+    bool sorted;        // By path, for index_find
+} mirror_index;
+
+int index_load(const char* file, mirror_index* indexp);
+
+int index_save(const char* file, mirror_index* index);
+
+index_entry* index_find(mirror_index* index, const char* path);
+
+void index_add(mirror_index* index, const index_entry* entry);
+
+void index_remove(index_entry* entry);
+
+void index_free(mirror_index* index);
+
+int file_checksum(const char* file, uint64_t* checksump);
+
+#endif // INDEX_H___
@@ -1,43 +1,58 @@
 #include "pipeline.h"
+#include "segments.h"
+#include "resume.h"
+#include "batch.h"
+#include "mirror.h"
+#include "options.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        printf("Expected 1 argument. Usage:\n  ./download ftp://...\n");
-        return 0;
-    }
-
-    /**
-     * 1. Parse input FTP URL
-     */
-    parse_url(argv[1]);
+    parse_args(argc, argv);
 
     /**
-     * 2. Resolve hostname to server's IPv4 IP address and open protocol socket
+     * 1-7. Or download every URL in a list, by host and login
      */
-    ftp_open_control_socket();
+    if (input_file != NULL) {
+        download_batch(input_file);
+        exit(EXIT_SUCCESS);
+    }
 
     /**
-     * 3. Login to the server (user + password)
+     * 1. Parse input FTP URL
      */
-    ftp_login();
+    parse_url(url_argument);
 
     /**
-     * 4. Enter passive mode and open passive socket
+     * 2-7. Or mirror the directory's tree, walking it on one connection
+     * and downloading its files on --jobs
      */
-    ftp_open_passive_socket();
+    if (mirror) {
+        download_mirror();
+        exit(EXIT_SUCCESS);
+    }
 
     /**
-     * 5. Send retrieve command for file
+     * 2-7. Or download the file in byte ranges, over several connections
      */
-    send_retrieve();
+    if (number_of_segments > 1) {
+        ftp_open_control_socket();
+        ftp_login();
+        download_segments(number_of_segments);
+        exit(EXIT_SUCCESS);
+    }
 
     /**
-     * 6. Download file
+     * 2-6. Download the file, over new connections for every attempt, each
+     * resuming where the one before failed:
+     *   2. Resolve hostname to server's IPv4 IP address and open protocol socket
+     *   3. Login to the server (user + password)
+     *   4. Enter binary and passive mode, and restart at the partial file's end
+     *   5. Send retrieve command for file
+     *   6. Download file
      */
-    download_file();
+    download_resumable();
 
     /**
      * 7. Close connection to server
@@ -0,0 +1,507 @@
+#include "mirror.h"
+#include "pipeline.h"
+#include "engine.h"
+#include "index.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/**
+ * Mirror mode. The URL's directory tree is walked over one control
+ * connection, breadth first, with MLSD, or with LIST if the server has no
+ * MLSD, and its directories are made locally as they are found.
+ *
+ * Its files are then downloaded by the engine, whose control connections
+ * are a pool of logged in sessions: each takes the next file queued once
+ * done with its own. The queue is ordered by size, largest first, so that
+ * the files started last are the small ones, and no connection is left
+ * with a large one while the others are idle.
+ *
+ * What was downloaded is kept in the mirror's index, and a mirror run again
+ * is a sync: it downloads only the files new or changed on the server since,
+ * by their size and modification time as listed, or changed locally, by
+ * their checksum. The listing tells both, so an unchanged tree costs its
+ * listing, and no command per file.
+ *
+ * A directory the server would not list tells nothing of its files: those
+ * the index has under it are kept, as are their local copies with --delete,
+ * and the run fails.
+ */
+
+#define ENTRY_OTHER 0
+#define ENTRY_FILE  1
+#define ENTRY_DIR   2
+
+typedef struct {
+    char* path;         // Relative to the mirror's root
+    long long size;     // -1 if the listing did not tell
+    long long stamp;    // As the index has it
+} mirror_file;
+
+static char** dirs = NULL;      // Relative to the root, each ending with /
+static int* depths = NULL;
+static int ndirs = 0;
+static int reserved_dirs = 0;
+
+static const char** unlisted = NULL; // Of dirs, the server would not list
+static int nunlisted = 0;
+
+static mirror_file* files = NULL;
+static int nfiles = 0;
+static int reserved_files = 0;
+
+static char* concat(const char* a, const char* b, const char* c) {
+    char* s = malloc(strlen(a) + strlen(b) + strlen(c) + 1);
+    strcpy(s, a);
+    strcat(s, b);
+    strcat(s, c);
+    return s;
+}
+
+/**
+ * A name the server may give an entry: not one that climbs out of its
+ * directory.
+ */
+static bool valid_name(const char* name) {
+    return name[0] != '\0' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0 &&
+        strchr(name, '/') == NULL;
+}
+
+/**
+ * Parse a line of MLSD (RFC 3659), "fact=value;fact=value; name". Its
+ * modify fact is MDTM's YYYYMMDDHHMMSS[.sss], of which the seconds are kept.
+ *
+ * @return 0 on success, 1 if the line is malformed
+ */
+static int parse_mlsd(char* line, char** namep, int* typep, long long* sizep, long long* stampp) {
+    char* name = strchr(line, ' ');
+    if (name == NULL) return 1;
+    *name++ = '\0';
+
+    *typep = ENTRY_OTHER; // cdir, pdir, and links
+    *sizep = *stampp = -1;
+
+    char* save;
+    for (char* fact = strtok_r(line, ";", &save); fact != NULL; fact = strtok_r(NULL, ";", &save)) {
+        char* value = strchr(fact, '=');
+        if (value == NULL) continue;
+        *value++ = '\0';
+
+        if (strcasecmp(fact, "type") == 0) {
+            if (strcasecmp(value, "file") == 0) *typep = ENTRY_FILE;
+            if (strcasecmp(value, "dir") == 0) *typep = ENTRY_DIR;
+        } else if (strcasecmp(fact, "size") == 0) {
+            sscanf(value, "%lld", sizep);
+        } else if (strcasecmp(fact, "modify") == 0) {
+            sscanf(value, "%14lld", stampp);
+        }
+    }
+
+    *namep = name;
+    return 0;
+}
+
+/**
+ * A stamp for a date as LIST has it, which is only ever compared to another.
+ */
+static long long hash_date(const char* date, int len) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < len; ++i) {
+        hash ^= (unsigned char)date[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash >> 2; // A stamp is not negative, and the index adds one to it
+}
+
+/**
+ * Parse a line of LIST, whose format is the server's own. Unix ls -l's is
+ * the common one, and DOS dir's the other:
+ *   drwxr-xr-x    2 ftp      ftp          4096 Jan 01 12:00 name
+ *   01-01-20  12:00PM       <DIR>          name
+ * The date is not parsed, for its format and time zone are the server's:
+ * its stamp is a hash of it. ls -l changes a date older than 6 months from
+ * time to year, so such files are downloaded once more when they turn 6
+ * months old.
+ *
+ * @return 0 on success, 1 if the line is not an entry
+ */
+static int parse_list(char* line, char** namep, int* typep, long long* sizep, long long* stampp) {
+    char field[32];
+    int n = 0, date = 0, date_end = 0;
+
+    *sizep = -1;
+
+    if (isdigit(line[0])) {
+        if (sscanf(line, "%*s %*s%n %31s %n", &date_end, field, &n) != 1 || n == 0) return 1;
+
+        if (strcmp(field, "<DIR>") == 0) {
+            *typep = ENTRY_DIR;
+        } else {
+            *typep = ENTRY_FILE;
+            sscanf(field, "%lld", sizep);
+        }
+    } else {
+        long long size;
+        if (sscanf(line, "%31s %*s %*s %*s %lld %n%*s %*s %*s%n %n",
+                field, &size, &date, &date_end, &n) != 2 || n == 0) {
+            return 1; // "total 42", say
+        }
+
+        // Links are skipped: they may point anywhere, or in a loop.
+        *typep = field[0] == 'd' ? ENTRY_DIR : field[0] == '-' ? ENTRY_FILE : ENTRY_OTHER;
+        *sizep = size;
+    }
+
+    *namep = line + n;
+    *stampp = hash_date(line + date, date_end - date);
+    return 0;
+}
+
+static void add_dir(char* path, int depth) {
+    if (ndirs == reserved_dirs) {
+        reserved_dirs = reserved_dirs == 0 ? 64 : reserved_dirs * 2;
+        dirs = realloc(dirs, reserved_dirs * sizeof(char*));
+        depths = realloc(depths, reserved_dirs * sizeof(int));
+    }
+
+    dirs[ndirs] = path;
+    depths[ndirs++] = depth;
+}
+
+static void add_file(char* path, long long size, long long stamp) {
+    if (nfiles == reserved_files) {
+        reserved_files = reserved_files == 0 ? 64 : reserved_files * 2;
+        files = realloc(files, reserved_files * sizeof(mirror_file));
+    }
+
+    files[nfiles++] = (mirror_file){.path = path, .size = size, .stamp = stamp};
+}
+
+/**
+ * Take the entries of directory d's listing: queue its directories, after
+ * making them locally, and its files.
+ */
+static void read_listing(int d, char* listing, bool mlsd) {
+    char* save;
+    for (char* line = strtok_r(listing, "\r\n", &save); line != NULL; line = strtok_r(NULL, "\r\n", &save)) {
+        char* name;
+        int type;
+        long long size, stamp;
+
+        int s = mlsd ? parse_mlsd(line, &name, &type, &size, &stamp) :
+            parse_list(line, &name, &type, &size, &stamp);
+        if (s != 0 || type == ENTRY_OTHER) continue;
+
+        if (!valid_name(name)) {
+            printf(CYELLOW" Skipping entry %s of %s\n"CEND, name, dirs[d]);
+            continue;
+        }
+
+        // The index is ours
+        if (d == 0 && strncmp(name, INDEX_FILE, strlen(INDEX_FILE)) == 0) continue;
+
+        if (type == ENTRY_FILE) {
+            add_file(concat(dirs[d], name, ""), size, stamp);
+            continue;
+        }
+
+        if (depths[d] == MIRROR_MAX_DEPTH) {
+            printf(CYELLOW" Skipping directory %s%s, too deep\n"CEND, dirs[d], name);
+            continue;
+        }
+
+        char* path = concat(dirs[d], name, "/");
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) libfail("Failed to make directory %s", path);
+        add_dir(path, depths[d] + 1);
+    }
+}
+
+/**
+ * 4-5'. Walk the tree under root, breadth first.
+ */
+static void walk(const char* root) {
+    char code[4];
+    bool mlsd = true;
+
+    add_dir(strdup(""), 0);
+
+    for (int d = 0; d < ndirs; ++d) {
+        char* remote = concat(root, dirs[d], "");
+
+        // 500 or 502 === Unknown command, not implemented: no MLSD, and
+        // LIST's format must be guessed
+        ftp_open_passive_socket();
+        char* listing = ftp_list(mlsd ? "MLSD" : "LIST", remote, code);
+
+        if (listing == NULL && mlsd && (strcmp(code, "500") == 0 || strcmp(code, "502") == 0)) {
+            progress(" Server has no MLSD, parsing LIST");
+            mlsd = false;
+
+            ftp_open_passive_socket();
+            listing = ftp_list("LIST", remote, code);
+        }
+
+        if (listing == NULL) {
+            printf(CYELLOW" Skipping directory %s, the server replied %s\n"CEND, remote, code);
+            unlisted = realloc(unlisted, (nunlisted + 1) * sizeof(char*));
+            unlisted[nunlisted++] = dirs[d];
+        } else {
+            read_listing(d, listing, mlsd);
+            free(listing);
+        }
+
+        free(remote);
+    }
+}
+
+/**
+ * Largest first, and files of unknown size last
+ */
+static int by_size(const void* a, const void* b) {
+    long long x = (*(mirror_file* const*)a)->size, y = (*(mirror_file* const*)b)->size;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/**
+ * Whether the file as listed is the one the index has, and the local copy
+ * is as downloaded: of the same size, and if it was written since the index
+ * was, of the same checksum.
+ */
+static bool unchanged(const mirror_file* file, const index_entry* entry, time_t indexed) {
+    if (entry == NULL || entry->size != file->size || entry->stamp != file->stamp) return false;
+
+    struct stat st;
+    if (stat(file->path, &st) != 0) return false;
+    if (file->size >= 0 && st.st_size != file->size) return false;
+    if (st.st_mtime < indexed) return true;
+
+    uint64_t checksum;
+    return file_checksum(file->path, &checksum) == 0 && checksum == entry->checksum;
+}
+
+/**
+ * Whether the path is under a directory the server would not list, which
+ * it may still have.
+ */
+static bool under_unlisted(const char* path) {
+    for (int i = 0; i < nunlisted; ++i) {
+        if (strncmp(path, unlisted[i], strlen(unlisted[i])) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * Delete the local copy of a file gone from the server, and its directories
+ * as they are left empty.
+ */
+static void delete_local(const char* path) {
+    if (unlink(path) != 0 && errno != ENOENT) {
+        printf(CYELLOW" Failed to delete %s: %s\n"CEND, path, strerror(errno));
+        return;
+    }
+
+    char* dir = strdup(path);
+    char* slash;
+    while ((slash = strrchr(dir, '/')) != NULL) {
+        *slash = '\0';
+        if (rmdir(dir) != 0) break;
+    }
+    free(dir);
+}
+
+/**
+ * 6. Compare the files listed to the index.
+ *
+ * @return The number of files to download, into queue, largest first
+ */
+static int sync_index(mirror_index* index, mirror_file** queue) {
+    struct stat st;
+    time_t indexed = stat(INDEX_FILE, &st) == 0 ? st.st_mtime : 0;
+
+    int n = 0, added = 0, changed = 0, deleted = 0, kept = 0, unknown = 0;
+
+    for (int i = 0; i < nfiles; ++i) {
+        index_entry* entry = index_find(index, files[i].path);
+        if (entry != NULL) entry->seen = true;
+
+        if (unchanged(&files[i], entry, indexed)) continue;
+
+        queue[n++] = &files[i];
+        entry == NULL ? ++added : ++changed;
+    }
+
+    for (int i = 0; i < index->n; ++i) {
+        index_entry* entry = &index->entries[i];
+        if (entry->seen || entry->removed) continue;
+
+        if (under_unlisted(entry->path)) {
+            ++unknown;
+        } else if (delete_removed) {
+            delete_local(entry->path);
+            index_remove(entry);
+            ++deleted;
+        } else {
+            ++kept;
+        }
+    }
+
+    progress("6. Sync: %d new, %d changed or missing, %d unchanged, %d deleted", added, changed,
+        nfiles - n, deleted);
+    if (kept > 0) progress(" Keeping %d files gone from the server, see --delete", kept);
+    if (unknown > 0) {
+        printf(CYELLOW" Keeping %d files of directories the server would not list\n"CEND, unknown);
+    }
+
+    qsort(queue, n, sizeof(mirror_file*), by_size);
+    return n;
+}
+
+/**
+ * 7'. Index the files downloaded, and forget those that failed.
+ */
+static void update_index(mirror_index* index, mirror_file** queue, const bool* done, int n) {
+    index_entry* added = malloc(n * sizeof(index_entry));
+    int nadded = 0;
+
+    // Added last, not to sort the index again for every file
+    for (int i = 0; i < n; ++i) {
+        index_entry* entry = index_find(index, queue[i]->path);
+
+        if (!done[i]) {
+            if (entry != NULL) index_remove(entry);
+            continue;
+        }
+
+        index_entry downloaded = {
+            .path = queue[i]->path,
+            .size = queue[i]->size,
+            .stamp = queue[i]->stamp
+        };
+
+        if (file_checksum(queue[i]->path, &downloaded.checksum) != 0) {
+            libfail("Failed to read %s", queue[i]->path);
+        }
+
+        if (entry != NULL) {
+            downloaded.path = entry->path;
+            *entry = downloaded;
+        } else {
+            added[nadded++] = downloaded;
+        }
+    }
+
+    for (int i = 0; i < nadded; ++i) index_add(index, &added[i]);
+    free(added);
+
+    index_save(INDEX_FILE, index);
+}
+
+static double elapsed(struct timespec* begin) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/**
+ * 2-7. Mirror the tree of the URL's directory into a directory of its name.
+ */
+int download_mirror() {
+    const url_t* url = ftp_url();
+
+    // The URL's filename, if any, is its last directory.
+    char* root = concat(url->pathname, url->filename, url->filename[0] != '\0' ? "/" : "");
+
+    // 1'. Make the local root, named after the remote one, and work in it
+    char* local = strdup(root[0] != '\0' ? root : url->hostname);
+    if (root[0] != '\0') {
+        local[strlen(local) - 1] = '\0';
+        char* slash = strrchr(local, '/');
+        if (slash != NULL) memmove(local, slash + 1, strlen(slash));
+    }
+
+    if (mkdir(local, 0755) != 0 && errno != EEXIST) libfail("Failed to make directory %s", local);
+    if (chdir(local) != 0) libfail("Failed to enter directory %s", local);
+
+    progress("1'. Mirroring ftp://%s/%s into %s/", url->hostname, root, local);
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    // 2-5'. Log in, and walk the tree
+    ftp_open_control_socket();
+    ftp_login();
+    ftp_binary_mode();
+
+    walk(root);
+
+    ftp_quit();
+
+    long long bytes = 0;
+    for (int i = 0; i < nfiles; ++i) {
+        if (files[i].size > 0) bytes += files[i].size;
+    }
+
+    progress(CGREEN"Walked."CEND" %d directories, %d files, %lld bytes in %.3lf s",
+        ndirs, nfiles, bytes, elapsed(&begin));
+
+    // 6. Queue the files new or changed since the index, largest first
+    mirror_index index;
+    if (index_load(INDEX_FILE, &index) != 0) {
+        printf(CYELLOW" Index %s/%s is corrupt, downloading what it lost again\n"CEND, local, INDEX_FILE);
+    }
+
+    mirror_file** queue = malloc(nfiles * sizeof(mirror_file*));
+    int n = sync_index(&index, queue);
+
+    // 7. Download them on the engine's pool of connections
+    url_t* urls = malloc(n * sizeof(url_t));
+    const url_t** list = malloc(n * sizeof(url_t*));
+    bool* done = malloc(n * sizeof(bool));
+
+    for (int i = 0; i < n; ++i) {
+        urls[i] = (url_t){
+            .protocol = strdup(url->protocol),
+            .username = strdup(url->username),
+            .password = strdup(url->password),
+            .hostname = strdup(url->hostname),
+            .pathname = strdup(root),
+            .filename = strdup(queue[i]->path), // Into its directory, under the local root
+            .port = url->port
+        };
+        list[i] = &urls[i];
+    }
+
+    int failed = n > 0 ? engine_download(list, n, done) : 0;
+
+    update_index(&index, queue, done, n);
+
+    for (int i = 0; i < n; ++i) ftp_free_url(&urls[i]);
+    for (int i = 0; i < nfiles; ++i) free(files[i].path);
+    for (int i = 0; i < ndirs; ++i) free(dirs[i]);
+    index_free(&index);
+    free(urls);
+    free(list);
+    free(done);
+    free(queue);
+    free(files);
+    free(dirs);
+    free(unlisted);
+    free(depths);
+    free(local);
+    free(root);
+
+    if (failed > 0 || nunlisted > 0) {
+        fail("%d files failed, %d directories could not be listed", failed, nunlisted);
+    }
+
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef MIRROR_H___
+#define MIRROR_H___
+
+// Directories deeper than this are not walked into: a server may list a
+// link to a directory above it as a directory
+#define MIRROR_MAX_DEPTH 64
+
+int download_mirror();
+
+#endif // MIRROR_H___
@@ -0,0 +1,258 @@
+#include "options.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <errno.h>
+#include <limits.h>
+
+// <!--- OPTIONS
+static int show_help = false; // h, help
+
+int number_of_segments = SEGMENTS_DEFAULT; // n, segments
+bool continue_download = false; // c, continue
+int retries = RETRIES_DEFAULT; // r, retries
+bool use_splice = true; // S, no-splice
+bool pipelined = false; // p, pipeline
+int buffer_size = BUFFER_DEFAULT; // b, buffer
+int rcvbuf_size = RCVBUF_DEFAULT; // R, rcvbuf
+bool direct_io = false; // D, direct
+int writeback_size = WRITEBACK_DEFAULT; // W, writeback
+const char* input_file = NULL; // i, input
+bool mirror = false; // m, mirror
+bool delete_removed = false; // d, delete
+int jobs = JOBS_DEFAULT; // j, jobs
+int per_host = PER_HOST_DEFAULT; // P, per-host
+
+// Positional
+const char* url_argument = NULL;
+// ----> END OF OPTIONS
+
+
+
+static const struct option long_options[] = {
+    {HELP_LFLAG,                    no_argument, NULL,                 HELP_FLAG},
+    {SEGMENTS_LFLAG,          required_argument, NULL,             SEGMENTS_FLAG},
+    {CONTINUE_LFLAG,                no_argument, NULL,             CONTINUE_FLAG},
+    {RETRIES_LFLAG,           required_argument, NULL,              RETRIES_FLAG},
+    {NO_SPLICE_LFLAG,               no_argument, NULL,            NO_SPLICE_FLAG},
+    {PIPELINE_LFLAG,                no_argument, NULL,             PIPELINE_FLAG},
+    {BUFFER_LFLAG,            required_argument, NULL,               BUFFER_FLAG},
+    {RCVBUF_LFLAG,            required_argument, NULL,               RCVBUF_FLAG},
+    {DIRECT_LFLAG,                  no_argument, NULL,               DIRECT_FLAG},
+    {WRITEBACK_LFLAG,         required_argument, NULL,            WRITEBACK_FLAG},
+    {INPUT_LFLAG,             required_argument, NULL,                INPUT_FLAG},
+    {MIRROR_LFLAG,                  no_argument, NULL,               MIRROR_FLAG},
+    {DELETE_LFLAG,                  no_argument, NULL,               DELETE_FLAG},
+    {JOBS_LFLAG,              required_argument, NULL,                 JOBS_FLAG},
+    {PER_HOST_LFLAG,          required_argument, NULL,             PER_HOST_FLAG},
+    // end of options
+    {0, 0, 0, 0}
+};
+
+static const char* short_options = "hn:cr:Spb:R:DW:i:mdj:P:";
+
+static const char* usage = "usage:\n"
+    "    ./download [option...] ftp://[user[:password]@]host/path/to/file\n"
+    "    ./download [option...] -i FILE\n"
+    "    ./download [option...] -m ftp://[user[:password]@]host/path/to/dir/\n"
+    "\n"
+    "Download a file from an FTP server into the current directory.\n"
+    "\n"
+    "Options:\n"
+    "  -h, --help                   Show this message and exit\n"
+    "  -n, --segments=N             Download N byte ranges of the file at\n"
+    "                               once, each over its own connections.\n"
+    "                               Needs a server with SIZE and REST,\n"
+    "                               and -c and -p are refused.\n"
+    "                                 [Default is 1, at most 64]\n"
+    "  -c, --continue               Resume the output file if it exists\n"
+    "                               already, with REST, rather than\n"
+    "                               download it anew\n"
+    "  -r, --retries=N              Reconnect and resume, with exponential\n"
+    "                               backoff, until N attempts in a row fail\n"
+    "                               without downloading anything\n"
+    "                                 [Default is 8, at most 1000]\n"
+    "  -S, --no-splice              Copy the payload through a buffer, rather\n"
+    "                               than splice it from the socket into the\n"
+    "                               output file\n"
+    "  -b, --buffer=N               Copy and splice N MiB at a time\n"
+    "                                 [Default is 1, at most 256]\n"
+    "  -R, --rcvbuf=N               Set the receive buffer of the passive\n"
+    "                               socket to N KiB, which turns off its\n"
+    "                               autotuning\n"
+    "                                 [Default is 0, autotuned]\n"
+    "  -D, --direct                 Write the output file with O_DIRECT,\n"
+    "                               around the page cache. Implies -S.\n"
+    "  -W, --writeback=N            Push every N MiB written to disk, and\n"
+    "                               drop it from the page cache\n"
+    "                                 [Default is 0, left to the kernel]\n"
+    "  -i, --input=FILE             Download every URL listed in FILE, one\n"
+    "                               per line, or in stdin if FILE is -,\n"
+    "                               over one control connection per host\n"
+    "                               and login. A URL of the same file name\n"
+    "                               as one before it is skipped.\n"
+    "  -j, --jobs=N                 With -i or -m, download up to N files\n"
+    "                               at once, from any hosts, on one thread.\n"
+    "                               Files are copied through a --buffer,\n"
+    "                               not spliced, and -D and -W are refused.\n"
+    "                                 [Default is 1, at most 512]\n"
+    "  -P, --per-host=N             With -j, open at most N control\n"
+    "                               connections to the same host\n"
+    "                                 [Default is 4, at most 512]\n"
+    "  -m, --mirror                 Mirror the directory tree of the URL,\n"
+    "                               which ends in /, into a directory of\n"
+    "                               its name in the current directory.\n"
+    "                               Run again, it downloads only the files\n"
+    "                               new or changed since. Refused with -i.\n"
+    "  -d, --delete                 With -m, delete the local files that\n"
+    "                               are gone from the server\n"
+    "  -p, --pipeline               Send the login, TYPE I, SIZE and PASV\n"
+    "                               at once, rather than each after the\n"
+    "                               reply to the one before. Reconnects to\n"
+    "                               send them one at a time if the server\n"
+    "                               does not take them.\n"
+    "\n";
+
+static void exit_usage(int status) {
+    printf("%s", usage);
+    exit(status);
+}
+
+static void exit_badarg(const char* option) {
+    printf("Bad argument for option %s.\n%s", option, usage);
+    exit(EXIT_FAILURE);
+}
+
+static int parse_int(const char* str, int* outp) {
+    char* endp;
+    errno = 0;
+    long result = strtol(str, &endp, 10);
+
+    if (endp == str || *endp != '\0' || errno == ERANGE ||
+            result >= INT_MAX || result <= INT_MIN) {
+        return 1;
+    }
+
+    *outp = (int)result;
+    return 0;
+}
+
+/**
+ * Standard unix main's argument parsing function.
+ */
+void parse_args(int argc, char** argv) {
+    while (true) {
+        int c = getopt_long(argc, argv, short_options, long_options, NULL);
+
+        if (c == -1) break; // No more options
+
+        switch (c) {
+        case HELP_FLAG:
+            show_help = true;
+            break;
+        case SEGMENTS_FLAG:
+            if (parse_int(optarg, &number_of_segments) != 0 ||
+                    number_of_segments < 1 || number_of_segments > SEGMENTS_MAX) {
+                exit_badarg(SEGMENTS_LFLAG);
+            }
+            break;
+        case CONTINUE_FLAG:
+            continue_download = true;
+            break;
+        case RETRIES_FLAG:
+            if (parse_int(optarg, &retries) != 0 ||
+                    retries < 0 || retries > RETRIES_MAX) {
+                exit_badarg(RETRIES_LFLAG);
+            }
+            break;
+        case NO_SPLICE_FLAG:
+            use_splice = false;
+            break;
+        case PIPELINE_FLAG:
+            pipelined = true;
+            break;
+        case BUFFER_FLAG:
+            if (parse_int(optarg, &buffer_size) != 0 ||
+                    buffer_size < 1 || buffer_size > BUFFER_MAX) {
+                exit_badarg(BUFFER_LFLAG);
+            }
+            break;
+        case RCVBUF_FLAG:
+            if (parse_int(optarg, &rcvbuf_size) != 0 ||
+                    rcvbuf_size < 0 || rcvbuf_size > RCVBUF_MAX) {
+                exit_badarg(RCVBUF_LFLAG);
+            }
+            break;
+        case DIRECT_FLAG:
+            direct_io = true;
+            break;
+        case WRITEBACK_FLAG:
+            if (parse_int(optarg, &writeback_size) != 0 ||
+                    writeback_size < 0 || writeback_size > WRITEBACK_MAX) {
+                exit_badarg(WRITEBACK_LFLAG);
+            }
+            break;
+        case INPUT_FLAG:
+            input_file = optarg;
+            break;
+        case MIRROR_FLAG:
+            mirror = true;
+            break;
+        case DELETE_FLAG:
+            delete_removed = true;
+            break;
+        case JOBS_FLAG:
+            if (parse_int(optarg, &jobs) != 0 || jobs < 1 || jobs > JOBS_MAX) {
+                exit_badarg(JOBS_LFLAG);
+            }
+            break;
+        case PER_HOST_FLAG:
+            if (parse_int(optarg, &per_host) != 0 ||
+                    per_host < 1 || per_host > PER_HOST_MAX) {
+                exit_badarg(PER_HOST_LFLAG);
+            }
+            break;
+        case '?':
+        default:
+            // getopt_long already printed an error message.
+            exit_usage(EXIT_FAILURE);
+        }
+    }
+
+    if (show_help) exit_usage(EXIT_SUCCESS);
+
+    // A mirror is of the URL argument, which a batch has none of.
+    if (mirror && input_file != NULL) {
+        printf("Options --%s and --%s do not go together.\n", MIRROR_LFLAG, INPUT_LFLAG);
+        exit_usage(EXIT_FAILURE);
+    }
+
+    // The engine reads many passive sockets at once, a buffer at a time,
+    // with no per-file state for O_DIRECT's tail or writeback's windows.
+    bool engine = mirror || (input_file != NULL && jobs > 1);
+    if (engine && (direct_io || writeback_size > 0)) {
+        printf("Options --%s and --%s do not apply to --%s or --%s with --%s.\n",
+            DIRECT_LFLAG, WRITEBACK_LFLAG, MIRROR_LFLAG, INPUT_LFLAG, JOBS_LFLAG);
+        exit_usage(EXIT_FAILURE);
+    }
+
+    // Segments are written into a .part of their own, and each logs in on
+    // a connection of its own, one command at a time.
+    bool segmented = number_of_segments > 1 && input_file == NULL && !mirror;
+    if (segmented && (continue_download || pipelined)) {
+        printf("Options --%s and --%s do not apply to --%s.\n",
+            CONTINUE_LFLAG, PIPELINE_LFLAG, SEGMENTS_LFLAG);
+        exit_usage(EXIT_FAILURE);
+    }
+
+    int expected = input_file == NULL ? 1 : 0;
+
+    if (optind + expected != argc) {
+        printf("Expected %d argument%s, but got %d.\n", expected,
+            expected == 1 ? ", the URL" : "s with --input", argc - optind);
+        exit_usage(EXIT_FAILURE);
+    }
+
+    if (input_file == NULL) url_argument = argv[optind];
+}
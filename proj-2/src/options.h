@@ -0,0 +1,130 @@
+#ifndef OPTIONS_H___
+#define OPTIONS_H___
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// NOTE: All externs are resolved in options.c
+// To add/edit an option, do:
+//      1. Add a block entry here
+//      2. Resolve the extern in options.c
+//      3. Update short_options and long_options in options.c
+//      4. Update the usage string in options.c
+//      5. Update parse_args() in options.c
+// then go on to add the option's functionality...
+
+
+
+// <!--- GENERAL OPTIONS
+// Show help/usage message and exit
+#define HELP_FLAG 'h'
+#define HELP_LFLAG "help"
+// ----> END OF GENERAL OPTIONS
+
+
+
+// <!--- OPTIONS
+// Download the file in N byte ranges at once, each over its own control and
+// passive connections (REST + RETR), into the same output file.
+#define SEGMENTS_FLAG 'n'
+#define SEGMENTS_LFLAG "segments"
+#define SEGMENTS_DEFAULT 1
+#define SEGMENTS_MAX 64
+extern int number_of_segments;
+
+// Resume the output file if it exists already, rather than download it anew.
+#define CONTINUE_FLAG 'c'
+#define CONTINUE_LFLAG "continue"
+extern bool continue_download;
+
+// Reconnect and resume the download, with exponential backoff, after up to
+// N attempts in a row that failed without downloading anything.
+#define RETRIES_FLAG 'r'
+#define RETRIES_LFLAG "retries"
+#define RETRIES_DEFAULT 8
+#define RETRIES_MAX 1000
+extern int retries;
+
+// Copy the payload through a user space buffer, rather than splice it from
+// the passive socket into the output file.
+#define NO_SPLICE_FLAG 'S'
+#define NO_SPLICE_LFLAG "no-splice"
+extern bool use_splice;
+
+// Send USER, PASS, TYPE I and PASV at once, rather than each after the
+// reply to the one before, and read their replies after.
+#define PIPELINE_FLAG 'p'
+#define PIPELINE_LFLAG "pipeline"
+extern bool pipelined;
+
+// Size of the buffer of the copy loop and of the splice pipe, in MiB.
+#define BUFFER_FLAG 'b'
+#define BUFFER_LFLAG "buffer"
+#define BUFFER_DEFAULT 1
+#define BUFFER_MAX 256
+extern int buffer_size;
+
+// Receive buffer of the passive socket, in KiB. Setting it turns off the
+// kernel's autotuning of it, so it is left alone by default (0).
+#define RCVBUF_FLAG 'R'
+#define RCVBUF_LFLAG "rcvbuf"
+#define RCVBUF_DEFAULT 0
+#define RCVBUF_MAX (1024 * 1024)
+extern int rcvbuf_size;
+
+// Write the output file with O_DIRECT, around the page cache, through the
+// copy loop.
+#define DIRECT_FLAG 'D'
+#define DIRECT_LFLAG "direct"
+extern bool direct_io;
+
+// Push every N MiB written of the output file to disk, and drop it from
+// the page cache. 0 leaves it all to the kernel.
+#define WRITEBACK_FLAG 'W'
+#define WRITEBACK_LFLAG "writeback"
+#define WRITEBACK_DEFAULT 0
+#define WRITEBACK_MAX 1024
+extern int writeback_size;
+
+// Download every URL listed in a file, one per line, or in stdin if "-",
+// over one control connection per host and login.
+#define INPUT_FLAG 'i'
+#define INPUT_LFLAG "input"
+extern const char* input_file;
+
+// Mirror the directory tree of the URL, ftp://host/path/to/dir/, into a
+// directory of its name in the current directory.
+#define MIRROR_FLAG 'm'
+#define MIRROR_LFLAG "mirror"
+extern bool mirror;
+
+// With --mirror, delete the local files the mirror's index has, that are
+// gone from the server.
+#define DELETE_FLAG 'd'
+#define DELETE_LFLAG "delete"
+extern bool delete_removed;
+
+// With --input or --mirror, download up to N files at once, on one thread,
+// with an event driven engine, rather than one host and login at a time.
+#define JOBS_FLAG 'j'
+#define JOBS_LFLAG "jobs"
+#define JOBS_DEFAULT 1
+#define JOBS_MAX 512
+extern int jobs;
+
+// With --jobs, open at most N control connections to the same host.
+#define PER_HOST_FLAG 'P'
+#define PER_HOST_LFLAG "per-host"
+#define PER_HOST_DEFAULT 4
+#define PER_HOST_MAX JOBS_MAX
+extern int per_host;
+// ----> END OF OPTIONS
+
+// <!--- POSITIONAL
+// NULL with --input
+extern const char* url_argument;
+// ----> END POSITIONAL
+
+void parse_args(int argc, char** argv);
+
+#endif // OPTIONS_H___
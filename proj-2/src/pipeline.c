@@ -1,11 +1,21 @@
 #include "pipeline.h"
+#include "transfer.h"
+#include "resolve.h"
+#include "reply.h"
+#include "options.h"
 #include "debug.h"
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <regex.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/resource.h>
 
 #include <netdb.h>
 #include <sys/socket.h>
@@ -17,6 +27,19 @@
  */
 static FILE* controlstream = NULL;
 static int controlfd = 0;
+static struct sockaddr_storage controladdr; // The server's address it connected to
+static reply_parser replies;
+
+/**
+ * Whether the replies read are those to pipelined commands
+ */
+static bool in_pipeline = false;
+
+/**
+ * When the connection was opened, or the last file done: what the time to
+ * the next file's first byte is measured from
+ */
+static struct timespec started;
 
 /**
  * FTP Passive Socket (Data Transfer)
@@ -35,6 +58,8 @@ static void close_passive_socket();
 
 static void free_url();
 
+static void no_pipelining(const char* why);
+
 /**
  * Send an FTP command to the control socket.
  */
@@ -45,7 +70,7 @@ static int send_ftp_command(const char* command) {
     logftpcommand(command);
 
     do {
-        count += s = send(controlfd, command + count, len - count, 0);
+        count += s = send(controlfd, command + count, len - count, MSG_NOSIGNAL);
         if (s <= 0) libfail("Failed to write anything to control socket");
     } while (count < len);
 
@@ -53,32 +78,54 @@ static int send_ftp_command(const char* command) {
 }
 
 /**
- * Read and discard reply lines from the FTP control socket stream until reading a
- * line that starts with an FTP code not followed by a dash.
+ * Read the next reply from the FTP control socket. Its last line, in *line if
+ * not NULL, is valid until the next reply is read.
  */
-static int recv_ftp_reply(char* code, char** line) {
-    char* reply = NULL;
-
-    ssize_t read_size = 0;
+static int recv_ftp_reply(char* code, const char** line) {
+    ftp_reply reply;
+    int s;
+
+    while ((s = reply_next(&replies, &reply)) == REPLY_MORE) {
+        size_t len;
+        char* space = reply_space(&replies, &len);
+
+        ssize_t r = recv(controlfd, space, len, 0);
+        if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (in_pipeline) no_pipelining("Timed out waiting for the replies");
+            fail("Timed out waiting for a reply");
+        }
+        if (r < 1) libfail("Failed to read reply from control socket");
+
+        reply_received(&replies, r);
+    }
 
-    do {
-        free(reply);
-        
-        reply = NULL;
-        size_t n = 0;
-        
-        read_size = getline(&reply, &n, controlstream); // keeps \r\n
-        if (read_size < 1) libfail("Failed to read reply from control socket stream");
+    if (s == REPLY_TOO_LONG) fail("Reply line longer than %d bytes", REPLY_BUFFER_SIZE);
 
-        logftpreply(reply);
-    } while ('1' > reply[0] || reply[0] > '5' || read_size < 4 || reply[3] == '-');
+    // 421 === Service not available, closing control connection. It may come
+    // in reply to anything, and is the server hanging up, not refusing.
+    if (strcmp(reply.code, "421") == 0) fail("Server closed the control connection");
 
-    strncpy(code, reply, 3); code[3] = '\0';
-    line != NULL ? *line = reply : free(reply);
+    strcpy(code, reply.code);
+    if (line != NULL) *line = reply.line;
 
     return 0;
 }
 
+/**
+ * The server replied code, rather than expected. A 4xx is a transient
+ * negative reply (RFC 959 section 4.2), "try again later", and fails the
+ * attempt, to be retried. Anything else, a 5xx, is a refusal.
+ */
+static void unexpected_reply(const char* code, const char* expected) {
+    if (in_pipeline) {
+        char why[64];
+        snprintf(why, sizeof(why), "Expected reply %s, got %s", expected, code);
+        no_pipelining(why);
+    }
+    if (code[0] == '4') fail("Expected reply %s, got %s", expected, code);
+    unexpected("Expected reply %s, got %s", expected, code);
+}
+
 /**
  * Extract substring matched by a capture group from the source string,
  * returning NULL if the capture group didn't match.
@@ -98,16 +145,19 @@ static char* regexcap(const char* source, regmatch_t match) {
 }
 
 /**
- * 1. Parse program's input, the FTP URL
- * For URL parsing we use a weak regular expression. It accepts all valid (ftp) URLs
- * with non-empty filenames, although it also passes a whole bunch of invalid ones too.
+ * Regex-parse an FTP URL into urlp. Its username and password are left NULL
+ * if it has none, and its filename is empty if it ends with a slash.
+ * For URL parsing we use a weak regular expression. It accepts all valid (ftp) URLs,
+ * although it also passes a whole bunch of invalid ones too.
  * It gets the job done quickly. Note: it does not accept a port after the host.
+ *
+ * @return 0 on success, 1 if the URL is invalid
  */
-int parse_url(const char* urlstr) {
+static int regex_url(const char* urlstr, url_t* urlp) {
     regex_t regex;
-    // capturers:     1       23         4 5              6          78          9
-    //                 ftp ://[user      [:pass]       @] host      /path/ to/   filename
-    regcomp(&regex, "^(ftp)://(([^:@/ ]+)(:([^:@/ ]+))?@)?([^:@/ ]+)/(([^/ ]+/)*)([^/ ]+)$",
+    // capturers:     1       23         4 5              6                       78          9
+    //                 ftp ://[user      [:pass]       @] host or [IPv6]       /path/ to/   filename
+    regcomp(&regex, "^(ftp)://(([^:@/ ]+)(:([^:@/ ]+))?@)?(\\[[^]/ ]+\\]|[^:@/ []+)/(([^/ ]+/)*)([^/ ]*)$",
         REG_EXTENDED | REG_ICASE | REG_NEWLINE);
 
     regmatch_t pmatch[10];
@@ -115,10 +165,10 @@ int parse_url(const char* urlstr) {
     // Regex-parse the input url
     int s = regexec(&regex, urlstr, 10, pmatch, 0);
     regfree(&regex);
-    if (s != 0) fail("Invalid URL {no port, must have nonempty filename}");
+    if (s != 0) return 1;
 
     // Take captures
-    url = (url_t){
+    *urlp = (url_t){
         .protocol = regexcap(urlstr, pmatch[1]),
         .username = regexcap(urlstr, pmatch[3]),
         .password = regexcap(urlstr, pmatch[5]),
@@ -128,19 +178,38 @@ int parse_url(const char* urlstr) {
         .port = 21
     };
 
+    // [IPv6] -> IPv6
+    if (urlp->hostname[0] == '[') {
+        size_t len = strlen(urlp->hostname);
+        memmove(urlp->hostname, urlp->hostname + 1, len - 2);
+        urlp->hostname[len - 2] = '\0';
+    }
+
+    return 0;
+}
+
+/**
+ * 1. Parse program's input, the FTP URL
+ */
+int parse_url(const char* urlstr) {
+    // A mirror's URL is of a directory, and may end with a slash
+    if (regex_url(urlstr, &url) != 0 || (url.filename[0] == '\0' && !mirror)) {
+        fail("Invalid URL {no port, must have nonempty filename}");
+    }
+
     atexit(free_url);
 
     progress("1. FTP URL: "CGREEN"ftp://%s/%s%s"CEND, url.hostname, url.pathname, url.filename);
 
     // Pick default username
     if (url.username == NULL) {
-        url.username = strdup("anonymous"); // *** DEFAULT USER
+        url.username = strdup(DEFAULT_USER);
         progress(" Defaulting username to %s", url.username);
     }
 
     // Pick default password
     if (url.password == NULL) {
-        url.password = strdup("upstudent-rcom"); // *** DEFAULT PASS
+        url.password = strdup(DEFAULT_PASS);
         progress(" Defaulting password to %s", url.password);
     }
 
@@ -161,54 +230,72 @@ int parse_url(const char* urlstr) {
 }
 
 /**
- * 2. Resolve hostname to server's IPv4 address and setup control socket
+ * 1'. Parse an FTP URL of many, quietly, into urlp, with the default
+ * username and password where it has none.
+ *
+ * @return 0 on success, 1 if the URL is invalid
+ */
+int ftp_parse_url(const char* urlstr, url_t* urlp) {
+    if (regex_url(urlstr, urlp) != 0) return 1;
+
+    if (urlp->filename[0] == '\0') {
+        ftp_free_url(urlp);
+        return 1;
+    }
+
+    if (urlp->username == NULL) urlp->username = strdup(DEFAULT_USER);
+    if (urlp->password == NULL) urlp->password = strdup(DEFAULT_PASS);
+
+    return 0;
+}
+
+/**
+ * 2. Resolve hostname to server's addresses and setup control socket, with
+ * the first of them to connect
  */
 int ftp_open_control_socket() {
     char code[4];
+    char address[INET6_ADDRSTRLEN + 8];
 
     progress("2. Resolve hostname %s and setup control socket", url.hostname);
 
-    // 2.1. resolve
-    struct hostent* host = gethostbyname(url.hostname);
-    if (host == NULL) libfail("Could not resolve hostname %s", url.hostname);
-
-    progress(" 2.1. Resolved hostname %s successfully", url.hostname);
-    progress("  host->h_name: %s", host->h_name);
-    progress("  host->h_addrtype: %d [IPv4=%d]", host->h_addrtype, AF_INET);
+    clock_gettime(CLOCK_MONOTONIC, &started);
 
-    // 2.2. extract IPv4 address
-    if (host->h_addrtype != AF_INET) fail("Expected IPv4 address");
+    // 2.1. resolve, IPv6 and IPv4
+    address_list addresses;
+    int s = resolve(url.hostname, url.port, &addresses);
+    if (s != 0) fail("Could not resolve hostname %s: %s", url.hostname, gai_strerror(s));
 
-    char* protocolip = inet_ntoa(*(struct in_addr*)host->h_addr);
+    progress(" 2.1. Resolved hostname %s successfully", url.hostname);
+    for (int i = 0; i < addresses.n; ++i) {
+        progress("      %s", address_string(addresses.addresses[i]->ai_addr, address, sizeof(address)));
+    }
 
-    progress(" 2.2. Protocol IP Address: %s", protocolip);
-    progress("      Establishing control connection with FTP server");
+    // 2.2. socket() and connect(), racing the addresses
+    progress(" 2.2. Establishing control connection with FTP server");
 
-    // 2.3. socket()
-    controlfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (controlfd == -1) libfail("Failed to open socket for control connection");
+    const struct addrinfo* winner;
+    controlfd = happy_connect(&addresses, &winner);
+    if (controlfd == -1) libfail("Failed to connect() control socket");
 
     controlstream = fdopen(controlfd, "r");
-    atexit(close_control_socket);
-
-    progress(" 2.3. Opened control socket for FTP's protocol connection");
+    reply_init(&replies, true);
 
-    // 2.4. connect()
-    struct sockaddr_in in_addr = {0};
-    in_addr.sin_family = AF_INET; // IPv4 address
-    in_addr.sin_port = htons(url.port); // host byte order -> network byte order
-    in_addr.sin_addr.s_addr = inet_addr(protocolip); // to network format
+    // Segments' child processes open their own, and inherit the handler.
+    static bool registered = false;
+    if (!registered) atexit(close_control_socket);
+    registered = true;
 
-    int s = connect(controlfd, (struct sockaddr*)&in_addr, sizeof(in_addr));
-    if (s != 0) libfail("Failed to connect() control socket");
+    memcpy(&controladdr, winner->ai_addr, winner->ai_addrlen);
 
-    progress(" 2.4. Connected control socket to %s:%d", protocolip, 21);
+    progress(" 2.3. Connected control socket to %s",
+        address_string((struct sockaddr*)&controladdr, address, sizeof(address)));
 
-    // 2.5. recv() 220 === Service ready for new user
+    // 2.4. recv() 220 === Service ready for new user
     recv_ftp_reply(code, NULL);
-    if (strcmp(code, "220") != 0) unexpected("Expected reply 220, got %s", code);
+    if (strcmp(code, "220") != 0) unexpected_reply(code, "220");
 
-    progress(" 2.5. Successfully established control socket connection");
+    progress(" 2.4. Successfully established control socket connection");
 
     return 0;
 }
@@ -231,7 +318,7 @@ int ftp_login() {
     free(user_command);
 
     recv_ftp_reply(code, NULL);
-    if (strcmp(code, "331") != 0) unexpected("Expected reply 331, got %s", code);
+    if (strcmp(code, "331") != 0) unexpected_reply(code, "331");
 
     progress(" 3.1. Server confirmed user %s", url.username);
 
@@ -244,7 +331,7 @@ int ftp_login() {
     free(pass_command);
 
     recv_ftp_reply(code, NULL);
-    if (strcmp(code, "230") != 0) unexpected("Expected reply 230, got %s", code);
+    if (strcmp(code, "230") != 0) unexpected_reply(code, "230");
 
     progress(" 3.2. Server acknowledges login, proceeding");
 
@@ -252,20 +339,19 @@ int ftp_login() {
 }
 
 /**
- * 4. Enter passive mode
+ * 4.1. PASV, for an IPv4 control connection: the server tells the
+ * passive address. It was sent already if pipelined.
  */
-int ftp_open_passive_socket() {
+static void passive_mode(struct sockaddr_storage* addrp, bool sent) {
     char code[4];
 
-    progress("4. Establish passive connection with FTP server");
-
-    // 4.1. send() PASV
-    //      recv() 227 Entering Passive Mode (IP3.IP2.IP1.IP0,Port1,Port0)
-    send_ftp_command("PASV \r\n");
+    // send() PASV
+    // recv() 227 Entering Passive Mode (IP3.IP2.IP1.IP0,Port1,Port0)
+    if (!sent) send_ftp_command("PASV \r\n");
 
-    char* line;
+    const char* line;
     recv_ftp_reply(code, &line);
-    if (strcmp(code, "227") != 0) unexpected("Expected reply 227, got %d", code);
+    if (strcmp(code, "227") != 0) unexpected_reply(code, "227");
 
     regex_t regex;
     regcomp(&regex, "([0-9]+, ?[0-9]+, ?[0-9]+, ?[0-9]+, ?[0-9]+, ?[0-9]+)",
@@ -278,45 +364,194 @@ int ftp_open_passive_socket() {
     if (s != 0) fail("Unexpected Passive Mode response format: %s", line);
     
     char* substr = regexcap(line, pmatch[1]);
-    free(line);
 
     progress(" 4.1. Entered Passive Mode: (%s)", substr);
 
-    // 4.2. extract passive ip from response line
+    // extract passive ip from response line
     int ip3, ip2, ip1, ip0, port1, port0;
     sscanf(substr, "%d, %d, %d, %d, %d, %d", &ip3, &ip2, &ip1, &ip0, &port1, &port0);
     free(substr);
 
-    char passiveip[20] = {0};
-    sprintf(passiveip, "%d.%d.%d.%d", ip3, ip2, ip1, ip0);
-    int port = port1 * 256 + port0;
+    struct sockaddr_in* in_addr = (struct sockaddr_in*)addrp;
+    memset(addrp, 0, sizeof(*addrp));
+    in_addr->sin_family = AF_INET; // IPv4 address
+    in_addr->sin_port = htons(port1 * 256 + port0); // host bytes -> network bytes
+    in_addr->sin_addr.s_addr = htonl((ip3 << 24) | (ip2 << 16) | (ip1 << 8) | ip0);
+}
+
+/**
+ * 4.1. EPSV, for an IPv6 control connection (RFC 2428): the server tells
+ * only the port, of the address we are connected to. It was sent already
+ * if pipelined.
+ */
+static void extended_passive_mode(struct sockaddr_storage* addrp, bool sent) {
+    char code[4];
+
+    // send() EPSV
+    // recv() 229 Entering Extended Passive Mode (|||port|)
+    if (!sent) send_ftp_command("EPSV\r\n");
+
+    const char* line;
+    recv_ftp_reply(code, &line);
+    if (strcmp(code, "229") != 0) unexpected_reply(code, "229");
+
+    // Any delimiter, the same 4 times, but | is the one used
+    const char* p = strchr(line, '(');
+    int port = 0;
+    if (p == NULL || p[1] == '\0' || p[2] != p[1] || p[3] != p[1] ||
+            sscanf(p + 4, "%d", &port) != 1 || port <= 0 || port > 65535) {
+        fail("Unexpected Extended Passive Mode response format: %s", line);
+    }
+
+    progress(" 4.1. Entered Extended Passive Mode: port %d", port);
+
+    *addrp = controladdr;
+    if (addrp->ss_family == AF_INET6) {
+        ((struct sockaddr_in6*)addrp)->sin6_port = htons(port);
+    } else {
+        ((struct sockaddr_in*)addrp)->sin_port = htons(port);
+    }
+}
+
+/**
+ * 4. Enter passive mode, with the PASV sent already if pipelined
+ */
+static int open_passive_socket(bool sent) {
+    char address[INET6_ADDRSTRLEN + 8];
+
+    progress("4. Establish passive connection with FTP server");
+
+    // 4.1. PASV only speaks IPv4
+    struct sockaddr_storage passiveaddr;
+    if (controladdr.ss_family == AF_INET6) {
+        extended_passive_mode(&passiveaddr, sent);
+    } else {
+        passive_mode(&passiveaddr, sent);
+    }
 
-    progress(" 4.2. Passive IP Address: %s:%d", passiveip, port);
+    progress(" 4.2. Passive IP Address: %s",
+        address_string((struct sockaddr*)&passiveaddr, address, sizeof(address)));
 
     // 4.3. socket()
-    passivefd = socket(AF_INET, SOCK_STREAM, 0);
+    passivefd = socket(passiveaddr.ss_family, SOCK_STREAM, 0);
     if (passivefd == -1) libfail("Failed to open socket for passive connection");
 
     passivestream = fdopen(passivefd, "r+");
-    atexit(close_passive_socket);
+
+    static bool registered = false;
+    if (!registered) atexit(close_passive_socket);
+    registered = true;
 
     progress(" 4.3. Opened passive socket for FTP's passive connection");
 
+    // Before connect(), for the window scale the SYN advertises
+    if (rcvbuf_size > 0) {
+        int size = rcvbuf_size * 1024;
+        if (setsockopt(passivefd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0) {
+            libfail("Failed to set passive socket's receive buffer");
+        }
+    }
+
     // 4.4. connect()
-    struct sockaddr_in in_addr = {0};
-    in_addr.sin_family = AF_INET; // IPv4 address
-    in_addr.sin_port = htons(port); // host bytes -> network bytes
-    in_addr.sin_addr.s_addr = inet_addr(passiveip); // to network format
+    socklen_t len = passiveaddr.ss_family == AF_INET6 ?
+        sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
 
-    s = connect(passivefd, (struct sockaddr*)&in_addr, sizeof(in_addr));
+    int s = connect(passivefd, (struct sockaddr*)&passiveaddr, len);
     if (s != 0) libfail("Failed to connect() passive socket");
 
-    progress(" 4.4. Connected passive socket to %s:%d", passiveip, port);
+    progress(" 4.4. Connected passive socket to %s", address);
+    progress("      Receive buffer %d KiB (%s)", socket_rcvbuf(passivefd) / 1024,
+        rcvbuf_size > 0 ? "set" : "autotuned");
     progress(" 4.5. Successfully established passive socket connection");
 
     return 0;
 }
 
+int ftp_open_passive_socket() {
+    return open_passive_socket(false);
+}
+
+/**
+ * 3-4'. Login, binary mode, SIZE and passive mode, pipelined: the commands
+ * are sent at once, and their replies read in order after, in one round
+ * trip rather than five. The server reads its commands off the connection
+ * one at a time, as RFC 959 has it, and finds the next one there already.
+ * A server that drops what it was sent before it asked for it sends
+ * replies that do not match, or none: the attempt then exits with
+ * EXIT_NO_PIPELINING, for the next one to send them one at a time.
+ *
+ * @return The file's size, or -1 if the server would not tell it
+ */
+long long ftp_pipelined_login() {
+    char code[4];
+    const char* line;
+
+    progress("3-4. Send USER, PASS, TYPE I, SIZE and PASV at once");
+
+    // 3-4.1. send() USER username, PASS password, TYPE I, SIZE filepath, PASV
+    const char* passive = controladdr.ss_family == AF_INET6 ? "EPSV" : "PASV";
+    size_t len = strlen(url.username) + strlen(url.password) + strlen(url.pathname) +
+        strlen(url.filename) + 64;
+
+    char* commands = malloc(len * sizeof(char));
+    sprintf(commands, "USER %s\r\nPASS %s\r\nTYPE I\r\nSIZE %s%s\r\n%s\r\n",
+        url.username, url.password, url.pathname, url.filename, passive);
+
+    send_ftp_command(commands);
+    free(commands);
+
+    in_pipeline = true;
+
+    // Not to wait forever on a server that dropped them
+    struct timeval timeout = {.tv_sec = PIPELINE_TIMEOUT};
+    setsockopt(controlfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // 3-4.2. recv() 331 === User name okay, send password
+    //        recv() 230 === Login successful, proceed
+    //        or 230 to USER, and 202 or 503 to the PASS it did not need
+    recv_ftp_reply(code, NULL);
+    if (strcmp(code, "331") == 0) {
+        recv_ftp_reply(code, NULL);
+        if (strcmp(code, "230") != 0) unexpected_reply(code, "230 to pipelined PASS");
+    } else if (strcmp(code, "230") == 0) {
+        recv_ftp_reply(code, NULL);
+    } else {
+        unexpected_reply(code, "331 to pipelined USER");
+    }
+
+    progress(" 3-4.2. Server acknowledges login of user %s, proceeding", url.username);
+
+    // 3-4.3. recv() 200 === Command okay
+    recv_ftp_reply(code, NULL);
+    if (strcmp(code, "200") != 0) unexpected_reply(code, "200 to pipelined TYPE I");
+
+    // 3-4.4. recv() 213 size
+    recv_ftp_reply(code, &line);
+
+    long long size = -1;
+    if (strcmp(code, "213") != 0 || sscanf(line + 4, "%lld", &size) != 1) size = -1;
+
+    progress(" 3-4.4. Binary mode, file %s%s has %lld bytes", url.pathname, url.filename, size);
+
+    // 3-4.5. recv() 227 or 229, and connect to the passive address
+    open_passive_socket(true);
+
+    in_pipeline = false;
+
+    timeout.tv_sec = 0;
+    setsockopt(controlfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    return size;
+}
+
+/**
+ * The server did not take the pipelined commands.
+ */
+static void no_pipelining(const char* why) {
+    printf(CYELLOW" %s to pipelined commands, the server may not take them\n"CEND, why);
+    exit(EXIT_NO_PIPELINING);
+}
+
 /**
  * 5. Send Retrieve command to FTP server
  * This command instructs the server to send the filename through the passive connection.
@@ -327,7 +562,7 @@ int send_retrieve() {
     progress("5. Retrieve file from Server (retrieve command)");
 
     // 5.1. send() RETR filepath
-    //      recv() 150 File status okay, opening data transfer now
+    //      recv() 1xx === Opening data connection (150), or already open (125)
     size_t len = strlen(url.pathname) + strlen(url.filename);
     char* retr_command = malloc((10 + len) * sizeof(char));
     sprintf(retr_command, "RETR %s%s\r\n", url.pathname, url.filename);
@@ -336,7 +571,7 @@ int send_retrieve() {
     free(retr_command);
 
     recv_ftp_reply(code, NULL);
-    if (strcmp(code, "150") != 0) unexpected("Expected reply 150, got %s", code);
+    if (code[0] != '1') unexpected_reply(code, "150");
 
     progress(" 5.1. Confirmed, server retrieved %s%s", url.pathname, url.filename);
 
@@ -344,62 +579,291 @@ int send_retrieve() {
 }
 
 /**
- * 6. Download file retrieved.
- * It is being sent through TCP to port 20, we just read the socket
- * and forward to the output file stream until the transmission is over.
+ * 5'. List directory path, with command (MLSD or LIST), through the passive
+ * connection opened for it, and read the whole listing.
+ *
+ * @return The listing, to free, or NULL if the server refused the command,
+ *         with its reply's code in code
+ */
+char* ftp_list(const char* command, const char* path, char* code) {
+    // 5'.1. send() MLSD path
+    //       recv() 150 or 125 === Opening data connection, or already open
+    //       recv() 5xx === Unknown command, or no such directory
+    char* list_command = malloc((10 + strlen(path)) * sizeof(char));
+    sprintf(list_command, "%s %s\r\n", command, path);
+
+    send_ftp_command(list_command);
+    free(list_command);
+
+    recv_ftp_reply(code, NULL);
+    if (code[0] == '5' || code[0] == '4') {
+        close_passive_socket();
+        return NULL;
+    }
+    if (strcmp(code, "150") != 0 && strcmp(code, "125") != 0) {
+        unexpected_reply(code, "150");
+    }
+
+    // 5'.2. Read the listing until the server closes the passive connection
+    size_t len = 0, reserved = 4096;
+    char* listing = malloc(reserved);
+
+    size_t count;
+    while ((count = fread(listing + len, 1, reserved - len - 1, passivestream)) > 0) {
+        len += count;
+        if (reserved - len - 1 == 0) {
+            reserved *= 2;
+            listing = realloc(listing, reserved);
+        }
+    }
+
+    if (ferror(passivestream)) libfail("Failed to read listing on passive socket");
+    listing[len] = '\0';
+
+    close_passive_socket();
+
+    // 5'.3. recv() 226 === Closing data connection, listing sent
+    recv_ftp_reply(code, NULL);
+    if (strcmp(code, "226") != 0 && strcmp(code, "250") != 0) {
+        unexpected_reply(code, "226");
+    }
+
+    return listing;
+}
+
+/**
+ * 6. Download file retrieved into path.
+ * It is being sent through TCP to port 20, we just splice the socket
+ * into the output file until the transmission is over.
+ * The file is written from offset on, keeping its first offset bytes, which
+ * is where the retrieve was restarted (REST) at, and preallocated up to
+ * size, if known (not negative).
  */
-int download_file() {
+int download_file(const char* path, long long offset, long long size) {
     char code[4];
 
-    progress("6. Download file %s into current directory", url.filename);
+    progress("6. Download file %s into current directory", path);
+
+    // 6.1. Open output file in current directory, and cut it at offset
+    int outfd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (outfd == -1) libfail("Failed to open output file in current directory");
+    if (ftruncate(outfd, offset) != 0) libfail("Failed to truncate output file");
+
+    if (offset > 0) {
+        progress(" 6.1. Opened output file successfully, appending at %lld", offset);
+    } else {
+        progress(" 6.1. Opened output file successfully");
+    }
+
+    preallocate(outfd, offset, size);
 
-    // 6.1. Open output file in current directory
-    FILE* out = fopen(url.filename, "w"); // streams are love, streams are life
-    if (out == NULL) libfail("Failed to open output file in current directory");
+    // The first byte, since the connection was opened, or the file before done
+    struct pollfd pfd = {.fd = passivefd, .events = POLLIN};
+    poll(&pfd, 1, -1);
 
-    progress(" 6.1. Opened output file successfully");
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double ttfb = (now.tv_sec - started.tv_sec) * 1e3 + (now.tv_nsec - started.tv_nsec) / 1e6;
 
-    // 6.2. Canonical reading loop on passivefd, read the whole thing
-    char buffer[1024]; // TCP caps at 1500B/p practically
-    ssize_t read_size = 0;
+    progress("      First byte after %.1lf ms (%s)", ttfb,
+        pipelined ? "pipelined" : "one command at a time");
 
+    // 6.2. Copy from passivefd until the server closes it, read the whole thing
     progress("      Reading...");
 
-    while ((read_size = read(passivefd, buffer, sizeof(buffer))) > 0) {
-        size_t write_size = fwrite(buffer, read_size, 1, out);
-        if (write_size != 1) libfail("Failed to write to output file");
-    }
+    double cpu = cpu_seconds(RUSAGE_SELF);
+    long long received = transfer_to_file(passivefd, outfd, offset, -1);
+    cpu = cpu_seconds(RUSAGE_SELF) - cpu;
+
+    if (received < 0) libfail("Failed to read file on passive socket");
 
-    if (read_size < 0) libfail("Failed to read file on passive socket");
+    if (close(outfd) != 0) libfail("Failed to write to output file");
 
-    fclose(out);
+    // What autotuning grew it to, while the socket is still there
+    int rcvbuf = socket_rcvbuf(passivefd);
 
-    progress(" 6.2. "CGREEN"Done."CEND);
+    close_passive_socket();
 
     // 6.3. recv() 226 === Closing data connection, transfer complete
+    //      recv() 4xx === Transfer aborted, the file is cut short
+    recv_ftp_reply(code, NULL);
+    if (code[0] == '4') fail("Transfer aborted by server with reply %s", code);
+    if (strcmp(code, "226") != 0) unexpected_reply(code, "226");
+
+    progress(" 6.2. "CGREEN"Done."CEND" %lld bytes, %.3lf s of CPU per GB (%s)",
+        received, received > 0 ? cpu / (received / 1e9) : 0.0, transfer_path());
+    progress("      Receive buffer ended at %d KiB (%s)", rcvbuf / 1024,
+        rcvbuf_size > 0 ? "set" : "autotuned");
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    return 0;
+}
+
+/**
+ * Switch to binary (image) transfers, whose SIZE and REST offsets are the
+ * file's bytes.
+ */
+int ftp_binary_mode() {
+    char code[4];
+
+    // send() TYPE I
+    // recv() 200 === Command okay
+    send_ftp_command("TYPE I\r\n");
+
+    recv_ftp_reply(code, NULL);
+    if (strcmp(code, "200") != 0) unexpected_reply(code, "200");
+
+    progress(" Switched to binary mode");
+
+    return 0;
+}
+
+/**
+ * Query the size of the file, in binary mode.
+ *
+ * @return The file's size, or -1 if the server would not tell it
+ */
+long long ftp_size() {
+    char code[4];
+    const char* line;
+
+    // send() SIZE filepath
+    // recv() 213 size
+    size_t len = strlen(url.pathname) + strlen(url.filename);
+    char* size_command = malloc((10 + len) * sizeof(char));
+    sprintf(size_command, "SIZE %s%s\r\n", url.pathname, url.filename);
+
+    send_ftp_command(size_command);
+    free(size_command);
+
+    recv_ftp_reply(code, &line);
+
+    long long size = -1;
+    if (strcmp(code, "213") != 0 || sscanf(line + 4, "%lld", &size) != 1) size = -1;
+
+    progress(" File %s%s has %lld bytes", url.pathname, url.filename, size);
+
+    return size;
+}
+
+/**
+ * Have the next RETR start at offset.
+ *
+ * @return 0 if the server accepted it, 1 otherwise
+ */
+int ftp_restart(long long offset) {
+    char code[4];
+
+    // send() REST offset
+    // recv() 350 === Requested file action pending further information
+    char rest_command[32];
+    sprintf(rest_command, "REST %lld\r\n", offset);
+
+    send_ftp_command(rest_command);
+
     recv_ftp_reply(code, NULL);
-    if (strcmp(code, "226") != 0) unexpected("Expected reply 226, got %d", code);
+    return strcmp(code, "350") == 0 ? 0 : 1;
+}
+
+/**
+ * 6'. Download length bytes of the file retrieved, starting at offset, into
+ * the same offset of outfd. If the range ends before the file does, the rest
+ * of the transfer is aborted (ABOR).
+ */
+int download_range(int outfd, long long offset, long long length, bool to_end) {
+    char code[4];
+
+    // Read on to the end if this is the last range, to see the file ends there.
+    long long received = transfer_to_file(passivefd, outfd, offset, to_end ? -1 : length);
+
+    if (received < 0) libfail("Failed to read file on passive socket");
+    if (received != length) {
+        fail("Range at %lld ended after %lld of %lld bytes", offset, received, length);
+    }
+
+    if (to_end) {
+        close_passive_socket();
+
+        // recv() 226 === Closing data connection, transfer complete
+        recv_ftp_reply(code, NULL);
+        if (strcmp(code, "226") != 0) unexpected_reply(code, "226");
+        return 0;
+    }
+
+    // Stop the server sending the rest of the file: close our end, and
+    // send() ABOR
+    // recv() 426 === Connection closed, transfer aborted (if it was running)
+    // recv() 226 or 225 === Closing (or keeping) the data connection
+    close_passive_socket();
+
+    send_ftp_command("ABOR\r\n");
+
+    do {
+        recv_ftp_reply(code, NULL);
+    } while (code[0] != '2');
 
     return 0;
 }
 
+/**
+ * 7. Close the connection to the server now, rather than at exit.
+ */
+void ftp_quit() {
+    close_passive_socket();
+    close_control_socket();
+}
+
+/**
+ * Forget the connections inherited from the parent process: only this
+ * process's copies of them are closed, and the server is not told.
+ */
+void ftp_detach() {
+    if (controlstream != NULL) fclose(controlstream);
+    if (passivestream != NULL) fclose(passivestream);
+    controlstream = passivestream = NULL;
+}
+
+const url_t* ftp_url() {
+    return &url;
+}
+
+/**
+ * Make urlp the URL the pipeline works on, from the next step on. It stays
+ * urlp's: only a URL from parse_url is freed at exit.
+ */
+void ftp_use_url(const url_t* urlp) {
+    url = *urlp;
+}
+
+void ftp_free_url(url_t* urlp) {
+    free(urlp->protocol);
+    free(urlp->username);
+    free(urlp->password);
+    free(urlp->hostname);
+    free(urlp->pathname);
+    free(urlp->filename);
+}
+
 /**
  * 7. Close the connection to the server.
  */
 static void close_control_socket() {
-    send_ftp_command("QUIT \r\n");
+    if (controlstream == NULL) return;
+
+    // Best effort: we may be exiting because the connection failed.
+    logftpcommand("QUIT \r\n");
+    send(controlfd, "QUIT \r\n", 7, MSG_NOSIGNAL);
     fclose(controlstream);
+    controlstream = NULL;
 }
 
 static void close_passive_socket() {
+    if (passivestream == NULL) return;
     fclose(passivestream);
+    passivestream = NULL;
 }
 
 static void free_url() {
-    free(url.protocol);
-    free(url.username);
-    free(url.password);
-    free(url.hostname);
-    free(url.pathname);
-    free(url.filename);
+    ftp_free_url(&url);
 }
@@ -1,6 +1,18 @@
 #ifndef PIPELINE_H___
 #define PIPELINE_H___
 
+#include <stdbool.h>
+
+#define DEFAULT_USER "anonymous"
+#define DEFAULT_PASS "upstudent-rcom"
+
+// Seconds to wait for the replies to pipelined commands
+#define PIPELINE_TIMEOUT 10
+
+// Exit status of an attempt whose pipelined commands the server did not
+// take: the next one sends them one at a time
+#define EXIT_NO_PIPELINING 3
+
 typedef struct {
     char* protocol;
     char* username;
@@ -13,14 +25,38 @@ typedef struct {
 
 int parse_url(const char* urlstr);
 
+int ftp_parse_url(const char* urlstr, url_t* urlp);
+
 int ftp_open_control_socket();
 
 int ftp_login();
 
+long long ftp_pipelined_login();
+
 int ftp_open_passive_socket();
 
 int send_retrieve();
 
-int download_file();
+char* ftp_list(const char* command, const char* path, char* code);
+
+int download_file(const char* path, long long offset, long long size);
+
+int ftp_binary_mode();
+
+long long ftp_size();
+
+int ftp_restart(long long offset);
+
+int download_range(int outfd, long long offset, long long length, bool to_end);
+
+void ftp_quit();
+
+void ftp_detach();
+
+const url_t* ftp_url();
+
+void ftp_use_url(const url_t* urlp);
+
+void ftp_free_url(url_t* urlp);
 
 #endif // PIPELINE_H___
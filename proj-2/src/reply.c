@@ -0,0 +1,93 @@
+#include "reply.h"
+#include "debug.h"
+
+#include <string.h>
+#include <ctype.h>
+
+/**
+ * Control reply parser (RFC 959 section 4.2). It is fed the bytes of the
+ * control connection as they come, into its own buffer, and cuts them into
+ * replies in place: it does not allocate, and a reply's line points into
+ * the buffer, until the parser is given more bytes.
+ *
+ * A reply is one line, "123 text", or many, from "123-text" to the first
+ * line that starts with "123 ". Lines in between may start with anything,
+ * a code even. Several replies may come at once, as pipelined commands
+ * have them, and a reply may come in many pieces.
+ */
+
+void reply_init(reply_parser* parser, bool log) {
+    parser->len = parser->parsed = 0;
+    parser->multiline[0] = '\0';
+    parser->log = log;
+}
+
+/**
+ * Where to receive the next bytes into, and how many fit, once the lines
+ * parsed are dropped. The lines of replies given before are no more.
+ */
+char* reply_space(reply_parser* parser, size_t* lenp) {
+    parser->len -= parser->parsed;
+    memmove(parser->buffer, parser->buffer + parser->parsed, parser->len);
+    parser->parsed = 0;
+
+    *lenp = sizeof(parser->buffer) - parser->len;
+    return parser->buffer + parser->len;
+}
+
+void reply_received(reply_parser* parser, size_t len) {
+    parser->len += len;
+}
+
+/**
+ * Whether the line starts with a reply code, followed by a space or a dash
+ */
+static bool coded(const char* line, size_t len) {
+    return len >= 3 && line[0] >= '1' && line[0] <= '5' && isdigit(line[1]) &&
+        isdigit(line[2]) && (len == 3 || line[3] == ' ' || line[3] == '-');
+}
+
+/**
+ * Parse the next reply of the bytes received, into *replyp.
+ *
+ * @return REPLY_DONE, REPLY_MORE if it is not all there yet, or
+ *         REPLY_TOO_LONG
+ */
+int reply_next(reply_parser* parser, ftp_reply* replyp) {
+    while (true) {
+        char* line = parser->buffer + parser->parsed;
+        char* end = memchr(line, '\n', parser->len - parser->parsed);
+
+        if (end == NULL) {
+            bool full = parser->parsed == 0 && parser->len == sizeof(parser->buffer);
+            return full ? REPLY_TOO_LONG : REPLY_MORE;
+        }
+
+        parser->parsed = end + 1 - parser->buffer;
+
+        *end = '\0';
+        if (end > line && end[-1] == '\r') *--end = '\0';
+        size_t len = end - line;
+
+        if (parser->log) logftpreply(line);
+
+        if (parser->multiline[0] != '\0') {
+            // Until the line that starts with the same code and a space
+            if (!coded(line, len) || strncmp(line, parser->multiline, 3) != 0 || line[3] == '-') {
+                continue;
+            }
+            parser->multiline[0] = '\0';
+        } else if (!coded(line, len)) {
+            continue; // Not a reply
+        } else if (line[3] == '-') {
+            memcpy(parser->multiline, line, 3);
+            parser->multiline[3] = '\0';
+            continue;
+        }
+
+        memcpy(replyp->code, line, 3);
+        replyp->code[3] = '\0';
+        replyp->line = line;
+        return REPLY_DONE;
+    }
+}
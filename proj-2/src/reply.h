@@ -0,0 +1,37 @@
+#ifndef REPLY_H___
+#define REPLY_H___
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Control replies are received into a buffer of this size, which a reply
+// line must fit in
+#define REPLY_BUFFER_SIZE 4096
+
+// reply_next results
+#define REPLY_MORE      0 // The bytes so far end before the reply does
+#define REPLY_DONE      1
+#define REPLY_TOO_LONG -1 // A line does not fit in the buffer
+
+typedef struct {
+    char buffer[REPLY_BUFFER_SIZE];
+    size_t len;         // Bytes received
+    size_t parsed;      // Of those, in lines parsed already
+    char multiline[4];  // Code of the multi-line reply being read, or ""
+    bool log;           // Log every line parsed
+} reply_parser;
+
+typedef struct {
+    char code[4];
+    const char* line;   // Its last line, without the CRLF
+} ftp_reply;
+
+void reply_init(reply_parser* parser, bool log);
+
+char* reply_space(reply_parser* parser, size_t* lenp);
+
+void reply_received(reply_parser* parser, size_t len);
+
+int reply_next(reply_parser* parser, ftp_reply* replyp);
+
+#endif // REPLY_H___
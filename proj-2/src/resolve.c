@@ -0,0 +1,307 @@
+#define _GNU_SOURCE // getaddrinfo_a
+#include "resolve.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
+#include <signal.h>
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * Name resolution and connection setup.
+ *
+ * Lookups are cached for the life of the process, by host and port, and
+ * run with getaddrinfo_a, so that the engine can go on with its other
+ * transfers meanwhile: it is told of finished lookups by an eventfd.
+ *
+ * A host's addresses are tried as RFC 8305 would have it, interleaving
+ * IPv6 and IPv4 and racing them: the next attempt starts when the one
+ * before fails, or has not connected within the attempt delay, and the
+ * first attempt to connect wins. A dead first address costs the attempt
+ * delay, not a connect() timeout.
+ */
+
+typedef struct {
+    char* host;
+    char port[8];
+    int state;
+    int error;                  // getaddrinfo's, if it failed
+    struct addrinfo hints;
+    struct gaicb request;
+    address_list list;
+} lookup_t;
+
+/**
+ * The cache, of every lookup started, whatever came of it
+ */
+static lookup_t** lookups = NULL;
+static int nlookups = 0;
+static int reserved = 0;
+
+/**
+ * Written to when an asynchronous lookup finishes, -1 until asked for
+ */
+static int wakefd = -1;
+
+/**
+ * Order the lookup's results to be tried, interleaving families as RFC
+ * 8305 section 4 does, in getaddrinfo's (RFC 6724) order within each.
+ */
+static void order_addresses(lookup_t* l) {
+    const struct addrinfo* families[2][RESOLVE_MAX_ADDRESSES];
+    int count[2] = {0, 0};
+    int first = -1;
+
+    for (const struct addrinfo* ai = l->request.ar_result; ai != NULL; ai = ai->ai_next) {
+        int f = ai->ai_family == AF_INET6 ? 0 : 1;
+        if (first == -1) first = f;
+        if (count[f] < RESOLVE_MAX_ADDRESSES) families[f][count[f]++] = ai;
+    }
+
+    l->list.n = 0;
+    for (int i = 0; l->list.n < RESOLVE_MAX_ADDRESSES && (i < count[0] || i < count[1]); ++i) {
+        for (int k = 0; k < 2 && l->list.n < RESOLVE_MAX_ADDRESSES; ++k) {
+            int f = k == 0 ? first : !first;
+            if (i < count[f]) l->list.addresses[l->list.n++] = families[f][i];
+        }
+    }
+}
+
+/**
+ * Take the result of the lookup, if it finished.
+ */
+static void update(lookup_t* l) {
+    if (l->state != RESOLVE_PENDING) return;
+
+    int s = gai_error(&l->request);
+    if (s == EAI_INPROGRESS) return;
+
+    if (s == 0 && l->request.ar_result != NULL) {
+        order_addresses(l);
+        l->state = RESOLVE_DONE;
+    } else {
+        l->error = s;
+        l->state = RESOLVE_FAILED;
+    }
+}
+
+static void notify(union sigval value) {
+    (void)value;
+    uint64_t one = 1;
+    if (write(wakefd, &one, sizeof(one)) < 0) {
+        // The counter is full: the engine has plenty to wake up for.
+    }
+}
+
+/**
+ * Start looking host up, unless it was already.
+ *
+ * @return The lookup, to poll
+ */
+int resolve_start(const char* host, int port) {
+    char portstr[8];
+    snprintf(portstr, sizeof(portstr), "%d", port);
+
+    for (int i = 0; i < nlookups; ++i) {
+        if (strcmp(lookups[i]->host, host) == 0 && strcmp(lookups[i]->port, portstr) == 0) {
+            return i;
+        }
+    }
+
+    if (nlookups == reserved) {
+        reserved = reserved == 0 ? 8 : reserved * 2;
+        lookups = realloc(lookups, reserved * sizeof(lookup_t*));
+    }
+
+    // getaddrinfo_a holds on to the request, which must not move.
+    lookup_t* l = calloc(1, sizeof(lookup_t));
+    l->host = strdup(host);
+    strcpy(l->port, portstr);
+    l->state = RESOLVE_PENDING;
+    l->hints.ai_family = AF_UNSPEC;
+    l->hints.ai_socktype = SOCK_STREAM;
+    l->hints.ai_flags = AI_ADDRCONFIG;
+    l->request.ar_name = l->host;
+    l->request.ar_service = l->port;
+    l->request.ar_request = &l->hints;
+
+    struct sigevent sev = {.sigev_notify = SIGEV_NONE};
+    if (wakefd != -1) {
+        sev.sigev_notify = SIGEV_THREAD;
+        sev.sigev_notify_function = notify;
+    }
+
+    struct gaicb* list[1] = {&l->request};
+    int s = getaddrinfo_a(GAI_NOWAIT, list, 1, &sev);
+    if (s != 0) {
+        l->error = s;
+        l->state = RESOLVE_FAILED;
+    }
+
+    lookups[nlookups] = l;
+    return nlookups++;
+}
+
+/**
+ * @return RESOLVE_PENDING, RESOLVE_FAILED, or RESOLVE_DONE, and then the
+ *         addresses to try in *listp
+ */
+int resolve_poll(int lookup, address_list* listp) {
+    lookup_t* l = lookups[lookup];
+    update(l);
+    if (l->state == RESOLVE_DONE) *listp = l->list;
+    return l->state;
+}
+
+const char* resolve_error(int lookup) {
+    return gai_strerror(lookups[lookup]->error);
+}
+
+/**
+ * Look host up, waiting for it if it is not cached.
+ *
+ * @return 0 on success, or getaddrinfo's error
+ */
+int resolve(const char* host, int port, address_list* listp) {
+    int lookup = resolve_start(host, port);
+    lookup_t* l = lookups[lookup];
+
+    while (resolve_poll(lookup, listp) == RESOLVE_PENDING) {
+        const struct gaicb* list[1] = {&l->request};
+        gai_suspend(list, 1, NULL);
+    }
+
+    return l->state == RESOLVE_DONE ? 0 : l->error;
+}
+
+/**
+ * The eventfd that wakes up a waiter when asynchronous lookups started from
+ * now on finish, for it to resolve_collect them.
+ */
+int resolve_eventfd() {
+    if (wakefd == -1) {
+        wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakefd == -1) libfail("Failed to create eventfd for name lookups");
+    }
+    return wakefd;
+}
+
+/**
+ * Clear the eventfd, and take the results of the lookups that finished.
+ */
+void resolve_collect() {
+    uint64_t count;
+    if (read(wakefd, &count, sizeof(count)) < 0) {
+        // Nothing new, it was cleared already.
+    }
+
+    for (int i = 0; i < nlookups; ++i) update(lookups[i]);
+}
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ll + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Connect to one of the addresses, racing them.
+ *
+ * @return The connected (blocking) socket, and its address in *winnerp,
+ *         or -1 with errno set if none connected
+ */
+int happy_connect(const address_list* list, const struct addrinfo** winnerp) {
+    struct pollfd pfds[RESOLVE_MAX_ADDRESSES];
+    const struct addrinfo* addrs[RESOLVE_MAX_ADDRESSES];
+    int open = 0, next = 0, err = ECONNREFUSED;
+
+    long long deadline = now_ms() + CONNECT_TIMEOUT_MS;
+    long long next_attempt = 0;
+
+    while (true) {
+        long long now = now_ms();
+
+        // Start the next attempt: when the last one failed, or was slow
+        if (next < list->n && (open == 0 || now >= next_attempt)) {
+            const struct addrinfo* ai = list->addresses[next++];
+            int fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+            if (fd != -1 && (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS)) {
+                pfds[open] = (struct pollfd){.fd = fd, .events = POLLOUT};
+                addrs[open++] = ai;
+                next_attempt = now + CONNECT_ATTEMPT_DELAY_MS;
+            } else {
+                err = errno;
+                if (fd != -1) close(fd);
+            }
+            continue;
+        }
+
+        if (open == 0 || now >= deadline) break;
+
+        long long until = next < list->n ? next_attempt : deadline;
+        if (until > deadline) until = deadline;
+        poll(pfds, open, until - now);
+
+        for (int i = 0; i < open; ++i) {
+            if (pfds[i].revents == 0) continue;
+
+            int soerr = 0;
+            socklen_t len = sizeof(soerr);
+            getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &soerr, &len);
+
+            if (soerr == 0) {
+                // The winner: the others lose
+                int fd = pfds[i].fd;
+                for (int j = 0; j < open; ++j) {
+                    if (j != i) close(pfds[j].fd);
+                }
+
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+                if (winnerp != NULL) *winnerp = addrs[i];
+                return fd;
+            }
+
+            err = soerr;
+            close(pfds[i].fd);
+            pfds[i] = pfds[--open];
+            addrs[i] = addrs[open];
+            --i;
+        }
+    }
+
+    for (int i = 0; i < open; ++i) close(pfds[i].fd);
+    errno = open > 0 ? ETIMEDOUT : err;
+    return -1;
+}
+
+/**
+ * Print addr as address:port, or [address]:port for IPv6.
+ */
+const char* address_string(const struct sockaddr* addr, char* buffer, size_t len) {
+    char ip[INET6_ADDRSTRLEN] = "?";
+
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)addr;
+        inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+        snprintf(buffer, len, "[%s]:%d", ip, ntohs(in6->sin6_port));
+    } else {
+        const struct sockaddr_in* in = (const struct sockaddr_in*)addr;
+        inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+        snprintf(buffer, len, "%s:%d", ip, ntohs(in->sin_port));
+    }
+
+    return buffer;
+}
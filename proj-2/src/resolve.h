@@ -0,0 +1,44 @@
+#ifndef RESOLVE_H___
+#define RESOLVE_H___
+
+#include <stddef.h>
+#include <netdb.h>
+
+// Delay before racing the next address of a host, while the ones before it
+// are still connecting (RFC 8305's Connection Attempt Delay)
+#define CONNECT_ATTEMPT_DELAY_MS 250
+
+// Time to give up on connecting to a host, all its addresses together
+#define CONNECT_TIMEOUT_MS 30000
+
+// Addresses of a host tried, at most
+#define RESOLVE_MAX_ADDRESSES 16
+
+// State of a lookup
+#define RESOLVE_PENDING 0
+#define RESOLVE_DONE    1
+#define RESOLVE_FAILED  2
+
+typedef struct {
+    int n;
+    // In the order to try them: families interleaved, the first one's first
+    const struct addrinfo* addresses[RESOLVE_MAX_ADDRESSES];
+} address_list;
+
+int resolve(const char* host, int port, address_list* listp);
+
+int resolve_start(const char* host, int port);
+
+int resolve_poll(int lookup, address_list* listp);
+
+const char* resolve_error(int lookup);
+
+int resolve_eventfd();
+
+void resolve_collect();
+
+int happy_connect(const address_list* list, const struct addrinfo** winnerp);
+
+const char* address_string(const struct sockaddr* addr, char* buffer, size_t len);
+
+#endif // RESOLVE_H___
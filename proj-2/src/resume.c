@@ -0,0 +1,163 @@
+#include "resume.h"
+#include "pipeline.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/**
+ * Resumable download. The pipeline gives up on the first error, so each
+ * attempt at the download runs in a child process, over new connections.
+ * When one fails, the parent waits, and starts another one where the
+ * output file was left (REST), until the file is complete.
+ *
+ * Children exiting with EXIT_UNEXPECTED were refused by the server, with
+ * a 5xx reply, and are not retried. Any other failure, a connection
+ * refused or dropped, a reply timed out, or a 4xx reply to any command
+ * (425 to PASV, 450 to RETR, 421), is.
+ *
+ * With --pipeline, a child exiting with EXIT_NO_PIPELINING found the server
+ * would not take its pipelined commands: the next attempts, from the next
+ * one on, send them one at a time.
+ */
+
+/**
+ * Size of the output file, 0 if there is none yet.
+ */
+static long long local_size(const char* filename) {
+    struct stat st;
+    if (stat(filename, &st) == 0) return st.st_size;
+    if (errno != ENOENT) libfail("Failed to stat output file %s", filename);
+    return 0;
+}
+
+/**
+ * 2-6. Download the file from offset on, in a child process, and exit.
+ */
+static void run_attempt(long long offset) {
+    const url_t* url = ftp_url();
+
+    // 2. Resolve hostname and open control socket
+    ftp_open_control_socket();
+
+    long long size;
+
+    if (pipelined) {
+        // 3-4. All of the below, and PASV, at once
+        size = ftp_pipelined_login();
+    } else {
+        // 3. Login to the server (user + password)
+        ftp_login();
+
+        // 4. Binary mode, so that sizes and offsets are bytes
+        ftp_binary_mode();
+        size = ftp_size();
+    }
+
+    if (size >= 0 && offset == size) {
+        progress(" Output file %s is complete already", url->filename);
+        exit(EXIT_SUCCESS);
+    }
+    if (size >= 0 && offset > size) {
+        progress(" Output file %s is larger than the file, downloading it anew", url->filename);
+        offset = 0;
+    }
+
+    if (!pipelined) ftp_open_passive_socket();
+
+    if (offset > 0) {
+        if (ftp_restart(offset) == 0) {
+            progress(" Resuming at %lld of %lld bytes", offset, size);
+        } else {
+            progress(" Server refused REST, downloading the file anew");
+            offset = 0;
+        }
+    }
+
+    // 5. Send retrieve command for file
+    send_retrieve();
+
+    // 6. Download file, after the offset bytes we have
+    download_file(url->filename, offset, size);
+
+    long long got = local_size(url->filename);
+    if (size >= 0 && got != size) fail("Downloaded %lld of %lld bytes", got, size);
+
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * 2-6. Download the file, reconnecting and resuming it after failures,
+ * with exponential backoff between attempts.
+ */
+int download_resumable() {
+    const url_t* url = ftp_url();
+
+    // Without --continue, the file is downloaded anew, and only what this
+    // run downloads is resumed.
+    if (!continue_download) {
+        int fd = open(url->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) libfail("Failed to open output file in current directory");
+        close(fd);
+    }
+
+    int stalled = 0; // Failed attempts in a row without progress
+    unsigned backoff = RESUME_BACKOFF_MIN;
+
+    for (int attempt = 1;; ++attempt) {
+        long long offset = local_size(url->filename);
+
+        // Children must not flush the parent's output again.
+        fflush(stdout);
+
+        pid_t child = fork();
+        if (child == -1) libfail("Failed to fork download attempt %d", attempt);
+        if (child == 0) run_attempt(offset);
+
+        int status;
+        if (waitpid(child, &status, 0) == -1) libfail("Failed to wait for download attempt");
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+            if (attempt > 1) progress(" Downloaded %s in %d attempts", url->filename, attempt);
+            return 0;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_UNEXPECTED) {
+            exit(EXIT_UNEXPECTED);
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_NO_PIPELINING) {
+            printf(CYELLOW" Attempt %d reconnecting, to send one command at a time\n"CEND, attempt);
+            pipelined = false;
+            continue;
+        }
+
+        long long now = local_size(url->filename);
+
+        if (now > offset) {
+            stalled = 0;
+            backoff = RESUME_BACKOFF_MIN;
+        } else {
+            ++stalled;
+        }
+
+        if (retries == 0 || stalled >= retries) {
+            fail("Giving up on %s after %d attempts, %lld bytes downloaded",
+                url->filename, attempt, now);
+        }
+
+        if (WIFSIGNALED(status)) {
+            printf(CYELLOW" Attempt %d killed by signal %d\n"CEND, attempt, WTERMSIG(status));
+        }
+        printf(CYELLOW" Attempt %d failed at %lld bytes, reconnecting in %u s\n"CEND,
+            attempt, now, backoff);
+
+        sleep(backoff);
+        backoff = backoff * 2 > RESUME_BACKOFF_MAX ? RESUME_BACKOFF_MAX : backoff * 2;
+    }
+}
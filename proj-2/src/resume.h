@@ -0,0 +1,10 @@
+#ifndef RESUME_H___
+#define RESUME_H___
+
+// Seconds to wait before reconnecting, doubled after every failed attempt
+#define RESUME_BACKOFF_MIN 1
+#define RESUME_BACKOFF_MAX 64
+
+int download_resumable();
+
+#endif // RESUME_H___
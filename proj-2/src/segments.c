@@ -0,0 +1,209 @@
+#include "segments.h"
+#include "pipeline.h"
+#include "resume.h"
+#include "transfer.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/**
+ * Segmented download. One TCP stream cannot fill a long fat pipe, so the
+ * file is split in n disjoint byte ranges, each downloaded by a child
+ * process over its own control and passive connections (REST offset +
+ * RETR), and written with pwrite at its offset of the output file.
+ *
+ * The pipeline keeps one connection per process, so each child has its
+ * own copy of it.
+ *
+ * The ranges are written into the file's .part, which is renamed to the
+ * file once they are all complete, and removed if one of them fails: the
+ * file is never left with holes, which a --continue would take for bytes.
+ *
+ * A segment that fails is resumed as download_resumable does, in a new
+ * child, from where it got to and after a backoff, until --retries
+ * attempts in a row fail without progress. How far each one got is kept
+ * in a shared mapping, which the children add the bytes they write to.
+ */
+
+/**
+ * Download one range, in a child process, after delay seconds, adding the
+ * bytes written to *gotp, and exit.
+ */
+static void run_segment(int outfd, long long offset, long long length, bool last,
+        unsigned delay, long long* gotp) {
+    ftp_detach();
+    transfer_count(gotp);
+    sleep(delay);
+
+    ftp_open_control_socket();
+    ftp_login();
+    ftp_binary_mode();
+    ftp_open_passive_socket();
+
+    if (ftp_restart(offset) != 0) unexpected("Server refused REST %lld", offset);
+
+    send_retrieve();
+    download_range(outfd, offset, length, last);
+
+    exit(EXIT_SUCCESS);
+}
+
+static double elapsed(struct timespec* begin) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/**
+ * Start segment i, from where it got to, after delay seconds.
+ */
+static pid_t start_segment(int outfd, long long size, int i, int n, long long* got,
+        unsigned delay) {
+    long long offset = size * i / n;
+    long long end = size * (i + 1) / n;
+
+    // Children must not flush the parent's output again.
+    fflush(stdout);
+
+    pid_t child = fork();
+    if (child == -1) libfail("Failed to fork segment %d", i);
+    if (child == 0) {
+        run_segment(outfd, offset + got[i], end - offset - got[i], i == n - 1, delay, &got[i]);
+    }
+    return child;
+}
+
+/**
+ * 4-6. Download the file in n segments at once, on a logged in control
+ * connection. Falls back to one resumable download if the server does not
+ * support SIZE and REST, or if the file is too small to be worth it.
+ */
+int download_segments(int n) {
+    const url_t* url = ftp_url();
+
+    progress("4. Query size of file %s to download it in %d segments", url->filename, n);
+
+    ftp_binary_mode();
+    long long size = ftp_size();
+
+    if (size >= 0 && size / SEGMENT_MIN_SIZE < n) {
+        n = size / SEGMENT_MIN_SIZE > 1 ? size / SEGMENT_MIN_SIZE : 1;
+    }
+
+    if (size < 0 || n == 1 || ftp_restart(0) != 0) {
+        progress(" 4.1. No segments, downloading the file whole");
+        ftp_quit();
+        return download_resumable();
+    }
+
+    progress(" 4.1. Downloading %lld bytes in %d segments", size, n);
+
+    // 6.1. Open the output file's .part in current directory, at its full size
+    char* part = malloc(strlen(url->filename) + strlen(PART_SUFFIX) + 1);
+    sprintf(part, "%s"PART_SUFFIX, url->filename);
+
+    int outfd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outfd == -1) libfail("Failed to open output file in current directory");
+    preallocate(outfd, 0, size);
+    if (ftruncate(outfd, size) != 0) libfail("Failed to size output file");
+
+    long long* got = mmap(NULL, n * sizeof(long long), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (got == MAP_FAILED) libfail("Failed to map the segments' progress");
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    pid_t* children = malloc(n * sizeof(pid_t));
+    long long* mark = calloc(n, sizeof(long long)); // got[i] when i last started
+    int* stalled = calloc(n, sizeof(int));          // Failed attempts in a row without progress
+    unsigned* backoff = malloc(n * sizeof(unsigned));
+
+    for (int i = 0; i < n; ++i) {
+        backoff[i] = RESUME_BACKOFF_MIN;
+        children[i] = start_segment(outfd, size, i, n, got, 0);
+    }
+
+    int running = n, failed = 0;
+
+    while (running > 0) {
+        int status;
+        pid_t child = wait(&status);
+        if (child == -1) libfail("Failed to wait for segments");
+
+        int i = 0;
+        while (i < n && children[i] != child) ++i;
+        if (i == n) continue;
+
+        children[i] = -1;
+        --running;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) continue;
+        if (failed > 0) continue; // Stopped, the file is lost already
+
+        if (got[i] > mark[i]) {
+            stalled[i] = 0;
+            backoff[i] = RESUME_BACKOFF_MIN;
+        } else {
+            ++stalled[i];
+        }
+        mark[i] = got[i];
+
+        long long length = size * (i + 1) / n - size * i / n;
+
+        // Children exiting with EXIT_UNEXPECTED were refused by the server.
+        if ((WIFEXITED(status) && WEXITSTATUS(status) == EXIT_UNEXPECTED) ||
+                retries == 0 || stalled[i] >= retries) {
+            printf(CRED" Segment %d failed at %lld of %lld bytes\n"CEND, i, got[i], length);
+            ++failed;
+
+            for (int k = 0; k < n; ++k) {
+                if (children[k] != -1) kill(children[k], SIGTERM);
+            }
+            continue;
+        }
+
+        printf(CYELLOW" Segment %d failed at %lld of %lld bytes, reconnecting in %u s\n"CEND,
+            i, got[i], length, backoff[i]);
+
+        children[i] = start_segment(outfd, size, i, n, got, backoff[i]);
+        ++running;
+
+        backoff[i] = backoff[i] * 2 > RESUME_BACKOFF_MAX ? RESUME_BACKOFF_MAX : backoff[i] * 2;
+    }
+
+    free(backoff);
+    free(stalled);
+    free(mark);
+    free(children);
+    munmap(got, n * sizeof(long long));
+
+    if (close(outfd) != 0) libfail("Failed to write to output file");
+
+    if (failed > 0) {
+        unlink(part);
+        fail("%d of %d segments failed", failed, n);
+    }
+
+    if (rename(part, url->filename) != 0) libfail("Failed to rename %s to %s", part, url->filename);
+    free(part);
+
+    double s = elapsed(&begin);
+    double cpu = cpu_seconds(RUSAGE_CHILDREN);
+    progress(" 6.2. "CGREEN"Done."CEND" %lld bytes in %.3lf s, %.2lf MB/s over %d segments",
+        size, s, size / s / 1e6, n);
+    progress("      %.3lf s of CPU per GB, in the segments' processes", cpu / (size / 1e9));
+
+    return 0;
+}
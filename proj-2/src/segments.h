@@ -0,0 +1,9 @@
+#ifndef SEGMENTS_H___
+#define SEGMENTS_H___
+
+// Smallest byte range worth its own connections
+#define SEGMENT_MIN_SIZE (256 * 1024)
+
+int download_segments(int n);
+
+#endif // SEGMENTS_H___
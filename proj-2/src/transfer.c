@@ -0,0 +1,315 @@
+#define _GNU_SOURCE // splice, F_SETPIPE_SZ, O_DIRECT, fallocate, sync_file_range
+#include "transfer.h"
+#include "options.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+/**
+ * The data path, from the passive socket to the output file.
+ *
+ * With splice, the payload goes socket -> pipe -> file inside the kernel,
+ * and never enters user space. Where it can't (an old kernel, a file
+ * system without splice_write, or --no-splice), it falls back to a read
+ * and pwrite loop with a --buffer sized buffer. With --direct, that loop
+ * writes with O_DIRECT, bypassing the page cache.
+ *
+ * With --writeback, written windows of the file are pushed to disk and
+ * dropped from the page cache as the download goes, so that a multi-GB
+ * file does not fill the page cache with dirty pages.
+ */
+
+/**
+ * How the last transfer_to_file went, for the reports
+ */
+static const char* path = "copy";
+
+/**
+ * Writeback of the output file, by windows from where the transfer began:
+ * [synced - window, synced) was the last one sent to disk.
+ */
+static long long began = 0;
+static long long synced = 0;
+
+/**
+ * Where to add the bytes written, as they are, if not NULL: for another
+ * process to see how far a transfer got, when this one dies.
+ */
+static long long* counter = NULL;
+
+static void count(long long written) {
+    if (counter != NULL) *counter += written;
+}
+
+/**
+ * Start writing the last full window of the file to disk, and wait for
+ * the one before it, to drop it from the page cache.
+ */
+static void writeback(int outfd, long long written) {
+    long long window = (long long)writeback_size * MIB;
+    if (window == 0) return;
+
+    while (written - synced >= window) {
+        sync_file_range(outfd, synced, window, SYNC_FILE_RANGE_WRITE);
+
+        if (synced - window >= began) {
+            sync_file_range(outfd, synced - window, window, SYNC_FILE_RANGE_WAIT_BEFORE |
+                SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(outfd, synced - window, window, POSIX_FADV_DONTNEED);
+        }
+
+        synced += window;
+    }
+}
+
+static void pwrite_all(int outfd, const char* buffer, size_t len, long long offset) {
+    for (size_t done = 0; done < len;) {
+        ssize_t w = pwrite(outfd, buffer + done, len - done, offset + done);
+        if (w <= 0) libfail("Failed to write to output file");
+        done += w;
+    }
+}
+
+/**
+ * Write pending bytes of the buffer at *posp with O_DIRECT, which takes
+ * only aligned lengths at aligned offsets: a head up to the first aligned
+ * offset, and the tail at the end, are written through the page cache.
+ *
+ * @return The bytes left pending at the start of the buffer
+ */
+static size_t write_direct(int outfd, char* buffer, size_t pending, long long* posp, bool last) {
+    int flags = fcntl(outfd, F_GETFL);
+
+    size_t head = (DIRECT_ALIGN - *posp % DIRECT_ALIGN) % DIRECT_ALIGN;
+    if (head > pending) head = pending;
+    if (last) head = pending;
+
+    if (head > 0) {
+        fcntl(outfd, F_SETFL, flags & ~O_DIRECT);
+        pwrite_all(outfd, buffer, head, *posp);
+        fcntl(outfd, F_SETFL, flags);
+        memmove(buffer, buffer + head, pending - head);
+        *posp += head;
+        pending -= head;
+    }
+
+    size_t aligned = pending - pending % DIRECT_ALIGN;
+    if (aligned > 0) {
+        pwrite_all(outfd, buffer, aligned, *posp);
+        memmove(buffer, buffer + aligned, pending - aligned);
+        *posp += aligned;
+        pending -= aligned;
+    }
+
+    return pending;
+}
+
+/**
+ * Copy the payload with read and pwrite, a buffer at a time.
+ */
+static long long copy_loop(int sockfd, int outfd, long long offset, long long limit, bool direct) {
+    size_t size = (size_t)buffer_size * MIB;
+    char* buffer;
+    if (posix_memalign((void**)&buffer, DIRECT_ALIGN, size) != 0) {
+        libfail("Failed to allocate a %d MiB buffer", buffer_size);
+    }
+
+    long long total = 0, pos = offset;
+    size_t pending = 0; // Read, but not written yet
+    ssize_t read_size = 0;
+
+    while (limit < 0 || total < limit) {
+        size_t want = size - pending;
+        if (limit >= 0 && limit - total < (long long)want) want = limit - total;
+
+        read_size = read(sockfd, buffer + pending, want);
+        if (read_size <= 0) break;
+
+        total += read_size;
+        pending += read_size;
+
+        long long before = pos;
+        if (direct) {
+            // Wait for a full buffer, to write as much as possible at once.
+            if (pending == size) pending = write_direct(outfd, buffer, pending, &pos, false);
+        } else {
+            pwrite_all(outfd, buffer, pending, pos);
+            pos += pending;
+            pending = 0;
+            writeback(outfd, pos);
+        }
+        count(pos - before);
+    }
+
+    // Keep what came before a failure: it is where a resume starts.
+    int err = errno;
+    if (pending > 0) {
+        write_direct(outfd, buffer, pending, &pos, true);
+        count(pending);
+    }
+    errno = err;
+
+    free(buffer);
+    return read_size < 0 ? -1 : total;
+}
+
+/**
+ * Empty the pipe into the file with read and pwrite, when it can't be
+ * spliced into it.
+ */
+static void drain_pipe(int pipefd, int outfd, long long offset, size_t len) {
+    char buffer[64 * 1024];
+
+    while (len > 0) {
+        size_t want = len < sizeof(buffer) ? len : sizeof(buffer);
+        ssize_t r = read(pipefd, buffer, want);
+        if (r <= 0) libfail("Failed to read splice pipe");
+
+        pwrite_all(outfd, buffer, r, offset);
+        offset += r;
+        len -= r;
+    }
+}
+
+/**
+ * Copy the payload with splice, socket -> pipe -> file.
+ *
+ * @return Bytes copied, -1 on a socket error, or -2 if the socket can't
+ *         be spliced at all, before anything was copied
+ */
+static long long splice_loop(int sockfd, int outfd, long long offset, long long limit) {
+    int pipefd[2];
+    if (pipe(pipefd) != 0) return -2;
+
+    // The default pipe holds 64 KiB; ask for a buffer's worth, and live
+    // with what we get (at most /proc/sys/fs/pipe-max-size unprivileged).
+    fcntl(pipefd[1], F_SETPIPE_SZ, buffer_size * MIB);
+    int chunk = fcntl(pipefd[1], F_GETPIPE_SZ);
+    if (chunk <= 0) chunk = 64 * 1024;
+
+    long long total = 0;
+    ssize_t in = 0;
+    bool to_file = true;
+
+    while (limit < 0 || total < limit) {
+        size_t want = chunk;
+        if (limit >= 0 && limit - total < (long long)want) want = limit - total;
+
+        in = splice(sockfd, NULL, pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in <= 0) break;
+
+        loff_t off = offset + total;
+        ssize_t left = in;
+
+        while (to_file && left > 0) {
+            ssize_t out = splice(pipefd[0], NULL, outfd, &off, left, SPLICE_F_MOVE);
+            if (out < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                to_file = false; // The file system can't, go through user space
+                break;
+            }
+            if (out <= 0) libfail("Failed to write to output file");
+            left -= out;
+        }
+
+        if (left > 0) drain_pipe(pipefd[0], outfd, off, left);
+        total += in;
+        count(in);
+        writeback(outfd, offset + total);
+    }
+
+    int err = errno;
+    close(pipefd[0]);
+    close(pipefd[1]);
+    errno = err;
+
+    if (in < 0 && total == 0 && (errno == EINVAL || errno == ENOSYS)) return -2;
+    return in < 0 ? -1 : total;
+}
+
+/**
+ * Copy what the socket receives into outfd from offset on, until it is
+ * closed, or until limit bytes if limit is not negative.
+ *
+ * @return Bytes copied, or -1 on a socket error (errno is set)
+ */
+long long transfer_to_file(int sockfd, int outfd, long long offset, long long limit) {
+    began = synced = offset;
+
+    if (direct_io) {
+        int flags = fcntl(outfd, F_GETFL);
+        if (fcntl(outfd, F_SETFL, flags | O_DIRECT) == 0) {
+            path = "direct";
+            long long total = copy_loop(sockfd, outfd, offset, limit, true);
+
+            int err = errno;
+            fcntl(outfd, F_SETFL, flags);
+            errno = err;
+            return total;
+        }
+
+        printf(CYELLOW" The file system of the output file has no O_DIRECT\n"CEND);
+    } else if (use_splice) {
+        long long total = splice_loop(sockfd, outfd, offset, limit);
+        if (total != -2) {
+            path = "splice";
+            return total;
+        }
+    }
+
+    path = "copy";
+    return copy_loop(sockfd, outfd, offset, limit, false);
+}
+
+const char* transfer_path() {
+    return path;
+}
+
+/**
+ * Add the bytes the transfers write from now on to *counterp, or stop if
+ * NULL.
+ */
+void transfer_count(long long* counterp) {
+    counter = counterp;
+}
+
+/**
+ * Reserve the disk space of the output file from offset to size at once,
+ * so that it is laid out contiguously, without changing its size: what a
+ * resume sees is still what was downloaded.
+ */
+void preallocate(int outfd, long long offset, long long size) {
+    if (size <= offset) return;
+
+    if (fallocate(outfd, FALLOC_FL_KEEP_SIZE, offset, size - offset) == 0) {
+        progress("      Preallocated %lld bytes of output file", size - offset);
+    } else if (errno != EOPNOTSUPP) {
+        libfail("Failed to preallocate output file");
+    }
+}
+
+/**
+ * The socket's receive buffer, as set or as autotuned so far.
+ */
+int socket_rcvbuf(int sockfd) {
+    int size = 0;
+    socklen_t len = sizeof(size);
+    getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, &len);
+    return size;
+}
+
+/**
+ * User and system CPU time used, of RUSAGE_SELF or RUSAGE_CHILDREN.
+ */
+double cpu_seconds(int who) {
+    struct rusage usage;
+    getrusage(who, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
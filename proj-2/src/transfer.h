@@ -0,0 +1,27 @@
+#ifndef TRANSFER_H___
+#define TRANSFER_H___
+
+#include <stdbool.h>
+
+#define MIB (1024 * 1024)
+
+// Alignment of O_DIRECT writes, in memory and in the file
+#define DIRECT_ALIGN 4096
+
+// A file is downloaded into its name and this, and renamed to its name once
+// complete, so that a failed download leaves what was there before
+#define PART_SUFFIX ".part"
+
+long long transfer_to_file(int sockfd, int outfd, long long offset, long long limit);
+
+const char* transfer_path();
+
+void transfer_count(long long* counterp);
+
+void preallocate(int outfd, long long offset, long long size);
+
+int socket_rcvbuf(int sockfd);
+
+double cpu_seconds(int who);
+
+#endif // TRANSFER_H___